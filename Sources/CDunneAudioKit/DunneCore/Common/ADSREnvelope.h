@@ -60,6 +60,9 @@ namespace DunneCore
         {
             return env.getValue();
         }
+
+        // envelope samples until idle, if not restarted or released; -1 if sustaining
+        int getRemainingSampleCount() { return env.getRemainingSampleCount(); }
         
         inline float getSample()
         {
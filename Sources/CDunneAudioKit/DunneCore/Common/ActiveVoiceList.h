@@ -0,0 +1,71 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <algorithm>
+#include <vector>
+
+namespace DunneCore
+{
+
+    // ActiveVoiceList is a compact list of the indices of the sounding voices in a voice pool,
+    // so per-chunk work is proportional to the number of notes playing rather than the pool size.
+    // Indices are kept in ascending order, so voices are always visited (and hence mixed) in the
+    // same order as a scan of the whole pool would visit them.
+    //
+    // Loops which may remove the current voice should re-check the entry before advancing:
+    //
+    //     for (int k = 0; k < list.count(); )
+    //     {
+    //         int i = list[k];
+    //         ...possibly remove(i)...
+    //         if (k < list.count() && list[k] == i) k++;
+    //     }
+
+    struct ActiveVoiceList
+    {
+        ActiveVoiceList() : activeCount(0) {}
+
+        // allocate for the given pool size, and empty the list; call only when not rendering
+        void init(int voiceCount)
+        {
+            // every slot always holds a valid voice index, even beyond count()
+            indices.assign(voiceCount, 0);
+            isActive.assign(voiceCount, false);
+            activeCount = 0;
+        }
+
+        int count() const { return activeCount; }
+        int operator[](int k) const { return indices[k]; }
+        bool contains(int voiceIndex) const { return isActive[voiceIndex]; }
+
+        void add(int voiceIndex)
+        {
+            if (isActive[voiceIndex]) return;
+            isActive[voiceIndex] = true;
+            int k = activeCount++;
+            for (; k > 0 && indices[k - 1] > voiceIndex; k--) indices[k] = indices[k - 1];
+            indices[k] = voiceIndex;
+        }
+
+        void remove(int voiceIndex)
+        {
+            if (!isActive[voiceIndex]) return;
+            isActive[voiceIndex] = false;
+            int k = int(std::lower_bound(indices.begin(), indices.begin() + activeCount, voiceIndex) - indices.begin());
+            for (activeCount--; k < activeCount; k++) indices[k] = indices[k + 1];
+        }
+
+        // add or remove, depending on whether the voice is playing a note
+        void update(int voiceIndex, bool isPlaying)
+        {
+            if (isPlaying) add(voiceIndex);
+            else remove(voiceIndex);
+        }
+
+    protected:
+        std::vector<int> indices;
+        std::vector<char> isActive;
+        int activeCount;
+    };
+
+}
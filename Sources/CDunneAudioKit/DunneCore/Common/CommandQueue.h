@@ -0,0 +1,185 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DunneCore
+{
+
+    // EngineCommand is one control event for a multi-voice instrument (note on/off, sustain pedal,
+    // parameter change, stopping all voices), posted by a control thread and applied by the audio thread.
+
+    struct EngineCommand
+    {
+        enum Type
+        {
+            kNoteOn,            // noteNumber, velocity, value = note frequency (if the engine needs one)
+            kNoteOff,           // noteNumber, immediate
+            kSustainPedal,      // immediate = pedal is down
+            kSetParameter,      // address, value, immediate = jump rather than ramp to value
+            kStopAllVoices,     // epoch, then callback(context) once stopped (may be null)
+            kRestartVoices,
+        };
+
+        Type type;
+        unsigned noteNumber;
+        unsigned velocity;
+        uint64_t address;
+        float value;
+        bool immediate;
+
+        // engine sample time at which to apply the command; a time already past (such as 0) means as
+        // soon as possible
+        int64_t sampleTime;
+
+        // kStopAllVoices only: request number, and function for the audio thread to call when it is done
+        uint64_t epoch;
+        void (*callback)(void *context);
+        void *context;
+
+        static EngineCommand noteOn(unsigned noteNumber, unsigned velocity, float frequency = 0.0f)
+        {
+            return { kNoteOn, noteNumber, velocity, 0, frequency, false, 0, 0, 0, 0 };
+        }
+        static EngineCommand noteOff(unsigned noteNumber, bool immediate)
+        {
+            return { kNoteOff, noteNumber, 0, 0, 0.0f, immediate, 0, 0, 0, 0 };
+        }
+        static EngineCommand sustainPedal(bool down)
+        {
+            return { kSustainPedal, 0, 0, 0, 0.0f, down, 0, 0, 0, 0 };
+        }
+        static EngineCommand setParameter(uint64_t address, float value, bool immediate)
+        {
+            return { kSetParameter, 0, 0, address, value, immediate, 0, 0, 0, 0 };
+        }
+        static EngineCommand stopAllVoices(uint64_t epoch, void (*callback)(void *context), void *context)
+        {
+            return { kStopAllVoices, 0, 0, 0, 0.0f, false, 0, epoch, callback, context };
+        }
+        static EngineCommand restartVoices()
+        {
+            return { kRestartVoices, 0, 0, 0, 0.0f, false, 0, 0, 0, 0 };
+        }
+    };
+
+    // CommandQueue is a bounded, lock-free FIFO with any number of producer threads and a single
+    // consumer (usually the audio thread), after Dmitry Vyukov's bounded MPMC queue. Each slot carries
+    // a sequence number, which tells producers when it is free and the consumer when it is filled, so
+    // neither side ever waits for the other. A single producer is simply a special case.
+
+    template <typename T, int capacity>
+    class CommandQueue
+    {
+        static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+    public:
+        CommandQueue() : enqueuePosition(0), dequeuePosition(0)
+        {
+            for (int i=0; i < capacity; i++) cells[i].sequence.store(size_t(i), std::memory_order_relaxed);
+        }
+
+        // any thread: append an item, returning false (and dropping it) if the queue is full
+        bool push(const T& item)
+        {
+            size_t position = enqueuePosition.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell &cell = cells[position & (capacity - 1)];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t difference = intptr_t(sequence) - intptr_t(position);
+                if (difference == 0)
+                {
+                    // slot is free: claim it, unless another producer got there first
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        cell.item = item;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0) return false;
+                else position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        // consumer only: the oldest item, or null if the queue is empty; it stays queued until pop()
+        T *front()
+        {
+            Cell &cell = cells[dequeuePosition & (capacity - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) return 0;
+            return &cell.item;
+        }
+
+        // consumer only: discard the item front() returned
+        void pop()
+        {
+            Cell &cell = cells[dequeuePosition & (capacity - 1)];
+            cell.sequence.store(dequeuePosition + capacity, std::memory_order_release);
+            dequeuePosition++;
+        }
+
+        // consumer only: remove the oldest item into item, returning false if the queue is empty
+        bool pop(T& item)
+        {
+            T *pItem = front();
+            if (pItem == 0) return false;
+            item = *pItem;
+            pop();
+            return true;
+        }
+
+    protected:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T item;
+        };
+
+        // Padding keeps the producers' and the consumer's positions on cache lines of their own, without
+        // alignas, which would need an aligned operator new (C++17) wherever the queue is a member.
+        static constexpr size_t cacheLineSize = 64;
+
+        Cell cells[capacity];
+        char padding0[cacheLineSize];
+        std::atomic<size_t> enqueuePosition;
+        char padding1[cacheLineSize - sizeof(std::atomic<size_t>)];
+        size_t dequeuePosition;
+    };
+
+    // PendingCommandList holds commands the consumer has taken from a CommandQueue, in the order they fall
+    // due (by sampleTime; those due at the same time in the order inserted), so a command posted for later
+    // holds back none due sooner. Consumer only, and of fixed capacity, so it never allocates.
+
+    template <typename T, int capacity>
+    class PendingCommandList
+    {
+    public:
+        PendingCommandList() : count(0) {}
+
+        bool isEmpty() const { return count == 0; }
+        bool isFull() const { return count == capacity; }
+
+        // add an item after any due at the same time; the list must not be full
+        void insert(const T& item)
+        {
+            // stored latest first, so the next item due is always the last
+            int i = count++;
+            for (; i > 0 && items[i - 1].sampleTime <= item.sampleTime; i--) items[i] = items[i - 1];
+            items[i] = item;
+        }
+
+        // the item due soonest; the list must not be empty
+        const T& front() const { return items[count - 1]; }
+
+        // discard the item front() returned
+        void pop() { count--; }
+
+    protected:
+        T items[capacity];
+        int count;
+    };
+
+}
@@ -1,6 +1,7 @@
 // Copyright AudioKit. All Rights Reserved.
 
 #include "EnvelopeGeneratorBase.h"
+#include <algorithm>
 #include <cmath>
 #include <cassert>
 
@@ -48,6 +49,29 @@ namespace DunneCore
         }
     }
 
+    int ExponentialSegmentGenerator::getRemainingSampleCount()
+    {
+        if (isHorizontal) return segLength < 0 ? -1 : std::max(0, segLength - tcount);
+        if (isLinear) return coefficient == 0.0 ? 0 : std::max(0, int(ceil((target - output) / coefficient)));
+        if (coefficient <= 0.0) return 1;
+
+        // output approaches its asymptote (target -/+ tco) geometrically, by a factor of coefficient per sample
+        double asymptote = offset / (1.0 - coefficient);
+        double samples = log((target - asymptote) / (output - asymptote)) / log(coefficient);
+        return samples > 0.0 ? int(ceil(samples)) : 0;
+    }
+
+    int MultiSegmentEnvelopeGenerator::getRemainingSampleCount()
+    {
+        int remaining = ExponentialSegmentGenerator::getRemainingSampleCount();
+        for (int i = curSegIndex + 1; remaining >= 0 && i < int(segments->size()); i++)
+        {
+            int length = (*segments)[i].lengthSamples;
+            remaining = length < 0 ? -1 : remaining + length;
+        }
+        return remaining;
+    }
+
     void MultiSegmentEnvelopeGenerator::setupCurSeg()
     {
         SegmentDescriptor seg = (*segments)[curSegIndex];
@@ -46,6 +46,9 @@ namespace DunneCore
             }
         }
 
+        // samples until this segment ends, or -1 for an untimed ("sustain") segment
+        int getRemainingSampleCount();
+
     protected:
         double output, target, offset, coefficient;
         bool isRising;
@@ -89,6 +92,9 @@ namespace DunneCore
 
         int getCurrentSegmentIndex() { return curSegIndex; }
 
+        // samples until the envelope ends (if not restarted or released), or -1 if it will sustain
+        int getRemainingSampleCount();
+
     protected:
         Descriptor* segments = nullptr;
         int curSegIndex;
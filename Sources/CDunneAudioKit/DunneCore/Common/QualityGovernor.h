@@ -0,0 +1,148 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <math.h>
+
+namespace DunneCore
+{
+
+    // QualityGovernor keeps an engine's rendering within a CPU budget, expressed as a fraction of real
+    // time (e.g. 0.5 means each render() call may take up to half the duration of the audio it produces).
+    // It times every render() call and sets a quality level: 0 means full quality, and each higher level
+    // asks the engine to shed more of its costly processing. The level rises one step at a time while the
+    // smoothed load exceeds the budget, and falls one step at a time only after the load has stayed well
+    // below the budget for a while. If raising quality soon overloads again, it waits longer next time.
+    //
+    // Engines call beginRender() and endRender() around each render(), and read getLevel(). Any thread may
+    // call setBudget(); the rendering thread takes up the new budget at its next beginRender().
+
+    struct QualityGovernor
+    {
+        // load is smoothed over about this much audio
+        static constexpr double smoothingSeconds = 0.05;
+
+        // after any change of level, wait this long before lowering quality further
+        static constexpr double settleSeconds = 0.05;
+
+        // load must stay below this fraction of the budget before quality is restored...
+        static constexpr float restoreFraction = 0.6f;
+
+        // ...for this long at first, doubling (up to maxHoldSeconds) each time restoring quality backfires
+        static constexpr double minHoldSeconds = 1.0;
+        static constexpr double maxHoldSeconds = 8.0;
+
+        QualityGovernor()
+        : level(0), load(0.0f), requestedBudget(0.0f), budget(0.0f), maxLevel(0), sampleRate(44100.0),
+          smoothedLoad(0.0), secondsSinceChange(0.0), secondsBelow(0.0), holdSeconds(minHoldSeconds),
+          lastChangeWasRestore(false) {}
+
+        void init(double sampleRate, int maxLevel)
+        {
+            this->sampleRate = sampleRate;
+            this->maxLevel = maxLevel;
+            reset();
+        }
+
+        // fraction of real time each render() may use; 0 (the default) disables the governor
+        void setBudget(float fraction)
+        {
+            requestedBudget.store(fraction, std::memory_order_relaxed);
+        }
+        float getBudget() const { return requestedBudget.load(std::memory_order_relaxed); }
+
+        // 0 = full quality, up to the maxLevel given to init()
+        int getLevel() const { return level.load(std::memory_order_relaxed); }
+
+        // smoothed render time, as a fraction of real time (0 if the governor is disabled)
+        float getLoad() const { return load.load(std::memory_order_relaxed); }
+
+        inline void beginRender()
+        {
+            float newBudget = requestedBudget.load(std::memory_order_relaxed);
+            if (newBudget != budget)
+            {
+                budget = newBudget;
+                if (budget <= 0.0f) reset();
+            }
+            if (budget > 0.0f) startTime = std::chrono::steady_clock::now();
+        }
+
+        inline void endRender(unsigned sampleCount)
+        {
+            if (budget <= 0.0f || sampleCount == 0) return;
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+            update(sampleCount, elapsed.count());
+        }
+
+        // account for one render() call of sampleCount samples, which took renderSeconds
+        void update(unsigned sampleCount, double renderSeconds)
+        {
+            double audioSeconds = sampleCount / sampleRate;
+            smoothedLoad += (1.0 - exp(-audioSeconds / smoothingSeconds)) * (renderSeconds / audioSeconds - smoothedLoad);
+            load.store(float(smoothedLoad), std::memory_order_relaxed);
+            secondsSinceChange += audioSeconds;
+
+            int currentLevel = level.load(std::memory_order_relaxed);
+            if (smoothedLoad > budget)
+            {
+                secondsBelow = 0.0;
+                if (currentLevel < maxLevel && secondsSinceChange >= settleSeconds)
+                {
+                    // overloaded again soon after restoring quality: be more patient next time
+                    if (lastChangeWasRestore && secondsSinceChange < holdSeconds)
+                        holdSeconds = fmin(2.0 * holdSeconds, maxHoldSeconds);
+                    setLevel(currentLevel + 1, false);
+                }
+            }
+            else if (smoothedLoad < restoreFraction * budget)
+            {
+                secondsBelow += audioSeconds;
+                if (currentLevel > 0 && secondsBelow >= holdSeconds)
+                {
+                    setLevel(currentLevel - 1, true);
+                    secondsBelow = 0.0;
+                }
+            }
+            else secondsBelow = 0.0;
+
+            // a long spell at one level earns back the default patience
+            if (secondsSinceChange > maxHoldSeconds) holdSeconds = minHoldSeconds;
+        }
+
+    protected:
+        std::atomic<int> level;
+        std::atomic<float> load;
+        std::atomic<float> requestedBudget;     // as last set, by any thread
+
+        float budget;                           // as in effect, on the rendering thread
+        int maxLevel;
+        double sampleRate;
+        double smoothedLoad;
+        double secondsSinceChange;
+        double secondsBelow;
+        double holdSeconds;
+        bool lastChangeWasRestore;
+        std::chrono::steady_clock::time_point startTime;
+
+        void setLevel(int newLevel, bool isRestore)
+        {
+            level.store(newLevel, std::memory_order_relaxed);
+            secondsSinceChange = 0.0;
+            lastChangeWasRestore = isRestore;
+        }
+
+        void reset()
+        {
+            level.store(0, std::memory_order_relaxed);
+            load.store(0.0f, std::memory_order_relaxed);
+            smoothedLoad = 0.0;
+            secondsSinceChange = 0.0;
+            secondsBelow = 0.0;
+            holdSeconds = minHoldSeconds;
+            lastChangeWasRestore = false;
+        }
+    };
+
+}
@@ -0,0 +1,169 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#include "RenderWorkerPool.h"
+
+#include <functional>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace DunneCore
+{
+
+    // how many times an idle worker polls for work before blocking; roughly 50-200 microseconds
+    static const int idleSpinCount = 4096;
+
+    static inline void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    // ask the scheduler to treat the calling thread like an audio thread; failure is not fatal
+    static void makeRealTime()
+    {
+#if defined(__APPLE__)
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        double ticksPerMs = 1.0e6 * timebase.denom / timebase.numer;
+        thread_time_constraint_policy_data_t policy;
+        policy.period = 0;
+        policy.computation = uint32_t(1.0 * ticksPerMs);
+        policy.constraint = uint32_t(2.0 * ticksPerMs);
+        policy.preemptible = true;
+        thread_policy_set(mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY,
+                          (thread_policy_t)&policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+#else
+        sched_param param;
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+    }
+
+    RenderWorkerPool::RenderWorkerPool()
+    : threadCount(0), isRealTime(true), isRunning(false), work(0), unfinishedTaskCount(0), function(0), context(0)
+    {
+    }
+
+    RenderWorkerPool::~RenderWorkerPool()
+    {
+        stop();
+    }
+
+    void RenderWorkerPool::start(int newThreadCount, bool realTime)
+    {
+        stop();
+        if (newThreadCount <= 0) return;
+
+        isRealTime = realTime;
+        workers.reset(new Worker[newThreadCount]);
+        isRunning.store(true);
+        for (int i=0; i < newThreadCount; i++)
+        {
+            Worker &worker = workers[i];
+            worker.isSleeping.store(false);
+            worker.thread = std::thread(&RenderWorkerPool::workerLoop, this, std::ref(worker));
+        }
+        threadCount = newThreadCount;
+    }
+
+    void RenderWorkerPool::stop()
+    {
+        if (threadCount == 0) return;
+
+        isRunning.store(false);
+        for (int i=0; i < threadCount; i++)
+        {
+            if (workers[i].isSleeping.exchange(false)) workers[i].wakeup.signal();
+            workers[i].thread.join();
+        }
+        workers.reset();
+        threadCount = 0;
+    }
+
+    void RenderWorkerPool::run(int taskCount, TaskFunction taskFunction, void *taskContext)
+    {
+        if (taskCount <= 0) return;
+        if (taskCount > maxTaskCount) taskCount = maxTaskCount;
+
+        // publish the job; workers read function and context only after claiming one of its tasks
+        function = taskFunction;
+        context = taskContext;
+        unfinishedTaskCount.store(taskCount, std::memory_order_relaxed);
+        work.store(uint32_t(taskCount) << 16);
+
+        // wake any workers which have stopped spinning; at most one worker per task is useful
+        for (int i=0; i < threadCount && i < taskCount - 1; i++)
+            if (workers[i].isSleeping.exchange(false)) workers[i].wakeup.signal();
+
+        // share the work, then wait for any tasks other threads are still running
+        runTasks();
+        while (unfinishedTaskCount.load(std::memory_order_acquire) != 0) cpuRelax();
+    }
+
+    bool RenderWorkerPool::claimTask(int &taskIndex)
+    {
+        uint32_t w = work.load(std::memory_order_acquire);
+        while (hasUnclaimedTask(w))
+        {
+            if (work.compare_exchange_weak(w, w + 1, std::memory_order_acquire, std::memory_order_acquire))
+            {
+                taskIndex = int(w & 0xFFFF);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void RenderWorkerPool::runTasks()
+    {
+        int taskIndex;
+        while (claimTask(taskIndex))
+        {
+            function(context, taskIndex);
+            unfinishedTaskCount.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void RenderWorkerPool::workerLoop(Worker &worker)
+    {
+        if (isRealTime) makeRealTime();
+
+        int idleCount = 0;
+        while (isRunning.load(std::memory_order_relaxed))
+        {
+            if (hasUnclaimedTask(work.load(std::memory_order_relaxed)))
+            {
+                runTasks();
+                idleCount = 0;
+                continue;
+            }
+            if (++idleCount < idleSpinCount)
+            {
+                cpuRelax();
+                continue;
+            }
+
+            // Block until run() or stop() wakes us. Whichever of us clears isSleeping owns the wakeup:
+            // if run() published work just before we announced we were sleeping, we clear it ourselves;
+            // if run() cleared it first, it has signalled (or will), and that signal must be consumed.
+            worker.isSleeping.store(true);
+            if (hasUnclaimedTask(work.load()) || !isRunning.load())
+            {
+                if (!worker.isSleeping.exchange(false)) worker.wakeup.wait();
+            }
+            else worker.wakeup.wait();
+            idleCount = 0;
+        }
+    }
+
+}
@@ -0,0 +1,73 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <stdint.h>
+
+#include "Semaphore.h"
+
+namespace DunneCore
+{
+
+    // RenderWorkerPool lets a multi-voice instrument spread the voices of one render() call over
+    // several threads. The audio thread calls run() with a number of tasks (typically one per sounding
+    // voice); the pool's worker threads and the audio thread itself then claim tasks one at a time
+    // until all are done, and run() returns only when every task has finished. Which thread runs which
+    // task varies from call to call, so each task must write only to its own output.
+    //
+    // Workers spin briefly between run() calls, so consecutive render chunks are picked up without any
+    // system call, then block on a semaphore (a futex on Linux) until run() wakes them. run() itself
+    // never allocates or locks.
+    //
+    // start() and stop() create and join the threads, so must not be called on the audio thread, nor
+    // while run() may be called.
+
+    class RenderWorkerPool
+    {
+    public:
+        typedef void (*TaskFunction)(void *context, int taskIndex);
+
+        // most tasks one run() call may have
+        static constexpr int maxTaskCount = 0xFFFF;
+
+        RenderWorkerPool();
+        ~RenderWorkerPool();
+
+        // (re)start with the given number of worker threads; 0 stops all workers. Workers ask for real-time
+        // scheduling, unless realTime is false (e.g. for loading files, which must not starve the audio thread).
+        void start(int threadCount, bool realTime = true);
+        void stop();
+
+        int getThreadCount() const { return threadCount; }
+
+        // audio thread: call function(context, i) for every i in [0, taskCount), returning when all are done
+        void run(int taskCount, TaskFunction function, void *context);
+
+    protected:
+        struct Worker
+        {
+            std::thread thread;
+            Semaphore wakeup;
+            std::atomic<bool> isSleeping;
+        };
+
+        std::unique_ptr<Worker[]> workers;
+        int threadCount;
+        bool isRealTime;
+        std::atomic<bool> isRunning;
+
+        // the current job: number of tasks in bits 16-31, index of the next unclaimed task in bits 0-15
+        std::atomic<uint32_t> work;
+        std::atomic<int> unfinishedTaskCount;
+        TaskFunction function;
+        void *context;
+
+        static inline bool hasUnclaimedTask(uint32_t w) { return (w & 0xFFFF) < (w >> 16); }
+        bool claimTask(int &taskIndex);
+        void runTasks();
+        void workerLoop(Worker &worker);
+    };
+
+}
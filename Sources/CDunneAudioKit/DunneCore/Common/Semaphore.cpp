@@ -0,0 +1,24 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#include "Semaphore.h"
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+namespace DunneCore
+{
+
+#if defined(__APPLE__)
+    Semaphore::Semaphore() { semaphore_create(mach_task_self(), &semaphore, SYNC_POLICY_FIFO, 0); }
+    Semaphore::~Semaphore() { semaphore_destroy(mach_task_self(), semaphore); }
+    void Semaphore::signal() { semaphore_signal(semaphore); }
+    void Semaphore::wait() { while (semaphore_wait(semaphore) != KERN_SUCCESS) {} }
+#else
+    Semaphore::Semaphore() { sem_init(&semaphore, 0, 0); }
+    Semaphore::~Semaphore() { sem_destroy(&semaphore); }
+    void Semaphore::signal() { sem_post(&semaphore); }
+    void Semaphore::wait() { while (sem_wait(&semaphore) != 0) {} }
+#endif
+
+}
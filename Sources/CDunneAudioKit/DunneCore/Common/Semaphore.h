@@ -0,0 +1,38 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+
+#if defined(__APPLE__)
+#include <mach/semaphore.h>
+#else
+#include <semaphore.h>
+#endif
+
+namespace DunneCore
+{
+
+    // Semaphore is a counting semaphore, with the platform's cheapest real-time-safe signal (a Mach
+    // semaphore on Apple platforms, a futex-backed POSIX semaphore elsewhere), so an audio thread may
+    // wake a waiting worker without ever taking a lock. A signal before the wait is not lost.
+
+    class Semaphore
+    {
+    public:
+        Semaphore();
+        ~Semaphore();
+
+        // any thread, including the audio thread
+        void signal();
+
+        // block until signalled; never call on the audio thread
+        void wait();
+
+    private:
+#if defined(__APPLE__)
+        semaphore_t semaphore;
+#else
+        sem_t semaphore;
+#endif
+    };
+
+}
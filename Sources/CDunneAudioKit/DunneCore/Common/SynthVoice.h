@@ -54,6 +54,10 @@ namespace DunneCore
         int newNoteNumber;  // holds new note number while damping note before restarting
         float newNoteVol;   // holds new note volume while damping note before restarting
         float tempGain;     // product of global volume, note volume, and amp EG
+        int controlCountdown = 0;   // chunks until filter coefficients are next recomputed
+        bool needsPrep = false;     // (re)started since prepToGetSamples() last ran, so needs it at once
+        int inaudibleChunkCount = 0;    // chunks in a row releasing below the audibility floor
+        int culledSampleCount = 0;      // once isInaudible() has returned true, samples it would still have rendered
 
         SynthVoice(std::mt19937* gen) : noteNumber(-1), osc1(gen), osc2(gen) {}
 
@@ -78,8 +82,13 @@ namespace DunneCore
                               float phaseDeltaMultiplier,
                               float cutoffMultiple,
                               float cutoffStrength,
-                              float resLinear);
+                              float resLinear,
+                              int controlDivisor);
         bool getSamples(int sampleCount, float *leftOuput, float *rightOutput);
+
+        // after prepToGetSamples(): return true if the voice's release has stayed below audibilityFloor (a
+        // linear gain, including note and master volume) for chunkLimit chunks in a row, so it may be stopped
+        bool isInaudible(int sampleCount, float audibilityFloor, int chunkLimit);
     };
 
 }
@@ -0,0 +1,67 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#include "CompressedSampleFile.h"
+#include "wavpack.h"
+
+namespace DunneCore
+{
+
+    CompressedSampleFile::CompressedSampleFile()
+    : sampleRate(0.0f)
+    , channelCount(0)
+    , sampleCount(0)
+    , wpc(0)
+    , isFloat(false)
+    , scale(1.0f)
+    {
+    }
+
+    CompressedSampleFile::~CompressedSampleFile()
+    {
+        close();
+    }
+
+    bool CompressedSampleFile::open(const char *path, char *errMsg)
+    {
+        close();
+        wpc = WavpackOpenFileInput(path, errMsg, OPEN_2CH_MAX, 0);
+        if (wpc == 0) return false;
+
+        sampleRate = (float)WavpackGetSampleRate(wpc);
+        channelCount = WavpackGetReducedChannels(wpc);
+        sampleCount = WavpackGetNumSamples(wpc);
+        isFloat = (WavpackGetMode(wpc) & MODE_FLOAT) != 0;
+        int bps = WavpackGetBitsPerSample(wpc);
+        scale = 1.0f / (1 << (bps - 1));
+        return true;
+    }
+
+    void CompressedSampleFile::close()
+    {
+        if (wpc) WavpackCloseFile(wpc);
+        wpc = 0;
+    }
+
+    bool CompressedSampleFile::seek(int64_t frameIndex)
+    {
+        if (wpc == 0) return false;
+        return WavpackSeekSample64(wpc, frameIndex) != 0;
+    }
+
+    int CompressedSampleFile::read(float *pOut, int frameCount)
+    {
+        if (wpc == 0 || frameCount <= 0) return 0;
+
+        // WavPack unpacks 32-bit words, which we convert to floating-point in place
+        int framesRead = (int)WavpackUnpackSamples(wpc, (int32_t*)pOut, frameCount);
+        if (!isFloat)
+        {
+            float *pf = pOut;
+            int32_t *pi = (int32_t*)pf;
+            for (int i = 0; i < (framesRead * channelCount); i++)
+                *pf++ = scale * *pi++;
+        }
+        return framesRead;
+    }
+
+}
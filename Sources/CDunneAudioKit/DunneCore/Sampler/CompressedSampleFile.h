@@ -0,0 +1,39 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <stdint.h>
+
+namespace DunneCore
+{
+
+    // CompressedSampleFile wraps a WavPack file opened for reading, and delivers its contents
+    // as interleaved floating-point sample frames, starting from any frame position.
+
+    struct CompressedSampleFile
+    {
+        float sampleRate;
+        int channelCount;
+        int sampleCount;
+
+        CompressedSampleFile();
+        ~CompressedSampleFile();
+
+        // returns false (and fills errMsg, at least 100 chars) if file could not be opened
+        bool open(const char *path, char *errMsg);
+        void close();
+        bool isOpen() { return wpc != 0; }
+
+        // position the file so the next read() starts at the given frame
+        bool seek(int64_t frameIndex);
+
+        // read up to frameCount interleaved frames into pOut, which must have room for
+        // frameCount * channelCount floats; returns number of frames actually read
+        int read(float *pOut, int frameCount);
+
+    protected:
+        void *wpc;          // WavpackContext*
+        bool isFloat;
+        float scale;
+    };
+
+}
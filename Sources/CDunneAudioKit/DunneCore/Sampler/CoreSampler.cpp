@@ -4,16 +4,57 @@
 #include "SamplerVoice.h"
 #include "FunctionTable.h"
 #include "SustainPedalLogic.h"
+#include "ActiveVoiceList.h"
+#include "SampleStreamer.h"
+#include "CompressedSampleFile.h"
+#include "QualityGovernor.h"
+#include "RenderWorkerPool.h"
+#include "Semaphore.h"
+#include "CommandQueue.h"
+#include "SamplePool.h"
+#include "SampleRateConverter.h"
 
 #include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <list>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <sys/stat.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
-// number of voices
-#define MAX_POLYPHONY 64
+// most note and pedal events which may be waiting for render() to apply them
+#define COMMAND_QUEUE_CAPACITY 1024
+
+// most lazily loaded samples whose bodies may be waiting for the loader thread at once
+#define BODY_REQUEST_CAPACITY 256
+
+// a lazily loaded sample's body is prefetched when a note this many semitones away plays
+#define LAZY_PREFETCH_NOTES 2
+
+// number of voices, unless init() is told otherwise
+#define DEFAULT_POLYPHONY 64
 
 // MIDI offers 128 distinct note numbers
 #define MIDI_NOTENUMBERS 128
 
+// ... and 128 distinct velocities
+#define MIDI_VELOCITIES 128
+
+// keyMap entry for (note, velocity) pairs which have no sample
+#define NO_SAMPLE 0xFFFF
+
+// highest CPU-governor quality level: see applyQualityLevel()
+#define MAX_QUALITY_LEVEL 8
+
 // Convert MIDI note to Hz, for 12-tone equal temperament
 #define NOTE_HZ(midiNoteNumber) ( 440.0f * pow(2.0f, ((midiNoteNumber) - 69.0f)/12.0f) )
 
@@ -21,25 +62,392 @@ struct CoreSampler::InternalData {
     // list of (pointers to) all loaded samples
     std::list<DunneCore::KeyMappedSampleBuffer*> sampleBufferList;
     
-    // maps MIDI note numbers to "closest" samples (all velocity layers)
-    std::list<DunneCore::KeyMappedSampleBuffer*> keyMap[MIDI_NOTENUMBERS];
+    // maps every MIDI (note number, velocity) pair directly to an index in keyMapBuffers, or NO_SAMPLE;
+    // built here by the loading/editing thread, then published to the rendering thread as a KeyMapCopy
+    uint16_t keyMap[MIDI_NOTENUMBERS][MIDI_VELOCITIES];
+    std::vector<DunneCore::KeyMappedSampleBuffer*> keyMapBuffers;
+
+    // key-map building state: number of samples mapped to each note, and the first of them
+    int keyMapCount[MIDI_NOTENUMBERS];
+    uint16_t keyMapFirst[MIDI_NOTENUMBERS];
+
+    void clearKeyMap();
+    void clearKeyMapNote(int noteNumber);
+    void addToKeyMap(int noteNumber, uint16_t bufferIndex);
+    void finishKeyMap();
+    void finishKeyMapNote(int noteNumber);
+    bool mapsToNote(const DunneCore::KeyMappedSampleBuffer *pBuf, int noteNumber);
+
+    // The rendering thread reads an immutable copy of the key map, published whole whenever it changes, so
+    // samples may be added, replaced and removed while rendering. Each copy also lists the buffers retired
+    // (removed or replaced) but not yet freed; the rendering thread marks a copy's generation released once
+    // none of its voices can be playing any of them.
+    struct KeyMapCopy
+    {
+        uint16_t keyMap[MIDI_NOTENUMBERS][MIDI_VELOCITIES];
+        std::vector<DunneCore::KeyMappedSampleBuffer*> buffers;
+        std::vector<DunneCore::KeyMappedSampleBuffer*> retiredBuffers;
+        uint64_t generation;
+    };
+    std::atomic<KeyMapCopy*> publishedKeyMap{nullptr};
+    std::atomic<uint64_t> releasedGeneration{0};
+    KeyMapCopy *renderKeyMap = nullptr;     // rendering thread's copy
+    uint64_t keyMapGeneration = 0;          // generation of the latest copy published
+    bool isSimpleKeyMap = false;            // latest key map was built by buildSimpleKeyMap()
+
+    // editing thread: superseded copies, and retired buffers with the first generation not containing them
+    std::vector<KeyMapCopy*> retiredKeyMaps;
+    std::vector<std::pair<DunneCore::KeyMappedSampleBuffer*, uint64_t>> retiredBuffers;
+
+    void publishKeyMap();
+    void updateRenderKeyMap();
+    void freeKeyMaps();
+
+    // Lazy loading: samples registered with only a head, by lazyId, until the loader thread has attached their
+    // bodies. The rendering thread requests bodies by lazyId, which are never reused, so a request for a sample
+    // which has since been removed (and perhaps freed) finds nothing.
+    struct LazySample
+    {
+        DunneCore::KeyMappedSampleBuffer *pHead;
+        std::string path;
+        SampleDescriptor sampleDescriptor;
+        int preloadFrames;  // for decoding the body: see decodeCompressedSampleFile()
+    };
+    std::mutex lazyMutex;
+    std::map<unsigned, LazySample> lazySamples;
+    unsigned lastLazyId = 0;
+    DunneCore::CommandQueue<unsigned, BODY_REQUEST_CAPACITY> bodyRequests;
+    DunneCore::Semaphore bodyRequested;     // signalled per request, and to stop the loader
+    std::atomic<bool> isLazyLoaderRunning{false};
+    std::thread lazyLoader;
+
+    DunneCore::KeyMappedSampleBuffer *mappedSample(int noteNumber, int velocity);
+    void requestBody(DunneCore::KeyMappedSampleBuffer *pBuf);
+    void forgetLazySample(DunneCore::KeyMappedSampleBuffer *pBuf);
+    void stopLazyLoader();
+
+    // Pre-resampling (see setPreResampling()): when init() changes the sample rate, each loaded sample waits here
+    // with a copy of itself (sharing its data, at its own rate), which the resampler thread converts to
+    // resampleRate and links to the sample's resampled list. As with lazy loading, samples removed or replaced
+    // meanwhile are forgotten, so nothing is linked to a retired buffer.
+    std::mutex resampleMutex;
+    std::map<DunneCore::KeyMappedSampleBuffer*, DunneCore::KeyMappedSampleBuffer*> pendingResamples;
+    DunneCore::KeyMappedSampleBuffer *pResampling = nullptr;   // sample whose copy is being converted, if any
+    float resampleRate = 0.0f;
+    std::atomic<bool> isResamplerRunning{false};
+    std::thread resampler;
+
+    void forgetResampling(DunneCore::KeyMappedSampleBuffer *pBuf);
+    void stopResampler();
     
     DunneCore::AHDSHREnvelopeParameters ampEnvelopeParameters;
     DunneCore::ADSREnvelopeParameters filterEnvelopeParameters;
     DunneCore::ADSREnvelopeParameters pitchEnvelopeParameters;
     
-    // table of voice resources
-    DunneCore::SamplerVoice voice[MAX_POLYPHONY];
+    // table of voice resources, allocated in one block by allocateVoices()
+    std::unique_ptr<DunneCore::SamplerVoice[]> voice;
+    int voiceCount;
+
+    // one bit per voice, set while that voice is free (noteNumber < 0)
+    std::vector<uint64_t> freeVoiceBits;
+
+    // voices which are not free, in index order, and (for any thread to read) how many there are
+    DunneCore::ActiveVoiceList activeVoices;
+    std::atomic<int> activeVoiceCount{0};
+
+    // index of the voice most recently assigned to each note number, or -1. An entry is only
+    // current while that voice's noteNumber still matches; voices stolen or stopped go stale.
+    int noteVoiceIndex[MIDI_NOTENUMBERS];
+
+    int firstFreeVoice();
+    void updateVoiceState(DunneCore::SamplerVoice *pVoice);
+    void createStreamer(int ringFrames);
     
-    // one vibrato LFO shared by all voices
+    // one vibrato LFO shared by all voices, and its output for the current chunk
     DunneCore::FunctionTableOscillator vibratoLFO;
+    float vibratoSample = 0.0f;
+
+    // samples rendered so far of the current chunk: envelopes and LFOs step once per CORESAMPLER_CHUNKSIZE
+    // samples, however render() calls and events split the output (rendering thread only)
+    unsigned chunkPhase = 0;
     
     DunneCore::SustainPedalLogic pedalLogic;
     
     // tuning table
     float tuningTable[128];
+
+    // created on demand, when the first streaming sample is loaded
+    std::unique_ptr<DunneCore::SampleStreamer> streamer;
+
+    // totals for compressed files loaded since the last unloadAllSamples()
+    SampleLoadStatistics loadStatistics = SampleLoadStatistics();
+
+    // CPU budget governor, and the settings it controls
+    DunneCore::QualityGovernor governor;
+    int appliedQualityLevel = 0;    // level reflected in the settings below
+    int voiceInterpolationMode = 0; // interpolationMode, lowered at levels 1 and 2
+    int controlDivisor = 1;         // filter coefficients are recomputed every controlDivisor chunks
+    int voiceLimit = 0;             // most voices which may sound at once
+
+    // voices releasing below audibilityFloor for inaudibleChunkLimit chunks are stopped early (0 disables)
+    float audibilityFloor = 0.0f;
+    int inaudibleChunkLimit = 4;
+    std::atomic<uint64_t> culledSampleCount{0};     // voice-samples not rendered as a result
+
+    // Multi-threaded rendering: each voice renders into its own VoiceOutput, on whichever thread
+    // claims it, and render() then mixes them in active-list order, exactly as single-threaded.
+    DunneCore::RenderWorkerPool renderPool;
+    struct VoiceOutput
+    {
+        float left[CORESAMPLER_CHUNKSIZE], right[CORESAMPLER_CHUNKSIZE];
+        int noteNumber;     // voice's note number before rendering
+        bool isFinished;    // voice must be stopped
+    };
+    std::unique_ptr<VoiceOutput[]> voiceOutput;
+
+    // the current render() call's arguments for renderVoice()
+    unsigned renderSampleCount;
+    bool renderAtChunkStart;
+    unsigned renderChunkRemaining;
+    float renderPitchDev, renderCutoffMul;
+    bool allowSampleRunout;
+
+    // note and pedal events posted by any thread, applied by render() when due
+    DunneCore::CommandQueue<DunneCore::EngineCommand, COMMAND_QUEUE_CAPACITY> commandQueue;
+    DunneCore::PendingCommandList<DunneCore::EngineCommand, COMMAND_QUEUE_CAPACITY> pendingCommands;
+    std::atomic<int64_t> sampleTime{0};     // samples rendered so far
+
+    // stop-all-voices requests: epoch of the latest requested and the latest carried out, which
+    // waitForStop() polls, so the rendering thread need never signal anyone
+    std::atomic<uint64_t> requestedStopEpoch{0};
+    std::atomic<uint64_t> stoppedEpoch{0};
+
+    // set when restartVoices() found the command queue full, for the rendering thread to restart once
+    // it has applied everything queued before
+    std::atomic<bool> isRestartPending{false};
 };
 
+// Frequency in Hz of any MIDI note number in 12-tone equal temperament, using a table
+// for valid note numbers, to avoid calling pow() while building key maps
+static float equalTemperedHz(int noteNumber)
+{
+    static struct NoteTable
+    {
+        float hz[MIDI_NOTENUMBERS];
+        NoteTable() { for (int i=0; i < MIDI_NOTENUMBERS; i++) hz[i] = NOTE_HZ(i); }
+    } table;
+
+    if (noteNumber >= 0 && noteNumber < MIDI_NOTENUMBERS) return table.hz[noteNumber];
+    return NOTE_HZ(noteNumber);
+}
+
+static inline int lowestSetBit(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return int(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Return index of the lowest-numbered free voice, or -1 if all are busy. Always choosing the
+// lowest keeps voice assignment (and hence mixing order) the same as a linear scan would.
+int CoreSampler::InternalData::firstFreeVoice()
+{
+    for (int w=0; w < int(freeVoiceBits.size()); w++)
+        if (freeVoiceBits[w]) return 64 * w + lowestSetBit(freeVoiceBits[w]);
+    return -1;
+}
+
+// Call after anything which may change a voice's noteNumber, to keep the free-voice mask,
+// active-voice list and note index in step with it
+void CoreSampler::InternalData::updateVoiceState(DunneCore::SamplerVoice *pVoice)
+{
+    int index = int(pVoice - voice.get());
+    uint64_t bit = uint64_t(1) << (index & 63);
+    if (pVoice->noteNumber < 0)
+    {
+        freeVoiceBits[index >> 6] |= bit;
+    }
+    else
+    {
+        freeVoiceBits[index >> 6] &= ~bit;
+        noteVoiceIndex[pVoice->noteNumber] = index;
+    }
+    activeVoices.update(index, pVoice->noteNumber >= 0);
+    activeVoiceCount.store(activeVoices.count(), std::memory_order_relaxed);
+}
+
+// one stream per voice, each with a ring of at least ringFrames
+void CoreSampler::InternalData::createStreamer(int ringFrames)
+{
+    streamer.reset(new DunneCore::SampleStreamer(voiceCount, ringFrames));
+    for (int i=0; i < voiceCount; i++)
+        voice[i].stream = streamer->getStream(i);
+}
+
+void CoreSampler::InternalData::clearKeyMap()
+{
+    for (int nn=0; nn < MIDI_NOTENUMBERS; nn++) clearKeyMapNote(nn);
+    keyMapBuffers.assign(sampleBufferList.begin(), sampleBufferList.end());
+}
+
+void CoreSampler::InternalData::clearKeyMapNote(int noteNumber)
+{
+    for (int vel=0; vel < MIDI_VELOCITIES; vel++) keyMap[noteNumber][vel] = NO_SAMPLE;
+    keyMapCount[noteNumber] = 0;
+}
+
+// Map one more sample to the given note. Samples must be added in keyMapBuffers order, because
+// (as with the old per-note lists) the first sample accepting a given velocity wins.
+void CoreSampler::InternalData::addToKeyMap(int noteNumber, uint16_t bufferIndex)
+{
+    if (keyMapCount[noteNumber]++ == 0) keyMapFirst[noteNumber] = bufferIndex;
+
+    DunneCore::KeyMappedSampleBuffer *pBuf = keyMapBuffers[bufferIndex];
+    int minVel = 0, maxVel = MIDI_VELOCITIES - 1;
+
+    // if sample does not have velocity range, accept any velocity
+    if (pBuf->minimumVelocity >= 0 && pBuf->maximumVelocity >= 0)
+    {
+        if (pBuf->minimumVelocity > minVel) minVel = pBuf->minimumVelocity;
+        if (pBuf->maximumVelocity < maxVel) maxVel = pBuf->maximumVelocity;
+    }
+
+    uint16_t *row = keyMap[noteNumber];
+    for (int vel = minVel; vel <= maxVel; vel++)
+        if (row[vel] == NO_SAMPLE) row[vel] = bufferIndex;
+}
+
+void CoreSampler::InternalData::finishKeyMap()
+{
+    for (int nn=0; nn < MIDI_NOTENUMBERS; nn++) finishKeyMapNote(nn);
+}
+
+void CoreSampler::InternalData::finishKeyMapNote(int noteNumber)
+{
+    // common case: only one sample mapped to a note - use it regardless of velocity
+    if (keyMapCount[noteNumber] == 1)
+        for (int vel=0; vel < MIDI_VELOCITIES; vel++) keyMap[noteNumber][vel] = keyMapFirst[noteNumber];
+}
+
+// true if buildKeyMap() maps the sample to the given note: its tuning lies within the sample's note range
+bool CoreSampler::InternalData::mapsToNote(const DunneCore::KeyMappedSampleBuffer *pBuf, int noteNumber)
+{
+    float hz = tuningTable[noteNumber];
+    return hz >= equalTemperedHz(pBuf->minimumNoteNumber) && hz <= equalTemperedHz(pBuf->maximumNoteNumber);
+}
+
+// editing thread: hand a copy of the key map to the rendering thread
+void CoreSampler::InternalData::publishKeyMap()
+{
+    KeyMapCopy *pMap = new KeyMapCopy;
+    memcpy(pMap->keyMap, keyMap, sizeof(keyMap));
+    pMap->buffers = keyMapBuffers;
+    for (auto &retired : retiredBuffers)
+    {
+        // a retired sample's body (if lazily loaded) and resampled copies are final, since it was forgotten
+        // before being retired
+        for (DunneCore::KeyMappedSampleBuffer *pBuf = retired.first; pBuf; pBuf = pBuf->body.load(std::memory_order_acquire))
+            for (DunneCore::KeyMappedSampleBuffer *pCopy = pBuf; pCopy; pCopy = pCopy->resampled.load(std::memory_order_acquire))
+                pMap->retiredBuffers.push_back(pCopy);
+    }
+    pMap->generation = ++keyMapGeneration;
+
+    KeyMapCopy *pOld = publishedKeyMap.exchange(pMap, std::memory_order_acq_rel);
+    if (pOld) retiredKeyMaps.push_back(pOld);
+}
+
+// rendering thread: switch to the latest key map, and release it once no voice plays a retired buffer
+void CoreSampler::InternalData::updateRenderKeyMap()
+{
+    KeyMapCopy *pMap = publishedKeyMap.load(std::memory_order_acquire);
+    renderKeyMap = pMap;
+    if (pMap == 0 || pMap->generation <= releasedGeneration.load(std::memory_order_relaxed)) return;
+
+    for (int k=0; k < activeVoices.count(); k++)
+    {
+        DunneCore::SamplerVoice *pVoice = &voice[activeVoices[k]];
+        for (DunneCore::KeyMappedSampleBuffer *pBuf : pMap->retiredBuffers)
+        {
+            if (pVoice->sampleBuffer == pBuf) return;
+            if (pVoice->ampEnvelope.isPreStarting() && pVoice->newSampleBuffer == pBuf) return;
+        }
+    }
+    releasedGeneration.store(pMap->generation, std::memory_order_release);
+}
+
+// free every key map copy and retired buffer; call only when not rendering
+void CoreSampler::InternalData::freeKeyMaps()
+{
+    delete publishedKeyMap.exchange(nullptr);
+    renderKeyMap = 0;
+    for (KeyMapCopy *pMap : retiredKeyMaps) delete pMap;
+    retiredKeyMaps.clear();
+    for (auto &retired : retiredBuffers) delete retired.first;
+    retiredBuffers.clear();
+}
+
+// rendering thread: the sample mapped to a (note, velocity) pair, if both are valid, or null
+DunneCore::KeyMappedSampleBuffer *CoreSampler::InternalData::mappedSample(int noteNumber, int velocity)
+{
+    if (noteNumber < 0 || noteNumber >= MIDI_NOTENUMBERS || velocity < 0 || velocity >= MIDI_VELOCITIES) return 0;
+    uint16_t index = renderKeyMap->keyMap[noteNumber][velocity];
+    return index == NO_SAMPLE ? 0 : renderKeyMap->buffers[index];
+}
+
+// rendering thread: ask the loader thread for a lazily loaded sample's body, unless already asked
+void CoreSampler::InternalData::requestBody(DunneCore::KeyMappedSampleBuffer *pBuf)
+{
+    if (pBuf == 0 || pBuf->lazyId == 0 || pBuf->isBodyRequested) return;
+    if (pBuf->body.load(std::memory_order_relaxed)) return;
+
+    // if the queue is full, the next note to want this sample asks again
+    if (!bodyRequests.push(pBuf->lazyId)) return;
+    pBuf->isBodyRequested = true;
+    bodyRequested.signal();
+}
+
+// editing thread: stop attaching a body to a sample about to be retired
+void CoreSampler::InternalData::forgetLazySample(DunneCore::KeyMappedSampleBuffer *pBuf)
+{
+    if (pBuf->lazyId == 0) return;
+    std::lock_guard<std::mutex> lock(lazyMutex);
+    lazySamples.erase(pBuf->lazyId);
+}
+
+void CoreSampler::InternalData::stopLazyLoader()
+{
+    isLazyLoaderRunning.store(false, std::memory_order_release);
+    if (!lazyLoader.joinable()) return;
+    bodyRequested.signal();
+    lazyLoader.join();
+}
+
+// editing thread: stop converting a sample about to be retired
+void CoreSampler::InternalData::forgetResampling(DunneCore::KeyMappedSampleBuffer *pBuf)
+{
+    std::lock_guard<std::mutex> lock(resampleMutex);
+    auto it = pendingResamples.find(pBuf);
+    if (it != pendingResamples.end())
+    {
+        delete it->second;
+        pendingResamples.erase(it);
+    }
+    if (pResampling == pBuf) pResampling = nullptr;
+}
+
+// stop the resampler thread, dropping any samples still waiting for it
+void CoreSampler::InternalData::stopResampler()
+{
+    isResamplerRunning.store(false, std::memory_order_release);
+    if (resampler.joinable()) resampler.join();
+    for (auto &pending : pendingResamples) delete pending.second;
+    pendingResamples.clear();
+}
+
 CoreSampler::CoreSampler()
 : currentSampleRate(44100.0f)    // sensible guess
 , isKeyMapValid(false)
@@ -62,119 +470,983 @@ CoreSampler::CoreSampler()
 , linearResonance(0.5f)
 , pitchADSRSemitones(0.0f)
 , loopThruRelease(false)
+, interpolationMode(DunneCore::kLinearInterpolation)
+, fixedPointPhase(false)
+, streamingPreloadFrames(0)
+, lazyLoading(false)
+, lazyHeadFrames(8192)
+, interleavedStorage(false)
+, preResampling(false)
+, hasSampleRate(false)
+, mipMapping(false)
+, sharesSamples(true)
+, deduplicatesContent(false)
+, storageBitDepth(32)
+, voiceStealingPolicy(kStealReleasedFirst)
 , stoppingAllVoices(false)
+, eventCounter(0)
 , data(new InternalData)
 {
-    DunneCore::SamplerVoice *pVoice = data->voice;
-    for (int i=0; i < MAX_POLYPHONY; i++, pVoice++)
+    allocateVoices(DEFAULT_POLYPHONY);
+    
+    for (int i=0; i < 128; i++)
+        data->tuningTable[i] = NOTE_HZ(i);
+    data->clearKeyMap();
+}
+
+CoreSampler::~CoreSampler()
+{
+    unloadAllSamples();
+}
+
+// (Re)allocate the voice pool. Any playing notes are lost, so call only when not rendering.
+void CoreSampler::allocateVoices(int maxVoices)
+{
+    if (maxVoices < 1) maxVoices = 1;
+    data->voice.reset(new DunneCore::SamplerVoice[maxVoices]);
+    data->voiceCount = maxVoices;
+    data->voiceOutput.reset(new InternalData::VoiceOutput[maxVoices]);
+
+    DunneCore::SamplerVoice *pVoice = data->voice.get();
+    for (int i=0; i < maxVoices; i++, pVoice++)
     {
         pVoice->ampEnvelope.pParameters = &data->ampEnvelopeParameters;
         pVoice->filterEnvelope.pParameters = &data->filterEnvelopeParameters;
         pVoice->pitchEnvelope.pParameters = &data->pitchEnvelopeParameters;
         pVoice->noteFrequency = 0.0f;
         pVoice->glideSecPerOctave = &glideRate;
+        pVoice->restartVoiceLFO = &restartVoiceLFO;
+        pVoice->interpolationMode = &data->voiceInterpolationMode;
+        pVoice->fixedPointPhase = &fixedPointPhase;
     }
+    data->freeVoiceBits.assign((maxVoices + 63) / 64, 0);
+    data->activeVoices.init(maxVoices);
+    for (int i=0; i < maxVoices; i++) data->updateVoiceState(&data->voice[i]);
+    applyQualityLevel(0);
+    for (int nn=0; nn < MIDI_NOTENUMBERS; nn++) data->noteVoiceIndex[nn] = -1;
+
+    // streams are per-voice too
+    if (data->streamer) data->createStreamer(data->streamer->getRingFrames());
+}
+
+int CoreSampler::getMaxVoices()
+{
+    return data->voiceCount;
+}
+
+int CoreSampler::getActiveVoiceCount()
+{
+    return data->activeVoiceCount.load(std::memory_order_relaxed);
+}
+
+int CoreSampler::init(double sampleRate, int maxVoices)
+{
+    if (maxVoices != data->voiceCount) allocateVoices(maxVoices);
+    return init(sampleRate);
+}
+
+int CoreSampler::init(double sampleRate)
+{
+    // samples loaded at the old rate are converted to the new one in the background
+    if (preResampling && float(sampleRate) != currentSampleRate) startResampler(float(sampleRate));
+
+    currentSampleRate = (float)sampleRate;
+    hasSampleRate = true;
+    data->ampEnvelopeParameters.updateSampleRate((float)(sampleRate/CORESAMPLER_CHUNKSIZE));
+    data->filterEnvelopeParameters.updateSampleRate((float)(sampleRate/CORESAMPLER_CHUNKSIZE));
+    data->pitchEnvelopeParameters.updateSampleRate((float)(sampleRate/CORESAMPLER_CHUNKSIZE));
+    data->vibratoLFO.waveTable.sinusoid();
+    data->vibratoLFO.init(sampleRate/CORESAMPLER_CHUNKSIZE, 5.0f);
+
+    // build the shared sinc table now, rather than on the audio thread
+    DunneCore::SincTable::get();
+
+    data->governor.init(sampleRate, MAX_QUALITY_LEVEL);
+    applyQualityLevel(0);
+    data->chunkPhase = 0;
     
-    for (int i=0; i < 128; i++)
-        data->tuningTable[i] = NOTE_HZ(i);
+    for (int i=0; i < data->voiceCount; i++)
+        data->voice[i].init(sampleRate);
+    return 0;   // no error
+}
+
+void CoreSampler::deinit()
+{
+}
+
+void CoreSampler::unloadAllSamples()
+{
+    isKeyMapValid = false;
+    data->loadStatistics = SampleLoadStatistics();
+
+    // the loader thread may be decoding a body for a buffer we're about to delete
+    data->stopLazyLoader();
+    data->lazySamples.clear();
+    data->stopResampler();
+
+    // streamer thread may still be reading from buffers we're about to delete
+    if (data->streamer)
+    {
+        for (int i=0; i < data->voiceCount; i++)
+        {
+            data->voice[i].stream = 0;
+            data->voice[i].oscillator.stream = 0;
+        }
+        data->streamer.reset();
+    }
+
+    for (DunneCore::KeyMappedSampleBuffer *pBuf : data->sampleBufferList)
+        delete pBuf;
+    data->sampleBufferList.clear();
+    data->clearKeyMap();
+    data->freeKeyMaps();
 }
 
-CoreSampler::~CoreSampler()
-{
-    unloadAllSamples();
+void CoreSampler::loadSampleData(SampleDataDescriptor& sdd)
+{
+    addSampleBuffer(sdd, sdd.sampleCount);
+}
+
+// SamplePool key for sample data from the given source, stored with the given length and settings
+static std::string samplePoolKey(const std::string& source, float sampleRate, int channelCount, int sampleCount,
+                                 int residentSampleCount, int storageBitDepth, bool interleaved)
+{
+    char settings[100];
+    snprintf(settings, sizeof(settings), "|%g|%d|%d|%d|%d|%d", sampleRate, channelCount, sampleCount,
+             residentSampleCount, storageBitDepth, interleaved ? 1 : 0);
+    return source + settings;
+}
+
+// SamplePool key for the same data, converted to another rate (see setPreResampling())
+static std::string resampledPoolKey(const std::string& key, float sampleRate)
+{
+    char rate[30];
+    snprintf(rate, sizeof(rate), "|@%g", sampleRate);
+    return key + rate;
+}
+
+// sd, with its sample positions moved to where they fall once its sample is resampled by ratio; loop points of
+// 1.0 or less are fractions of the sample's length (see newSampleBuffer()), so stay as they are
+static SampleDescriptor resampledDescriptor(SampleDescriptor sd, double ratio)
+{
+    auto position = [ratio](float point, bool mayBeFraction) {
+        if (point <= 0.0f || (mayBeFraction && point <= 1.0f)) return point;
+        float moved = float(point * ratio);
+        return mayBeFraction && moved <= 1.0f ? nextafterf(1.0f, 2.0f) : moved;
+    };
+    sd.startPoint = position(sd.startPoint, false);
+    sd.endPoint = position(sd.endPoint, false);
+    sd.loopStartPoint = position(sd.loopStartPoint, true);
+    sd.loopEndPoint = position(sd.loopEndPoint, true);
+    return sd;
+}
+
+// convert all of source's resident data into dest, which holds converter.getOutputLength() frames
+static void resampleSampleData(const DunneCore::SampleRateConverter& converter, const DunneCore::SampleBuffer& source,
+                               DunneCore::SampleBuffer& dest)
+{
+    int inputCount = source.residentSampleCount;
+    int outputCount = dest.residentSampleCount;
+    int stride = source.isInterleaved ? 2 : 1;
+    std::vector<float> input(inputCount), output(size_t(source.channelCount) * outputCount);
+    for (int channel=0; channel < source.channelCount; channel++)
+    {
+        int offset = channel == 0 ? 0 : source.isInterleaved ? 1 : inputCount;
+        for (int i=0; i < inputCount; i++) input[i] = source.getData(offset + stride * i);
+        converter.convert(input.data(), inputCount, 1, output.data() + channel * outputCount);
+    }
+    dest.setFrames(0, outputCount, output.data(), output.data() + outputCount, 1);
+}
+
+// give storage its mip levels (see setMipMapping()), in its own format and layout: each converted straight from
+// the full-rate data, so every level is band-limited just once
+static void addMipLevels(const std::shared_ptr<DunneCore::SampleStorage>& storage)
+{
+    DunneCore::SampleBuffer source;
+    source.init(storage);
+    std::shared_ptr<DunneCore::SampleStorage> *pNext = &storage->halfRate;
+    for (int level=1; level <= DunneCore::SampleBuffer::mipLevelCount; level++)
+    {
+        float rate = source.sampleRate / float(1 << level);
+        DunneCore::SampleRateConverter converter(source.sampleRate, rate);
+        DunneCore::SampleBuffer decimated;
+        decimated.init(rate, source.channelCount, converter.getOutputLength(source.sampleCount), -1,
+                       source.isInterleaved, source.format);
+        resampleSampleData(converter, source, decimated);
+        *pNext = decimated.storage;
+        pNext = &decimated.storage->halfRate;
+    }
+}
+
+// a file's path, size and modification time, so a file rewritten since it was pooled is loaded afresh
+static std::string fileIdentity(const char *path)
+{
+    struct stat info;
+    if (stat(path, &info) != 0) return path;
+    char sizeAndTime[50];
+    snprintf(sizeAndTime, sizeof(sizeAndTime), "|%lld|%lld", (long long)info.st_size, (long long)info.st_mtime);
+    return std::string(path) + sizeAndTime;
+}
+
+bool CoreSampler::loadSampleData(SampleDataDescriptor& sdd, const char *sourceKey)
+{
+    if (sourceKey == 0 || !sharesSamples)
+    {
+        if (sdd.data == 0) return false;
+        loadSampleData(sdd);
+        return true;
+    }
+
+    std::string key = samplePoolKey(sourceKey, sdd.sampleRate, sdd.channelCount, sdd.sampleCount, sdd.sampleCount,
+                                    storageBitDepth, interleavedStorage);
+    DunneCore::KeyMappedSampleBuffer *pBuf;
+    if (sdd.data == 0)
+    {
+        // holding on to the pooled data, so newSharedSampleBuffer() is sure to find it, and need not fill anything
+        std::shared_ptr<DunneCore::SampleStorage> storage =
+            DunneCore::SamplePool::shared().find(storedPoolKey(key, sdd.sampleRate, sdd.sampleCount, sdd.sampleCount));
+        if (!storage) return false;
+        pBuf = newSharedSampleBuffer(key, sdd.sampleDescriptor, sdd.sampleRate, sdd.channelCount, sdd.sampleCount,
+                                     sdd.sampleCount, [](DunneCore::KeyMappedSampleBuffer*) {});
+    }
+    else pBuf = newSharedSampleBuffer(key, sdd.sampleDescriptor, sdd.sampleRate, sdd.channelCount, sdd.sampleCount,
+                                      sdd.sampleCount, [&sdd](DunneCore::KeyMappedSampleBuffer *pNew) {
+        copySampleData(pNew, sdd);
+    });
+    data->sampleBufferList.push_back(pBuf);
+    return true;
+}
+
+bool CoreSampler::adoptSampleData(SampleDataDescriptor& sdd, const char *sourceKey,
+                                  void (*releaseData)(float *data, void *context), void *context)
+{
+    // usable in place only if already in the storage format, layout and rate
+    bool isStereo = sdd.channelCount == 2;
+    if (storageBitDepth != 32 || sdd.channelCount > 2 || (isStereo && sdd.isInterleaved != interleavedStorage) ||
+        resamplesOnLoad(sdd.sampleRate, sdd.sampleCount, sdd.sampleCount))
+    {
+        loadSampleData(sdd, sourceKey);
+        releaseData(sdd.data, context);
+        return false;
+    }
+
+    bool isAdopted = false;
+    auto adopt = [&]() {
+        std::shared_ptr<DunneCore::SampleStorage> storage = std::make_shared<DunneCore::SampleStorage>();
+        storage->format = DunneCore::SampleBuffer::kFloat32;
+        storage->sampleRate = sdd.sampleRate;
+        storage->channelCount = sdd.channelCount;
+        storage->sampleCount = storage->residentSampleCount = sdd.sampleCount;
+        storage->isInterleaved = isStereo && sdd.isInterleaved;
+        DunneCore::SampleDataDeleter deleter;
+        deleter.release = releaseData;
+        deleter.context = context;
+        storage->samples = std::unique_ptr<float[], DunneCore::SampleDataDeleter>(sdd.data, deleter);
+        if (mipMapsOnLoad(sdd.sampleCount, sdd.sampleCount)) addMipLevels(storage);
+        isAdopted = true;
+        return storage;
+    };
+
+    // an identical sample already in the pool is used instead, and this copy released
+    std::shared_ptr<DunneCore::SampleStorage> storage;
+    if (sourceKey == 0 || !sharesSamples) storage = adopt();
+    else
+    {
+        std::string key = samplePoolKey(sourceKey, sdd.sampleRate, sdd.channelCount, sdd.sampleCount, sdd.sampleCount,
+                                        storageBitDepth, interleavedStorage);
+        storage = DunneCore::SamplePool::shared().obtain(storedPoolKey(key, sdd.sampleRate, sdd.sampleCount,
+                                                                       sdd.sampleCount), adopt);
+    }
+    data->sampleBufferList.push_back(newSampleBuffer(sdd.sampleDescriptor, sdd.sampleRate, sdd.channelCount,
+                                                     sdd.sampleCount, sdd.sampleCount, storage));
+    if (!isAdopted) releaseData(sdd.data, context);
+    return isAdopted;
+}
+
+void CoreSampler::loadCompressedSampleFile(SampleFileDescriptor& sfd)
+{
+    loadCompressedSampleFiles(&sfd, 1, 1);
+}
+
+// state shared by the threads of one loadCompressedSampleFiles() call; task i decodes file firstIndex + i
+struct CompressedLoadJob
+{
+    CoreSampler *pSampler;
+    SampleFileDescriptor *descriptors;
+    std::vector<DunneCore::KeyMappedSampleBuffer*> buffers;
+    std::vector<char> isShared;     // per buffer: its data was already in memory
+    int firstIndex;
+    int preloadFrames;
+};
+
+void CoreSampler::decodeCompressedSampleFileTask(void *context, int taskIndex)
+{
+    CompressedLoadJob *pJob = (CompressedLoadJob*)context;
+    int index = pJob->firstIndex + taskIndex;
+    bool isShared = false;
+    pJob->buffers[index] = pJob->pSampler->decodeCompressedSampleFile(pJob->descriptors[index], pJob->preloadFrames,
+                                                                      &isShared);
+    pJob->isShared[index] = isShared;
+}
+
+int CoreSampler::loadCompressedSampleFiles(SampleFileDescriptor *descriptors, int count, int threadCount)
+{
+    if (count <= 0) return 0;
+    auto startTime = std::chrono::steady_clock::now();
+
+    // decode on a pool of threads (the calling thread included), each claiming the next file in turn
+    if (threadCount <= 0) threadCount = int(std::thread::hardware_concurrency());
+    if (threadCount > count) threadCount = count;
+    CompressedLoadJob job;
+    job.pSampler = this;
+    job.descriptors = descriptors;
+    job.buffers.assign(count, nullptr);
+    job.isShared.assign(count, 0);
+    int streamingFrames = streamingPreloadFrames > 0 ? streamingPreloadFrames : -1;
+    job.preloadFrames = lazyLoading ? std::max(lazyHeadFrames, 0) : streamingFrames;
+    DunneCore::RenderWorkerPool pool;
+    pool.start(threadCount - 1, false);
+    for (job.firstIndex = 0; job.firstIndex < count; job.firstIndex += DunneCore::RenderWorkerPool::maxTaskCount)
+    {
+        int taskCount = std::min(count - job.firstIndex, DunneCore::RenderWorkerPool::maxTaskCount);
+        pool.run(taskCount, decodeCompressedSampleFileTask, &job);
+    }
+    pool.stop();
+
+    // add the buffers in the order given, so the key map does not depend on which thread finished first
+    int loadedCount = 0, sharedCount = 0;
+    double byteCount = 0.0, sharedByteCount = 0.0;
+    for (int i=0; i < count; i++)
+    {
+        DunneCore::KeyMappedSampleBuffer *pBuf = job.buffers[i];
+        if (pBuf == 0) continue;
+        data->sampleBufferList.push_back(pBuf);
+        // let each ring run as far ahead of its voice as the resident head does
+        if (pBuf->isStreaming && !data->streamer) data->createStreamer(std::max(streamingFrames, job.preloadFrames));
+        if (job.isShared[i])
+        {
+            sharedByteCount += double(pBuf->storage->getByteCount());
+            sharedCount++;
+        }
+        else byteCount += double(pBuf->storage->getByteCount());
+        loadedCount++;
+
+        // register a lazily loaded sample's head, so its body can be loaded when wanted
+        if (lazyLoading && pBuf->isStreaming)
+        {
+            std::lock_guard<std::mutex> lock(data->lazyMutex);
+            pBuf->lazyId = ++data->lastLazyId;
+            data->lazySamples[pBuf->lazyId] = { pBuf, descriptors[i].path, descriptors[i].sampleDescriptor,
+                                                streamingFrames };
+        }
+    }
+    if (lazyLoading && !data->lazySamples.empty() && !data->isLazyLoaderRunning.load())
+    {
+        data->isLazyLoaderRunning.store(true);
+        data->lazyLoader = std::thread(&CoreSampler::runLazyLoader, this);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    SampleLoadStatistics &stats = data->loadStatistics;
+    stats.fileCount += loadedCount;
+    stats.megabytes += byteCount / 1.0e6;
+    stats.sharedFileCount += sharedCount;
+    stats.sharedMegabytes += sharedByteCount / 1.0e6;
+    stats.seconds += elapsed.count();
+    double totalMegabytes = stats.megabytes + stats.sharedMegabytes;
+    stats.megabytesPerSecond = stats.seconds > 0.0 ? totalMegabytes / stats.seconds : 0.0;
+    return loadedCount;
+}
+
+SampleLoadStatistics CoreSampler::getLoadStatistics()
+{
+    return data->loadStatistics;
+}
+
+int CoreSampler::getPendingLazySampleCount()
+{
+    std::lock_guard<std::mutex> lock(data->lazyMutex);
+    return int(data->lazySamples.size());
+}
+
+// loader thread: decode the bodies of lazily loaded samples, as the rendering thread asks for them,
+// sleeping until it does (each request signals once, so each wakeup finds a request, or a stop)
+void CoreSampler::runLazyLoader()
+{
+    for (;;)
+    {
+        data->bodyRequested.wait();
+        if (!data->isLazyLoaderRunning.load(std::memory_order_acquire)) break;
+        unsigned lazyId;
+        if (data->bodyRequests.pop(lazyId)) loadLazyBody(lazyId);
+    }
+}
+
+// Decode one lazily loaded sample's body and attach it to the head, unless the head has been removed or
+// replaced meanwhile. A body which fails to load is not retried; the head goes on streaming.
+void CoreSampler::loadLazyBody(unsigned lazyId)
+{
+    SampleFileDescriptor sfd;
+    std::string path;
+    int preloadFrames;
+    {
+        std::lock_guard<std::mutex> lock(data->lazyMutex);
+        auto it = data->lazySamples.find(lazyId);
+        if (it == data->lazySamples.end()) return;
+        path = it->second.path;
+        sfd.sampleDescriptor = it->second.sampleDescriptor;
+        preloadFrames = it->second.preloadFrames;
+    }
+    sfd.path = path.c_str();
+    DunneCore::KeyMappedSampleBuffer *pBody = decodeCompressedSampleFile(sfd, preloadFrames);
+
+    std::lock_guard<std::mutex> lock(data->lazyMutex);
+    auto it = data->lazySamples.find(lazyId);
+    if (it != data->lazySamples.end())
+    {
+        if (pBody) it->second.pHead->body.store(pBody, std::memory_order_release);
+        data->lazySamples.erase(it);
+    }
+    else delete pBody;
+}
+
+int CoreSampler::getPendingResampleCount()
+{
+    std::lock_guard<std::mutex> lock(data->resampleMutex);
+    return int(data->pendingResamples.size()) + (data->pResampling ? 1 : 0);
+}
+
+// Editing thread: queue every loaded sample not yet converted to sampleRate for the resampler thread. Each waits
+// as a copy sharing its data, mapping and points, since the sample itself may be retired (and freed) meanwhile.
+void CoreSampler::startResampler(float sampleRate)
+{
+    data->stopResampler();
+    std::lock_guard<std::mutex> lock(data->resampleMutex);
+    data->resampleRate = sampleRate;
+    for (DunneCore::KeyMappedSampleBuffer *pBuf : data->sampleBufferList)
+    {
+        if (pBuf->isStreaming || pBuf->lazyId != 0 || !pBuf->hasData() ||
+            pBuf->atSampleRate(sampleRate)->sampleRate == sampleRate) continue;
+
+        DunneCore::KeyMappedSampleBuffer *pCopy = new DunneCore::KeyMappedSampleBuffer();
+        pCopy->init(pBuf->storage);
+        pCopy->noteNumber = pBuf->noteNumber;
+        pCopy->minimumNoteNumber = pBuf->minimumNoteNumber;
+        pCopy->maximumNoteNumber = pBuf->maximumNoteNumber;
+        pCopy->minimumVelocity = pBuf->minimumVelocity;
+        pCopy->maximumVelocity = pBuf->maximumVelocity;
+        pCopy->noteFrequency = pBuf->noteFrequency;
+        pCopy->startPoint = pBuf->startPoint;
+        pCopy->endPoint = pBuf->endPoint;
+        pCopy->isLooping = pBuf->isLooping;
+        pCopy->loopStartPoint = pBuf->loopStartPoint;
+        pCopy->loopEndPoint = pBuf->loopEndPoint;
+        data->pendingResamples[pBuf] = pCopy;
+    }
+    if (data->pendingResamples.empty()) return;
+    data->isResamplerRunning.store(true);
+    data->resampler = std::thread(&CoreSampler::runResampler, this);
+}
+
+// resampler thread: convert each waiting copy to resampleRate, in its own storage format and layout, then link it
+// to its sample's resampled list, unless the sample has been removed or replaced meanwhile
+void CoreSampler::runResampler()
+{
+    while (data->isResamplerRunning.load(std::memory_order_acquire))
+    {
+        DunneCore::KeyMappedSampleBuffer *pCopy;
+        float rate;
+        {
+            std::lock_guard<std::mutex> lock(data->resampleMutex);
+            if (data->pendingResamples.empty()) break;
+            auto it = data->pendingResamples.begin();
+            data->pResampling = it->first;
+            pCopy = it->second;
+            rate = data->resampleRate;
+            data->pendingResamples.erase(it);
+        }
+
+        DunneCore::SampleRateConverter converter(pCopy->sampleRate, rate);
+        int count = converter.getOutputLength(pCopy->sampleCount);
+        double ratio = double(rate) / pCopy->sampleRate;
+        DunneCore::SampleBuffer converted;
+        converted.init(rate, pCopy->channelCount, count, -1, pCopy->isInterleaved, pCopy->format);
+        resampleSampleData(converter, *pCopy, converted);
+        if (pCopy->storage->halfRate) addMipLevels(converted.storage);
+
+        float lastPoint = float(count - 1);
+        float startPoint = std::min(float(pCopy->startPoint * ratio), lastPoint);
+        float endPoint = std::min(float(pCopy->endPoint * ratio), lastPoint);
+        float loopStartPoint = std::max(float(pCopy->loopStartPoint * ratio), startPoint);
+        float loopEndPoint = std::min(float(pCopy->loopEndPoint * ratio), endPoint);
+        pCopy->init(converted.storage);
+        pCopy->startPoint = startPoint;
+        pCopy->endPoint = endPoint;
+        pCopy->loopStartPoint = loopStartPoint;
+        pCopy->loopEndPoint = loopEndPoint;
+        pCopy->updateMipLevels();
+
+        std::lock_guard<std::mutex> lock(data->resampleMutex);
+        if (data->pResampling)
+        {
+            DunneCore::KeyMappedSampleBuffer *pLast = data->pResampling;
+            while (DunneCore::KeyMappedSampleBuffer *pNext = pLast->resampled.load(std::memory_order_relaxed)) pLast = pNext;
+            pLast->resampled.store(pCopy, std::memory_order_release);
+        }
+        else delete pCopy;
+        data->pResampling = nullptr;
+    }
+}
+
+int CoreSampler::getSampleCount()
+{
+    return int(data->sampleBufferList.size());
+}
+
+DunneCore::KeyMappedSampleBuffer *CoreSampler::getSample(int index)
+{
+    if (index < 0 || index >= getSampleCount()) return 0;
+    return *std::next(data->sampleBufferList.begin(), index);
+}
+
+DunneCore::KeyMappedSampleBuffer *CoreSampler::addSample(SampleDataDescriptor& sdd)
+{
+    DunneCore::KeyMappedSampleBuffer *pNew = copySampleBuffer(sdd, sdd.sampleCount);
+    return swapSample(0, pNew) ? pNew : 0;
+}
+
+DunneCore::KeyMappedSampleBuffer *CoreSampler::addCompressedSample(SampleFileDescriptor& sfd)
+{
+    // the streamer can't be created while rendering, so stream only if it already exists
+    int preloadFrames = data->streamer && streamingPreloadFrames > 0 ? streamingPreloadFrames : -1;
+    DunneCore::KeyMappedSampleBuffer *pNew = decodeCompressedSampleFile(sfd, preloadFrames);
+    return pNew && swapSample(0, pNew) ? pNew : 0;
+}
+
+DunneCore::KeyMappedSampleBuffer *CoreSampler::replaceSample(DunneCore::KeyMappedSampleBuffer *pOld, SampleDataDescriptor& sdd)
+{
+    if (pOld == 0) return 0;
+    DunneCore::KeyMappedSampleBuffer *pNew = copySampleBuffer(sdd, sdd.sampleCount);
+    return swapSample(pOld, pNew) ? pNew : 0;
+}
+
+DunneCore::KeyMappedSampleBuffer *CoreSampler::replaceCompressedSample(DunneCore::KeyMappedSampleBuffer *pOld,
+                                                                       SampleFileDescriptor& sfd)
+{
+    if (pOld == 0) return 0;
+    int preloadFrames = data->streamer && streamingPreloadFrames > 0 ? streamingPreloadFrames : -1;
+    DunneCore::KeyMappedSampleBuffer *pNew = decodeCompressedSampleFile(sfd, preloadFrames);
+    return pNew && swapSample(pOld, pNew) ? pNew : 0;
+}
+
+bool CoreSampler::removeSample(DunneCore::KeyMappedSampleBuffer *pBuf)
+{
+    return pBuf != 0 && swapSample(pBuf, 0);
+}
+
+// Put pNew in pOld's place in the sample list (at the end, if pOld is null; or remove pOld, if pNew is null),
+// re-map the notes either of them maps to, and retire pOld. Returns false (deleting pNew) if pOld is not in
+// the list.
+bool CoreSampler::swapSample(DunneCore::KeyMappedSampleBuffer *pOld, DunneCore::KeyMappedSampleBuffer *pNew)
+{
+    std::list<DunneCore::KeyMappedSampleBuffer*> &list = data->sampleBufferList;
+    std::vector<DunneCore::KeyMappedSampleBuffer*> &buffers = data->keyMapBuffers;
+    if (pOld)
+    {
+        auto it = std::find(list.begin(), list.end(), pOld);
+        if (it == list.end())
+        {
+            delete pNew;
+            return false;
+        }
+        if (pNew) *it = pNew;
+        else list.erase(it);
+        data->forgetLazySample(pOld);
+        data->forgetResampling(pOld);
+
+        // a removed sample leaves a gap in keyMapBuffers, so other samples keep their indices
+        auto slot = std::find(buffers.begin(), buffers.end(), pOld);
+        if (slot != buffers.end()) *slot = pNew;
+        data->retiredBuffers.push_back(std::make_pair(pOld, data->keyMapGeneration + 1));
+    }
+    else if (pNew)
+    {
+        list.push_back(pNew);
+        buffers.push_back(pNew);
+    }
+    else return false;
+
+    // no key map yet: the change takes effect when it is built
+    if (!isKeyMapValid) return true;
+
+    if (data->isSimpleKeyMap || buffers.size() > NO_SAMPLE)
+    {
+        // nearest-pitch mapping can change anywhere, but rebuilding it is cheap next to loading samples
+        if (data->isSimpleKeyMap) buildSimpleKeyMap();
+        else buildKeyMap();
+    }
+    else
+    {
+        // re-map only the notes either sample maps to, considering samples in list order as buildKeyMap() does
+        for (int nn=0; nn < MIDI_NOTENUMBERS; nn++)
+        {
+            if (!((pOld && data->mapsToNote(pOld, nn)) || (pNew && data->mapsToNote(pNew, nn)))) continue;
+            data->clearKeyMapNote(nn);
+            for (size_t i=0; i < buffers.size(); i++)
+                if (buffers[i] && data->mapsToNote(buffers[i], nn)) data->addToKeyMap(nn, uint16_t(i));
+            data->finishKeyMapNote(nn);
+        }
+        data->publishKeyMap();
+    }
+
+    reclaimRetiredSamples();
+    return true;
+}
+
+int CoreSampler::reclaimRetiredSamples()
+{
+    uint64_t released = data->releasedGeneration.load(std::memory_order_acquire);
+
+    // the rendering thread has moved on from key maps older than the released one
+    std::vector<InternalData::KeyMapCopy*> &maps = data->retiredKeyMaps;
+    for (auto it = maps.begin(); it != maps.end(); )
+    {
+        if ((*it)->generation < released)
+        {
+            delete *it;
+            it = maps.erase(it);
+        }
+        else ++it;
+    }
+
+    // retired buffers are no longer reachable once released, but the streamer may still be opening one
+    bool isStreamerIdle = !data->streamer || data->streamer->isUpToDate();
+    std::vector<std::pair<DunneCore::KeyMappedSampleBuffer*, uint64_t>> &retired = data->retiredBuffers;
+    for (auto it = retired.begin(); it != retired.end(); )
+    {
+        if (it->second <= released && (isStreamerIdle || !it->first->isStreaming))
+        {
+            delete it->first;
+            it = retired.erase(it);
+        }
+        else ++it;
+    }
+    return int(retired.size());
+}
+
+// Open and decode one file into a new sample buffer (not yet in the sample list), or return null on error.
+// If preloadFrames is negative, the whole file is decoded; if positive, only its head, for streaming; if 0,
+// nothing (for a lazily loaded sample with no head). Reads only settings fixed while loading, so several
+// files may be decoded at once. If pShared is given, it is set to whether the data was shared, not decoded.
+DunneCore::KeyMappedSampleBuffer *CoreSampler::decodeCompressedSampleFile(SampleFileDescriptor& sfd, int preloadFrames,
+                                                                          bool *pShared)
+{
+    DunneCore::CompressedSampleFile file;
+    char errMsg[100];
+    if (!file.open(sfd.path, errMsg))
+    {
+        printf("Wavpack error loading %s: %s\n", sfd.path, errMsg);
+        return 0;
+    }
+
+    // when streaming, decode only the head of the file; looped samples keep their whole loop resident
+    int residentCount = file.sampleCount;
+    if (preloadFrames == 0) residentCount = 0;
+    else if (preloadFrames > 0)
+    {
+        SampleDescriptor& sd = sfd.sampleDescriptor;
+        residentCount = preloadFrames;
+        if (sd.startPoint > 0.0f) residentCount += int(sd.startPoint);
+        if (sd.isLooping)
+        {
+            // fractional loop points (<= 1.0) are resolved later; be safe and keep the whole sample
+            if (sd.loopEndPoint <= 1.0f) residentCount = file.sampleCount;
+            else if (int(sd.loopEndPoint) + 2 > residentCount) residentCount = int(sd.loopEndPoint) + 2;
+        }
+        if (residentCount > file.sampleCount) residentCount = file.sampleCount;
+    }
+
+    // decode, unless the same file (or, deduplicating by content, an identical one) is already in memory with
+    // the same settings; heads are pooled by path, so as not to read the whole file
+    int channelCount = file.channelCount;
+    std::string key;
+    if (sharesSamples)
+    {
+        std::string source = fileIdentity(sfd.path);
+        if (deduplicatesContent && residentCount == file.sampleCount)
+        {
+            std::string contentKey = DunneCore::SamplePool::shared().getFileContentKey(sfd.path, source);
+            if (!contentKey.empty()) source = contentKey;
+        }
+        key = samplePoolKey(source, file.sampleRate, channelCount, file.sampleCount, residentCount, storageBitDepth,
+                            interleavedStorage);
+    }
+    DunneCore::KeyMappedSampleBuffer *pBuf = newSharedSampleBuffer(key, sfd.sampleDescriptor, file.sampleRate,
+                                                                   channelCount, file.sampleCount, residentCount,
+                                                                   [&](DunneCore::KeyMappedSampleBuffer *pNew) {
+        if (pNew->format == DunneCore::SampleBuffer::kFloat32 && (channelCount == 1 || pNew->isInterleaved))
+        {
+            // storage has the file's own layout: decode straight into it
+            file.read(pNew->samples, residentCount);
+        }
+        else
+        {
+            // decode a block at a time, then convert and/or de-interleave into storage
+            const int blockFrames = 4096;
+            std::vector<float> block(blockFrames * channelCount);
+            for (int frame = 0; frame < residentCount; )
+            {
+                int frameCount = file.read(block.data(), std::min(blockFrames, residentCount - frame));
+                if (frameCount <= 0) break;
+                pNew->setFrames(frame, frameCount, block.data(), block.data() + 1, channelCount);
+                frame += frameCount;
+            }
+        }
+    }, pShared);
+    file.close();
+
+    if (pBuf->isStreaming) pBuf->streamPath = sfd.path;
+    return pBuf;
 }
 
-int CoreSampler::init(double sampleRate)
+unsigned CoreSampler::getStreamingUnderrunCount()
 {
-    currentSampleRate = (float)sampleRate;
-    data->ampEnvelopeParameters.updateSampleRate((float)(sampleRate/CORESAMPLER_CHUNKSIZE));
-    data->filterEnvelopeParameters.updateSampleRate((float)(sampleRate/CORESAMPLER_CHUNKSIZE));
-    data->pitchEnvelopeParameters.updateSampleRate((float)(sampleRate/CORESAMPLER_CHUNKSIZE));
-    data->vibratoLFO.waveTable.sinusoid();
-    data->vibratoLFO.init(sampleRate/CORESAMPLER_CHUNKSIZE, 5.0f);
-    
-    for (int i=0; i<MAX_POLYPHONY; i++)
-        data->voice[i].init(sampleRate);
-    return 0;   // no error
+    return data->streamer ? data->streamer->getUnderrunCount() : 0;
 }
 
-void CoreSampler::deinit()
+unsigned CoreSampler::getStreamingErrorCount()
 {
+    return data->streamer ? data->streamer->getOpenFailureCount() : 0;
 }
 
-void CoreSampler::unloadAllSamples()
+bool CoreSampler::setStorageBitDepth(int bitDepth)
 {
-    isKeyMapValid = false;
-    for (DunneCore::KeyMappedSampleBuffer *pBuf : data->sampleBufferList)
-        delete pBuf;
-    data->sampleBufferList.clear();
-    for (int i=0; i < MIDI_NOTENUMBERS; i++)
-        data->keyMap[i].clear();
+    if (bitDepth != 16 && bitDepth != 24 && bitDepth != 32) return false;
+    storageBitDepth = bitDepth;
+    return true;
 }
 
-void CoreSampler::loadSampleData(SampleDataDescriptor& sdd)
+// A new sample buffer (not yet in the sample list) with its mapping, pitch and loop points set, and either
+// storage of its own in the current format, for the caller to fill in, or the given shared storage.
+DunneCore::KeyMappedSampleBuffer *CoreSampler::newSampleBuffer(SampleDescriptor sd, float sampleRate, int channelCount,
+                                                               int totalSampleCount, int residentSampleCount,
+                                                               const std::shared_ptr<DunneCore::SampleStorage>& storage)
 {
     DunneCore::KeyMappedSampleBuffer *pBuf = new DunneCore::KeyMappedSampleBuffer();
-    pBuf->minimumNoteNumber = sdd.sampleDescriptor.minimumNoteNumber;
-    pBuf->maximumNoteNumber = sdd.sampleDescriptor.maximumNoteNumber;
-    pBuf->minimumVelocity = sdd.sampleDescriptor.minimumVelocity;
-    pBuf->maximumVelocity = sdd.sampleDescriptor.maximumVelocity;
-    data->sampleBufferList.push_back(pBuf);
-    
-    pBuf->init(sdd.sampleRate, sdd.channelCount, sdd.sampleCount);
-    float *pData = sdd.data;
-    if (sdd.isInterleaved) for (int i=0; i < sdd.sampleCount; i++)
-    {
-        pBuf->setData(i, *pData++);
-        if (sdd.channelCount > 1) pBuf->setData(sdd.sampleCount + i, *pData++);
-    }
-    else for (int i=0; i < sdd.channelCount * sdd.sampleCount; i++)
-    {
-        pBuf->setData(i, *pData++);
-    }
-    pBuf->noteNumber = sdd.sampleDescriptor.noteNumber;
-    pBuf->noteFrequency = sdd.sampleDescriptor.noteFrequency;
+    pBuf->minimumNoteNumber = sd.minimumNoteNumber;
+    pBuf->maximumNoteNumber = sd.maximumNoteNumber;
+    pBuf->minimumVelocity = sd.minimumVelocity;
+    pBuf->maximumVelocity = sd.maximumVelocity;
+
+    DunneCore::SampleBuffer::SampleFormat format = DunneCore::SampleBuffer::kFloat32;
+    if (storageBitDepth == 16) format = DunneCore::SampleBuffer::kInt16;
+    else if (storageBitDepth == 24) format = DunneCore::SampleBuffer::kInt24;
+    if (storage) pBuf->init(storage);
+    else pBuf->init(sampleRate, channelCount, totalSampleCount, residentSampleCount, interleavedStorage, format);
+    pBuf->noteNumber = sd.noteNumber;
+    pBuf->noteFrequency = sd.noteFrequency;
     
     // Handle rare case where loopEndPoint is 0 (due to being uninitialized)
-    if (sdd.sampleDescriptor.loopEndPoint == 0.0f)
-        sdd.sampleDescriptor.loopEndPoint = float(sdd.sampleCount - 1);
+    if (sd.loopEndPoint == 0.0f)
+        sd.loopEndPoint = float(totalSampleCount - 1);
 
-    if (sdd.sampleDescriptor.startPoint > 0.0f) pBuf->startPoint = sdd.sampleDescriptor.startPoint;
-    if (sdd.sampleDescriptor.endPoint > 0.0f)   pBuf->endPoint = sdd.sampleDescriptor.endPoint;
+    if (sd.startPoint > 0.0f) pBuf->startPoint = sd.startPoint;
+    if (sd.endPoint > 0.0f)   pBuf->endPoint = sd.endPoint;
     
-    pBuf->isLooping = sdd.sampleDescriptor.isLooping;
+    pBuf->isLooping = sd.isLooping;
     if (pBuf->isLooping)
     {
         // loopStartPoint, loopEndPoint are usually sample indices, but values 0.0-1.0
         // are interpreted as fractions of the total sample length.
-        if (sdd.sampleDescriptor.loopStartPoint > 1.0f) pBuf->loopStartPoint = sdd.sampleDescriptor.loopStartPoint;
-        else pBuf->loopStartPoint = pBuf->endPoint * sdd.sampleDescriptor.loopStartPoint;
-        if (sdd.sampleDescriptor.loopEndPoint > 1.0f) pBuf->loopEndPoint = sdd.sampleDescriptor.loopEndPoint;
-        else pBuf->loopEndPoint = pBuf->endPoint * sdd.sampleDescriptor.loopEndPoint;
+        if (sd.loopStartPoint > 1.0f) pBuf->loopStartPoint = sd.loopStartPoint;
+        else pBuf->loopStartPoint = pBuf->endPoint * sd.loopStartPoint;
+        if (sd.loopEndPoint > 1.0f) pBuf->loopEndPoint = sd.loopEndPoint;
+        else pBuf->loopEndPoint = pBuf->endPoint * sd.loopEndPoint;
 
         // Clamp loop endpoints to valid range
         if (pBuf->loopStartPoint < pBuf->startPoint) pBuf->loopStartPoint = pBuf->startPoint;
         if (pBuf->loopEndPoint > pBuf->endPoint) pBuf->loopEndPoint = pBuf->endPoint;
     }
+    pBuf->updateMipLevels();
+    return pBuf;
 }
 
-DunneCore::KeyMappedSampleBuffer *CoreSampler::lookupSample(unsigned noteNumber, unsigned velocity)
+DunneCore::KeyMappedSampleBuffer *CoreSampler::addSampleBuffer(SampleDataDescriptor& sdd, int totalSampleCount)
 {
-    // common case: only one sample mapped to this note - return it immediately
-    if (data->keyMap[noteNumber].size() == 1)
-        return data->keyMap[noteNumber].front();
-    
-    // search samples mapped to this note for best choice based on velocity
-    for (DunneCore::KeyMappedSampleBuffer *pBuf : data->keyMap[noteNumber])
+    DunneCore::KeyMappedSampleBuffer *pBuf = copySampleBuffer(sdd, totalSampleCount);
+    data->sampleBufferList.push_back(pBuf);
+    return pBuf;
+}
+
+void CoreSampler::setPreResampling(bool resample, double expectedSampleRate)
+{
+    preResampling = resample;
+
+    // before init(), the rate samples convert to as they load; init() converts them again if it differs
+    if (resample && !hasSampleRate && expectedSampleRate > 0.0) currentSampleRate = (float)expectedSampleRate;
+}
+
+// whether a sample at the given rate and length is converted to the engine's rate as it loads
+bool CoreSampler::resamplesOnLoad(float sampleRate, int totalSampleCount, int residentSampleCount)
+{
+    return preResampling && sampleRate > 0.0f && sampleRate != currentSampleRate &&
+           totalSampleCount > 0 && residentSampleCount == totalSampleCount;
+}
+
+// whether a sample of the given length gets mip levels as it loads
+bool CoreSampler::mipMapsOnLoad(int totalSampleCount, int residentSampleCount)
+{
+    return mipMapping && totalSampleCount > 0 && residentSampleCount == totalSampleCount;
+}
+
+// the SamplePool key under which the data pooled as key is stored as this sampler would load it: converted to the
+// engine's rate, and with mip levels, if need be
+std::string CoreSampler::storedPoolKey(const std::string& key, float sampleRate, int totalSampleCount,
+                                       int residentSampleCount)
+{
+    std::string storedKey = key;
+    if (resamplesOnLoad(sampleRate, totalSampleCount, residentSampleCount))
+        storedKey = resampledPoolKey(key, currentSampleRate);
+    if (mipMapsOnLoad(totalSampleCount, residentSampleCount)) storedKey += "|mip";
+    return storedKey;
+}
+
+// As newSampleBuffer(), but if key is not empty and sharing is enabled, the storage is shared through the
+// SamplePool: fill(pBuf) stores the data only if no other buffer holds it already. A sample to be converted to
+// the engine's rate (see setPreResampling()) is filled into a temporary float buffer, then converted into
+// storage; either way, mip levels are added (see setMipMapping()) before the storage is pooled, under its own key
+// if it differs from the source. If pShared is given, it is set to whether the storage was already pooled.
+DunneCore::KeyMappedSampleBuffer *CoreSampler::newSharedSampleBuffer(const std::string& key, SampleDescriptor& sd,
+                                                                     float sampleRate, int channelCount,
+                                                                     int totalSampleCount, int residentSampleCount,
+                                                                     const std::function<void(DunneCore::KeyMappedSampleBuffer*)>& fill,
+                                                                     bool *pShared)
+{
+    DunneCore::KeyMappedSampleBuffer *pBuf = 0;
+    if (pShared) *pShared = false;
+    if (resamplesOnLoad(sampleRate, totalSampleCount, residentSampleCount))
+    {
+        DunneCore::SampleRateConverter converter(sampleRate, currentSampleRate);
+        int convertedCount = converter.getOutputLength(totalSampleCount);
+        SampleDescriptor convertedSd = resampledDescriptor(sd, double(currentSampleRate) / sampleRate);
+        auto load = [&]() {
+            DunneCore::KeyMappedSampleBuffer source;
+            source.init(sampleRate, channelCount, totalSampleCount, -1, interleavedStorage);
+            fill(&source);
+            pBuf = newSampleBuffer(convertedSd, currentSampleRate, channelCount, convertedCount, convertedCount);
+            resampleSampleData(converter, source, *pBuf);
+            if (mipMapsOnLoad(convertedCount, convertedCount))
+            {
+                addMipLevels(pBuf->storage);
+                pBuf->updateMipLevels();
+            }
+            return pBuf->storage;
+        };
+        if (key.empty() || !sharesSamples)
+        {
+            load();
+            return pBuf;
+        }
+
+        std::string storedKey = storedPoolKey(key, sampleRate, totalSampleCount, residentSampleCount);
+        std::shared_ptr<DunneCore::SampleStorage> storage = DunneCore::SamplePool::shared().obtain(storedKey, load);
+        if (pBuf == 0)
+        {
+            pBuf = newSampleBuffer(convertedSd, currentSampleRate, channelCount, convertedCount, convertedCount, storage);
+            if (pShared) *pShared = true;
+        }
+        return pBuf;
+    }
+
+    auto load = [&]() {
+        pBuf = newSampleBuffer(sd, sampleRate, channelCount, totalSampleCount, residentSampleCount);
+        fill(pBuf);
+        if (mipMapsOnLoad(totalSampleCount, residentSampleCount))
+        {
+            addMipLevels(pBuf->storage);
+            pBuf->updateMipLevels();
+        }
+        return pBuf->storage;
+    };
+    if (key.empty() || !sharesSamples)
     {
-        // if sample does not have velocity range, accept it trivially
-        if (pBuf->minimumVelocity < 0 || pBuf->maximumVelocity < 0) return pBuf;
-        
-        // otherwise (common case), accept based on velocity
-        if ((int)velocity >= pBuf->minimumVelocity && (int)velocity <= pBuf->maximumVelocity) return pBuf;
+        load();
+        return pBuf;
     }
-    
+
+    std::string storedKey = storedPoolKey(key, sampleRate, totalSampleCount, residentSampleCount);
+    std::shared_ptr<DunneCore::SampleStorage> storage = DunneCore::SamplePool::shared().obtain(storedKey, load);
+    if (pBuf == 0)
+    {
+        pBuf = newSampleBuffer(sd, sampleRate, channelCount, totalSampleCount, residentSampleCount, storage);
+        if (pShared) *pShared = true;
+    }
+    return pBuf;
+}
+
+// a new sample buffer (not yet in the sample list) holding a copy of the given sample data
+DunneCore::KeyMappedSampleBuffer *CoreSampler::copySampleBuffer(SampleDataDescriptor& sdd, int totalSampleCount)
+{
+    return newSharedSampleBuffer(std::string(), sdd.sampleDescriptor, sdd.sampleRate, sdd.channelCount,
+                                 totalSampleCount, sdd.sampleCount, [&sdd](DunneCore::KeyMappedSampleBuffer *pNew) {
+        copySampleData(pNew, sdd);
+    });
+}
+
+void CoreSampler::copySampleData(DunneCore::KeyMappedSampleBuffer *pBuf, SampleDataDescriptor& sdd)
+{
+    // interleaved data holds channelCount samples per frame; planar data holds one channel after another
+    if (sdd.isInterleaved) pBuf->setFrames(0, sdd.sampleCount, sdd.data, sdd.data + 1, sdd.channelCount);
+    else pBuf->setFrames(0, sdd.sampleCount, sdd.data, sdd.data + sdd.sampleCount, 1);
+}
+
+DunneCore::KeyMappedSampleBuffer *CoreSampler::lookupSample(unsigned noteNumber, unsigned velocity)
+{
+    if (noteNumber >= MIDI_NOTENUMBERS) return 0;
+    if (velocity >= MIDI_VELOCITIES) velocity = MIDI_VELOCITIES - 1;
+
     // return nil if no samples mapped to note (or sample velocities are invalid)
+    DunneCore::KeyMappedSampleBuffer *pBuf = data->mappedSample(noteNumber, velocity);
+    if (pBuf && pBuf->lazyId) pBuf = lazySampleToPlay(noteNumber, velocity, pBuf);
+
+    // the copy converted to the current rate, if there is one (see setPreResampling())
+    return pBuf ? pBuf->atSampleRate(currentSampleRate) : 0;
+}
+
+// For a lazily loaded sample: its body, if loaded. Otherwise ask for it (and for the samples of neighbouring
+// notes and velocity layers), and meanwhile play its head, or if it has none, the nearest velocity layer of
+// the same note which can play.
+DunneCore::KeyMappedSampleBuffer *CoreSampler::lazySampleToPlay(unsigned noteNumber, unsigned velocity,
+                                                                DunneCore::KeyMappedSampleBuffer *pBuf)
+{
+    DunneCore::KeyMappedSampleBuffer *pBody = pBuf->body.load(std::memory_order_acquire);
+    if (pBody) return pBody;
+
+    int nn = int(noteNumber), vel = int(velocity);
+    data->requestBody(pBuf);
+    for (int d=1; d <= LAZY_PREFETCH_NOTES; d++)
+    {
+        data->requestBody(data->mappedSample(nn - d, vel));
+        data->requestBody(data->mappedSample(nn + d, vel));
+    }
+    if (pBuf->minimumVelocity >= 0 && pBuf->maximumVelocity >= 0)
+    {
+        data->requestBody(data->mappedSample(nn, pBuf->minimumVelocity - 1));
+        data->requestBody(data->mappedSample(nn, pBuf->maximumVelocity + 1));
+    }
+    if (pBuf->residentSampleCount > 0) return pBuf;
+
+    for (int d=1; d < MIDI_VELOCITIES; d++)
+    {
+        for (int v : { vel - d, vel + d })
+        {
+            DunneCore::KeyMappedSampleBuffer *pOther = data->mappedSample(nn, v);
+            if (pOther == 0 || pOther == pBuf) continue;
+            if (pOther->lazyId == 0) return pOther;
+            if ((pBody = pOther->body.load(std::memory_order_acquire)) != 0) return pBody;
+            if (pOther->residentSampleCount > 0) return pOther;
+        }
+    }
     return 0;
 }
 
@@ -189,34 +1461,45 @@ void CoreSampler::buildSimpleKeyMap()
 {
     // clear out the old mapping entirely
     isKeyMapValid = false;
-    for (int i=0; i < MIDI_NOTENUMBERS; i++)
-        data->keyMap[i].clear();
-    
+    data->clearKeyMap();
+
+    // sort samples by pitch, so each note need only look at its nearest neighbors
+    std::vector<DunneCore::KeyMappedSampleBuffer*>& buffers = data->keyMapBuffers;
+    int bufferCount = int(std::min(buffers.size(), size_t(NO_SAMPLE)));
+    data->loadStatistics.unmappedSampleCount = int(buffers.size()) - bufferCount;
+    std::vector<std::pair<float, uint16_t>> samplesByPitch;
+    for (int i=0; i < bufferCount; i++)
+        samplesByPitch.push_back(std::make_pair(equalTemperedHz(buffers[i]->noteNumber), uint16_t(i)));
+    std::sort(samplesByPitch.begin(), samplesByPitch.end());
+    data->isSimpleKeyMap = true;
+    if (samplesByPitch.empty())
+    {
+        data->publishKeyMap();
+        return;
+    }
+
+    std::vector<uint16_t> closest;
     for (int nn=0; nn < MIDI_NOTENUMBERS; nn++)
     {
         float noteFreq = data->tuningTable[nn];
-        
-        // scan loaded samples to find the minimum distance to note nn
+
+        // find the minimum distance to note nn, from the samples just below and above it
+        auto above = std::lower_bound(samplesByPitch.begin(), samplesByPitch.end(), std::make_pair(noteFreq, uint16_t(0)));
         float minDistance = 1000000.0f;
-        for (DunneCore::KeyMappedSampleBuffer *pBuf : data->sampleBufferList)
-        {
-            float distance = fabsf(NOTE_HZ(pBuf->noteNumber) - noteFreq);
-            if (distance < minDistance)
-            {
-                minDistance = distance;
-            }
-        }
-        
-        // scan again to add only samples at this distance to the list for note nn
-        for (DunneCore::KeyMappedSampleBuffer *pBuf : data->sampleBufferList)
-        {
-            float distance = fabsf(NOTE_HZ(pBuf->noteNumber) - noteFreq);
-            if (distance == minDistance)
-            {
-                data->keyMap[nn].push_back(pBuf);
-            }
-        }
+        if (above != samplesByPitch.end()) minDistance = std::min(minDistance, fabsf(above->first - noteFreq));
+        if (above != samplesByPitch.begin()) minDistance = std::min(minDistance, fabsf((above - 1)->first - noteFreq));
+
+        // collect all samples at exactly this distance, and map them in load order
+        closest.clear();
+        for (auto it = above; it != samplesByPitch.end() && fabsf(it->first - noteFreq) == minDistance; ++it)
+            closest.push_back(it->second);
+        for (auto it = above; it != samplesByPitch.begin() && fabsf((it - 1)->first - noteFreq) == minDistance; --it)
+            closest.push_back((it - 1)->second);
+        std::sort(closest.begin(), closest.end());
+        for (uint16_t index : closest) data->addToKeyMap(nn, index);
     }
+    data->finishKeyMap();
+    data->publishKeyMap();
     isKeyMapValid = true;
 }
 
@@ -225,47 +1508,204 @@ void CoreSampler::buildKeyMap(void)
 {
     // clear out the old mapping entirely
     isKeyMapValid = false;
-    for (int i=0; i < MIDI_NOTENUMBERS; i++) data->keyMap[i].clear();
-    
-    for (int nn=0; nn < MIDI_NOTENUMBERS; nn++)
+    data->clearKeyMap();
+
+    // sort notes by frequency, so each sample's note range becomes one contiguous run
+    uint8_t notesByPitch[MIDI_NOTENUMBERS];
+    float sortedHz[MIDI_NOTENUMBERS];
+    for (int nn=0; nn < MIDI_NOTENUMBERS; nn++) notesByPitch[nn] = uint8_t(nn);
+    std::stable_sort(notesByPitch, notesByPitch + MIDI_NOTENUMBERS, [this](uint8_t a, uint8_t b) {
+        return data->tuningTable[a] < data->tuningTable[b];
+    });
+    for (int i=0; i < MIDI_NOTENUMBERS; i++) sortedHz[i] = data->tuningTable[notesByPitch[i]];
+
+    int bufferCount = int(std::min(data->keyMapBuffers.size(), size_t(NO_SAMPLE)));
+    data->loadStatistics.unmappedSampleCount = int(data->keyMapBuffers.size()) - bufferCount;
+    for (int i=0; i < bufferCount; i++)
     {
-        float noteFreq = data->tuningTable[nn];
-        for (DunneCore::KeyMappedSampleBuffer *pBuf : data->sampleBufferList)
-        {
-            float minFreq = NOTE_HZ(pBuf->minimumNoteNumber);
-            float maxFreq = NOTE_HZ(pBuf->maximumNoteNumber);
-            if (noteFreq >= minFreq && noteFreq <= maxFreq)
-                data->keyMap[nn].push_back(pBuf);
-        }
+        DunneCore::KeyMappedSampleBuffer *pBuf = data->keyMapBuffers[i];
+        float minFreq = equalTemperedHz(pBuf->minimumNoteNumber);
+        float maxFreq = equalTemperedHz(pBuf->maximumNoteNumber);
+        int first = int(std::lower_bound(sortedHz, sortedHz + MIDI_NOTENUMBERS, minFreq) - sortedHz);
+        int last = int(std::upper_bound(sortedHz, sortedHz + MIDI_NOTENUMBERS, maxFreq) - sortedHz);
+        for (int k = first; k < last; k++)
+            data->addToKeyMap(notesByPitch[k], uint16_t(i));
     }
+    data->finishKeyMap();
+    data->isSimpleKeyMap = false;
+    data->publishKeyMap();
     isKeyMapValid = true;
 }
 
 DunneCore::SamplerVoice *CoreSampler::voicePlayingNote(unsigned noteNumber)
 {
-    for (int i=0; i < MAX_POLYPHONY; i++)
+    if (noteNumber >= MIDI_NOTENUMBERS) return 0;
+    int index = data->noteVoiceIndex[noteNumber];
+    if (index < 0) return 0;
+    DunneCore::SamplerVoice *pVoice = &data->voice[index];
+    return (pVoice->noteNumber == (int)noteNumber) ? pVoice : 0;
+}
+
+DunneCore::SamplerVoice *CoreSampler::voiceToSteal()
+{
+    unsigned greatestDiffOfAll = 0;
+    DunneCore::SamplerVoice *pStalestVoiceOfAll = 0;
+    unsigned greatestDiffInRelease = 0;
+    DunneCore::SamplerVoice *pStalestVoiceInRelease = 0;
+    float lowestLevel = 0.0f;
+    DunneCore::SamplerVoice *pQuietestVoice = 0;
+    for (int k=0; k < data->activeVoices.count(); k++)
     {
-        DunneCore::SamplerVoice *pVoice = &data->voice[i];
-        if (pVoice->noteNumber == noteNumber) return pVoice;
+        DunneCore::SamplerVoice *pVoice = &data->voice[data->activeVoices[k]];
+        unsigned diff = eventCounter - pVoice->event;
+        if (pStalestVoiceOfAll == 0 || diff > greatestDiffOfAll)
+        {
+            greatestDiffOfAll = diff;
+            pStalestVoiceOfAll = pVoice;
+        }
+
+        // voices already being damped to make way for another note are only stolen as a last resort
+        if (pVoice->ampEnvelope.isPreStarting()) continue;
+
+        if (pVoice->ampEnvelope.isReleasing() && (pStalestVoiceInRelease == 0 || diff > greatestDiffInRelease))
+        {
+            greatestDiffInRelease = diff;
+            pStalestVoiceInRelease = pVoice;
+        }
+        float level = pVoice->noteVolume * pVoice->ampEnvelope.getValue();
+        if (pQuietestVoice == 0 || level < lowestLevel)
+        {
+            lowestLevel = level;
+            pQuietestVoice = pVoice;
+        }
     }
-    return 0;
+
+    switch (voiceStealingPolicy)
+    {
+        case kStealOldest:
+            return pStalestVoiceOfAll;
+        case kStealQuietest:
+            return pQuietestVoice ? pQuietestVoice : pStalestVoiceOfAll;
+        case kStealReleasedFirst:
+        default:
+            return pStalestVoiceInRelease ? pStalestVoiceInRelease : pStalestVoiceOfAll;
+    }
+}
+
+bool CoreSampler::playNote(unsigned noteNumber, unsigned velocity, int64_t sampleTime)
+{
+    DunneCore::EngineCommand command = DunneCore::EngineCommand::noteOn(noteNumber, velocity);
+    command.sampleTime = sampleTime;
+    return data->commandQueue.push(command);
+}
+
+bool CoreSampler::stopNote(unsigned noteNumber, bool immediate, int64_t sampleTime)
+{
+    DunneCore::EngineCommand command = DunneCore::EngineCommand::noteOff(noteNumber, immediate);
+    command.sampleTime = sampleTime;
+    return data->commandQueue.push(command);
+}
+
+bool CoreSampler::sustainPedal(bool down, int64_t sampleTime)
+{
+    DunneCore::EngineCommand command = DunneCore::EngineCommand::sustainPedal(down);
+    command.sampleTime = sampleTime;
+    return data->commandQueue.push(command);
+}
+
+void CoreSampler::processCommands()
+{
+    data->updateRenderKeyMap();
+
+    // Sort everything posted into the pending list, by when it falls due, so a command posted for later
+    // holds back none due sooner. Times already past count as now, keeping due commands in posting order.
+    int64_t now = data->sampleTime.load(std::memory_order_relaxed);
+    DunneCore::EngineCommand *pCommand;
+    while (!data->pendingCommands.isFull() && (pCommand = data->commandQueue.front()) != 0)
+    {
+        DunneCore::EngineCommand command = *pCommand;
+        data->commandQueue.pop();
+        if (command.sampleTime < now) command.sampleTime = now;
+        data->pendingCommands.insert(command);
+    }
+
+    while (!data->pendingCommands.isEmpty() && data->pendingCommands.front().sampleTime <= now)
+    {
+        applyCommand(data->pendingCommands.front());
+        data->pendingCommands.pop();
+    }
+
+    if (data->commandQueue.front() == 0 && data->isRestartPending.load(std::memory_order_relaxed))
+    {
+        data->isRestartPending.store(false, std::memory_order_relaxed);
+        stoppingAllVoices = false;
+    }
+}
+
+void CoreSampler::applyCommand(const DunneCore::EngineCommand &command)
+{
+    switch (command.type)
+    {
+        case DunneCore::EngineCommand::kNoteOn:
+            handleNoteOn(command.noteNumber, command.velocity);
+            break;
+        case DunneCore::EngineCommand::kNoteOff:
+            handleNoteOff(command.noteNumber, command.immediate);
+            break;
+        case DunneCore::EngineCommand::kSustainPedal:
+            handleSustainPedal(command.immediate);
+            break;
+        case DunneCore::EngineCommand::kStopAllVoices:
+            stoppingAllVoices = true;
+            stopVoices();
+            if (command.callback) command.callback(command.context);
+
+            // a later request stopped everything an earlier one wanted stopped, too
+            if (command.epoch > data->stoppedEpoch.load(std::memory_order_relaxed))
+                data->stoppedEpoch.store(command.epoch, std::memory_order_release);
+            break;
+        case DunneCore::EngineCommand::kRestartVoices:
+            stoppingAllVoices = false;
+            break;
+        default:
+            break;
+    }
+}
+
+// how many of the next sampleCount samples may be rendered before a posted event falls due
+unsigned CoreSampler::samplesUntilNextCommand(unsigned sampleCount)
+{
+    // 0 if anything has been posted since processCommands() looked, as it may already be due
+    if (data->commandQueue.front() != 0 && !data->pendingCommands.isFull()) return 0;
+    if (data->pendingCommands.isEmpty()) return sampleCount;
+    int64_t wait = data->pendingCommands.front().sampleTime - data->sampleTime.load(std::memory_order_relaxed);
+    if (wait <= 0) return 0;
+    return wait < int64_t(sampleCount) ? unsigned(wait) : sampleCount;
+}
+
+int64_t CoreSampler::getSampleTime()
+{
+    return data->sampleTime.load(std::memory_order_relaxed);
 }
 
-void CoreSampler::playNote(unsigned noteNumber, unsigned velocity)
+void CoreSampler::handleNoteOn(unsigned noteNumber, unsigned velocity)
 {
+    eventCounter++;
     bool anotherKeyWasDown = data->pedalLogic.isAnyKeyDown();
     data->pedalLogic.keyDownAction(noteNumber);
     play(noteNumber, velocity, anotherKeyWasDown);
 }
 
-void CoreSampler::stopNote(unsigned noteNumber, bool immediate)
+void CoreSampler::handleNoteOff(unsigned noteNumber, bool immediate)
 {
+    eventCounter++;
     if (immediate || data->pedalLogic.keyUpAction(noteNumber))
         stop(noteNumber, immediate);
 }
 
-void CoreSampler::sustainPedal(bool down)
+void CoreSampler::handleSustainPedal(bool down)
 {
+    eventCounter++;
     if (down) data->pedalLogic.pedalDown();
     else {
         for (int nn=0; nn < MIDI_NOTENUMBERS; nn++)
@@ -284,7 +1724,7 @@ void CoreSampler::play(unsigned noteNumber, unsigned velocity, bool anotherKeyWa
     float noteFrequency = data->tuningTable[noteNumber];
     
     // sanity check: ensure we are initialized with at least one buffer
-    if (!isKeyMapValid || data->sampleBufferList.size() == 0) return;
+    if (data->renderKeyMap == 0 || data->renderKeyMap->buffers.empty()) return;
     
     if (isMonophonic)
     {
@@ -302,6 +1742,8 @@ void CoreSampler::play(unsigned noteNumber, unsigned velocity, bool anotherKeyWa
                 if (pBuf == 0) return;  // don't crash if someone forgets to build map
                 pVoice->start(noteNumber, currentSampleRate, noteFrequency, velocity / 127.0f, pBuf);
             }
+            pVoice->event = eventCounter;
+            data->updateVoiceState(pVoice);
             lastPlayedNoteNumber = noteNumber;
             return;
         }
@@ -315,6 +1757,8 @@ void CoreSampler::play(unsigned noteNumber, unsigned velocity, bool anotherKeyWa
                 pVoice->restartNewNote(noteNumber, currentSampleRate, noteFrequency, velocity / 127.0f, pBuf);
             else
                 pVoice->start(noteNumber, currentSampleRate, noteFrequency, velocity / 127.0f, pBuf);
+            pVoice->event = eventCounter;
+            data->updateVoiceState(pVoice);
             lastPlayedNoteNumber = noteNumber;
             return;
         }
@@ -330,24 +1774,30 @@ void CoreSampler::play(unsigned noteNumber, unsigned velocity, bool anotherKeyWa
             if (pBuf == 0) return; // don't crash if someone forgets to build map
             // re-start the note
             pVoice->restartSameNote(velocity / 127.0f, pBuf);
+            pVoice->event = eventCounter;
             return;
         }
-        
-        // find a free voice (with noteNumber < 0) to play the note
-        int polyphony = isMonophonic ? 1 : MAX_POLYPHONY;
-        for (int i = 0; i < polyphony; i++)
+
+        DunneCore::KeyMappedSampleBuffer *pBuf = lookupSample(noteNumber, velocity);
+        if (pBuf == 0) return;  // don't crash if someone forgets to build map
+
+        // find a free voice (with noteNumber < 0) to play the note, unless the CPU governor forbids more voices
+        int voiceIndex = data->activeVoices.count() < data->voiceLimit ? data->firstFreeVoice() : -1;
+        if (voiceIndex >= 0)
         {
-            DunneCore::SamplerVoice *pVoice = &data->voice[i];
-            if (pVoice->noteNumber < 0)
-            {
-                // found a free voice: assign it to play this note
-                DunneCore::KeyMappedSampleBuffer *pBuf = lookupSample(noteNumber, velocity);
-                if (pBuf == 0) return;  // don't crash if someone forgets to build map
-                pVoice->start(noteNumber, currentSampleRate, noteFrequency, velocity / 127.0f, pBuf);
-                lastPlayedNoteNumber = noteNumber;
-                return;
-            }
+            // found a free voice: assign it to play this note
+            pVoice = &data->voice[voiceIndex];
+            pVoice->start(noteNumber, currentSampleRate, noteFrequency, velocity / 127.0f, pBuf);
+        }
+        else
+        {
+            // all voices (or all we are allowed) in use: steal one, which is damped quickly before restarting with this note
+            pVoice = voiceToSteal();
+            pVoice->restartNewNote(noteNumber, currentSampleRate, noteFrequency, velocity / 127.0f, pBuf);
         }
+        pVoice->event = eventCounter;
+        data->updateVoiceState(pVoice);
+        lastPlayedNoteNumber = noteNumber;
     }
 }
 
@@ -380,62 +1830,265 @@ void CoreSampler::stop(unsigned noteNumber, bool immediate)
     {
         pVoice->release(loopThruRelease);
     }
+    pVoice->event = eventCounter;
+    data->updateVoiceState(pVoice);
+}
+
+uint64_t CoreSampler::stopAllVoices(void (*onStopped)(void *context), void *context)
+{
+    uint64_t epoch = data->requestedStopEpoch.fetch_add(1) + 1;
+    if (!data->commandQueue.push(DunneCore::EngineCommand::stopAllVoices(epoch, onStopped, context))) return 0;
+    return epoch;
+}
+
+void CoreSampler::restartVoices()
+{
+    // a full queue must not leave voices stopped for good
+    if (!data->commandQueue.push(DunneCore::EngineCommand::restartVoices()))
+        data->isRestartPending.store(true, std::memory_order_relaxed);
+}
+
+bool CoreSampler::waitForStop(uint64_t epoch, double timeoutSeconds)
+{
+    // poll, rather than have the rendering thread notify a condition variable, which may take a lock
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeoutSeconds);
+    while (data->stoppedEpoch.load(std::memory_order_acquire) < epoch && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return data->stoppedEpoch.load(std::memory_order_acquire) >= epoch;
 }
 
-void CoreSampler::stopAllVoices()
+void CoreSampler::stopAllVoicesNow()
 {
-    // Lock out starting any new notes, and tell Render() to stop all active notes
+    processCommands();
     stoppingAllVoices = true;
-    
-    // Wait until Render() has killed all active notes
-    bool noteStillSounding = true;
-    while (noteStillSounding)
+    stopVoices();
+}
+
+// silence every active voice at once
+void CoreSampler::stopVoices()
+{
+    while (data->activeVoices.count() > 0)
     {
-        noteStillSounding = false;
-        for (int i=0; i < MAX_POLYPHONY; i++)
-            if (data->voice[i].noteNumber >= 0) noteStillSounding = true;
+        DunneCore::SamplerVoice *pVoice = &data->voice[data->activeVoices[0]];
+        pVoice->stop();
+        pVoice->event = ++eventCounter;
+        data->updateVoiceState(pVoice);
     }
 }
 
-void CoreSampler::restartVoices()
+void CoreSampler::render(unsigned channelCount, unsigned sampleCount, float *outBuffers[])
 {
-    // Allow starting new notes again
-    stoppingAllVoices = false;
+    render(channelCount, sampleCount, outBuffers, 0, 0);
 }
 
-void CoreSampler::render(unsigned channelCount, unsigned sampleCount, float *outBuffers[])
+void CoreSampler::render(unsigned channelCount, unsigned sampleCount, float *outBuffers[],
+                         const DunneCore::EngineCommand *events, int eventCount)
+{
+    // Render the block in spans which end wherever an event is due, so each is applied at its exact
+    // sample, and at the end of each chunk, where envelopes and LFOs step (see renderSpan()). The governor
+    // times the whole block, however many spans it takes.
+    data->governor.beginRender();
+    unsigned done = 0;
+    for (;;)
+    {
+        processCommands();
+        for (; eventCount > 0 && (events->sampleTime <= int64_t(done) || done == sampleCount); events++, eventCount--)
+            applyCommand(*events);
+        if (done == sampleCount) break;
+
+        unsigned count = samplesUntilNextCommand(sampleCount - done);
+        if (eventCount > 0 && events->sampleTime - int64_t(done) < int64_t(count))
+            count = unsigned(events->sampleTime - int64_t(done));
+        if (count == 0) continue;   // a posted command fell due meanwhile: apply it before rendering more
+        count = std::min(count, CORESAMPLER_CHUNKSIZE - data->chunkPhase);
+        renderSpan(count, outBuffers[0] + done, outBuffers[1] + done);
+        done += count;
+    }
+    data->governor.endRender(sampleCount);
+}
+
+// Render a span which lies within one chunk. Envelopes and LFOs step, and voices take up parameter
+// changes, only at the start of each chunk, so their timing doesn't depend on how the output is split;
+// a voice (re)started part way through a chunk is set up for the rest of it.
+void CoreSampler::renderSpan(unsigned sampleCount, float *pOutLeft, float *pOutRight)
 {
-    float *pOutLeft = outBuffers[0];
-    float *pOutRight = outBuffers[1];
-    data->vibratoLFO.setFrequency(vibratoFrequency);
-    float pitchDev = this->pitchOffset + vibratoDepth * data->vibratoLFO.getSample();
+    bool atChunkStart = data->chunkPhase == 0;
+    unsigned chunkRemaining = CORESAMPLER_CHUNKSIZE - data->chunkPhase;
+    data->chunkPhase = (data->chunkPhase + sampleCount) % CORESAMPLER_CHUNKSIZE;
+
+    int qualityLevel = data->governor.getLevel();
+    if (qualityLevel != data->appliedQualityLevel) applyQualityLevel(qualityLevel);
+    data->voiceInterpolationMode = std::max(0, interpolationMode - std::min(qualityLevel, 2));
+
+    if (atChunkStart)
+    {
+        data->vibratoLFO.setFrequency(vibratoFrequency);
+        data->vibratoSample = data->vibratoLFO.getSample();
+    }
+    float pitchDev = this->pitchOffset + vibratoDepth * data->vibratoSample;
     float cutoffMul = isFilterEnabled ? cutoffMultiple : -1.0f;
     
     bool allowSampleRunout = !(isMonophonic && isLegato);
 
-    DunneCore::SamplerVoice *pVoice = &data->voice[0];
-    for (int i=0; i < MAX_POLYPHONY; i++, pVoice++)
+    DunneCore::ActiveVoiceList &activeVoices = data->activeVoices;
+    if (data->renderPool.getThreadCount() > 0 && activeVoices.count() > 1)
     {
-        pVoice->restartVoiceLFO = restartVoiceLFO;
-        int nn = pVoice->noteNumber;
-        if (nn >= 0)
+        data->renderSampleCount = sampleCount;
+        data->renderAtChunkStart = atChunkStart;
+        data->renderChunkRemaining = chunkRemaining;
+        data->renderPitchDev = pitchDev;
+        data->renderCutoffMul = cutoffMul;
+        data->allowSampleRunout = allowSampleRunout;
+        data->renderPool.run(activeVoices.count(), renderVoiceTask, this);
+
+        for (int k=0; k < activeVoices.count(); )
         {
-            if (stoppingAllVoices ||
-                pVoice->prepToGetSamples(sampleCount, masterVolume, pitchDev, cutoffMul, keyTracking,
-                                         cutoffEnvelopeStrength, filterEnvelopeVelocityScaling, linearResonance,
-                                         pitchADSRSemitones, voiceVibratoDepth, voiceVibratoFrequency) ||
-                (pVoice->getSamples(sampleCount, pOutLeft, pOutRight) && allowSampleRunout))
+            int i = activeVoices[k];
+            InternalData::VoiceOutput &output = data->voiceOutput[i];
+            for (unsigned j=0; j < sampleCount; j++)
+            {
+                pOutLeft[j] += output.left[j];
+                pOutRight[j] += output.right[j];
+            }
+            if (output.isFinished)
             {
-                stopNote(nn, true);
+                data->culledSampleCount.fetch_add(data->voice[i].culledSampleCount, std::memory_order_relaxed);
+                handleNoteOff(output.noteNumber, true);
             }
+
+            // stopping this voice removed it from the list, moving the next one into its place
+            if (k < activeVoices.count() && activeVoices[k] == i) k++;
+        }
+        data->sampleTime.fetch_add(sampleCount, std::memory_order_relaxed);
+        return;
+    }
+
+    for (int k=0; k < activeVoices.count(); )
+    {
+        int i = activeVoices[k];
+        DunneCore::SamplerVoice *pVoice = &data->voice[i];
+        int nn = pVoice->noteNumber;
+        if (stoppingAllVoices ||
+            ((atChunkStart || pVoice->needsPrep) &&
+             (pVoice->prepToGetSamples(chunkRemaining, masterVolume, pitchDev, cutoffMul, keyTracking,
+                                       cutoffEnvelopeStrength, filterEnvelopeVelocityScaling, linearResonance,
+                                       pitchADSRSemitones, voiceVibratoDepth, voiceVibratoFrequency,
+                                       data->controlDivisor) ||
+              (data->audibilityFloor > 0.0f &&
+               pVoice->isInaudible(chunkRemaining, data->audibilityFloor, data->inaudibleChunkLimit)))) ||
+            (pVoice->getSamples(sampleCount, pOutLeft, pOutRight) && allowSampleRunout))
+        {
+            data->culledSampleCount.fetch_add(pVoice->culledSampleCount, std::memory_order_relaxed);
+            handleNoteOff(nn, true);
         }
+
+        // stopping this voice removed it from the list, moving the next one into its place
+        if (k < activeVoices.count() && activeVoices[k] == i) k++;
+    }
+
+    data->sampleTime.fetch_add(sampleCount, std::memory_order_relaxed);
+}
+
+// Render the voice at the given position in the active-voice list into its own VoiceOutput.
+// Runs on any of the render threads, so must touch nothing shared with other voices.
+void CoreSampler::renderVoice(int activeIndex)
+{
+    int i = data->activeVoices[activeIndex];
+    DunneCore::SamplerVoice *pVoice = &data->voice[i];
+    InternalData::VoiceOutput &output = data->voiceOutput[i];
+    unsigned sampleCount = data->renderSampleCount;
+    memset(output.left, 0, sampleCount * sizeof(float));
+    memset(output.right, 0, sampleCount * sizeof(float));
+
+    unsigned chunkRemaining = data->renderChunkRemaining;
+    output.noteNumber = pVoice->noteNumber;
+    output.isFinished = stoppingAllVoices ||
+        ((data->renderAtChunkStart || pVoice->needsPrep) &&
+         (pVoice->prepToGetSamples(chunkRemaining, masterVolume, data->renderPitchDev, data->renderCutoffMul, keyTracking,
+                                   cutoffEnvelopeStrength, filterEnvelopeVelocityScaling, linearResonance,
+                                   pitchADSRSemitones, voiceVibratoDepth, voiceVibratoFrequency,
+                                   data->controlDivisor) ||
+          (data->audibilityFloor > 0.0f &&
+           pVoice->isInaudible(chunkRemaining, data->audibilityFloor, data->inaudibleChunkLimit)))) ||
+        (pVoice->getSamples(sampleCount, output.left, output.right) && data->allowSampleRunout);
+}
+
+void CoreSampler::renderVoiceTask(void *context, int taskIndex)
+{
+    ((CoreSampler *)context)->renderVoice(taskIndex);
+}
+
+void CoreSampler::setRenderThreadCount(int threadCount)
+{
+    data->renderPool.start(threadCount);
+}
+
+int CoreSampler::getRenderThreadCount()
+{
+    return data->renderPool.getThreadCount();
+}
+
+// Quality levels, each including all those below it:
+//   1, 2: interpolation is one, then two steps cheaper (e.g. sinc to Hermite, then linear)
+//   3, 4: voice filter coefficients are recomputed every 2nd, then every 4th chunk
+//   5-8:  each step allows only 3/4 as many voices as were sounding, so new notes steal
+// The governor moves one level at a time, so this only ever takes a single step.
+void CoreSampler::applyQualityLevel(int level)
+{
+    data->controlDivisor = level >= 4 ? 4 : level >= 3 ? 2 : 1;
+
+    if (level < 5) data->voiceLimit = data->voiceCount;
+    else if (level > data->appliedQualityLevel)
+    {
+        int soundingCount = std::min(data->voiceLimit, data->activeVoices.count());
+        if (soundingCount > 0) data->voiceLimit = std::max(1, soundingCount * 3 / 4);
     }
+    else
+        data->voiceLimit = std::min(data->voiceCount, data->voiceLimit * 4 / 3 + 1);
+
+    data->appliedQualityLevel = level;
+}
+
+void CoreSampler::setCpuBudget(float fraction)
+{
+    data->governor.setBudget(fraction);
+}
+
+float CoreSampler::getCpuBudget()
+{
+    return data->governor.getBudget();
+}
+
+void CoreSampler::setAudibilityFloor(float floor, int chunkCount)
+{
+    data->audibilityFloor = floor;
+    data->inaudibleChunkLimit = std::max(1, chunkCount);
+}
+
+float CoreSampler::getAudibilityFloor()
+{
+    return data->audibilityFloor;
+}
+
+uint64_t CoreSampler::getCulledSampleCount()
+{
+    return data->culledSampleCount.load(std::memory_order_relaxed);
+}
+
+int CoreSampler::getQualityLevel()
+{
+    return data->governor.getLevel();
+}
+
+float CoreSampler::getCpuLoad()
+{
+    return data->governor.getLoad();
 }
 
-void  CoreSampler::setADSRAttackDurationSeconds(float value) __attribute__((no_sanitize("thread")))
+void  CoreSampler::setADSRAttackDurationSeconds(float value)
 {
     data->ampEnvelopeParameters.setAttackDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 
 float CoreSampler::getADSRAttackDurationSeconds(void)
@@ -446,7 +2099,7 @@ float CoreSampler::getADSRAttackDurationSeconds(void)
 void  CoreSampler::setADSRHoldDurationSeconds(float value)
 {
     data->ampEnvelopeParameters.setHoldDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 
 float CoreSampler::getADSRHoldDurationSeconds(void)
@@ -457,7 +2110,7 @@ float CoreSampler::getADSRHoldDurationSeconds(void)
 void  CoreSampler::setADSRDecayDurationSeconds(float value)
 {
     data->ampEnvelopeParameters.setDecayDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 
 float CoreSampler::getADSRDecayDurationSeconds(void)
@@ -468,7 +2121,7 @@ float CoreSampler::getADSRDecayDurationSeconds(void)
 void  CoreSampler::setADSRSustainFraction(float value)
 {
     data->ampEnvelopeParameters.sustainFraction = value;
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 
 float CoreSampler::getADSRSustainFraction(void)
@@ -479,7 +2132,7 @@ float CoreSampler::getADSRSustainFraction(void)
 void  CoreSampler::setADSRReleaseHoldDurationSeconds(float value)
 {
     data->ampEnvelopeParameters.setReleaseHoldDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 
 float CoreSampler::getADSRReleaseHoldDurationSeconds(void)
@@ -490,7 +2143,7 @@ float CoreSampler::getADSRReleaseHoldDurationSeconds(void)
 void  CoreSampler::setADSRReleaseDurationSeconds(float value)
 {
     data->ampEnvelopeParameters.setReleaseDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 
 float CoreSampler::getADSRReleaseDurationSeconds(void)
@@ -501,7 +2154,7 @@ float CoreSampler::getADSRReleaseDurationSeconds(void)
 void  CoreSampler::setFilterAttackDurationSeconds(float value)
 {
     data->filterEnvelopeParameters.setAttackDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateFilterAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateFilterAdsrParameters();
 }
 
 float CoreSampler::getFilterAttackDurationSeconds(void)
@@ -512,7 +2165,7 @@ float CoreSampler::getFilterAttackDurationSeconds(void)
 void  CoreSampler::setFilterDecayDurationSeconds(float value)
 {
     data->filterEnvelopeParameters.setDecayDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateFilterAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateFilterAdsrParameters();
 }
 
 float CoreSampler::getFilterDecayDurationSeconds(void)
@@ -523,7 +2176,7 @@ float CoreSampler::getFilterDecayDurationSeconds(void)
 void  CoreSampler::setFilterSustainFraction(float value)
 {
     data->filterEnvelopeParameters.sustainFraction = value;
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateFilterAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateFilterAdsrParameters();
 }
 
 float CoreSampler::getFilterSustainFraction(void)
@@ -534,7 +2187,7 @@ float CoreSampler::getFilterSustainFraction(void)
 void  CoreSampler::setFilterReleaseDurationSeconds(float value)
 {
     data->filterEnvelopeParameters.setReleaseDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updateFilterAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateFilterAdsrParameters();
 }
 
 float CoreSampler::getFilterReleaseDurationSeconds(void)
@@ -546,7 +2199,7 @@ float CoreSampler::getFilterReleaseDurationSeconds(void)
 void  CoreSampler::setPitchAttackDurationSeconds(float value)
 {
     data->pitchEnvelopeParameters.setAttackDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updatePitchAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updatePitchAdsrParameters();
 }
 
 float CoreSampler::getPitchAttackDurationSeconds(void)
@@ -557,7 +2210,7 @@ float CoreSampler::getPitchAttackDurationSeconds(void)
 void  CoreSampler::setPitchDecayDurationSeconds(float value)
 {
     data->pitchEnvelopeParameters.setDecayDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updatePitchAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updatePitchAdsrParameters();
 }
 
 float CoreSampler::getPitchDecayDurationSeconds(void)
@@ -568,7 +2221,7 @@ float CoreSampler::getPitchDecayDurationSeconds(void)
 void  CoreSampler::setPitchSustainFraction(float value)
 {
     data->pitchEnvelopeParameters.sustainFraction = value;
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updatePitchAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updatePitchAdsrParameters();
 }
 
 float CoreSampler::getPitchSustainFraction(void)
@@ -579,7 +2232,7 @@ float CoreSampler::getPitchSustainFraction(void)
 void  CoreSampler::setPitchReleaseDurationSeconds(float value)
 {
     data->pitchEnvelopeParameters.setReleaseDurationSeconds(value);
-    for (int i = 0; i < MAX_POLYPHONY; i++) data->voice[i].updatePitchAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updatePitchAdsrParameters();
 }
 
 float CoreSampler::getPitchReleaseDurationSeconds(void)
@@ -3,11 +3,16 @@
 #ifdef __cplusplus
 #ifdef _WIN32
 #include "Sampler_Typedefs.h"
+#include <functional>
 #include <memory>
+#include <string>
 #else
 #import "Sampler_Typedefs.h"
+#import <functional>
 #import <memory>
+#import <string>
 #endif
+#include <stdint.h>
 
 // process samples in "chunks" this size
 #define CORESAMPLER_CHUNKSIZE 16
@@ -16,29 +21,194 @@
 namespace DunneCore {
     struct SamplerVoice;
     struct KeyMappedSampleBuffer;
+    struct SampleStorage;
+    struct EngineCommand;
 }
 
 class CoreSampler
 {
 public:
+    /// how to choose which voice to steal, when a new note arrives and all voices are busy
+    enum VoiceStealingPolicy
+    {
+        kStealReleasedFirst,    // the stalest voice in its release phase, else the stalest of all
+        kStealOldest,           // the stalest voice, i.e. least recently started or released
+        kStealQuietest          // the voice with the lowest current amplitude
+    };
+
     CoreSampler();
     ~CoreSampler();
     
     /// returns system error code, nonzero only if a problem occurs
     int init(double sampleRate);
+
+    /// as above, but first (re)allocate the voice pool for the given polyphony (default 64);
+    /// call before rendering starts, never from the audio thread
+    int init(double sampleRate, int maxVoices);
+
+    /// number of voices in the pool
+    int getMaxVoices(void);
+
+    /// number of voices sounding (including any releasing), as of the last note event or render
+    int getActiveVoiceCount(void);
     
     /// call this to un-load all samples and clear the keymap
     void deinit();
     
-    /// call before/after loading/unloading samples, to ensure none are in use
-    void stopAllVoices();
+    /// Stop all voices, and ignore new notes until restartVoices(), e.g. before/after loading/unloading
+    /// samples. Safe to call from any thread, and never blocks: the request is queued like a note event,
+    /// and carried out at the start of the next render(), which then calls onStopped(context), if given, on
+    /// the rendering thread (so it must be real-time safe). Returns the request's epoch, for waitForStop(),
+    /// or 0 if the command queue is full. restartVoices() is queued likewise; if the queue is full, voices
+    /// restart once the rendering thread has applied everything queued before.
+    uint64_t stopAllVoices(void (*onStopped)(void *context) = 0, void *context = 0);
     void restartVoices();
+
+    /// block until the stop request with the given epoch has been carried out, returning false if that does
+    /// not happen within timeoutSeconds (e.g. because nothing is rendering); never call on the rendering thread
+    bool waitForStop(uint64_t epoch, double timeoutSeconds = 1.0);
+
+    /// rendering thread, or any thread while nothing renders (e.g. between offline render calls): apply all
+    /// posted events, then stop all voices at once, and ignore new notes until restartVoices()
+    void stopAllVoicesNow();
     
     /// call to load samples
     void loadSampleData(SampleDataDescriptor& sdd);
 
+    /// as above, but sharing the stored data (see setSampleSharing()) with every other sample loaded from the
+    /// same source, e.g. file path, with the same length and storage settings. If sdd.data is null, only data
+    /// already shared is used: returns false if there is none, so the caller need decode the source only then.
+    bool loadSampleData(SampleDataDescriptor& sdd, const char *sourceKey);
+
+    /// as above, but taking ownership of sdd.data, which the caller must not touch again: it is freed by calling
+    /// releaseData(sdd.data, context), from whichever thread frees the last sample using it. Data already in the
+    /// storage format and layout (32-bit float, and for stereo, interleaved just if setInterleavedStorage(true))
+    /// is used in place, with no copy, and true returned; anything else is converted into new storage, then
+    /// freed at once. sourceKey may be null, or share the data as above.
+    bool adoptSampleData(SampleDataDescriptor& sdd, const char *sourceKey,
+                         void (*releaseData)(float *data, void *context), void *context);
+
+    /// call to load a WavPack-compressed sample file (streamed from disk, if enabled)
+    void loadCompressedSampleFile(SampleFileDescriptor& sfd);
+
+    /// call to load many WavPack-compressed sample files at once, decoding them on threadCount threads (0 means
+    /// one per processor core) straight into their sample buffers. Samples are added in the order given, so
+    /// the key map comes out exactly as if they were loaded one by one. Returns the number of files loaded.
+    int loadCompressedSampleFiles(SampleFileDescriptor *descriptors, int count, int threadCount = 0);
+
+    /// totals for all compressed files loaded since the last unloadAllSamples(), including throughput in MB/s
+    /// and how many files shared data already in memory rather than being decoded; also how many samples
+    /// (of any kind) the last key map built had no room for
+    SampleLoadStatistics getLoadStatistics(void);
+
+    /// call before loading compressed files, to keep only the first preloadFrames of each file in memory,
+    /// and stream the remainder from disk while voices play. 0 (the default) loads everything up front.
+    void setStreamingPreloadFrames(int preloadFrames) { streamingPreloadFrames = preloadFrames; }
+
+    /// call before loading compressed files, to load them lazily (or not, the default). Each sample is then
+    /// registered with only its first headFrames decoded (its attack; looped samples keep their whole loop),
+    /// and the rest streamed from disk, until a background thread has decoded the whole file: first when it is
+    /// played, or prefetched when a neighbouring note or velocity layer is. With headFrames 0 nothing is decoded
+    /// up front, and a note plays the nearest velocity layer already loaded until its own sample arrives.
+    void setLazyLoading(bool lazy, int headFrames = 8192) { lazyLoading = lazy; lazyHeadFrames = headFrames; }
+
+    /// number of lazily loaded samples still waiting for the rest of their data
+    int getPendingLazySampleCount(void);
+
+    /// call before loading samples, to convert (or not, the default) each fully resident sample recorded at a
+    /// rate other than the engine's to the engine's rate as it loads, with a high-quality windowed-sinc converter,
+    /// rather than have every voice interpolate across the difference. A sample played at its own pitch then
+    /// advances exactly one frame per output sample, which (with linear or Hermite interpolation) is a plain copy.
+    /// When init() changes the rate, samples already loaded are converted again on a background thread, each
+    /// keeping a copy per rate; until its copy is ready, a sample plays as before. Streamed and lazily loaded
+    /// heads are not converted. Until init() first gives the engine's rate, samples are converted to
+    /// expectedSampleRate (if given); a sampler already initialised converts to its own rate, and is not re-initialised.
+    void setPreResampling(bool resample, double expectedSampleRate = 0.0);
+
+    /// number of samples still waiting for the background thread to convert them to the current rate
+    int getPendingResampleCount(void);
+
+    /// call before loading samples, to give (or not, the default) each fully resident sample two mip levels as it
+    /// loads: copies decimated 2x and 4x, each band-limited to its own Nyquist frequency by the same converter as
+    /// setPreResampling(). Voices playing a sample an octave or more up then read the level where they step less
+    /// than two frames per output sample, and so do not alias, at the cost of 75% more memory per sample.
+    /// Below an octave up, output is unchanged. Streamed and lazily loaded heads get no mip levels.
+    void setMipMapping(bool mipMap) { mipMapping = mipMap; }
+
+    /// call before loading samples, to share (the default) or not share sample data with other samples loaded
+    /// from the same source (compressed files are identified by path, size and modification time), through a
+    /// process-wide pool of reference-counted, immutable sample storage. Memory then scales with the number of
+    /// distinct samples, however many CoreSamplers load them.
+    void setSampleSharing(bool share) { sharesSamples = share; }
+
+    /// call before loading compressed files, to identify each fully resident file shared through the pool (see
+    /// setSampleSharing()) by a hash of its compressed bytes rather than (the default) its path, so identical
+    /// files under different names, e.g. round-robins or release samples copied between layers, are decoded once
+    /// and their data shared. Each file is read one extra time, when first loaded, to hash it.
+    void setContentDeduplication(bool dedup) { deduplicatesContent = dedup; }
+
+    /// call before loading stereo samples, to store them interleaved (LRLR) rather than planar (the default),
+    /// so each voice reads one contiguous stream of memory
+    void setInterleavedStorage(bool interleaved) { interleavedStorage = interleaved; }
+
+    /// call before loading samples, to store them as 16-bit or (packed) 24-bit integers, rather than
+    /// 32-bit float (the default), to save memory; returns false if bitDepth is not 16, 24 or 32
+    bool setStorageBitDepth(int bitDepth);
+
+    /// number of output samples rendered before the streamer could deliver their sample data
+    unsigned getStreamingUnderrunCount(void);
+
+    /// number of times a voice's sample file could not be reopened for streaming (e.g. it was moved or
+    /// changed since loading), in which case the voice plays only the sample's resident head
+    unsigned getStreamingErrorCount(void);
+
+    /// keep rendering within the given fraction of real time, by lowering quality as needed (interpolation,
+    /// then filter control rate, then polyphony) and restoring it when the load drops; 0 (the default) disables
+    void setCpuBudget(float fraction);
+    float getCpuBudget(void);
+
+    /// how far quality has been lowered to meet the CPU budget: 0 means not at all
+    int getQualityLevel(void);
+
+    /// smoothed render time as a fraction of real time, measured only while a CPU budget is set
+    float getCpuLoad(void);
+
+    /// stop voices early once their release has stayed below floor, a linear gain combining the amp envelope,
+    /// note volume and master volume (e.g. 0.00003 for -90 dBFS), for chunkCount chunks in a row, rather than
+    /// rendering them until the envelope ends; 0 (the default) disables this
+    void setAudibilityFloor(float floor, int chunkCount = 4);
+    float getAudibilityFloor(void);
+
+    /// voice-samples left unrendered so far, by stopping voices below the audibility floor
+    uint64_t getCulledSampleCount(void);
+
+    /// render voices on this many worker threads, as well as the calling thread; 0 (the default) renders
+    /// on the calling thread alone. Output is bit-identical either way. Call only while not rendering.
+    void setRenderThreadCount(int threadCount);
+    int getRenderThreadCount(void);
+
     /// call to unload samples, freeing memory
     void unloadAllSamples();
+
+    /// number of samples loaded, and the sample at a given position in load (i.e. mapping) order
+    int getSampleCount(void);
+    DunneCore::KeyMappedSampleBuffer *getSample(int index);
+
+    /// Edit a sample set while it plays, without reloading the rest of it: add a sample (at the end of the
+    /// mapping order), replace one (in its place) or remove one. Only the notes the change affects are re-mapped
+    /// (or, after buildSimpleKeyMap(), the whole map, which is cheap next to loading), into a new copy of the
+    /// key map which render() switches to at its next block. Removed and replaced buffers are freed once no
+    /// voice can still be playing them, by this or any later edit, or reclaimRetiredSamples(). Call from one
+    /// thread at a time, never the rendering thread. Returns the new sample, or null on failure.
+    DunneCore::KeyMappedSampleBuffer *addSample(SampleDataDescriptor& sdd);
+    DunneCore::KeyMappedSampleBuffer *addCompressedSample(SampleFileDescriptor& sfd);
+    DunneCore::KeyMappedSampleBuffer *replaceSample(DunneCore::KeyMappedSampleBuffer *pOld, SampleDataDescriptor& sdd);
+    DunneCore::KeyMappedSampleBuffer *replaceCompressedSample(DunneCore::KeyMappedSampleBuffer *pOld,
+                                                              SampleFileDescriptor& sfd);
+    bool removeSample(DunneCore::KeyMappedSampleBuffer *pSample);
+
+    /// free removed and replaced samples which rendering has finished with; returns the number still waiting
+    int reclaimRetiredSamples(void);
     
     // after loading samples, call one of these to build the key map
     
@@ -46,20 +216,40 @@ public:
     void setNoteFrequency(int noteNumber, float noteFrequency);
     
     /// use this when you have full key mapping data (min/max note, vel)
+    /// Only the first 65535 samples can be mapped; getLoadStatistics().unmappedSampleCount reports any more.
     void buildKeyMap(void);
     
-    /// use this when you don't have full key mapping data (min/max note, vel)
+    /// use this when you don't have full key mapping data (min/max note, vel); same 65535-sample limit
     void buildSimpleKeyMap(void);
     
     /// optionally call this to make samples continue looping after note-release
     void setLoopThruRelease(bool value) { loopThruRelease = value; }
     
-    void playNote(unsigned noteNumber, unsigned velocity);
-    void stopNote(unsigned noteNumber, bool immediate);
-    void sustainPedal(bool down);
+    /// Post a note or pedal event, which render() applies at exactly sampleTime (see getSampleTime()),
+    /// or as soon as possible if that has passed, e.g. 0. Events are applied in order of sampleTime, those
+    /// due together in the order posted, so an event posted for later never delays one due sooner. Safe to
+    /// call from any thread, as only the rendering thread ever touches voices; returns false, dropping the
+    /// event, if the command queue is full.
+    bool playNote(unsigned noteNumber, unsigned velocity, int64_t sampleTime = 0);
+    bool stopNote(unsigned noteNumber, bool immediate, int64_t sampleTime = 0);
+    bool sustainPedal(bool down, int64_t sampleTime = 0);
+
+    /// rendering thread only: apply all posted events which are due. render() calls this first, so it
+    /// is only needed to apply events without rendering.
+    void processCommands();
+
+    /// number of samples rendered so far, the clock against which events are timed
+    int64_t getSampleTime(void);
     
+    /// Render sampleCount samples, applying posted events at the exact sample they are timed for: the
+    /// block is split into spans at each event, rather than events waiting for the next render() call.
     void render(unsigned channelCount, unsigned sampleCount, float *outBuffers[]);
 
+    /// as above, also applying a list of events sorted by sampleTime, which here means the offset into this
+    /// block (events at or beyond sampleCount are applied at its end)
+    void render(unsigned channelCount, unsigned sampleCount, float *outBuffers[],
+                const DunneCore::EngineCommand *events, int eventCount);
+
     void  setADSRAttackDurationSeconds(float value);
     float getADSRAttackDurationSeconds(void);
     void  setADSRHoldDurationSeconds(float value);
@@ -148,13 +338,91 @@ public:
     
     // if true, sample continue looping thru note release phase
     bool loopThruRelease;
+
+    // how voices interpolate between samples: a DunneCore::InterpolationMode (0 = linear, the default,
+    // 1 = 4-point Hermite, 2 = 8-point windowed sinc)
+    int interpolationMode;
+
+    // if true, voices keep their sample position as a 32.32 fixed-point phase rather than a double:
+    // slightly cheaper per sample, and exact however long a sample loops
+    bool fixedPointPhase;
+
+    // resident frames per compressed sample when streaming from disk; 0 means streaming is disabled
+    int streamingPreloadFrames;
+
+    // if true, compressed samples loaded from now on are loaded lazily, with lazyHeadFrames resident at first
+    bool lazyLoading;
+    int lazyHeadFrames;
+
+    // if true, stereo samples loaded from now on are stored interleaved
+    bool interleavedStorage;
+
+    // if true, samples loaded from now on are converted to the engine's sample rate
+    bool preResampling;
+
+    // false until init() first sets currentSampleRate, which until then is only a guess
+    bool hasSampleRate;
+
+    // if true, samples loaded from now on get mip levels
+    bool mipMapping;
+
+    // if true, samples loaded from now on share their data through the SamplePool
+    bool sharesSamples;
+
+    // if true, compressed files loaded from now on are pooled by content rather than path
+    bool deduplicatesContent;
+
+    // bits per sample (16, 24 or 32 for float) for samples loaded from now on
+    int storageBitDepth;
+    
+    // which voice to steal when all are busy
+    VoiceStealingPolicy voiceStealingPolicy;
     
-    // temporary state
+    // temporary state: set by stopping all voices, cleared by restarting them (rendering thread only)
     bool stoppingAllVoices;
+
+    // counts note-on, note-off and pedal events, to find the "stalest" voice
+    unsigned eventCounter;
     
     // helper functions
     DunneCore::SamplerVoice *voicePlayingNote(unsigned noteNumber);
+    DunneCore::SamplerVoice *voiceToSteal();
+    void allocateVoices(int maxVoices);
+    void applyQualityLevel(int level);
+    void handleNoteOn(unsigned noteNumber, unsigned velocity);
+    void handleNoteOff(unsigned noteNumber, bool immediate);
+    void handleSustainPedal(bool down);
+    void stopVoices();
+    void applyCommand(const DunneCore::EngineCommand &command);
+    unsigned samplesUntilNextCommand(unsigned sampleCount);
+    void renderSpan(unsigned sampleCount, float *pOutLeft, float *pOutRight);
+    void renderVoice(int activeIndex);
+    static void renderVoiceTask(void *context, int taskIndex);
     DunneCore::KeyMappedSampleBuffer *lookupSample(unsigned noteNumber, unsigned velocity);
+    DunneCore::KeyMappedSampleBuffer *lazySampleToPlay(unsigned noteNumber, unsigned velocity,
+                                                       DunneCore::KeyMappedSampleBuffer *pBuf);
+    void runLazyLoader();
+    void loadLazyBody(unsigned lazyId);
+    void startResampler(float sampleRate);
+    void runResampler();
+    bool resamplesOnLoad(float sampleRate, int totalSampleCount, int residentSampleCount);
+    bool mipMapsOnLoad(int totalSampleCount, int residentSampleCount);
+    std::string storedPoolKey(const std::string& key, float sampleRate, int totalSampleCount, int residentSampleCount);
+    DunneCore::KeyMappedSampleBuffer *newSampleBuffer(SampleDescriptor sd, float sampleRate, int channelCount,
+                                                      int totalSampleCount, int residentSampleCount,
+                                                      const std::shared_ptr<DunneCore::SampleStorage>& storage = nullptr);
+    DunneCore::KeyMappedSampleBuffer *newSharedSampleBuffer(const std::string& key, SampleDescriptor& sd,
+                                                            float sampleRate, int channelCount,
+                                                            int totalSampleCount, int residentSampleCount,
+                                                            const std::function<void(DunneCore::KeyMappedSampleBuffer*)>& fill,
+                                                            bool *pShared = nullptr);
+    DunneCore::KeyMappedSampleBuffer *addSampleBuffer(SampleDataDescriptor& sdd, int totalSampleCount);
+    DunneCore::KeyMappedSampleBuffer *copySampleBuffer(SampleDataDescriptor& sdd, int totalSampleCount);
+    static void copySampleData(DunneCore::KeyMappedSampleBuffer *pBuf, SampleDataDescriptor& sdd);
+    DunneCore::KeyMappedSampleBuffer *decodeCompressedSampleFile(SampleFileDescriptor& sfd, int preloadFrames,
+                                                                  bool *pShared = nullptr);
+    bool swapSample(DunneCore::KeyMappedSampleBuffer *pOld, DunneCore::KeyMappedSampleBuffer *pNew);
+    static void decodeCompressedSampleFileTask(void *context, int taskIndex);
     void play(unsigned noteNumber,
               unsigned velocity,
               bool anotherKeyWasDown);
@@ -1,14 +1,28 @@
 // Copyright AudioKit. All Rights Reserved.
 
 #include "SampleBuffer.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace DunneCore
 {
 
     SampleBuffer::SampleBuffer()
-    : samples(0)
+    : format(kFloat32)
+    , samples(0)
+    , samples16(0)
+    , samples24(0)
     , channelCount(0)
     , sampleCount(0)
+    , residentSampleCount(0)
+    , isInterleaved(false)
+    , isStreaming(false)
     , startPoint(0.0f)
     , endPoint(0.0f)
     , isLooping(false)
@@ -22,28 +36,203 @@ namespace DunneCore
         deinit();
     }
     
-    void SampleBuffer::init(float sampleRate, int channelCount, int sampleCount)
+    void SampleBuffer::init(float sampleRate, int channelCount, int sampleCount, int residentSampleCount,
+                            bool interleaved, SampleFormat format)
+    {
+        if (residentSampleCount < 0 || residentSampleCount > sampleCount) residentSampleCount = sampleCount;
+        std::shared_ptr<SampleStorage> newStorage = std::make_shared<SampleStorage>();
+        newStorage->format = format;
+        newStorage->sampleRate = sampleRate;
+        newStorage->channelCount = channelCount;
+        newStorage->sampleCount = sampleCount;
+        newStorage->residentSampleCount = residentSampleCount;
+        newStorage->isInterleaved = interleaved && channelCount > 1;
+        int count = channelCount * residentSampleCount;
+        switch (format)
+        {
+            case kInt16: newStorage->samples16.reset(new int16_t[count]); break;
+            case kInt24: newStorage->samples24.reset(new uint8_t[3 * count]); break;
+            default:     newStorage->samples.reset(new float[count]); break;
+        }
+        init(newStorage);
+    }
+
+    void SampleBuffer::init(const std::shared_ptr<SampleStorage>& sharedStorage)
     {
-        this->sampleRate = sampleRate;
-        this->sampleCount = sampleCount;
-        this->channelCount = channelCount;
-        if (samples) delete[] samples;
-        samples = new float[channelCount * sampleCount];
+        deinit();
+        storage = sharedStorage;
+        format = storage->format;
+        sampleRate = storage->sampleRate;
+        channelCount = storage->channelCount;
+        sampleCount = storage->sampleCount;
+        residentSampleCount = storage->residentSampleCount;
+        isInterleaved = storage->isInterleaved;
+        isStreaming = residentSampleCount < sampleCount;
+        samples = storage->samples.get();
+        samples16 = storage->samples16.get();
+        samples24 = storage->samples24.get();
         loopStartPoint = startPoint = 0.0f;
         loopEndPoint = endPoint = (float)(sampleCount - 1);
     }
     
+    void SampleBuffer::updateMipLevels()
+    {
+        if (!storage || !storage->halfRate)
+        {
+            mipLevel.reset();
+            return;
+        }
+        if (!mipLevel) mipLevel.reset(new SampleBuffer());
+        mipLevel->init(storage->halfRate);
+        mipLevel->startPoint = 0.5f * startPoint;
+        mipLevel->endPoint = 0.5f * endPoint;
+        mipLevel->isLooping = isLooping;
+        mipLevel->loopStartPoint = 0.5f * loopStartPoint;
+        mipLevel->loopEndPoint = 0.5f * loopEndPoint;
+        mipLevel->updateMipLevels();
+    }
+
     void SampleBuffer::deinit()
     {
-        if (samples) delete[] samples;
+        storage.reset();
+        mipLevel.reset();
         samples = 0;
+        samples16 = 0;
+        samples24 = 0;
     }
     
+    // store one sample at index, which must be in range
+    static inline void storeSample(SampleBuffer& buffer, unsigned index, float data)
+    {
+        if (buffer.format == SampleBuffer::kFloat32)
+        {
+            buffer.samples[index] = data;
+            return;
+        }
+
+        float fullScale = (buffer.format == SampleBuffer::kInt16) ? 32768.0f : 8388608.0f;
+        float value = rintf(data * fullScale);
+        if (value > fullScale - 1.0f) value = fullScale - 1.0f;
+        if (value < -fullScale) value = -fullScale;
+        if (buffer.format == SampleBuffer::kInt16)
+        {
+            buffer.samples16[index] = int16_t(value);
+        }
+        else
+        {
+            uint32_t bits = uint32_t(int32_t(value));
+            uint8_t *s = buffer.samples24 + 3 * index;
+            s[0] = uint8_t(bits);
+            s[1] = uint8_t(bits >> 8);
+            s[2] = uint8_t(bits >> 16);
+        }
+    }
+
     void SampleBuffer::setData(unsigned index, float data)
     {
-        if ((int)index < channelCount * sampleCount)
+        if ((int)index >= channelCount * residentSampleCount) return;
+        storeSample(*this, index, data);
+    }
+
+    // split interleaved LRLR... into left and right
+    static void deinterleave(const float *pSource, float *pLeft, float *pRight, int frameCount)
+    {
+        int i = 0;
+#if defined(__ARM_NEON)
+        for (; i + 4 <= frameCount; i += 4)
+        {
+            float32x4x2_t frames = vld2q_f32(pSource + 2 * i);
+            vst1q_f32(pLeft + i, frames.val[0]);
+            vst1q_f32(pRight + i, frames.val[1]);
+        }
+#elif defined(__SSE2__)
+        for (; i + 4 <= frameCount; i += 4)
+        {
+            __m128 a = _mm_loadu_ps(pSource + 2 * i);
+            __m128 b = _mm_loadu_ps(pSource + 2 * i + 4);
+            _mm_storeu_ps(pLeft + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(pRight + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+#endif
+        for (; i < frameCount; i++)
+        {
+            pLeft[i] = pSource[2 * i];
+            pRight[i] = pSource[2 * i + 1];
+        }
+    }
+
+    // merge left and right into interleaved LRLR...
+    static void interleave(const float *pLeft, const float *pRight, float *pDest, int frameCount)
+    {
+        int i = 0;
+#if defined(__ARM_NEON)
+        for (; i + 4 <= frameCount; i += 4)
+        {
+            float32x4x2_t frames = { { vld1q_f32(pLeft + i), vld1q_f32(pRight + i) } };
+            vst2q_f32(pDest + 2 * i, frames);
+        }
+#elif defined(__SSE2__)
+        for (; i + 4 <= frameCount; i += 4)
+        {
+            __m128 left = _mm_loadu_ps(pLeft + i);
+            __m128 right = _mm_loadu_ps(pRight + i);
+            _mm_storeu_ps(pDest + 2 * i, _mm_unpacklo_ps(left, right));
+            _mm_storeu_ps(pDest + 2 * i + 4, _mm_unpackhi_ps(left, right));
+        }
+#endif
+        for (; i < frameCount; i++)
+        {
+            pDest[2 * i] = pLeft[i];
+            pDest[2 * i + 1] = pRight[i];
+        }
+    }
+
+    void SampleBuffer::setFrames(int frame, int frameCount, const float *pLeft, const float *pRight, int sourceStride)
+    {
+        if (frame < 0 || frame >= residentSampleCount) return;
+        if (frameCount > residentSampleCount - frame) frameCount = residentSampleCount - frame;
+        bool isStereo = channelCount > 1;
+        bool isSourceInterleaved = sourceStride == 2 && pRight == pLeft + 1;
+
+        if (format == kFloat32)
+        {
+            size_t bytes = size_t(frameCount) * sizeof(float);
+            if (!isStereo || !isInterleaved)
+            {
+                float *pDestLeft = samples + frame;
+                float *pDestRight = samples + residentSampleCount + frame;
+                if (sourceStride == 1)
+                {
+                    memcpy(pDestLeft, pLeft, bytes);
+                    if (isStereo) memcpy(pDestRight, pRight, bytes);
+                    return;
+                }
+                if (isStereo && isSourceInterleaved)
+                {
+                    deinterleave(pLeft, pDestLeft, pDestRight, frameCount);
+                    return;
+                }
+            }
+            else if (isSourceInterleaved)
+            {
+                memcpy(samples + 2 * frame, pLeft, 2 * bytes);
+                return;
+            }
+            else if (sourceStride == 1)
+            {
+                interleave(pLeft, pRight, samples + 2 * frame, frameCount);
+                return;
+            }
+        }
+
+        // integer storage, or an unusual source layout: one sample at a time
+        int stride = isStereo && isInterleaved ? 2 : 1;
+        int rightOffset = isInterleaved ? 1 : residentSampleCount;
+        for (int i=0; i < frameCount; i++)
         {
-            samples[index] = data;
+            unsigned index = unsigned(stride * (frame + i));
+            storeSample(*this, index, pLeft[i * sourceStride]);
+            if (isStereo) storeSample(*this, index + rightOffset, pRight[i * sourceStride]);
         }
     }
     
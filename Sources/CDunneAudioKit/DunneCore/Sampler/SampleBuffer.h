@@ -1,48 +1,154 @@
 // Copyright AudioKit. All Rights Reserved.
 
 #pragma once
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "SampleInterpolator.h"
+
 namespace DunneCore
 {
 
     // SampleBuffer represents an array of sample data, which can be addressed with a real-valued
     // "index" via linear interpolation.
-    
+    //
+    // A streaming SampleBuffer keeps only its first residentSampleCount frames in memory; the rest
+    // is read from streamPath on demand (see SampleStreamer). For ordinary buffers, residentSampleCount
+    // equals sampleCount. Either way, stereo samples[] are either planar, with channel stride
+    // residentSampleCount, or (if isInterleaved) interleaved LRLR, so each frame is contiguous.
+    //
+    // Samples may be held as 32-bit float (the default), or more compactly as 16-bit or packed
+    // 24-bit integers, which are converted to float as they are read (see the SampleReader types below).
+    //
+    // The sample data itself lives in a SampleStorage, which several SampleBuffers may share (see
+    // SamplePool): each buffer has its own pitch, loop and mapping details, but reads the same samples.
+    //
+    // A fully resident buffer may also have mip levels (see CoreSampler::setMipMapping()): the same sample
+    // decimated 2x, then 4x, band-limited to each level's own Nyquist frequency, which oscillators read instead
+    // when playing an octave or more up, so they need not interpolate past the band limit and alias.
+
+    // Sample readers, for use in interpolation loops. Conversion of integer samples is exact,
+    // because every 16- or 24-bit value is representable in float and is scaled by a power of two,
+    // so 16- or 24-bit sources render identically whichever format they are stored in.
+
+    struct FloatSampleReader
+    {
+        const float *p;
+        FloatSampleReader(const float *ptr) : p(ptr) {}
+        FloatSampleReader offset(int index) const { return FloatSampleReader(p + index); }
+        inline float operator[](int index) const { return p[index]; }
+    };
+
+    struct Int16SampleReader
+    {
+        const int16_t *p;
+        Int16SampleReader(const int16_t *ptr) : p(ptr) {}
+        Int16SampleReader offset(int index) const { return Int16SampleReader(p + index); }
+        inline float operator[](int index) const { return float(p[index]) * (1.0f / 32768.0f); }
+    };
+
+    struct Int24SampleReader
+    {
+        const uint8_t *p;   // packed little-endian, 3 bytes per sample
+        Int24SampleReader(const uint8_t *ptr) : p(ptr) {}
+        Int24SampleReader offset(int index) const { return Int24SampleReader(p + 3 * index); }
+        inline float operator[](int index) const
+        {
+            const uint8_t *s = p + 3 * index;
+            int32_t value = int32_t(uint32_t(s[0]) << 8 | uint32_t(s[1]) << 16 | uint32_t(s[2]) << 24) >> 8;
+            return float(value) * (1.0f / 8388608.0f);
+        }
+    };
+
+    struct SampleStorage;
+
     struct SampleBuffer
     {
-        float *samples;
+        enum SampleFormat { kFloat32, kInt16, kInt24 };
+
+        SampleFormat format;
+        float *samples;         // sample data if format is kFloat32, else null
+        int16_t *samples16;     // sample data if format is kInt16, else null
+        uint8_t *samples24;     // sample data if format is kInt24 (packed, 3 bytes per sample), else null
         float sampleRate;
         int channelCount;
         int sampleCount;
+        int residentSampleCount;
+        bool isInterleaved;
+        bool isStreaming;
+        std::string streamPath;
         float startPoint, endPoint;
         bool isLooping;
         float loopStartPoint, loopEndPoint;
         float noteFrequency;
+
+        // owns samples, samples16 or samples24 (whichever is used), and may be shared with other buffers
+        std::shared_ptr<SampleStorage> storage;
+
+        // number of mip levels below full rate, if a buffer has any
+        static constexpr int mipLevelCount = 2;
+
+        // the next mip level, if storage has one: this sample at half the rate, with every point halved
+        std::unique_ptr<SampleBuffer> mipLevel;
         
         SampleBuffer();
         ~SampleBuffer();
         
-        void init(float sampleRate, int channelCount, int sampleCount);
+        // residentSampleCount < 0 means all sampleCount frames are held in memory;
+        // interleaved applies only to stereo buffers
+        void init(float sampleRate, int channelCount, int sampleCount, int residentSampleCount = -1,
+                  bool interleaved = false, SampleFormat format = kFloat32);
+
+        // as above, but reading existing sample data, in the storage's own format and layout;
+        // a shared storage must no longer be written, so setData() must not be used
+        void init(const std::shared_ptr<SampleStorage>& sharedStorage);
         void deinit();
-        
+
+        // (re)build mipLevel, and the levels below it, from storage's mip levels; call whenever points change
+        void updateMipLevels();
+
+        bool hasData() const { return samples != 0 || samples16 != 0 || samples24 != 0; }
+
+        // store one sample, at the given index in the (planar or interleaved) storage;
+        // values are rounded to the nearest integer sample if format is not kFloat32
         void setData(unsigned index, float data);
+
+        // store frameCount frames, starting at the given frame, converting to the storage's format and layout
+        // in one pass (vectorized where possible) with no per-sample range check: frames beyond the resident
+        // data are dropped. Each channel's source samples are sourceStride apart, e.g. pLeft = data,
+        // pRight = data + 1 and sourceStride 2 for interleaved stereo; pRight is ignored for mono buffers.
+        void setFrames(int frame, int frameCount, const float *pLeft, const float *pRight, int sourceStride);
+
+        // read one sample, at the given index in the storage
+        inline float getData(int index) const
+        {
+            switch (format)
+            {
+                case kInt16: return Int16SampleReader(samples16)[index];
+                case kInt24: return Int24SampleReader(samples24)[index];
+                default:     return samples[index];
+            }
+        }
         
         // Use double for the real-valued index, because oscillators will need the extra precision.
         inline float interp(double fIndex, float gain)
         {
-            if (samples == 0 || sampleCount == 0) return 0.0f;
+            if (!hasData() || residentSampleCount == 0) return 0.0f;
             
             int ri = int(fIndex);
             double f = fIndex - ri;
             int rj = ri + 1;
             
-            float si = ri < sampleCount ? samples[ri] : 0.0f;
-            float sj = rj < sampleCount ? samples[rj] : 0.0f;
+            float si = ri < residentSampleCount ? getData(ri) : 0.0f;
+            float sj = rj < residentSampleCount ? getData(rj) : 0.0f;
             return (float)(gain * ((1.0 - f) * si + f * sj));
         }
         
         inline void interp(double fIndex, float *leftOutput, float *rightOutput, float gain)
         {
-            if (samples == 0 || sampleCount == 0)
+            if (!hasData() || residentSampleCount == 0)
             {
                 *leftOutput = *rightOutput = 0.0f;
                 return;
@@ -56,16 +162,92 @@ namespace DunneCore
             int ri = int(fIndex);
             double f = fIndex - ri;
             int rj = ri + 1;
-            
-            float si = ri < sampleCount ? samples[ri] : 0.0f;
-            float sj = rj < sampleCount ? samples[rj] : 0.0f;
+
+            int stride = isInterleaved ? 2 : 1;
+            int rightOffset = isInterleaved ? 1 : residentSampleCount;
+            float si = ri < residentSampleCount ? getData(stride * ri) : 0.0f;
+            float sj = rj < residentSampleCount ? getData(stride * rj) : 0.0f;
             *leftOutput = (float)(gain * ((1.0 - f) * si + f * sj));
-            si = ri < sampleCount ? samples[sampleCount + ri] : 0.0f;
-            sj = rj < sampleCount ? samples[sampleCount + rj] : 0.0f;
+            si = ri < residentSampleCount ? getData(rightOffset + stride * ri) : 0.0f;
+            sj = rj < residentSampleCount ? getData(rightOffset + stride * rj) : 0.0f;
             *rightOutput = (float)(gain * ((1.0f - f) * si + f * sj));
         }
+
+        // as above, with any of the kernels in SampleInterpolator.h; samples outside the resident data read as zero
+        template <typename Kernel>
+        inline void interp(const Kernel& kernel, double fIndex, float *leftOutput, float *rightOutput, float gain)
+        {
+            int ri = int(fIndex);
+            interp(kernel, ri, fIndex - ri, leftOutput, rightOutput, gain);
+        }
+
+        // as above, given the index's integer part ri and fractional part f (double or float)
+        template <typename Kernel, typename Fraction>
+        inline void interp(const Kernel& kernel, int ri, Fraction f, float *leftOutput, float *rightOutput, float gain)
+        {
+            if (!hasData() || residentSampleCount == 0)
+            {
+                *leftOutput = *rightOutput = 0.0f;
+                return;
+            }
+
+            const int tapCount = Kernel::tapsBefore + 1 + Kernel::tapsAfter;
+            float left[tapCount], right[tapCount];
+            int stride = isInterleaved ? 2 : 1;
+            int rightOffset = isInterleaved ? 1 : residentSampleCount;
+            for (int k=0; k < tapCount; k++)
+            {
+                int index = ri - Kernel::tapsBefore + k;
+                bool isResident = index >= 0 && index < residentSampleCount;
+                left[k] = isResident ? getData(stride * index) : 0.0f;
+                right[k] = isResident && channelCount > 1 ? getData(rightOffset + stride * index) : left[k];
+            }
+            *leftOutput = kernel(FloatSampleReader(left), 1, Kernel::tapsBefore, f, gain);
+            *rightOutput = channelCount > 1 ? kernel(FloatSampleReader(right), 1, Kernel::tapsBefore, f, gain) : *leftOutput;
+        }
     };
     
+    // Frees float sample data: with delete[], or if release is set, by calling release(data, context), for
+    // data adopted from its creator (see CoreSampler::adoptSampleData()).
+    struct SampleDataDeleter
+    {
+        void (*release)(float *data, void *context) = 0;
+        void *context = 0;
+
+        void operator()(float *data) const
+        {
+            if (release) release(data, context);
+            else delete[] data;
+        }
+    };
+
+    // SampleStorage holds the resident sample data of one or more SampleBuffers, with its layout.
+
+    struct SampleStorage
+    {
+        SampleBuffer::SampleFormat format;
+        float sampleRate;
+        int channelCount;
+        int sampleCount;
+        int residentSampleCount;
+        bool isInterleaved;
+
+        std::unique_ptr<float[], SampleDataDeleter> samples;
+        std::unique_ptr<int16_t[]> samples16;
+        std::unique_ptr<uint8_t[]> samples24;
+
+        // the next mip level down, at half the rate, in the same format and layout, if any
+        std::shared_ptr<SampleStorage> halfRate;
+
+        // bytes of sample data held in memory, including any mip levels
+        size_t getByteCount() const
+        {
+            size_t bytesPerSample = format == SampleBuffer::kInt16 ? 2 : format == SampleBuffer::kInt24 ? 3 : 4;
+            return size_t(channelCount) * size_t(residentSampleCount) * bytesPerSample +
+                   (halfRate ? halfRate->getByteCount() : 0);
+        }
+    };
+
     // KeyMappedSampleBuffer is a derived version with added MIDI note-number and velocity ranges
     struct KeyMappedSampleBuffer : public SampleBuffer
     {
@@ -73,6 +255,32 @@ namespace DunneCore
         int noteNumber;     // closest MIDI note-number to this sample's frequency (noteFrequency)
         int minimumNoteNumber, maximumNoteNumber;     // bounding note numbers for mapping
         int minimumVelocity, maximumVelocity;       // min/max MIDI velocities for mapping
+
+        // Lazily loaded samples only (see CoreSampler::setLazyLoading()): this buffer holds just the head of
+        // the sample, and body the whole of it, once a background thread has decoded it. Voices then play the
+        // body instead, which is freed along with this buffer.
+        unsigned lazyId = 0;
+        bool isBodyRequested = false;   // rendering thread only
+        std::atomic<KeyMappedSampleBuffer*> body{nullptr};
+
+        // Pre-resampled samples only (see CoreSampler::setPreResampling()): a copy of this sample converted to
+        // another engine sample rate, in the background when the rate changed, which links to the next such copy
+        // in turn. Voices play the copy at the current rate, if there is one. Copies are freed along with this buffer.
+        std::atomic<KeyMappedSampleBuffer*> resampled{nullptr};
+
+        // this buffer, or its copy at the given rate if there is one
+        KeyMappedSampleBuffer *atSampleRate(float rate)
+        {
+            for (KeyMappedSampleBuffer *pBuf = this; pBuf; pBuf = pBuf->resampled.load(std::memory_order_acquire))
+                if (pBuf->sampleRate == rate) return pBuf;
+            return this;
+        }
+
+        ~KeyMappedSampleBuffer()
+        {
+            delete body.load();
+            delete resampled.load();
+        }
     };
 
 }
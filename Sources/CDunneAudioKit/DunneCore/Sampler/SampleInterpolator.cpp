@@ -0,0 +1,43 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#include "SampleInterpolator.h"
+#include <math.h>
+
+namespace DunneCore
+{
+
+    const SincTable& SincTable::get()
+    {
+        static const SincTable table;
+        return table;
+    }
+
+    SincTable::SincTable()
+    {
+        // cutoff, as a fraction of the Nyquist frequency: a little below 1.0, so the short kernel's
+        // transition band falls mostly above the original passband
+        const double cutoff = 0.85;
+        const double halfWidth = tapCount / 2;
+
+        for (int p=0; p <= phaseCount; p++)
+        {
+            float *c = coefficient + p * tapCount;
+            double fraction = double(p) / phaseCount;
+            double sum = 0.0;
+            for (int k=0; k < tapCount; k++)
+            {
+                // distance from the interpolated position to tap k
+                double x = (k - (tapCount / 2 - 1)) - fraction;
+                double sinc = (x == 0.0) ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+                double window = 0.42 + 0.5 * cos(M_PI * x / halfWidth) + 0.08 * cos(2.0 * M_PI * x / halfWidth);
+                if (fabs(x) >= halfWidth) window = 0.0;
+                c[k] = float(sinc * window);
+                sum += c[k];
+            }
+
+            // normalize for unity gain at DC
+            for (int k=0; k < tapCount; k++) c[k] = float(c[k] / sum);
+        }
+    }
+
+}
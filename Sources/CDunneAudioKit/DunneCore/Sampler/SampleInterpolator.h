@@ -0,0 +1,110 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+
+namespace DunneCore
+{
+
+    // How sample oscillators compute values between stored samples. Higher-order kernels attenuate
+    // the images (heard as aliasing) which linear interpolation leaves behind when samples are
+    // pitch-shifted, at the cost of reading more samples per output sample.
+
+    enum InterpolationMode
+    {
+        kLinearInterpolation,       // 2-point linear (the default)
+        kHermiteInterpolation,      // 4-point, 3rd-order Hermite (Catmull-Rom)
+        kSincInterpolation,         // 8-point Blackman-windowed sinc, from a table of polyphase filters
+        kInterpolationModeCount
+    };
+
+    // Each kernel reads samples [ri - tapsBefore, ri + tapsAfter], where ri is the integer part of the
+    // index. Kernels are function objects, templated on the sample reader (see SampleBuffer.h); stride
+    // is 2 for interleaved stereo, else 1. All produce gain * (interpolated value). Kernels which are
+    // isInterpolating return exactly gain * s[ri] at whole-sample positions (fraction 0), so oscillators
+    // playing at the original speed may copy samples rather than evaluate the kernel.
+
+    struct LinearKernel
+    {
+        static constexpr int tapsBefore = 0;
+        static constexpr int tapsAfter = 1;
+        static constexpr bool isInterpolating = true;
+
+        // double precision, exactly as SampleBuffer::interp()
+        template <typename Reader>
+        inline float operator()(Reader s, int stride, int ri, double f, float gain) const
+        {
+            return (float)(gain * ((1.0 - f) * s[stride * ri] + f * s[stride * (ri + 1)]));
+        }
+
+        // single precision, for fixed-point oscillator phases (see SampleOscillator)
+        template <typename Reader>
+        inline float operator()(Reader s, int stride, int ri, float f, float gain) const
+        {
+            return gain * ((1.0f - f) * s[stride * ri] + f * s[stride * (ri + 1)]);
+        }
+    };
+
+    struct HermiteKernel
+    {
+        static constexpr int tapsBefore = 1;
+        static constexpr int tapsAfter = 2;
+        static constexpr bool isInterpolating = true;
+
+        template <typename Reader>
+        inline float operator()(Reader s, int stride, int ri, float f, float gain) const
+        {
+            float xm1 = s[stride * (ri - 1)];
+            float x0 = s[stride * ri];
+            float x1 = s[stride * (ri + 1)];
+            float x2 = s[stride * (ri + 2)];
+            float c1 = 0.5f * (x1 - xm1);
+            float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+            float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+            return gain * (((c3 * f + c2) * f + c1) * f + x0);
+        }
+    };
+
+    // Coefficients of the windowed-sinc kernel, for phaseCount + 1 equally-spaced fractional positions;
+    // coefficients for fractions in between are interpolated linearly from the two nearest phases.
+    struct SincTable
+    {
+        static constexpr int tapCount = 8;
+        static constexpr int phaseCount = 256;
+
+        // tapCount coefficients for phase p (fraction p / phaseCount) start at coefficient[p * tapCount]
+        float coefficient[(phaseCount + 1) * tapCount];
+
+        // the single, shared table, computed the first time this is called
+        static const SincTable& get();
+
+    private:
+        SincTable();
+    };
+
+    struct SincKernel
+    {
+        static constexpr int tapsBefore = SincTable::tapCount / 2 - 1;
+        static constexpr int tapsAfter = SincTable::tapCount / 2;
+        static constexpr bool isInterpolating = false;  // its cutoff is below Nyquist, so it filters every sample
+
+        const float *coefficient;
+
+        SincKernel() : coefficient(SincTable::get().coefficient) {}
+
+        template <typename Reader>
+        inline float operator()(Reader s, int stride, int ri, float f, float gain) const
+        {
+            float phase = f * SincTable::phaseCount;
+            int p = int(phase);
+            if (p > SincTable::phaseCount - 1) p = SincTable::phaseCount - 1;  // f may round up to 1.0
+            float t = phase - p;
+            const float *c0 = coefficient + p * SincTable::tapCount;
+            const float *c1 = c0 + SincTable::tapCount;
+            float sum = 0.0f;
+            for (int k=0; k < SincTable::tapCount; k++)
+                sum += (c0[k] + t * (c1[k] - c0[k])) * s[stride * (ri - tapsBefore + k)];
+            return gain * sum;
+        }
+    };
+
+}
@@ -2,49 +2,435 @@
 
 #pragma once
 #include <math.h>
+#include <stdint.h>
 
 #include "SampleBuffer.h"
+#include "SampleStream.h"
 
 namespace DunneCore
 {
 
+    // SampleOscillator keeps its position (index) in a SampleBuffer as a double by default. Optionally
+    // (see setFixedPointPhase()) the position is instead kept as an unsigned 32.32 fixed-point phase,
+    // which advances by exact integer steps: its integer part indexes the samples directly, its fraction
+    // feeds the interpolation kernel as a float, and looping stays exact however long a note sustains.
+    // indexPoint then mirrors the phase, for code which only reads the position.
+
     struct SampleOscillator
     {
         bool isLooping;     // true until note released
         double indexPoint;  // use double so we don't lose precision when indexPoint becomes much larger than increment
         double increment;   // 1.0 = play at original speed
         double multiplier;  // multiplier applied to increment for pitch bend, vibrato
+        SampleStream *stream;   // non-null only while playing a streaming SampleBuffer
+        InterpolationMode interpolationMode;
+        bool isFixedPointPhase; // true to advance phase, rather than indexPoint
+        uint64_t phase;         // 32.32 fixed-point index, used only if isFixedPointPhase
+
+        SampleOscillator() : indexPoint(0.0), stream(0), interpolationMode(kLinearInterpolation), isFixedPointPhase(false), phase(0) {}
         
         void setPitchOffsetSemitones(double semitones) { multiplier = pow(2.0, semitones/12.0); }
+
+        // move to the given index; use this rather than setting indexPoint directly
+        void setIndexPoint(double index)
+        {
+            indexPoint = index;
+            phase = toPhase(index);
+        }
+
+        // switch between double and fixed-point positions, keeping the current position
+        void setFixedPointPhase(bool fixedPoint)
+        {
+            if (fixedPoint && !isFixedPointPhase) phase = toPhase(indexPoint);
+            isFixedPointPhase = fixedPoint;
+        }
+
+        // 32.32 fixed-point equivalent of a (non-negative) index
+        static inline uint64_t toPhase(double index) { return index > 0.0 ? uint64_t(index * 4294967296.0 + 0.5) : 0; }
         
         // return true if we run out of samples
         inline bool getSample(SampleBuffer *sampleBuffer, int sampleCount, float *output, float gain)
         {
-            if (sampleBuffer == NULL || indexPoint > sampleBuffer->endPoint) return true;
+            if (sampleBuffer == NULL || isPastEnd(sampleBuffer)) return true;
             *output = sampleBuffer->interp(indexPoint, gain);
-            
-            indexPoint += multiplier * increment;
-            if (sampleBuffer->isLooping && isLooping)
-            {
-                if (indexPoint > sampleBuffer->loopEndPoint)
-                    indexPoint = indexPoint - sampleBuffer->loopEndPoint + sampleBuffer->loopStartPoint;
-            }
+            advance(sampleBuffer);
             return false;
         }
         
         // return true if we run out of samples
         inline bool getSamplePair(SampleBuffer *sampleBuffer, int sampleCount, float *leftOutput, float *rightOutput, float gain)
         {
-            if (sampleBuffer == NULL || indexPoint > sampleBuffer->endPoint) return true;
-            sampleBuffer->interp(indexPoint, leftOutput, rightOutput, gain);
-            
+            if (sampleBuffer == NULL || isPastEnd(sampleBuffer)) return true;
+            if (isFixedPointPhase) interpFixedPoint(sampleBuffer, leftOutput, rightOutput, gain);
+            else if (interpolationMode == kLinearInterpolation)
+            {
+                if (stream) stream->interp(sampleBuffer, indexPoint, leftOutput, rightOutput, gain);
+                else sampleBuffer->interp(indexPoint, leftOutput, rightOutput, gain);
+            }
+            else interpHigherOrder(sampleBuffer, leftOutput, rightOutput, gain);
+            advance(sampleBuffer);
+            return false;
+        }
+
+        // most samples getSampleBlock() can render per call
+        static constexpr int maxBlockSize = 64;
+
+        // Render up to sampleCount (at most maxBlockSize) samples, applying per-sample gains, and return
+        // the number rendered: fewer than sampleCount means we ran out of samples. Output is identical to
+        // that of repeated getSamplePair() calls, but spans which cannot reach the end point, the loop end
+        // or the end of the buffer are rendered by a simple branch-free loop the compiler can vectorize.
+        // Not for streaming buffers. An octave or more up, buffers with mip levels are read from a lower level.
+        inline int getSampleBlock(SampleBuffer *sampleBuffer, int sampleCount, float *leftOutput, float *rightOutput, const float *gain)
+        {
+            if (sampleBuffer && sampleBuffer->mipLevel && multiplier * increment >= 2.0)
+                return renderMipLevelBlock(sampleBuffer, sampleCount, leftOutput, rightOutput, gain);
+            if (isFixedPointPhase)
+            {
+                switch (interpolationMode)
+                {
+                    case kHermiteInterpolation:
+                        return renderBlockFixed(HermiteKernel(), sampleBuffer, sampleCount, leftOutput, rightOutput, gain);
+                    case kSincInterpolation:
+                        return renderBlockFixed(SincKernel(), sampleBuffer, sampleCount, leftOutput, rightOutput, gain);
+                    default:
+                        return renderBlockFixed(LinearKernel(), sampleBuffer, sampleCount, leftOutput, rightOutput, gain);
+                }
+            }
+            switch (interpolationMode)
+            {
+                case kHermiteInterpolation:
+                    return renderBlock(HermiteKernel(), sampleBuffer, sampleCount, leftOutput, rightOutput, gain);
+                case kSincInterpolation:
+                    return renderBlock(SincKernel(), sampleBuffer, sampleCount, leftOutput, rightOutput, gain);
+                default:
+                    return renderBlock(LinearKernel(), sampleBuffer, sampleCount, leftOutput, rightOutput, gain);
+            }
+        }
+
+    protected:
+        // getSampleBlock() from the mip level where the step is under 2.0 (or the lowest there is), L levels down:
+        // positions and increment are scaled by 2^-L for the block and back afterwards, exactly, being powers of two
+        inline int renderMipLevelBlock(SampleBuffer *sampleBuffer, int sampleCount, float *leftOutput, float *rightOutput, const float *gain)
+        {
+            SampleBuffer *pLevel = sampleBuffer;
+            int level = 0;
+            for (double step = multiplier * increment; pLevel->mipLevel && step >= 2.0; step *= 0.5)
+            {
+                pLevel = pLevel->mipLevel.get();
+                level++;
+            }
+            double scale = 1.0 / double(1 << level);
+            double fullIncrement = increment;
+            uint64_t lowBits = phase & ((uint64_t(1) << level) - 1);
+            indexPoint *= scale;
+            phase >>= level;
+            increment *= scale;
+
+            int done = getSampleBlock(pLevel, sampleCount, leftOutput, rightOutput, gain);
+
+            increment = fullIncrement;
+            phase = (phase << level) | lowBits;
+            if (isFixedPointPhase) indexPoint = phaseToIndex(phase);
+            else indexPoint /= scale;
+            return done;
+        }
+
+        inline bool isPastEnd(SampleBuffer *sampleBuffer)
+        {
+            if (isFixedPointPhase) return phase > toPhase(sampleBuffer->endPoint);
+            return indexPoint > sampleBuffer->endPoint;
+        }
+
+        // step forward by one output sample, wrapping around the loop if need be
+        inline void advance(SampleBuffer *sampleBuffer)
+        {
+            if (isFixedPointPhase)
+            {
+                phase += toPhase(multiplier * increment);
+                if (sampleBuffer->isLooping && isLooping)
+                {
+                    uint64_t loopEnd = toPhase(sampleBuffer->loopEndPoint);
+                    if (phase > loopEnd) phase = phase - loopEnd + toPhase(sampleBuffer->loopStartPoint);
+                }
+                indexPoint = phaseToIndex(phase);
+                return;
+            }
+
             indexPoint += multiplier * increment;
             if (sampleBuffer->isLooping && isLooping)
             {
                 if (indexPoint > sampleBuffer->loopEndPoint)
                     indexPoint = indexPoint - sampleBuffer->loopEndPoint + sampleBuffer->loopStartPoint;
             }
-            return false;
+        }
+
+        // positions as used by renderSpan(): either double indices, or 32.32 fixed-point phases
+        static inline double phaseToIndex(uint64_t position) { return double(position) * (1.0 / 4294967296.0); }
+        static inline int integerPart(double position) { return int(position); }
+        static inline double fractionalPart(double position) { return position - int(position); }
+        static inline int integerPart(uint64_t position) { return int(position >> 32); }
+        // only the top 24 bits of the fraction, which convert to float exactly (so f never rounds up to 1.0)
+        static inline float fractionalPart(uint64_t position) { return float(uint32_t(position) >> 8) * (1.0f / 16777216.0f); }
+
+        void interpHigherOrder(SampleBuffer *sampleBuffer, float *leftOutput, float *rightOutput, float gain)
+        {
+            if (interpolationMode == kHermiteInterpolation)
+                interp(HermiteKernel(), sampleBuffer, leftOutput, rightOutput, gain);
+            else
+                interp(SincKernel(), sampleBuffer, leftOutput, rightOutput, gain);
+        }
+
+        template <typename Kernel>
+        inline void interp(const Kernel& kernel, SampleBuffer *sampleBuffer, float *leftOutput, float *rightOutput, float gain)
+        {
+            if (stream) stream->interp(kernel, sampleBuffer, indexPoint, leftOutput, rightOutput, gain);
+            else sampleBuffer->interp(kernel, indexPoint, leftOutput, rightOutput, gain);
+        }
+
+        // at the fixed-point phase, with the same arithmetic as renderSpan()
+        void interpFixedPoint(SampleBuffer *sampleBuffer, float *leftOutput, float *rightOutput, float gain)
+        {
+            switch (interpolationMode)
+            {
+                case kHermiteInterpolation:
+                    interpFixedPoint(HermiteKernel(), sampleBuffer, leftOutput, rightOutput, gain);
+                    break;
+                case kSincInterpolation:
+                    interpFixedPoint(SincKernel(), sampleBuffer, leftOutput, rightOutput, gain);
+                    break;
+                default:
+                    interpFixedPoint(LinearKernel(), sampleBuffer, leftOutput, rightOutput, gain);
+                    break;
+            }
+        }
+
+        template <typename Kernel>
+        inline void interpFixedPoint(const Kernel& kernel, SampleBuffer *sampleBuffer, float *leftOutput, float *rightOutput, float gain)
+        {
+            float f = fractionalPart(phase);
+            if (stream) stream->interp(kernel, sampleBuffer, int64_t(phase >> 32), f, leftOutput, rightOutput, gain);
+            else sampleBuffer->interp(kernel, integerPart(phase), f, leftOutput, rightOutput, gain);
+        }
+
+        // getSampleBlock() for a given interpolation kernel
+        template <typename Kernel>
+        inline int renderBlock(const Kernel& kernel, SampleBuffer *sampleBuffer, int sampleCount,
+                               float *leftOutput, float *rightOutput, const float *gain)
+        {
+            double position[maxBlockSize + 1];
+            int done = 0;
+            while (done < sampleCount)
+            {
+                if (sampleBuffer == NULL || indexPoint > sampleBuffer->endPoint) return done;
+
+                int remaining = sampleCount - done;
+                double step = multiplier * increment;
+                bool mayWrap = sampleBuffer->isLooping && isLooping;
+                int n = 0;
+                if (sampleBuffer->hasData() && step > 0.0 && indexPoint >= Kernel::tapsBefore)
+                {
+                    // estimate how far we can go without crossing a boundary...
+                    int lastSafeIndex = sampleBuffer->residentSampleCount - Kernel::tapsAfter;
+                    double limit = sampleBuffer->endPoint;
+                    if (limit > lastSafeIndex) limit = lastSafeIndex;
+                    if (mayWrap && limit > sampleBuffer->loopEndPoint - step) limit = sampleBuffer->loopEndPoint - step;
+                    double estimate = (limit - indexPoint) / step;
+                    n = estimate < remaining ? int(estimate) : remaining;
+                    if (n < 0) n = 0;
+
+                    // ...then find positions just as getSamplePair() would, and back off if the estimate
+                    // was too generous; positions only increase, so only the last one need be checked
+                    double x = indexPoint;
+                    for (int i=0; i < n; i++) { position[i] = x; x += step; }
+                    position[n] = x;
+                    while (n > 0 && !(position[n - 1] <= sampleBuffer->endPoint &&
+                                      position[n - 1] < lastSafeIndex &&
+                                      (!mayWrap || position[n] <= sampleBuffer->loopEndPoint))) n--;
+                }
+
+                if (n == 0)
+                {
+                    // at (or very near) a boundary: take one sample the careful way
+                    if (getSamplePair(sampleBuffer, 1, leftOutput + done, rightOutput + done, gain[done])) return done;
+                    done++;
+                    continue;
+                }
+
+                if (Kernel::isInterpolating && step == 1.0 && position[0] == double(integerPart(position[0])))
+                    copySpan(sampleBuffer, n, integerPart(position[0]), gain + done, leftOutput + done, rightOutput + done);
+                else
+                    renderSpan(kernel, sampleBuffer, n, position, gain + done, leftOutput + done, rightOutput + done);
+                indexPoint = position[n];
+                done += n;
+            }
+            return done;
+        }
+
+        // renderBlock(), for fixed-point phases: the number of samples before the next boundary is
+        // found exactly by integer division, so no positions need to be checked afterwards
+        template <typename Kernel>
+        inline int renderBlockFixed(const Kernel& kernel, SampleBuffer *sampleBuffer, int sampleCount,
+                                    float *leftOutput, float *rightOutput, const float *gain)
+        {
+            uint64_t position[maxBlockSize];
+            int done = 0;
+            while (done < sampleCount)
+            {
+                if (sampleBuffer == NULL || isPastEnd(sampleBuffer)) return done;
+
+                int remaining = sampleCount - done;
+                uint64_t step = toPhase(multiplier * increment);
+                bool mayWrap = sampleBuffer->isLooping && isLooping;
+                int lastSafeIndex = sampleBuffer->residentSampleCount - Kernel::tapsAfter;
+                int n = 0;
+                if (sampleBuffer->hasData() && step > 0 && lastSafeIndex > 0 && integerPart(phase) >= Kernel::tapsBefore)
+                {
+                    // the last phase which is at most endPoint, below lastSafeIndex, and (when looping)
+                    // does not step past the loop end
+                    uint64_t limit = toPhase(sampleBuffer->endPoint);
+                    uint64_t safeLimit = (uint64_t(lastSafeIndex) << 32) - 1;
+                    if (limit > safeLimit) limit = safeLimit;
+                    if (mayWrap)
+                    {
+                        uint64_t loopEnd = toPhase(sampleBuffer->loopEndPoint);
+                        if (loopEnd < step) limit = 0;
+                        else if (limit > loopEnd - step) limit = loopEnd - step;
+                    }
+                    if (phase <= limit)
+                    {
+                        uint64_t count = (limit - phase) / step + 1;
+                        n = count < uint64_t(remaining) ? int(count) : remaining;
+                    }
+                }
+
+                if (n == 0)
+                {
+                    // at a boundary: take one sample the careful way
+                    if (getSamplePair(sampleBuffer, 1, leftOutput + done, rightOutput + done, gain[done])) return done;
+                    done++;
+                    continue;
+                }
+
+                if (Kernel::isInterpolating && step == (uint64_t(1) << 32) && uint32_t(phase) == 0)
+                    copySpan(sampleBuffer, n, integerPart(phase), gain + done, leftOutput + done, rightOutput + done);
+                else
+                {
+                    for (int i=0; i < n; i++) position[i] = phase + i * step;
+                    renderSpan(kernel, sampleBuffer, n, position, gain + done, leftOutput + done, rightOutput + done);
+                }
+                phase += n * step;
+                indexPoint = phaseToIndex(phase);
+                done += n;
+            }
+            return done;
+        }
+
+        // renderSpan() for the sample buffer's storage format
+        template <typename Kernel, typename Position>
+        static inline void renderSpan(const Kernel& kernel, SampleBuffer *sampleBuffer, int n, const Position *position,
+                                      const float *pGain, float *pOutLeft, float *pOutRight)
+        {
+            switch (sampleBuffer->format)
+            {
+                case SampleBuffer::kInt16:
+                    renderSpan(kernel, Int16SampleReader(sampleBuffer->samples16), sampleBuffer, n, position, pGain, pOutLeft, pOutRight);
+                    break;
+                case SampleBuffer::kInt24:
+                    renderSpan(kernel, Int24SampleReader(sampleBuffer->samples24), sampleBuffer, n, position, pGain, pOutLeft, pOutRight);
+                    break;
+                default:
+                    renderSpan(kernel, FloatSampleReader(sampleBuffer->samples), sampleBuffer, n, position, pGain, pOutLeft, pOutRight);
+                    break;
+            }
+        }
+
+        // Playing at the original speed from a whole-sample position (as pre-resampled samples do at their
+        // own pitch; see CoreSampler::setPreResampling()), every position is a whole sample, where interpolating
+        // kernels give back the sample itself: so copy n frames from frame first, applying only the gains.
+        // The output is identical to renderSpan()'s.
+        static inline void copySpan(SampleBuffer *sampleBuffer, int n, int first,
+                                    const float *pGain, float *pOutLeft, float *pOutRight)
+        {
+            switch (sampleBuffer->format)
+            {
+                case SampleBuffer::kInt16:
+                    copySpan(Int16SampleReader(sampleBuffer->samples16), sampleBuffer, n, first, pGain, pOutLeft, pOutRight);
+                    break;
+                case SampleBuffer::kInt24:
+                    copySpan(Int24SampleReader(sampleBuffer->samples24), sampleBuffer, n, first, pGain, pOutLeft, pOutRight);
+                    break;
+                default:
+                    copySpan(FloatSampleReader(sampleBuffer->samples), sampleBuffer, n, first, pGain, pOutLeft, pOutRight);
+                    break;
+            }
+        }
+
+        template <typename Reader>
+        static inline void copySpan(Reader pLeft, SampleBuffer *sampleBuffer, int n, int first,
+                                    const float *pGain, float *pOutLeft, float *pOutRight)
+        {
+            if (sampleBuffer->channelCount == 1)
+            {
+                Reader s = pLeft.offset(first);
+                for (int i=0; i < n; i++) pOutLeft[i] = pOutRight[i] = pGain[i] * s[i];
+            }
+            else if (sampleBuffer->isInterleaved)
+            {
+                Reader s = pLeft.offset(2 * first);
+                for (int i=0; i < n; i++)
+                {
+                    pOutLeft[i] = pGain[i] * s[2 * i];
+                    pOutRight[i] = pGain[i] * s[2 * i + 1];
+                }
+            }
+            else
+            {
+                Reader sl = pLeft.offset(first);
+                Reader sr = pLeft.offset(sampleBuffer->residentSampleCount + first);
+                for (int i=0; i < n; i++)
+                {
+                    pOutLeft[i] = pGain[i] * sl[i];
+                    pOutRight[i] = pGain[i] * sr[i];
+                }
+            }
+        }
+
+        // the branch-free part of getSampleBlock(), for n positions known to be safely inside the buffer
+        template <typename Kernel, typename Reader, typename Position>
+        static inline void renderSpan(const Kernel& kernel, Reader pLeft, SampleBuffer *sampleBuffer, int n,
+                                      const Position *position, const float *pGain, float *pOutLeft, float *pOutRight)
+        {
+            if (sampleBuffer->channelCount == 1)
+            {
+                for (int i=0; i < n; i++)
+                {
+                    int ri = integerPart(position[i]);
+                    auto f = fractionalPart(position[i]);
+                    pOutLeft[i] = pOutRight[i] = kernel(pLeft, 1, ri, f, pGain[i]);
+                }
+            }
+            else if (sampleBuffer->isInterleaved)
+            {
+                Reader pRight = pLeft.offset(1);
+                for (int i=0; i < n; i++)
+                {
+                    int ri = integerPart(position[i]);
+                    auto f = fractionalPart(position[i]);
+                    pOutLeft[i] = kernel(pLeft, 2, ri, f, pGain[i]);
+                    pOutRight[i] = kernel(pRight, 2, ri, f, pGain[i]);
+                }
+            }
+            else
+            {
+                Reader pRight = pLeft.offset(sampleBuffer->residentSampleCount);
+                for (int i=0; i < n; i++)
+                {
+                    int ri = integerPart(position[i]);
+                    auto f = fractionalPart(position[i]);
+                    pOutLeft[i] = kernel(pLeft, 1, ri, f, pGain[i]);
+                    pOutRight[i] = kernel(pRight, 1, ri, f, pGain[i]);
+                }
+            }
         }
     };
 
@@ -0,0 +1,173 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#include "SamplePool.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace DunneCore
+{
+
+    SamplePool& SamplePool::shared()
+    {
+        static SamplePool pool;
+        return pool;
+    }
+
+    std::shared_ptr<SampleStorage> SamplePool::find(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        return it == entries.end() ? nullptr : it->second.storage.lock();
+    }
+
+    std::shared_ptr<SampleStorage> SamplePool::obtain(const std::string& key,
+                                                      const std::function<std::shared_ptr<SampleStorage>()>& load)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            Entry &entry = entries[key];
+            if (!entry.isLoading)
+            {
+                std::shared_ptr<SampleStorage> storage = entry.storage.lock();
+                if (storage) return storage;
+                entry.isLoading = true;
+                break;
+            }
+            loaded.wait(lock);
+        }
+
+        lock.unlock();
+        std::shared_ptr<SampleStorage> storage;
+        try
+        {
+            storage = load();
+        }
+        catch (...)
+        {
+            // don't leave waiters waiting for good (e.g. after std::bad_alloc): the next of them loads instead
+            lock.lock();
+            entries[key].isLoading = false;
+            removeExpiredEntries();
+            loaded.notify_all();
+            throw;
+        }
+        lock.lock();
+
+        // entries may have been added meanwhile, but std::map never moves existing ones
+        Entry &entry = entries[key];
+        entry.isLoading = false;
+        entry.storage = storage;
+        removeExpiredEntries();
+        loaded.notify_all();
+        return storage;
+    }
+
+    int SamplePool::getEntryCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        removeExpiredEntries();
+        return int(entries.size());
+    }
+
+    size_t SamplePool::getByteCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t byteCount = 0;
+        for (auto &item : entries)
+        {
+            std::shared_ptr<SampleStorage> storage = item.second.storage.lock();
+            if (storage) byteCount += storage->getByteCount();
+        }
+        return byteCount;
+    }
+
+    // two independent 64-bit multiply-xorshift hashes of a file's bytes, 8 at a time, and its length in bytes
+    static std::string hashFile(const char *path)
+    {
+        FILE *pFile = fopen(path, "rb");
+        if (pFile == 0) return std::string();
+
+        uint64_t hashA = 0x243F6A8885A308D3ull, hashB = 0x13198A2E03707344ull;
+        long long length = 0;
+        const size_t chunkSize = 1 << 16;
+        std::unique_ptr<uint8_t[]> chunk(new uint8_t[chunkSize + 8]);
+        for (;;)
+        {
+            size_t count = fread(chunk.get(), 1, chunkSize, pFile);
+            if (count == 0) break;
+            length += (long long)count;
+            memset(chunk.get() + count, 0, 8);      // pad the last word of the file with zeros
+            for (size_t i=0; i < count; i += 8)
+            {
+                uint64_t word;
+                memcpy(&word, chunk.get() + i, 8);
+                hashA = (hashA ^ word) * 0x9E3779B97F4A7C15ull;
+                hashA ^= hashA >> 29;
+                hashB = (hashB ^ word) * 0xC2B2AE3D27D4EB4Full;
+                hashB ^= hashB >> 31;
+            }
+        }
+        bool isReadError = ferror(pFile) != 0;
+        fclose(pFile);
+        if (isReadError) return std::string();
+
+        char key[80];
+        snprintf(key, sizeof(key), "#%lld:%016llx%016llx", length, (unsigned long long)hashA, (unsigned long long)hashB);
+        return key;
+    }
+
+    std::string SamplePool::getFileContentKey(const char *path, const std::string& identity)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = contentKeys.find(identity);
+            if (it != contentKeys.end()) return it->second;
+        }
+
+        // hashed without the lock held; a file hashed by two threads at once just gets the same key twice
+        std::string key = hashFile(path);
+        if (key.empty()) return key;
+        std::lock_guard<std::mutex> lock(mutex);
+        contentKeys[identity] = key;
+        return key;
+    }
+
+    // call with the lock held: forget entries whose storage has been freed, and the content keys of files no
+    // entry is loaded from any more (a file loaded again is simply hashed again). A content key begins the key
+    // of every entry loaded from that content, which sorts first among them.
+    void SamplePool::removeExpiredEntries()
+    {
+        std::vector<std::string> expiredKeys;
+        for (auto it = entries.begin(); it != entries.end(); )
+        {
+            if (it->second.isLoading || !it->second.storage.expired())
+            {
+                ++it;
+                continue;
+            }
+            if (!contentKeys.empty()) expiredKeys.push_back(it->first);
+            it = entries.erase(it);
+        }
+        if (expiredKeys.empty()) return;
+
+        // content keys just hashed, whose entries are yet to be added, are left alone
+        auto begins = [](const std::string& key, const std::string& prefix) {
+            return key.compare(0, prefix.size(), prefix) == 0;
+        };
+        for (auto it = contentKeys.begin(); it != contentKeys.end(); )
+        {
+            const std::string &contentKey = it->second;
+            auto entry = entries.lower_bound(contentKey);
+            bool isUsed = entry != entries.end() && begins(entry->first, contentKey);
+            bool wasUsed = std::any_of(expiredKeys.begin(), expiredKeys.end(),
+                                       [&](const std::string& key) { return begins(key, contentKey); });
+            if (wasUsed && !isUsed) it = contentKeys.erase(it);
+            else ++it;
+        }
+    }
+
+}
@@ -0,0 +1,65 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "SampleBuffer.h"
+
+namespace DunneCore
+{
+
+    // SamplePool lets every CoreSampler in the process share the sample data of identical samples, so
+    // memory scales with the number of distinct samples rather than of instruments loaded. Entries are
+    // keyed by a string describing both the source (e.g. file path) and everything which affects the
+    // stored data (resident length, storage format and layout). The pool holds only weak references:
+    // each SampleStorage is freed as soon as the last buffer using it is, and its entry then lapses.
+    //
+    // A source may also be identified by its content rather than its path (see getFileContentKey()), so
+    // identical files stored under different names share their data too.
+
+    class SamplePool
+    {
+    public:
+        // the process-wide pool
+        static SamplePool& shared();
+
+        // the live storage for key, or null
+        std::shared_ptr<SampleStorage> find(const std::string& key);
+
+        // the live storage for key, else the result of load() (which runs without the lock held), stored
+        // under key unless null; callers asking for a key which is already loading wait for that result. If
+        // load() throws, the exception propagates, and the next waiter (if any) loads instead.
+        std::shared_ptr<SampleStorage> obtain(const std::string& key,
+                                              const std::function<std::shared_ptr<SampleStorage>()>& load);
+
+        // number of live entries, and the bytes of sample data they hold
+        int getEntryCount();
+        size_t getByteCount();
+
+        // a source key for the content of the file at path (see CoreSampler::setContentDeduplication()): its
+        // length and a 128-bit hash of its bytes, or empty if it cannot be read. Each file is read only once,
+        // then its key remembered by identity (which must change whenever the file does, e.g. path, size and
+        // modification time), for as long as an entry loaded from that content lives.
+        std::string getFileContentKey(const char *path, const std::string& identity);
+
+    protected:
+        struct Entry
+        {
+            std::weak_ptr<SampleStorage> storage;
+            bool isLoading = false;
+        };
+
+        std::mutex mutex;
+        std::condition_variable loaded;
+        std::map<std::string, Entry> entries;
+        std::map<std::string, std::string> contentKeys;     // by file identity
+
+        void removeExpiredEntries();
+    };
+
+}
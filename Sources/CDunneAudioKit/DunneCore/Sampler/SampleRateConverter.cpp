@@ -0,0 +1,95 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#include "SampleRateConverter.h"
+#include <math.h>
+
+// cutoff, as a fraction of the lower Nyquist frequency, leaving room for the transition band
+#define SRC_CUTOFF 0.95
+
+// Kaiser window shape: about 85 dB of stopband attenuation
+#define SRC_KAISER_BETA 8.5
+
+namespace DunneCore
+{
+
+    // zeroth-order modified Bessel function of the first kind, by its power series
+    static double besselI0(double x)
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k=1; k < 50 && term > 1.0e-12 * sum; k++)
+        {
+            double factor = x / (2.0 * k);
+            term *= factor * factor;
+            sum += term;
+        }
+        return sum;
+    }
+
+    const float *SampleRateConverter::getTable()
+    {
+        struct Table
+        {
+            // one entry past the end, which is zero, so lookups need not check for it
+            float entry[zeroCrossings * tableResolution + 2];
+
+            Table()
+            {
+                const int size = zeroCrossings * tableResolution;
+                double norm = besselI0(SRC_KAISER_BETA);
+                for (int i=0; i <= size; i++)
+                {
+                    double x = double(i) / tableResolution;     // in zero crossings
+                    double r = x / zeroCrossings;
+                    double sinc = (i == 0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+                    entry[i] = float(sinc * besselI0(SRC_KAISER_BETA * sqrt(1.0 - r * r)) / norm);
+                }
+                entry[size] = entry[size + 1] = 0.0f;
+            }
+        };
+        static const Table table;
+        return table.entry;
+    }
+
+    SampleRateConverter::SampleRateConverter(double inputRate, double outputRate)
+    : step(inputRate / outputRate)
+    , table(getTable())
+    {
+        scale = SRC_CUTOFF * (outputRate < inputRate ? outputRate / inputRate : 1.0);
+        halfWidth = zeroCrossings / scale;
+    }
+
+    int SampleRateConverter::getOutputLength(int inputLength) const
+    {
+        if (inputLength <= 0) return 0;
+        return int((inputLength - 1) / step + 1.0e-9) + 1;
+    }
+
+    void SampleRateConverter::convert(const float *input, int inputLength, int inputStride, float *output) const
+    {
+        const int tableEnd = zeroCrossings * tableResolution;
+        const double tableStep = scale * tableResolution;
+        int outputLength = getOutputLength(inputLength);
+        for (int n=0; n < outputLength; n++)
+        {
+            // the input samples within the kernel's reach of this output's position t
+            double t = n * step;
+            int first = int(ceil(t - halfWidth));
+            int last = int(floor(t + halfWidth));
+            if (first < 0) first = 0;
+            if (last > inputLength - 1) last = inputLength - 1;
+
+            float sum = 0.0f;
+            for (int k=first; k <= last; k++)
+            {
+                double x = fabs(t - k) * tableStep;
+                int i = int(x);
+                if (i >= tableEnd) continue;
+                float f = float(x - i);
+                float weight = table[i] + f * (table[i + 1] - table[i]);
+                sum += weight * input[k * inputStride];
+            }
+            output[n] = float(sum * scale);
+        }
+    }
+
+}
@@ -0,0 +1,46 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+
+namespace DunneCore
+{
+
+    // SampleRateConverter converts whole channels of sample data from one rate to another, ahead of time (see
+    // CoreSampler::setPreResampling()), so voices need not interpolate across the difference on every note.
+    //
+    // Each output sample is the sum of the input samples within zeroCrossings (scaled up when downsampling) of
+    // its position, weighted by a Kaiser-windowed sinc. The weights come from one finely sampled table of the
+    // kernel, interpolated linearly between entries: a polyphase filter with practically any number of phases,
+    // so any pair of rates can be converted. The cutoff sits just below the lower of the two Nyquist frequencies,
+    // so downsampling does not alias, and the window keeps images and aliases some 85 dB down.
+
+    class SampleRateConverter
+    {
+    public:
+        // kernel length either side of centre, in zero crossings
+        static constexpr int zeroCrossings = 64;
+
+        // table entries per zero crossing
+        static constexpr int tableResolution = 512;
+
+        SampleRateConverter(double inputRate, double outputRate);
+
+        // number of output samples for inputLength input samples: enough to span the same time, so input
+        // sample i maps to output position i * outputRate / inputRate
+        int getOutputLength(int inputLength) const;
+
+        // convert one channel, whose samples are inputStride apart, writing getOutputLength(inputLength)
+        // contiguous samples to output; input beyond either end is taken as silence
+        void convert(const float *input, int inputLength, int inputStride, float *output) const;
+
+    protected:
+        double step;        // input samples per output sample
+        double scale;       // kernel zero crossings per input sample: 1.0, or less when downsampling
+        double halfWidth;   // kernel reach either side of centre, in input samples
+        const float *table; // the kernel, from 0 to zeroCrossings, tableResolution entries per crossing
+
+        // the shared kernel table, computed the first time this is called
+        static const float *getTable();
+    };
+
+}
@@ -0,0 +1,175 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include "SampleBuffer.h"
+#include "Semaphore.h"
+
+namespace DunneCore
+{
+
+    // SampleStream is a per-voice, single-producer/single-consumer ring of sample frames, which
+    // continues a streaming SampleBuffer beyond its resident head. The audio thread (consumer) calls
+    // start() when its voice begins playing a streaming buffer, and releases frames as the voice's
+    // oscillator advances. The SampleStreamer thread (producer) decodes frames into the ring.
+    //
+    // All frame indices are absolute positions in the sample; the ring holds frames in
+    // [readFrame, writeFrame), with each frame at slot (frameIndex % capacity). The streamer sleeps until
+    // signalled: by start(), or by endChunk() once the voice has freed room for another refillFrames.
+
+    struct SampleStream
+    {
+        // frames the streamer decodes at a time, and the least free space worth waking it for
+        static constexpr int refillFrames = 4096;
+
+        SampleStream();
+
+        // allocate a ring of capacity frames (a power of two), and the streamer's wake-up semaphore;
+        // call only before any voice uses the stream
+        void init(int ringCapacity, Semaphore *pRefillRequested);
+
+        // audio thread: begin streaming the given buffer for a voice starting at startIndex
+        void start(SampleBuffer *buffer, double startIndex);
+
+        // audio thread: voice no longer needs any frames
+        void stop() { start(0, 0.0); }
+
+        // audio thread: call at the start of each chunk, to see how far the streamer has got
+        inline void beginChunk()
+        {
+            isReady = readyGeneration.load(std::memory_order_acquire) == generation;
+            availableFrames = isReady ? writeFrame.load(std::memory_order_acquire) : 0;
+        }
+
+        // frames behind the current position which interpolation kernels may still read
+        static constexpr int historyFrames = SincKernel::tapsBefore;
+
+        // audio thread: call at the end of each chunk, to free frames already passed by the oscillator,
+        // and wake the streamer if there is now room to refill, unless it has been asked already and
+        // delivered nothing since
+        inline void endChunk(double indexPoint)
+        {
+            int64_t frame = int64_t(indexPoint) - historyFrames;
+            if (frame > consumedFrame)
+            {
+                consumedFrame = frame;
+                readFrame.store(frame, std::memory_order_release);
+            }
+            if (isReady && availableFrames != refillRequestFrame &&
+                capacity - (availableFrames - consumedFrame) >= refillFrames)
+            {
+                refillRequestFrame = availableFrames;
+                refillRequested->signal();
+            }
+        }
+
+        // fetch one frame from the resident head or the ring; returns false on underrun
+        inline bool getFrame(SampleBuffer *buffer, int64_t frameIndex, float *left, float *right)
+        {
+            if (frameIndex < 0)
+            {
+                *left = *right = 0.0f;
+                return true;
+            }
+            if (frameIndex < buffer->residentSampleCount)
+            {
+                int index = int(frameIndex);
+                if (buffer->isInterleaved)
+                {
+                    *left = buffer->getData(2 * index);
+                    *right = buffer->getData(2 * index + 1);
+                }
+                else
+                {
+                    *left = buffer->getData(index);
+                    *right = buffer->channelCount > 1 ? buffer->getData(buffer->residentSampleCount + index) : *left;
+                }
+                return true;
+            }
+            if (frameIndex >= buffer->sampleCount)
+            {
+                *left = *right = 0.0f;
+                return true;
+            }
+            if (frameIndex >= availableFrames)
+            {
+                *left = *right = 0.0f;
+                return false;
+            }
+            int slot = int(frameIndex & (capacity - 1));
+            *left = ring[slot];
+            *right = buffer->channelCount > 1 ? ring[capacity + slot] : *left;
+            return true;
+        }
+
+        // same arithmetic as SampleBuffer::interp(), but reading past the resident head
+        inline void interp(SampleBuffer *buffer, double fIndex, float *leftOutput, float *rightOutput, float gain)
+        {
+            int64_t ri = int64_t(fIndex);
+            double f = fIndex - ri;
+
+            float li, ri_, lj, rj;
+            bool ok = getFrame(buffer, ri, &li, &ri_);
+            if (!getFrame(buffer, ri + 1, &lj, &rj)) ok = false;
+            if (!ok) underrunCount.fetch_add(1, std::memory_order_relaxed);
+
+            *leftOutput = (float)(gain * ((1.0 - f) * li + f * lj));
+            *rightOutput = (float)(gain * ((1.0f - f) * ri_ + f * rj));
+        }
+
+        // as above, with any of the kernels in SampleInterpolator.h
+        template <typename Kernel>
+        inline void interp(const Kernel& kernel, SampleBuffer *buffer, double fIndex, float *leftOutput, float *rightOutput, float gain)
+        {
+            int64_t ri = int64_t(fIndex);
+            interp(kernel, buffer, ri, fIndex - ri, leftOutput, rightOutput, gain);
+        }
+
+        // as above, given the index's integer part ri and fractional part f (double or float)
+        template <typename Kernel, typename Fraction>
+        inline void interp(const Kernel& kernel, SampleBuffer *buffer, int64_t ri, Fraction f, float *leftOutput, float *rightOutput, float gain)
+        {
+            const int tapCount = Kernel::tapsBefore + 1 + Kernel::tapsAfter;
+            float left[tapCount], right[tapCount];
+
+            bool ok = true;
+            for (int k=0; k < tapCount; k++)
+                if (!getFrame(buffer, ri - Kernel::tapsBefore + k, &left[k], &right[k])) ok = false;
+            if (!ok) underrunCount.fetch_add(1, std::memory_order_relaxed);
+
+            *leftOutput = kernel(FloatSampleReader(left), 1, Kernel::tapsBefore, f, gain);
+            *rightOutput = kernel(FloatSampleReader(right), 1, Kernel::tapsBefore, f, gain);
+        }
+
+        // number of output samples rendered with frames the streamer had not yet delivered
+        std::atomic<unsigned> underrunCount;
+
+    protected:
+        friend class SampleStreamer;
+
+        // planar: left channel in [0, capacity), right in [capacity, 2 * capacity)
+        std::unique_ptr<float[]> ring;
+        int capacity;
+        Semaphore *refillRequested;
+
+        // written by the audio thread only
+        std::atomic<SampleBuffer*> requestedBuffer;
+        std::atomic<unsigned> requestGeneration;
+        std::atomic<int64_t> readFrame;
+
+        // written by the streamer thread only
+        std::atomic<unsigned> readyGeneration;
+        std::atomic<int64_t> writeFrame;
+
+        // audio thread's private state
+        unsigned generation;
+        int64_t consumedFrame;
+        bool isReady;
+        int64_t availableFrames;
+        int64_t refillRequestFrame;     // availableFrames when the streamer was last asked to refill
+    };
+
+}
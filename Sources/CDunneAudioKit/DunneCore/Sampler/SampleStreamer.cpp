@@ -0,0 +1,174 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#include "SampleStreamer.h"
+
+namespace DunneCore
+{
+
+    SampleStream::SampleStream()
+    : underrunCount(0)
+    , capacity(0)
+    , refillRequested(0)
+    , requestedBuffer(0)
+    , requestGeneration(0)
+    , readFrame(0)
+    , readyGeneration(0)
+    , writeFrame(0)
+    , generation(0)
+    , consumedFrame(0)
+    , isReady(false)
+    , availableFrames(0)
+    , refillRequestFrame(0)
+    {
+    }
+
+    void SampleStream::init(int ringCapacity, Semaphore *pRefillRequested)
+    {
+        capacity = ringCapacity;
+        ring.reset(new float[2 * capacity]);
+        refillRequested = pRefillRequested;
+    }
+
+    void SampleStream::start(SampleBuffer *buffer, double startIndex)
+    {
+        // frames in the resident head are never needed from the ring
+        consumedFrame = buffer ? buffer->residentSampleCount : 0;
+        if (int64_t(startIndex) > consumedFrame) consumedFrame = int64_t(startIndex);
+        readFrame.store(consumedFrame, std::memory_order_relaxed);
+        requestedBuffer.store(buffer, std::memory_order_relaxed);
+
+        // the streamer will see all of the above once it sees the new generation
+        generation++;
+        requestGeneration.store(generation, std::memory_order_release);
+        isReady = false;
+        availableFrames = 0;
+        refillRequestFrame = 0;
+        if (refillRequested) refillRequested->signal();
+    }
+
+    SampleStreamer::SampleStreamer(int count, int frames)
+    : streamCount(count)
+    , ringFrames(2 * SampleStream::refillFrames)
+    , streams(new SampleStream[count])
+    , readers(new ReaderState[count])
+    , scratch(new float[2 * SampleStream::refillFrames])
+    , openFailureCount(0)
+    , isRunning(true)
+    {
+        while (ringFrames < frames) ringFrames *= 2;
+        for (int i = 0; i < streamCount; i++) streams[i].init(ringFrames, &refillRequested);
+        thread = std::thread(&SampleStreamer::run, this);
+    }
+
+    SampleStreamer::~SampleStreamer()
+    {
+        isRunning.store(false, std::memory_order_release);
+        refillRequested.signal();
+        if (thread.joinable()) thread.join();
+    }
+
+    unsigned SampleStreamer::getUnderrunCount()
+    {
+        unsigned total = 0;
+        for (int i = 0; i < streamCount; i++)
+            total += streams[i].underrunCount.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    bool SampleStreamer::isUpToDate()
+    {
+        for (int i = 0; i < streamCount; i++)
+            if (streams[i].readyGeneration.load(std::memory_order_acquire) !=
+                streams[i].requestGeneration.load(std::memory_order_acquire)) return false;
+        return true;
+    }
+
+    void SampleStreamer::run()
+    {
+        while (isRunning.load(std::memory_order_acquire))
+        {
+            bool didWork = false;
+            for (int i = 0; i < streamCount; i++)
+                if (service(streams[i], readers[i])) didWork = true;
+
+            // nothing to decode right now: sleep until a voice starts, or frees room in its ring
+            if (!didWork) refillRequested.wait();
+        }
+    }
+
+    // return true if any work was done
+    bool SampleStreamer::service(SampleStream& stream, ReaderState& reader)
+    {
+        unsigned requestGeneration = stream.requestGeneration.load(std::memory_order_acquire);
+        if (requestGeneration != reader.generation)
+        {
+            // voice has started a new note (or stopped): abandon whatever we were doing
+            reader.generation = requestGeneration;
+            reader.file.close();
+            reader.nextFrame = reader.endFrame = 0;
+
+            SampleBuffer *buffer = stream.requestedBuffer.load(std::memory_order_relaxed);
+            if (buffer)
+            {
+                char errMsg[100];
+                reader.nextFrame = buffer->residentSampleCount;
+                reader.endFrame = buffer->sampleCount;
+                if (!reader.file.open(buffer->streamPath.c_str(), errMsg))
+                    openFailureCount.fetch_add(1, std::memory_order_relaxed);
+                else if (reader.file.channelCount != buffer->channelCount || !reader.file.seek(reader.nextFrame))
+                {
+                    reader.file.close();
+                    openFailureCount.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            stream.writeFrame.store(reader.nextFrame, std::memory_order_relaxed);
+            stream.readyGeneration.store(requestGeneration, std::memory_order_release);
+            return true;
+        }
+
+        if (!reader.file.isOpen()) return false;
+
+        int64_t readFrame = stream.readFrame.load(std::memory_order_acquire);
+        if (readFrame > reader.nextFrame)
+        {
+            // the voice overtook us (underrun): skip ahead, rather than decode frames nobody will play
+            if (!reader.file.seek(readFrame))
+            {
+                reader.file.close();
+                return false;
+            }
+            reader.nextFrame = readFrame;
+        }
+
+        int64_t remaining = reader.endFrame - reader.nextFrame;
+        if (remaining <= 0)
+        {
+            reader.file.close();
+            return false;
+        }
+
+        // wait until there is room for a full chunk, unless this is the last one
+        int64_t space = stream.capacity - (reader.nextFrame - readFrame);
+        int frameCount = SampleStream::refillFrames;
+        if (remaining < frameCount) frameCount = int(remaining);
+        if (space < frameCount) return false;
+
+        int framesRead = reader.file.read(scratch.get(), frameCount);
+        int channelCount = reader.file.channelCount;
+        const float *pIn = scratch.get();
+        for (int i = 0; i < framesRead; i++)
+        {
+            int slot = int((reader.nextFrame + i) & (stream.capacity - 1));
+            stream.ring[slot] = *pIn++;
+            if (channelCount > 1) stream.ring[stream.capacity + slot] = *pIn++;
+        }
+        reader.nextFrame += framesRead;
+        stream.writeFrame.store(reader.nextFrame, std::memory_order_release);
+
+        // premature end of file
+        if (framesRead < frameCount) reader.file.close();
+        return true;
+    }
+
+}
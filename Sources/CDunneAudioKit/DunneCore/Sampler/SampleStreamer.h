@@ -0,0 +1,68 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "SampleStream.h"
+#include "CompressedSampleFile.h"
+
+namespace DunneCore
+{
+
+    // SampleStreamer owns one SampleStream per voice, and a background thread which keeps each
+    // active stream's ring topped up by decoding ahead of its voice, from the buffer's streamPath,
+    // sleeping whenever no ring has room for more. Resident memory therefore scales with the number
+    // of sounding voices, not with sample-set size.
+
+    class SampleStreamer
+    {
+    public:
+        // each stream's ring holds at least ringFrames (rounded up to a power of two, and to two refills)
+        SampleStreamer(int streamCount, int ringFrames);
+        ~SampleStreamer();
+
+        SampleStream *getStream(int index) { return &streams[index]; }
+
+        // frames each stream's ring holds
+        int getRingFrames() { return ringFrames; }
+
+        // total underruns across all streams since creation
+        unsigned getUnderrunCount();
+
+        // number of times a stream's file could not be opened (or no longer matched its sample), since
+        // creation; those voices play only the resident head
+        unsigned getOpenFailureCount() { return openFailureCount.load(std::memory_order_relaxed); }
+
+        // true if the streamer thread has taken up every stream's latest request, so it no longer refers
+        // to any buffer voices had stopped playing before this call
+        bool isUpToDate();
+
+    protected:
+        // streamer thread's view of one stream
+        struct ReaderState
+        {
+            unsigned generation;
+            CompressedSampleFile file;
+            int64_t nextFrame;
+            int64_t endFrame;
+            ReaderState() : generation(0), nextFrame(0), endFrame(0) {}
+        };
+
+        int streamCount;
+        int ringFrames;
+        std::unique_ptr<SampleStream[]> streams;
+        std::unique_ptr<ReaderState[]> readers;
+        std::unique_ptr<float[]> scratch;
+        std::atomic<unsigned> openFailureCount;
+
+        std::atomic<bool> isRunning;
+        Semaphore refillRequested;
+        std::thread thread;
+
+        void run();
+        bool service(SampleStream& stream, ReaderState& reader);
+    };
+
+}
@@ -2,6 +2,7 @@
 
 #include "SamplerVoice.h"
 #include <stdio.h>
+#include <algorithm>
 
 #define MIDDLE_C_HZ 262.626f
 
@@ -17,7 +18,6 @@ namespace DunneCore
         pitchEnvelope.init();
         vibratoLFO.waveTable.sinusoid();
         vibratoLFO.init(sampleRate/CORESAMPLER_CHUNKSIZE, 5.0f);
-        restartVoiceLFO = false;
         volumeRamper.init(0.0f);
         tempGain = 0.0f;
     }
@@ -25,14 +25,21 @@ namespace DunneCore
     void SamplerVoice::start(unsigned note, float sampleRate, float frequency, float volume, SampleBuffer *buffer)
     {
         sampleBuffer = buffer;
-        oscillator.indexPoint = buffer->startPoint;
+        oscillator.setIndexPoint(buffer->startPoint);
         oscillator.increment = (buffer->sampleRate / sampleRate) * (frequency / buffer->noteFrequency);
         oscillator.multiplier = 1.0;
         oscillator.isLooping = buffer->isLooping;
+        updateStream();
+
+        // parameter changes are only applied to sounding voices, so catch up on any we missed
+        updateAmpAdsrParameters();
+        updateFilterAdsrParameters();
+        updatePitchAdsrParameters();
         
         noteVolume = volume;
         ampEnvelope.start();
         volumeRamper.init(0.0f);
+        needsPrep = true;
         
         samplingRate = sampleRate;
         leftFilter.updateSampleRate(double(samplingRate));
@@ -54,6 +61,7 @@ namespace DunneCore
         }
         noteFrequency = frequency;
         noteNumber = note;
+        controlCountdown = 0;
 
         restartVoiceLFOIfNeeded();
     }
@@ -79,9 +87,11 @@ namespace DunneCore
 
         noteFrequency = frequency;
         noteNumber = note;
+        controlCountdown = 0;
         tempNoteVolume = noteVolume;
         newSampleBuffer = buffer;
         ampEnvelope.restart();
+        needsPrep = true;
         noteVolume = volume;
         filterEnvelope.restart();
         pitchEnvelope.restart();
@@ -104,6 +114,7 @@ namespace DunneCore
         }
         noteFrequency = frequency;
         noteNumber = note;
+        controlCountdown = 0;
     }
 
     void SamplerVoice::restartSameNote(float volume, SampleBuffer *buffer)
@@ -111,6 +122,7 @@ namespace DunneCore
         tempNoteVolume = noteVolume;
         newSampleBuffer = buffer;
         ampEnvelope.restart();
+        needsPrep = true;
         noteVolume = volume;
         filterEnvelope.restart();
         pitchEnvelope.restart();
@@ -127,7 +139,14 @@ namespace DunneCore
     
     void SamplerVoice::stop()
     {
+        if (oscillator.stream)
+        {
+            oscillator.stream->stop();
+            oscillator.stream = 0;
+        }
         noteNumber = -1;
+        inaudibleChunkCount = 0;
+        culledSampleCount = 0;
         ampEnvelope.reset();
         volumeRamper.init(0.0f);
         filterEnvelope.reset();
@@ -138,8 +157,10 @@ namespace DunneCore
                                         float cutoffMultiple, float keyTracking,
                                         float cutoffEnvelopeStrength, float cutoffEnvelopeVelocityScaling,
                                         float resLinear, float pitchADSRSemitones,
-                                        float voiceLFODepthSemitones, float voiceLFOFrequencyHz)
+                                        float voiceLFODepthSemitones, float voiceLFOFrequencyHz,
+                                        int controlDivisor)
     {
+        needsPrep = false;
         if (ampEnvelope.isIdle()) return true;
 
         if (ampEnvelope.isPreStarting())
@@ -147,15 +168,16 @@ namespace DunneCore
             tempGain = masterVolume * tempNoteVolume;
             volumeRamper.reinit(ampEnvelope.getSample(), sampleCount);
             // This can execute as part of the voice-stealing mechanism, and will be executed rarely.
-            // To test, set MAX_POLYPHONY in CoreSampler.cpp to something small like 2 or 3.
+            // To test, init() the CoreSampler with maxVoices set to something small like 2 or 3.
             if (!ampEnvelope.isPreStarting())
             {
                 tempGain = masterVolume * noteVolume;
                 volumeRamper.reinit(ampEnvelope.getSample(), sampleCount);
                 sampleBuffer = newSampleBuffer;
                 oscillator.increment = (sampleBuffer->sampleRate / samplingRate) * (noteFrequency / sampleBuffer->noteFrequency);
-                oscillator.indexPoint = sampleBuffer->startPoint;
+                oscillator.setIndexPoint(sampleBuffer->startPoint);
                 oscillator.isLooping = sampleBuffer->isLooping;
+                updateStream();
             }
         }
         else
@@ -197,13 +219,19 @@ namespace DunneCore
         }
         else
         {
+            // the envelope must advance every chunk, but coefficients may be recomputed less often
+            float filterEnvelopeSample = filterEnvelope.getSample();
+            if (!isFilterEnabled || --controlCountdown <= 0)
+            {
+                controlCountdown = controlDivisor;
+                float noteHz = noteFrequency * powf(2.0f, (pitchOffsetModified) / 12.0f);
+                float baseFrequency = MIDDLE_C_HZ + keyTracking * (noteHz - MIDDLE_C_HZ);
+                float envStrength = ((1.0f - cutoffEnvelopeVelocityScaling) + cutoffEnvelopeVelocityScaling * noteVolume);
+                double cutoffFrequency = baseFrequency * (1.0f + cutoffMultiple + cutoffEnvelopeStrength * envStrength * filterEnvelopeSample);
+                leftFilter.setParameters(cutoffFrequency, resLinear);
+                rightFilter.setParameters(cutoffFrequency, resLinear);
+            }
             isFilterEnabled = true;
-            float noteHz = noteFrequency * powf(2.0f, (pitchOffsetModified) / 12.0f);
-            float baseFrequency = MIDDLE_C_HZ + keyTracking * (noteHz - MIDDLE_C_HZ);
-            float envStrength = ((1.0f - cutoffEnvelopeVelocityScaling) + cutoffEnvelopeVelocityScaling * noteVolume);
-            double cutoffFrequency = baseFrequency * (1.0f + cutoffMultiple + cutoffEnvelopeStrength * envStrength * filterEnvelope.getSample());
-            leftFilter.setParameters(cutoffFrequency, resLinear);
-            rightFilter.setParameters(cutoffFrequency, resLinear);
         }
         
         return false;
@@ -211,6 +239,53 @@ namespace DunneCore
     
     bool SamplerVoice::getSamples(int sampleCount, float *leftOutput, float *rightOutput)
     {
+        oscillator.interpolationMode = InterpolationMode(*interpolationMode);
+        oscillator.setFixedPointPhase(*fixedPointPhase);
+        if (!oscillator.stream)
+        {
+            float gain[SampleOscillator::maxBlockSize];
+            float leftSample[SampleOscillator::maxBlockSize], rightSample[SampleOscillator::maxBlockSize];
+            for (int done=0; done < sampleCount; )
+            {
+                int count = sampleCount - done;
+                if (count > SampleOscillator::maxBlockSize) count = SampleOscillator::maxBlockSize;
+
+                LinearRamper savedVolumeRamper = volumeRamper;
+                volumeRamper.getValues(count, gain);
+                for (int i=0; i < count; i++) gain[i] *= tempGain;
+
+                int rendered = oscillator.getSampleBlock(sampleBuffer, count, leftSample, rightSample, gain);
+                if (isFilterEnabled)
+                {
+                    for (int i=0; i < rendered; i++)
+                    {
+                        *leftOutput++ += leftFilter.process(leftSample[i]);
+                        *rightOutput++ += rightFilter.process(rightSample[i]);
+                    }
+                }
+                else
+                {
+                    for (int i=0; i < rendered; i++)
+                    {
+                        *leftOutput++ += leftSample[i];
+                        *rightOutput++ += rightSample[i];
+                    }
+                }
+
+                if (rendered < count)
+                {
+                    // ran out of samples: leave volumeRamper where the per-sample loop below would
+                    volumeRamper = savedVolumeRamper;
+                    for (int i=0; i <= rendered; i++) volumeRamper.getNextValue();
+                    return true;
+                }
+                done += count;
+            }
+            return false;
+        }
+
+        // streaming: the oscillator must check every frame against what the streamer has delivered
+        oscillator.stream->beginChunk();
         for (int i=0; i < sampleCount; i++)
         {
             float gain = tempGain * volumeRamper.getNextValue();
@@ -228,11 +303,40 @@ namespace DunneCore
                 *rightOutput++ += rightSample;
             }
         }
+        oscillator.stream->endChunk(oscillator.indexPoint);
         return false;
     }
 
+    bool SamplerVoice::isInaudible(int sampleCount, float audibilityFloor, int chunkLimit)
+    {
+        if (!ampEnvelope.isReleasing() || tempGain * ampEnvelope.getValue() >= audibilityFloor)
+        {
+            inaudibleChunkCount = 0;
+            return false;
+        }
+        if (++inaudibleChunkCount < chunkLimit) return false;
+
+        // this chunk and the rest of the release (the envelope advances once per chunk), unless the
+        // sample runs out sooner
+        double remaining = sampleCount + double(ampEnvelope.getRemainingSampleCount()) * CORESAMPLER_CHUNKSIZE;
+        double speed = oscillator.increment * oscillator.multiplier;
+        if (!oscillator.isLooping && speed > 0.0)
+            remaining = std::min(remaining, ceil((sampleBuffer->endPoint - oscillator.indexPoint) / speed));
+        culledSampleCount = remaining > 0.0 ? int(remaining) : 0;
+        return true;
+    }
+
+    // (re)connect the oscillator to this voice's stream, if the current sample buffer requires it
+    void SamplerVoice::updateStream()
+    {
+        SampleStream *newStream = (stream && sampleBuffer->isStreaming) ? stream : 0;
+        if (newStream) newStream->start(sampleBuffer, oscillator.indexPoint);
+        else if (oscillator.stream) oscillator.stream->stop();
+        oscillator.stream = newStream;
+    }
+
     void SamplerVoice::restartVoiceLFOIfNeeded() {
-        if (restartVoiceLFO || !hasStartedVoiceLFO) {
+        if (*restartVoiceLFO || !hasStartedVoiceLFO) {
             vibratoLFO.phase = 0;
             hasStartedVoiceLFO = true;
         }
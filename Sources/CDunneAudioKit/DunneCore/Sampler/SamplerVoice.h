@@ -26,6 +26,9 @@ namespace DunneCore
         /// a pointer to the sample buffer for that oscillator
         SampleBuffer *sampleBuffer;
 
+        /// this voice's stream, used only for streaming sample buffers (null if streaming is not enabled)
+        SampleStream *stream;
+
         /// two filters (left/right)
         ResonantLowPassFilter leftFilter, rightFilter;
         AHDSHREnvelope ampEnvelope;
@@ -34,8 +37,14 @@ namespace DunneCore
         // per-voice vibrato LFO
         FunctionTableOscillator vibratoLFO;
 
-        // restart phase of per-voice vibrato LFO
-        bool restartVoiceLFO;
+        // common setting: restart phase of per-voice vibrato LFO
+        bool *restartVoiceLFO;
+
+        // common setting: interpolation mode (a DunneCore::InterpolationMode)
+        int *interpolationMode;
+
+        // common setting: true for 32.32 fixed-point oscillator phase
+        bool *fixedPointPhase;
 
         /// common glide rate, seconds per octave
         float *glideSecPerOctave;
@@ -43,6 +52,9 @@ namespace DunneCore
         /// MIDI note number, or -1 if not playing any note
         int noteNumber;
 
+        /// last "event number" associated with this voice
+        unsigned event;
+
         /// (target) note frequency in Hz
         float noteFrequency;
 
@@ -74,8 +86,22 @@ namespace DunneCore
 
         /// true if filter should be used
         bool isFilterEnabled;
+
+        /// chunks until filter coefficients are next recomputed
+        int controlCountdown;
+
+        /// true from (re)starting a note until prepToGetSamples() next runs, so a note starting part way
+        /// through a chunk is set up at once, rather than at the next chunk
+        bool needsPrep;
+
+        /// chunks in a row this voice has been releasing below the audibility floor
+        int inaudibleChunkCount;
+
+        /// once isInaudible() has returned true, the samples this voice would still have rendered; else 0
+        int culledSampleCount;
         
-        SamplerVoice() : noteNumber(-1) {}
+        SamplerVoice() : stream(0), noteNumber(-1), event(0), isFilterEnabled(false), controlCountdown(0),
+                         needsPrep(false), inaudibleChunkCount(0), culledSampleCount(0) {}
 
         void init(double sampleRate);
 
@@ -105,13 +131,19 @@ namespace DunneCore
                               float resLinear,
                               float pitchADSRSemitones,
                               float voiceLFOFrequencyHz,
-                              float voiceLFODepthSemitones);
+                              float voiceLFODepthSemitones,
+                              int controlDivisor);
 
         bool getSamples(int sampleCount, float *leftOutput, float *rightOutput);
 
+        // after prepToGetSamples(): return true if the voice's release has stayed below audibilityFloor (a
+        // linear gain, including note and master volume) for chunkLimit chunks in a row, so it may be stopped
+        bool isInaudible(int sampleCount, float audibilityFloor, int chunkLimit);
+
     private:
         bool hasStartedVoiceLFO;
         void restartVoiceLFOIfNeeded();
+        void updateStream();
     };
 
 }
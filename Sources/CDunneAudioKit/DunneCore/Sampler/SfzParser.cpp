@@ -0,0 +1,357 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#include "SfzParser.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// #include directives may nest this deep, which also stops a file including itself forever
+#define SFZ_MAX_INCLUDE_DEPTH 16
+
+namespace DunneCore
+{
+
+    static inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+    static inline bool isNameChar(char c) { return isalnum((unsigned char)c) || c == '_' || c == '$'; }
+
+    static bool readFile(const char *path, std::string& text)
+    {
+        FILE *pFile = fopen(path, "rb");
+        if (pFile == 0) return false;
+        fseek(pFile, 0, SEEK_END);
+        long length = ftell(pFile);
+        fseek(pFile, 0, SEEK_SET);
+        text.resize(length > 0 ? size_t(length) : 0);
+        size_t lengthRead = text.empty() ? 0 : fread(&text[0], 1, text.size(), pFile);
+        fclose(pFile);
+        text.resize(lengthRead);
+        return true;
+    }
+
+    static bool isAbsolutePath(const std::string& path)
+    {
+        if (!path.empty() && path[0] == '/') return true;
+        return path.size() > 2 && isalpha((unsigned char)path[0]) && path[1] == ':' && path[2] == '/';
+    }
+
+    static std::string directoryOf(const char *path)
+    {
+        const char *pSlash = strrchr(path, '/');
+        const char *pBackslash = strrchr(path, '\\');
+        if (pBackslash > pSlash) pSlash = pBackslash;
+        return pSlash ? std::string(path, pSlash - path) : std::string(".");
+    }
+
+    bool SfzParser::parseFile(const char *path)
+    {
+        std::string text;
+        if (!readFile(path, text)) return false;
+        parse(text.data(), text.size(), directoryOf(path));
+        return true;
+    }
+
+    void SfzParser::parse(const char *text, size_t length, const std::string& directory)
+    {
+        rootDirectory = directory;
+        level = kGlobal;
+        global = Settings();
+        hasMaster = hasGroup = false;
+        parseText(text, text + length);
+        endRegion();
+    }
+
+    // Scan one buffer: headers, opcodes (name=value), directives and comments, in any layout
+    void SfzParser::parseText(const char *p, const char *end)
+    {
+        while (p < end)
+        {
+            char c = *p;
+            if (isSpace(c))
+            {
+                p++;
+            }
+            else if (c == '/' && p + 1 < end && p[1] == '/')
+            {
+                while (p < end && *p != '\n') p++;
+            }
+            else if (c == '/' && p + 1 < end && p[1] == '*')
+            {
+                p += 2;
+                while (p + 1 < end && !(p[0] == '*' && p[1] == '/')) p++;
+                p += 2;
+            }
+            else if (c == '<')
+            {
+                const char *pName = ++p;
+                while (p < end && *p != '>') p++;
+                beginHeader({ pName, p });
+                p++;
+            }
+            else if (c == '#')
+            {
+                const char *pName = p;
+                while (p < end && !isSpace(*p)) p++;
+                handleDirective({ pName, p }, p, end);
+            }
+            else
+            {
+                // opcode name, up to '='; anything else is skipped, a word at a time
+                const char *pName = p;
+                while (p < end && isNameChar(*p)) p++;
+                if (p == pName || p >= end || *p != '=')
+                {
+                    while (p < end && !isSpace(*p) && *p != '<') p++;
+                    continue;
+                }
+                Span name = { pName, p++ };
+
+                // the value runs to the end of the line, a comment, a header, or the next opcode, so it may
+                // contain spaces (as sample paths often do)
+                const char *pValue = p;
+                const char *pEnd = p;
+                while (p < end && *p != '\n' && *p != '\r' && *p != '<' &&
+                       !(p[0] == '/' && p + 1 < end && (p[1] == '/' || p[1] == '*')))
+                {
+                    if (isSpace(*p))
+                    {
+                        const char *q = p;
+                        while (q < end && (*q == ' ' || *q == '\t')) q++;
+                        const char *r = q;
+                        while (r < end && isNameChar(*r)) r++;
+                        if (r > q && r < end && *r == '=') break;
+                        p = q;
+                        continue;
+                    }
+                    pEnd = ++p;
+                }
+                setOpcode(name, { pValue, pEnd });
+            }
+        }
+    }
+
+    void SfzParser::handleDirective(Span directive, const char *&p, const char *end)
+    {
+        // the directive's first argument, quoted or not
+        auto nextWord = [&p, end]() -> Span {
+            while (p < end && (*p == ' ' || *p == '\t')) p++;
+            if (p < end && *p == '"')
+            {
+                const char *pWord = ++p;
+                while (p < end && *p != '"' && *p != '\n') p++;
+                Span word = { pWord, p };
+                if (p < end && *p == '"') p++;
+                return word;
+            }
+            const char *pWord = p;
+            while (p < end && !isSpace(*p)) p++;
+            return { pWord, p };
+        };
+
+        if (directive.is("#define"))
+        {
+            Span name = nextWord();
+            Span value = nextWord();
+            if (name.end > name.begin && *name.begin == '$')
+                defines[std::string(name.begin, name.end)] = std::string(value.begin, value.end);
+        }
+        else if (directive.is("#include"))
+        {
+            Span name = nextWord();
+            std::string path(name.begin, name.end);
+            for (char &c : path) if (c == '\\') c = '/';
+            if (!isAbsolutePath(path)) path = rootDirectory + "/" + path;
+
+            std::string text;
+            if (includeDepth >= SFZ_MAX_INCLUDE_DEPTH || !readFile(path.c_str(), text))
+            {
+                unreadableIncludes.push_back(path);
+                return;
+            }
+            includeDepth++;
+            parseText(text.data(), text.data() + text.size());
+            includeDepth--;
+        }
+    }
+
+    // Each header starts from the settings of the nearest enclosing header in effect
+    void SfzParser::beginHeader(Span name)
+    {
+        endRegion();
+        if (name.is("control")) level = kControl;
+        else if (name.is("global"))
+        {
+            level = kGlobal;
+            global = Settings();
+            hasMaster = hasGroup = false;
+        }
+        else if (name.is("master"))
+        {
+            level = kMaster;
+            master = global;
+            hasMaster = true;
+            hasGroup = false;
+        }
+        else if (name.is("group"))
+        {
+            level = kGroup;
+            group = hasMaster ? master : global;
+            hasGroup = true;
+        }
+        else if (name.is("region"))
+        {
+            level = kRegion;
+            region = hasGroup ? group : hasMaster ? master : global;
+        }
+        else level = kIgnored;
+    }
+
+    // add the current region, if it names a sample
+    void SfzParser::endRegion()
+    {
+        if (level != kRegion || region.sample.empty()) return;
+
+        Region r;
+        SampleDescriptor &sd = r.sampleDescriptor;
+        sd.noteNumber = region.pitchKeycenter;
+        sd.noteFrequency = 440.0f * powf(2.0f, (region.pitchKeycenter - region.transpose - 0.01f * region.tune - 69.0f) / 12.0f);
+        sd.minimumNoteNumber = region.lokey;
+        sd.maximumNoteNumber = region.hikey;
+        sd.minimumVelocity = region.lovel;
+        sd.maximumVelocity = region.hivel;
+        sd.isLooping = region.isLooping;
+        sd.loopStartPoint = region.loopStart;
+        sd.loopEndPoint = region.loopEnd;
+        sd.startPoint = region.offset;
+        sd.endPoint = region.end;
+        r.samplePath = isAbsolutePath(region.sample) ? region.sample : rootDirectory + "/" + region.sample;
+        regions.push_back(std::move(r));
+        level = kIgnored;
+    }
+
+    SfzParser::Settings *SfzParser::currentSettings()
+    {
+        switch (level)
+        {
+            case kGlobal: return &global;
+            case kMaster: return &master;
+            case kGroup: return &group;
+            case kRegion: return &region;
+            default: return 0;
+        }
+    }
+
+    void SfzParser::setOpcode(Span name, Span value)
+    {
+        std::string expanded;
+        if (expand(name, expanded)) return;     // opcode names built from variables are not supported
+        if (expand(value, expanded)) value = { expanded.data(), expanded.data() + expanded.size() };
+
+        if (level == kControl)
+        {
+            if (name.is("default_path"))
+            {
+                defaultPath.assign(value.begin, value.end);
+                for (char &c : defaultPath) if (c == '\\') c = '/';
+            }
+            return;
+        }
+
+        Settings *pSettings = currentSettings();
+        if (pSettings == 0) return;
+        Settings &s = *pSettings;
+        if (name.is("sample"))
+        {
+            s.sample.assign(value.begin, value.end);
+            for (char &c : s.sample) if (c == '\\') c = '/';
+            if (!isAbsolutePath(s.sample)) s.sample.insert(0, defaultPath);
+        }
+        else if (name.is("key")) s.lokey = s.hikey = s.pitchKeycenter = noteNumber(value);
+        else if (name.is("lokey")) s.lokey = noteNumber(value);
+        else if (name.is("hikey")) s.hikey = noteNumber(value);
+        else if (name.is("pitch_keycenter")) s.pitchKeycenter = noteNumber(value);
+        else if (name.is("lovel")) s.lovel = int(number(value));
+        else if (name.is("hivel")) s.hivel = int(number(value));
+        else if (name.is("loop_mode") || name.is("loopmode"))
+            s.isLooping = value.is("loop_continuous") || value.is("loop_sustain");
+        else if (name.is("loop_start") || name.is("loopstart")) s.loopStart = number(value);
+        else if (name.is("loop_end") || name.is("loopend")) s.loopEnd = number(value);
+        else if (name.is("offset")) s.offset = number(value);
+        else if (name.is("end")) s.end = number(value);
+        else if (name.is("transpose")) s.transpose = number(value);
+        else if (name.is("tune")) s.tune = number(value);
+    }
+
+    // Substitute #define'd $variables into text, returning false (leaving expanded alone) if there are none
+    bool SfzParser::expand(Span text, std::string& expanded)
+    {
+        const char *pDollar = (const char *)memchr(text.begin, '$', text.end - text.begin);
+        if (pDollar == 0 || defines.empty()) return false;
+
+        std::string result(text.begin, pDollar);
+        for (const char *p = pDollar; p < text.end; )
+        {
+            if (*p != '$')
+            {
+                result += *p++;
+                continue;
+            }
+
+            // the longest variable name matching here
+            const char *pName = p++;
+            while (p < text.end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+            const char *pEnd = p;
+            auto it = defines.end();
+            for (; pEnd > pName + 1; pEnd--)
+                if ((it = defines.find(std::string(pName, pEnd))) != defines.end()) break;
+            if (it == defines.end())
+            {
+                result.append(pName, p);
+                continue;
+            }
+            result += it->second;
+            p = pEnd;
+        }
+        expanded.swap(result);
+        return true;
+    }
+
+    // a MIDI note number, given as a number or a note name such as c4 (60), c#4 or db4 (61)
+    int SfzParser::noteNumber(Span value)
+    {
+        if (value.begin == value.end) return 0;
+        char c = char(tolower((unsigned char)*value.begin));
+        if (c < 'a' || c > 'g') return int(number(value));
+
+        static const int semitones[] = { 9, 11, 0, 2, 4, 5, 7 };    // a b c d e f g
+        int note = semitones[c - 'a'];
+        const char *p = value.begin + 1;
+        if (p < value.end && *p == '#') { note++; p++; }
+        else if (p < value.end && *p == 'b') { note--; p++; }
+        int octave = atoi(std::string(p, value.end).c_str());
+        return (octave + 1) * 12 + note;
+    }
+
+    // values are not null-terminated, so copy the (short) number before converting it
+    float SfzParser::number(Span value)
+    {
+        char digits[64];
+        size_t length = size_t(value.end - value.begin);
+        if (length >= sizeof(digits)) length = sizeof(digits) - 1;
+        memcpy(digits, value.begin, length);
+        digits[length] = 0;
+        return float(strtod(digits, 0));
+    }
+
+    std::vector<SampleFileDescriptor> SfzParser::getSampleFileDescriptors() const
+    {
+        std::vector<SampleFileDescriptor> descriptors(regions.size());
+        for (size_t i=0; i < regions.size(); i++)
+        {
+            descriptors[i].sampleDescriptor = regions[i].sampleDescriptor;
+            descriptors[i].path = regions[i].samplePath.c_str();
+        }
+        return descriptors;
+    }
+
+}
@@ -0,0 +1,97 @@
+// Copyright AudioKit. All Rights Reserved.
+
+#pragma once
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Sampler_Typedefs.h"
+
+namespace DunneCore
+{
+
+    // SfzParser reads an SFZ instrument definition in a single pass, producing a SampleFileDescriptor for
+    // each <region>, ready for CoreSampler::loadCompressedSampleFiles(). Opcodes are inherited from the
+    // enclosing <global>, <master> and <group> headers as the SFZ format specifies; <control> may set
+    // default_path, and #define and #include directives are expanded. The text is scanned in place: opcode
+    // names and values are never copied, except where a #define'd $variable must be substituted.
+    //
+    // Supported opcodes: sample, key, lokey, hikey, pitch_keycenter, lovel, hivel, loop_mode, loop_start,
+    // loop_end, offset, end, transpose and tune (plus the SFZ 2 spellings loopmode, loopstart and loopend).
+    // Key numbers may be given as note names, e.g. c#4 (middle C is c4, note 60). Other opcodes are ignored.
+
+    class SfzParser
+    {
+    public:
+        struct Region
+        {
+            SampleDescriptor sampleDescriptor;
+            std::string samplePath;     // with '/' separators, resolved against the directory of the SFZ file
+        };
+
+        // parse the SFZ file at path (and any files it includes), adding to the regions found so far;
+        // returns false if the file cannot be read. Included files which cannot be read are skipped, and
+        // listed by getUnreadableIncludes().
+        bool parseFile(const char *path);
+
+        // parse SFZ text; sample and #include paths are relative to directory
+        void parse(const char *text, size_t length, const std::string& directory);
+
+        const std::vector<Region>& getRegions() const { return regions; }
+
+        // the resolved paths of #include'd files which could not be read (or were nested too deeply), in the
+        // order met
+        const std::vector<std::string>& getUnreadableIncludes() const { return unreadableIncludes; }
+
+        // one descriptor per region, whose paths stay valid until the parser is changed or destroyed
+        std::vector<SampleFileDescriptor> getSampleFileDescriptors() const;
+
+    protected:
+        // the opcode values a header sets; anything not set is inherited from the enclosing header
+        struct Settings
+        {
+            std::string sample;
+            int lokey = 0, hikey = 127, pitchKeycenter = 60;
+            int lovel = 0, hivel = 127;
+            bool isLooping = false;
+            float loopStart = 0.0f, loopEnd = 0.0f;
+            float offset = 0.0f, end = 0.0f;
+            float transpose = 0.0f, tune = 0.0f;
+        };
+
+        enum Level { kControl, kGlobal, kMaster, kGroup, kRegion, kIgnored };
+
+        struct Span
+        {
+            const char *begin, *end;
+
+            template <size_t size>
+            bool is(const char (&name)[size]) const
+            {
+                return size_t(end - begin) == size - 1 && memcmp(begin, name, size - 1) == 0;
+            }
+        };
+
+        std::vector<Region> regions;
+        std::vector<std::string> unreadableIncludes;
+        std::map<std::string, std::string> defines;
+        std::string defaultPath;
+        std::string rootDirectory;
+        Level level = kGlobal;
+        Settings global, master, group, region;
+        bool hasMaster = false, hasGroup = false;   // a <master> (<group>) is in effect since the last <global>
+        int includeDepth = 0;
+
+        void parseText(const char *text, const char *end);
+        void beginHeader(Span name);
+        void endRegion();
+        void setOpcode(Span name, Span value);
+        void handleDirective(Span directive, const char *&p, const char *end);
+        bool expand(Span value, std::string& expanded);
+        Settings *currentSettings();
+        static int noteNumber(Span value);
+        static float number(Span value);
+    };
+
+}
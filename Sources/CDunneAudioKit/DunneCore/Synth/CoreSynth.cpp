@@ -5,25 +5,38 @@
 #include "SynthVoice.h"
 #include "WaveStack.h"
 #include "SustainPedalLogic.h"
+#include "ActiveVoiceList.h"
+#include "QualityGovernor.h"
+#include "RenderWorkerPool.h"
+#include "CommandQueue.h"
 
 #include <math.h>
+#include <string.h>
 #include <list>
 #include <random>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 
-using std::unique_ptr;
-
-#define MAX_VOICE_COUNT 32      // number of voices
+#define DEFAULT_VOICE_COUNT 32  // number of voices, unless init() is told otherwise
 #define MIDI_NOTENUMBERS 128    // MIDI offers 128 distinct note numbers
+#define MAX_QUALITY_LEVEL 7     // highest CPU-governor quality level: see applyQualityLevel()
+#define COMMAND_QUEUE_CAPACITY 1024 // most note and pedal events which may be waiting for render()
 
 struct CoreSynth::InternalData
 {
     std::mt19937 gen{0};
 
-    /// array of voice resources
-    unique_ptr<DunneCore::SynthVoice> voice[MAX_VOICE_COUNT];
+    /// array of voice resources, allocated in one block by allocateVoices()
+    std::vector<DunneCore::SynthVoice> voice;
+    int voiceCount;
+
+    /// voices which are playing a note, in index order
+    DunneCore::ActiveVoiceList activeVoices;
     
     DunneCore::WaveStack waveform1, waveform2, waveform3;      // WaveStacks are shared by all voice oscillators
     DunneCore::FunctionTableOscillator vibratoLFO;             // one vibrato LFO shared by all voices
+    float vibratoSample = 0.0f;                                // its output for the current chunk
     DunneCore::SustainPedalLogic pedalLogic;
     
     // simple parameters
@@ -33,6 +46,44 @@ struct CoreSynth::InternalData
     
     DunneCore::EnvelopeSegmentParameters segParameters[8];
     DunneCore::EnvelopeParameters envParameters;
+
+    // CPU budget governor, and the settings it controls
+    DunneCore::QualityGovernor governor;
+    int appliedQualityLevel = 0;    // level reflected in the settings below
+    std::atomic<int> filterStages{2};   // as last set by setFilterStages(), taken up by the rendering thread
+    int controlDivisor = 1;         // filter coefficients are recomputed every controlDivisor chunks
+    int voiceLimit = 0;             // most voices which may sound at once
+
+    // voices releasing below audibilityFloor for inaudibleChunkLimit chunks are stopped early (0 disables)
+    float audibilityFloor = 0.0f;
+    int inaudibleChunkLimit = 4;
+    std::atomic<uint64_t> culledSampleCount{0};     // voice-samples not rendered as a result
+
+    // Multi-threaded rendering: each voice renders into its own VoiceOutput, on whichever thread
+    // claims it, and render() then mixes them in active-list order, exactly as single-threaded.
+    DunneCore::RenderWorkerPool renderPool;
+    struct VoiceOutput
+    {
+        float left[SYNTH_CHUNKSIZE], right[SYNTH_CHUNKSIZE];
+        int noteNumber;     // voice's note number before rendering
+        bool isFinished;    // voice must be stopped
+    };
+    std::vector<VoiceOutput> voiceOutput;
+
+    // samples rendered so far of the current chunk: envelopes and LFOs step once per SYNTH_CHUNKSIZE
+    // samples, however render() calls and events split the output (rendering thread only)
+    unsigned chunkPhase = 0;
+
+    // the current render() call's arguments for renderVoice()
+    unsigned renderSampleCount;
+    float renderPhaseDeltaMultiplier;
+    bool renderAtChunkStart;
+    unsigned renderChunkRemaining;
+
+    // note and pedal events posted by any thread, applied by render() when due
+    DunneCore::CommandQueue<DunneCore::EngineCommand, COMMAND_QUEUE_CAPACITY> commandQueue;
+    DunneCore::PendingCommandList<DunneCore::EngineCommand, COMMAND_QUEUE_CAPACITY> pendingCommands;
+    std::atomic<int64_t> sampleTime{0};     // samples rendered so far
 };
 
 CoreSynth::CoreSynth()
@@ -45,16 +96,40 @@ CoreSynth::CoreSynth()
 , linearResonance(1.0f)
 , data(new InternalData)
 {
-    for (int i=0; i < MAX_VOICE_COUNT; i++)
+    allocateVoices(DEFAULT_VOICE_COUNT);
+}
+
+CoreSynth::~CoreSynth()
+{
+}
+
+// (Re)allocate the voice pool. Any playing notes are lost, so call only when not rendering.
+void CoreSynth::allocateVoices(int maxVoices)
+{
+    if (maxVoices < 1) maxVoices = 1;
+    data->voice.clear();
+    data->voice.reserve(maxVoices);
+    for (int i=0; i < maxVoices; i++)
     {
-        data->voice[i] = unique_ptr<DunneCore::SynthVoice>(new DunneCore::SynthVoice(&data->gen));
-        data->voice[i]->ampEG.pParameters = &data->ampEGParameters;
-        data->voice[i]->filterEG.pParameters = &data->filterEGParameters;
+        data->voice.emplace_back(&data->gen);
+        data->voice[i].ampEG.pParameters = &data->ampEGParameters;
+        data->voice[i].filterEG.pParameters = &data->filterEGParameters;
     }
+    data->voiceCount = maxVoices;
+    data->voiceOutput.resize(maxVoices);
+    data->activeVoices.init(maxVoices);
+    data->voiceLimit = maxVoices;
 }
 
-CoreSynth::~CoreSynth()
+int CoreSynth::getMaxVoices()
+{
+    return data->voiceCount;
+}
+
+int CoreSynth::init(double sampleRate, int maxVoices)
 {
+    if (maxVoices != data->voiceCount) allocateVoices(maxVoices);
+    return init(sampleRate);
 }
 
 int CoreSynth::init(double sampleRate)
@@ -105,7 +180,7 @@ int CoreSynth::init(double sampleRate)
     data->voiceParameters.osc3.drawbars[15] = 0.0f;
     data->voiceParameters.osc3.mixLevel = 0.5f;
     
-    data->voiceParameters.filterStages = 2;
+    data->voiceParameters.filterStages = data->filterStages.load(std::memory_order_relaxed);
     
     data->segParameters[0].initialLevel = 0.0f;   // attack: ramp quickly to 0.2
     data->segParameters[0].finalLevel = 0.2f;
@@ -128,10 +203,14 @@ int CoreSynth::init(double sampleRate)
     
     data->envParameters.init((float)(sampleRate/SYNTH_CHUNKSIZE), 6, data->segParameters, 3, 0, 5);
     
-    for (int i=0; i < MAX_VOICE_COUNT; i++)
+    for (int i=0; i < data->voiceCount; i++)
     {
-        data->voice[i]->init(sampleRate, &data->waveform1, &data->waveform2, &data->waveform3, &data->voiceParameters, &data->envParameters);
+        data->voice[i].init(sampleRate, &data->waveform1, &data->waveform2, &data->waveform3, &data->voiceParameters, &data->envParameters);
     }
+
+    data->governor.init(sampleRate, MAX_QUALITY_LEVEL);
+    applyQualityLevel(0);
+    data->chunkPhase = 0;
     
     return 0;   // no error
 }
@@ -140,21 +219,97 @@ void CoreSynth::deinit()
 {
 }
 
-void CoreSynth::playNote(unsigned noteNumber, unsigned velocity, float noteFrequency)
+bool CoreSynth::playNote(unsigned noteNumber, unsigned velocity, float noteFrequency, int64_t sampleTime)
+{
+    DunneCore::EngineCommand command = DunneCore::EngineCommand::noteOn(noteNumber, velocity, noteFrequency);
+    command.sampleTime = sampleTime;
+    return data->commandQueue.push(command);
+}
+
+bool CoreSynth::stopNote(unsigned noteNumber, bool immediate, int64_t sampleTime)
+{
+    DunneCore::EngineCommand command = DunneCore::EngineCommand::noteOff(noteNumber, immediate);
+    command.sampleTime = sampleTime;
+    return data->commandQueue.push(command);
+}
+
+bool CoreSynth::sustainPedal(bool down, int64_t sampleTime)
+{
+    DunneCore::EngineCommand command = DunneCore::EngineCommand::sustainPedal(down);
+    command.sampleTime = sampleTime;
+    return data->commandQueue.push(command);
+}
+
+void CoreSynth::processCommands()
+{
+    // Sort everything posted into the pending list, by when it falls due, so a command posted for later
+    // holds back none due sooner. Times already past count as now, keeping due commands in posting order.
+    int64_t now = data->sampleTime.load(std::memory_order_relaxed);
+    DunneCore::EngineCommand *pCommand;
+    while (!data->pendingCommands.isFull() && (pCommand = data->commandQueue.front()) != 0)
+    {
+        DunneCore::EngineCommand command = *pCommand;
+        data->commandQueue.pop();
+        if (command.sampleTime < now) command.sampleTime = now;
+        data->pendingCommands.insert(command);
+    }
+
+    while (!data->pendingCommands.isEmpty() && data->pendingCommands.front().sampleTime <= now)
+    {
+        applyCommand(data->pendingCommands.front());
+        data->pendingCommands.pop();
+    }
+}
+
+void CoreSynth::applyCommand(const DunneCore::EngineCommand &command)
+{
+    switch (command.type)
+    {
+        case DunneCore::EngineCommand::kNoteOn:
+            handleNoteOn(command.noteNumber, command.velocity, command.value);
+            break;
+        case DunneCore::EngineCommand::kNoteOff:
+            handleNoteOff(command.noteNumber, command.immediate);
+            break;
+        case DunneCore::EngineCommand::kSustainPedal:
+            handleSustainPedal(command.immediate);
+            break;
+        default:
+            break;
+    }
+}
+
+// how many of the next sampleCount samples may be rendered before a posted event falls due
+unsigned CoreSynth::samplesUntilNextCommand(unsigned sampleCount)
+{
+    // 0 if anything has been posted since processCommands() looked, as it may already be due
+    if (data->commandQueue.front() != 0 && !data->pendingCommands.isFull()) return 0;
+    if (data->pendingCommands.isEmpty()) return sampleCount;
+    int64_t wait = data->pendingCommands.front().sampleTime - data->sampleTime.load(std::memory_order_relaxed);
+    if (wait <= 0) return 0;
+    return wait < int64_t(sampleCount) ? unsigned(wait) : sampleCount;
+}
+
+int64_t CoreSynth::getSampleTime()
+{
+    return data->sampleTime.load(std::memory_order_relaxed);
+}
+
+void CoreSynth::handleNoteOn(unsigned noteNumber, unsigned velocity, float noteFrequency)
 {
     eventCounter++;
     data->pedalLogic.keyDownAction(noteNumber);
     play(noteNumber, velocity, noteFrequency);
 }
 
-void CoreSynth::stopNote(unsigned noteNumber, bool immediate)
+void CoreSynth::handleNoteOff(unsigned noteNumber, bool immediate)
 {
     eventCounter++;
     if (immediate || data->pedalLogic.keyUpAction(noteNumber))
         stop(noteNumber, immediate);
 }
 
-void CoreSynth::sustainPedal(bool down)
+void CoreSynth::handleSustainPedal(bool down)
 {
     eventCounter++;
     if (down) data->pedalLogic.pedalDown();
@@ -170,9 +325,10 @@ void CoreSynth::sustainPedal(bool down)
 
 DunneCore::SynthVoice *CoreSynth::voicePlayingNote(unsigned noteNumber)
 {
-    for (int i=0; i < MAX_VOICE_COUNT; i++)
+    for (int k=0; k < data->activeVoices.count(); k++)
     {
-        if (data->voice[i]->noteNumber == noteNumber) return data->voice[i].get();
+        auto pVoice = &data->voice[data->activeVoices[k]];
+        if (pVoice->noteNumber == noteNumber) return pVoice;
     }
     return 0;
 }
@@ -188,26 +344,27 @@ void CoreSynth::play(unsigned noteNumber, unsigned velocity, float noteFrequency
         return;
     }
     
-    // find a free voice (with noteNumber < 0) to play the note
-    for (int i=0; i < MAX_VOICE_COUNT; i++)
+    // find a free voice (with noteNumber < 0) to play the note, unless the CPU governor forbids more voices
+    for (int i=0; data->activeVoices.count() < data->voiceLimit && i < data->voiceCount; i++)
     {
-        auto pVoice = data->voice[i].get();
+        auto pVoice = &data->voice[i];
         if (pVoice->noteNumber < 0)
         {
             // found a free voice: assign it to play this note
             pVoice->start(eventCounter, noteNumber, noteFrequency, velocity / 127.0f);
+            data->activeVoices.add(i);
             return;
         }
     }
     
-    // all oscillators in use: find "stalest" voice to steal
+    // all oscillators (or all we are allowed) in use: find "stalest" voice to steal
     unsigned greatestDiffOfAll = 0;
     DunneCore::SynthVoice *pStalestVoiceOfAll = 0;
     unsigned greatestDiffInRelease = 0;
     DunneCore::SynthVoice *pStalestVoiceInRelease = 0;
-    for (int i=0; i < MAX_VOICE_COUNT; i++)
+    for (int k=0; k < data->activeVoices.count(); k++)
     {
-        auto pVoice = data->voice[i].get();
+        auto pVoice = &data->voice[data->activeVoices[k]];
         unsigned diff = eventCounter - pVoice->event;
         if (pVoice->ampEG.isReleasing())
         {
@@ -244,6 +401,7 @@ void CoreSynth::stop(unsigned noteNumber, bool immediate)
     if (immediate)
     {
         pVoice->stop(eventCounter);
+        data->activeVoices.remove(int(pVoice - &data->voice[0]));
     }
     else
     {
@@ -253,31 +411,227 @@ void CoreSynth::stop(unsigned noteNumber, bool immediate)
 
 void CoreSynth::render(unsigned channelCount, unsigned sampleCount, float *outBuffers[])
 {
-    float *pOutLeft = outBuffers[0];
-    float *pOutRight = outBuffers[1];
-    
-    float pitchDev = pitchOffset + vibratoDepth * data->vibratoLFO.getSample();
+    render(channelCount, sampleCount, outBuffers, 0, 0);
+}
+
+void CoreSynth::render(unsigned channelCount, unsigned sampleCount, float *outBuffers[],
+                       const DunneCore::EngineCommand *events, int eventCount)
+{
+    // Render the block in spans which end wherever an event is due, so each is applied at its exact
+    // sample, and at the end of each chunk, where envelopes and LFOs step (see renderSpan()). The governor
+    // times the whole block, however many spans it takes.
+    data->governor.beginRender();
+    unsigned done = 0;
+    for (;;)
+    {
+        processCommands();
+        for (; eventCount > 0 && (events->sampleTime <= int64_t(done) || done == sampleCount); events++, eventCount--)
+            applyCommand(*events);
+        if (done == sampleCount) break;
+
+        unsigned count = samplesUntilNextCommand(sampleCount - done);
+        if (eventCount > 0 && events->sampleTime - int64_t(done) < int64_t(count))
+            count = unsigned(events->sampleTime - int64_t(done));
+        if (count == 0) continue;   // a posted command fell due meanwhile: apply it before rendering more
+        count = std::min(count, SYNTH_CHUNKSIZE - data->chunkPhase);
+        renderSpan(count, outBuffers[0] + done, outBuffers[1] + done);
+        done += count;
+    }
+    data->governor.endRender(sampleCount);
+}
+
+// Render a span which lies within one chunk. Envelopes and LFOs step, and voices take up parameter
+// changes, only at the start of each chunk, so their timing doesn't depend on how the output is split;
+// a voice (re)started part way through a chunk is set up for the rest of it.
+void CoreSynth::renderSpan(unsigned sampleCount, float *pOutLeft, float *pOutRight)
+{
+    bool atChunkStart = data->chunkPhase == 0;
+    unsigned chunkRemaining = SYNTH_CHUNKSIZE - data->chunkPhase;
+    data->chunkPhase = (data->chunkPhase + sampleCount) % SYNTH_CHUNKSIZE;
+
+    int qualityLevel = data->governor.getLevel();
+    int filterStages = data->filterStages.load(std::memory_order_relaxed);
+    if (filterStages != data->voiceParameters.filterStages)
+    {
+        // voice filters take their stage count from the quality level as well, so apply both together
+        data->voiceParameters.filterStages = filterStages;
+        applyQualityLevel(qualityLevel);
+    }
+    else if (qualityLevel != data->appliedQualityLevel) applyQualityLevel(qualityLevel);
+
+    if (atChunkStart) data->vibratoSample = data->vibratoLFO.getSample();
+    float pitchDev = pitchOffset + vibratoDepth * data->vibratoSample;
     float phaseDeltaMultiplier = pow(2.0f, pitchDev / 12.0);
 
-    for (int i=0; i < MAX_VOICE_COUNT; i++)
+    DunneCore::ActiveVoiceList &activeVoices = data->activeVoices;
+    if (data->renderPool.getThreadCount() > 0 && activeVoices.count() > 1)
     {
-        auto pVoice = data->voice[i].get();
-        int nn = pVoice->noteNumber;
-        if (nn >= 0)
+        data->renderSampleCount = sampleCount;
+        data->renderPhaseDeltaMultiplier = phaseDeltaMultiplier;
+        data->renderAtChunkStart = atChunkStart;
+        data->renderChunkRemaining = chunkRemaining;
+        data->renderPool.run(activeVoices.count(), renderVoiceTask, this);
+
+        for (int k=0; k < activeVoices.count(); )
         {
-            if (pVoice->prepToGetSamples(masterVolume, phaseDeltaMultiplier, cutoffMultiple, cutoffEnvelopeStrength, linearResonance) ||
-                pVoice->getSamples(sampleCount, pOutLeft, pOutRight))
+            int i = activeVoices[k];
+            InternalData::VoiceOutput &output = data->voiceOutput[i];
+            for (unsigned j=0; j < sampleCount; j++)
+            {
+                pOutLeft[j] += output.left[j];
+                pOutRight[j] += output.right[j];
+            }
+            if (output.isFinished)
             {
-                stopNote(nn, true);
+                data->culledSampleCount.fetch_add(data->voice[i].culledSampleCount, std::memory_order_relaxed);
+                handleNoteOff(output.noteNumber, true);
             }
+
+            // stopping this voice removed it from the list, moving the next one into its place
+            if (k < activeVoices.count() && activeVoices[k] == i) k++;
+        }
+        data->sampleTime.fetch_add(sampleCount, std::memory_order_relaxed);
+        return;
+    }
+
+    for (int k=0; k < activeVoices.count(); )
+    {
+        int i = activeVoices[k];
+        auto pVoice = &data->voice[i];
+        int nn = pVoice->noteNumber;
+        if (((atChunkStart || pVoice->needsPrep) &&
+             (pVoice->prepToGetSamples(masterVolume, phaseDeltaMultiplier, cutoffMultiple, cutoffEnvelopeStrength,
+                                       linearResonance, data->controlDivisor) ||
+              (data->audibilityFloor > 0.0f &&
+               pVoice->isInaudible(chunkRemaining, data->audibilityFloor, data->inaudibleChunkLimit)))) ||
+            pVoice->getSamples(sampleCount, pOutLeft, pOutRight))
+        {
+            data->culledSampleCount.fetch_add(pVoice->culledSampleCount, std::memory_order_relaxed);
+            handleNoteOff(nn, true);
         }
+
+        // stopping this voice removed it from the list, moving the next one into its place
+        if (k < activeVoices.count() && activeVoices[k] == i) k++;
+    }
+
+    data->sampleTime.fetch_add(sampleCount, std::memory_order_relaxed);
+}
+
+// Render the voice at the given position in the active-voice list into its own VoiceOutput.
+// Runs on any of the render threads, so must touch nothing shared with other voices.
+void CoreSynth::renderVoice(int activeIndex)
+{
+    int i = data->activeVoices[activeIndex];
+    DunneCore::SynthVoice *pVoice = &data->voice[i];
+    InternalData::VoiceOutput &output = data->voiceOutput[i];
+    unsigned sampleCount = data->renderSampleCount;
+    memset(output.left, 0, sampleCount * sizeof(float));
+    memset(output.right, 0, sampleCount * sizeof(float));
+
+    output.noteNumber = pVoice->noteNumber;
+    output.isFinished =
+        ((data->renderAtChunkStart || pVoice->needsPrep) &&
+         (pVoice->prepToGetSamples(masterVolume, data->renderPhaseDeltaMultiplier, cutoffMultiple, cutoffEnvelopeStrength,
+                                   linearResonance, data->controlDivisor) ||
+          (data->audibilityFloor > 0.0f &&
+           pVoice->isInaudible(data->renderChunkRemaining, data->audibilityFloor, data->inaudibleChunkLimit)))) ||
+        pVoice->getSamples(sampleCount, output.left, output.right);
+}
+
+void CoreSynth::renderVoiceTask(void *context, int taskIndex)
+{
+    ((CoreSynth *)context)->renderVoice(taskIndex);
+}
+
+void CoreSynth::setRenderThreadCount(int threadCount)
+{
+    data->renderPool.start(threadCount);
+}
+
+int CoreSynth::getRenderThreadCount()
+{
+    return data->renderPool.getThreadCount();
+}
+
+// Quality levels, each including all those below it:
+//   1:    voice filters use one stage fewer (but at least one)
+//   2, 3: voice filter coefficients are recomputed every 2nd, then every 4th chunk
+//   4-7:  each step allows only 3/4 as many voices as were sounding, so new notes steal
+// The governor moves one level at a time, so this only ever takes a single step.
+void CoreSynth::applyQualityLevel(int level)
+{
+    int filterStages = data->voiceParameters.filterStages;
+    if (level >= 1 && filterStages > 1) filterStages--;
+    for (auto& voice : data->voice)
+    {
+        voice.leftFilter.setStages(filterStages);
+        voice.rightFilter.setStages(filterStages);
     }
+
+    data->controlDivisor = level >= 3 ? 4 : level >= 2 ? 2 : 1;
+
+    if (level < 4) data->voiceLimit = data->voiceCount;
+    else if (level > data->appliedQualityLevel)
+    {
+        int soundingCount = std::min(data->voiceLimit, data->activeVoices.count());
+        if (soundingCount > 0) data->voiceLimit = std::max(1, soundingCount * 3 / 4);
+    }
+    else if (level < data->appliedQualityLevel)
+        data->voiceLimit = std::min(data->voiceCount, data->voiceLimit * 4 / 3 + 1);
+
+    data->appliedQualityLevel = level;
+}
+
+void CoreSynth::setFilterStages(int stages)
+{
+    data->filterStages.store(stages, std::memory_order_relaxed);
+}
+
+int CoreSynth::getFilterStages()
+{
+    return data->filterStages.load(std::memory_order_relaxed);
+}
+
+void CoreSynth::setCpuBudget(float fraction)
+{
+    data->governor.setBudget(fraction);
+}
+
+float CoreSynth::getCpuBudget()
+{
+    return data->governor.getBudget();
+}
+
+void CoreSynth::setAudibilityFloor(float floor, int chunkCount)
+{
+    data->audibilityFloor = floor;
+    data->inaudibleChunkLimit = std::max(1, chunkCount);
+}
+
+float CoreSynth::getAudibilityFloor()
+{
+    return data->audibilityFloor;
+}
+
+uint64_t CoreSynth::getCulledSampleCount()
+{
+    return data->culledSampleCount.load(std::memory_order_relaxed);
+}
+
+int CoreSynth::getQualityLevel()
+{
+    return data->governor.getLevel();
+}
+
+float CoreSynth::getCpuLoad()
+{
+    return data->governor.getLoad();
 }
 
 void CoreSynth::setAmpAttackDurationSeconds(float value)
 {
     data->ampEGParameters.setAttackDurationSeconds(value);
-    for (int i = 0; i < MAX_VOICE_COUNT; i++) data->voice[i]->updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 float CoreSynth::getAmpAttackDurationSeconds(void)
 {
@@ -286,7 +640,7 @@ float CoreSynth::getAmpAttackDurationSeconds(void)
 void  CoreSynth::setAmpDecayDurationSeconds(float value)
 {
     data->ampEGParameters.setDecayDurationSeconds(value);
-    for (int i = 0; i < MAX_VOICE_COUNT; i++) data->voice[i]->updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 float CoreSynth::getAmpDecayDurationSeconds(void)
 {
@@ -295,7 +649,7 @@ float CoreSynth::getAmpDecayDurationSeconds(void)
 void  CoreSynth::setAmpSustainFraction(float value)
 {
     data->ampEGParameters.sustainFraction = value;
-    for (int i = 0; i < MAX_VOICE_COUNT; i++) data->voice[i]->updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 float CoreSynth::getAmpSustainFraction(void)
 {
@@ -304,7 +658,7 @@ float CoreSynth::getAmpSustainFraction(void)
 void  CoreSynth::setAmpReleaseDurationSeconds(float value)
 {
     data->ampEGParameters.setReleaseDurationSeconds(value);
-    for (int i = 0; i < MAX_VOICE_COUNT; i++) data->voice[i]->updateAmpAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateAmpAdsrParameters();
 }
 
 float CoreSynth::getAmpReleaseDurationSeconds(void)
@@ -315,7 +669,7 @@ float CoreSynth::getAmpReleaseDurationSeconds(void)
 void  CoreSynth::setFilterAttackDurationSeconds(float value)
 {
     data->filterEGParameters.setAttackDurationSeconds(value);
-    for (int i = 0; i < MAX_VOICE_COUNT; i++) data->voice[i]->updateFilterAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateFilterAdsrParameters();
 }
 float CoreSynth::getFilterAttackDurationSeconds(void)
 {
@@ -324,7 +678,7 @@ float CoreSynth::getFilterAttackDurationSeconds(void)
 void  CoreSynth::setFilterDecayDurationSeconds(float value)
 {
     data->filterEGParameters.setDecayDurationSeconds(value);
-    for (int i = 0; i < MAX_VOICE_COUNT; i++) data->voice[i]->updateFilterAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateFilterAdsrParameters();
 }
 float CoreSynth::getFilterDecayDurationSeconds(void)
 {
@@ -333,7 +687,7 @@ float CoreSynth::getFilterDecayDurationSeconds(void)
 void  CoreSynth::setFilterSustainFraction(float value)
 {
     data->filterEGParameters.sustainFraction = value;
-    for (int i = 0; i < MAX_VOICE_COUNT; i++) data->voice[i]->updateFilterAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateFilterAdsrParameters();
 }
 float CoreSynth::getFilterSustainFraction(void)
 {
@@ -342,7 +696,7 @@ float CoreSynth::getFilterSustainFraction(void)
 void  CoreSynth::setFilterReleaseDurationSeconds(float value)
 {
     data->filterEGParameters.setReleaseDurationSeconds(value);
-    for (int i = 0; i < MAX_VOICE_COUNT; i++) data->voice[i]->updateFilterAdsrParameters();
+    for (int k = 0; k < data->activeVoices.count(); k++) data->voice[data->activeVoices[k]].updateFilterAdsrParameters();
 }
 float CoreSynth::getFilterReleaseDurationSeconds(void)
 {
@@ -2,12 +2,14 @@
 
 #ifdef __cplusplus
 #import <memory>
+#include <stdint.h>
 
 #define SYNTH_CHUNKSIZE 16            // process samples in "chunks" this size
 
 namespace DunneCore
 {
     struct SynthVoice;
+    struct EngineCommand;
 }
 
 class CoreSynth
@@ -18,13 +20,32 @@ public:
     
     /// returns system error code, nonzero only if a problem occurs
     int init(double sampleRate);
+
+    /// as above, but first (re)allocate the voice pool for the given polyphony (default 32);
+    /// call before rendering starts, never from the audio thread
+    int init(double sampleRate, int maxVoices);
+
+    /// number of voices in the pool
+    int getMaxVoices(void);
     
     /// call this to un-load all samples and clear the keymap
     void deinit();
     
-    void playNote(unsigned noteNumber, unsigned velocity, float noteFrequency);
-    void stopNote(unsigned noteNumber, bool immediate);
-    void sustainPedal(bool down);
+    /// Post a note or pedal event, which render() applies at exactly sampleTime (see getSampleTime()),
+    /// or as soon as possible if that has passed, e.g. 0. Events are applied in order of sampleTime, those
+    /// due together in the order posted, so an event posted for later never delays one due sooner. Safe to
+    /// call from any thread, as only the rendering thread ever touches voices; returns false, dropping the
+    /// event, if the command queue is full.
+    bool playNote(unsigned noteNumber, unsigned velocity, float noteFrequency, int64_t sampleTime = 0);
+    bool stopNote(unsigned noteNumber, bool immediate, int64_t sampleTime = 0);
+    bool sustainPedal(bool down, int64_t sampleTime = 0);
+
+    /// rendering thread only: apply all posted events which are due. render() calls this first, so it
+    /// is only needed to apply events without rendering.
+    void processCommands();
+
+    /// number of samples rendered so far, the clock against which events are timed
+    int64_t getSampleTime(void);
     
     void  setAmpAttackDurationSeconds(float value);
     float getAmpAttackDurationSeconds(void);
@@ -44,7 +65,44 @@ public:
     void  setFilterReleaseDurationSeconds(float value);
     float getFilterReleaseDurationSeconds(void);
     
+    /// Render sampleCount samples, applying posted events at the exact sample they are timed for: the
+    /// block is split into spans at each event, rather than events waiting for the next render() call.
     void render(unsigned channelCount, unsigned sampleCount, float *outBuffers[]);
+
+    /// as above, also applying a list of events sorted by sampleTime, which here means the offset into this
+    /// block (events at or beyond sampleCount are applied at its end)
+    void render(unsigned channelCount, unsigned sampleCount, float *outBuffers[],
+                const DunneCore::EngineCommand *events, int eventCount);
+
+    /// number of filter stages in each voice (default 2; 0 bypasses the filter), less any the CPU governor
+    /// has shed (see setCpuBudget()); safe to call while rendering, which takes up the change
+    void setFilterStages(int stages);
+    int getFilterStages(void);
+
+    /// keep rendering within the given fraction of real time, by lowering quality as needed (filter stages,
+    /// then filter control rate, then polyphony) and restoring it when the load drops; 0 (the default) disables
+    void setCpuBudget(float fraction);
+    float getCpuBudget(void);
+
+    /// how far quality has been lowered to meet the CPU budget: 0 means not at all
+    int getQualityLevel(void);
+
+    /// smoothed render time as a fraction of real time, measured only while a CPU budget is set
+    float getCpuLoad(void);
+
+    /// stop voices early once their release has stayed below floor, a linear gain combining the amp envelope,
+    /// note volume and master volume (e.g. 0.00003 for -90 dBFS), for chunkCount chunks in a row, rather than
+    /// rendering them until the envelope ends; 0 (the default) disables this
+    void setAudibilityFloor(float floor, int chunkCount = 4);
+    float getAudibilityFloor(void);
+
+    /// voice-samples left unrendered so far, by stopping voices below the audibility floor
+    uint64_t getCulledSampleCount(void);
+
+    /// render voices on this many worker threads, as well as the calling thread; 0 (the default) renders
+    /// on the calling thread alone. Output is bit-identical either way. Call only while not rendering.
+    void setRenderThreadCount(int threadCount);
+    int getRenderThreadCount(void);
     
 protected:
  
@@ -70,8 +128,18 @@ protected:
     
     void play(unsigned noteNumber, unsigned velocity, float noteFrequency);
     void stop(unsigned noteNumber, bool immediate);
+    void handleNoteOn(unsigned noteNumber, unsigned velocity, float noteFrequency);
+    void handleNoteOff(unsigned noteNumber, bool immediate);
+    void handleSustainPedal(bool down);
+    void applyCommand(const DunneCore::EngineCommand &command);
+    unsigned samplesUntilNextCommand(unsigned sampleCount);
+    void renderSpan(unsigned sampleCount, float *pOutLeft, float *pOutRight);
     
     DunneCore::SynthVoice *voicePlayingNote(unsigned noteNumber);
+    void allocateVoices(int maxVoices);
+    void applyQualityLevel(int level);
+    void renderVoice(int activeIndex);
+    static void renderVoiceTask(void *context, int taskIndex);
 };
 
 #endif
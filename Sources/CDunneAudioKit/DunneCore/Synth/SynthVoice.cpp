@@ -1,7 +1,9 @@
 // Copyright AudioKit. All Rights Reserved.
 
 #include "SynthVoice.h"
+#include "CoreSynth.h"      // for SYNTH_CHUNKSIZE
 #include <stdio.h>
+#include <algorithm>
 
 namespace DunneCore
 {
@@ -47,12 +49,18 @@ namespace DunneCore
         osc1.setFrequency(frequency * pow(2.0f, pParameters->osc1.pitchOffset / 12.0f));
         osc2.setFrequency(frequency * pow(2.0f, pParameters->osc2.pitchOffset / 12.0f));
         osc3.setFrequency(frequency);
+
+        // parameter changes are only applied to sounding voices, so catch up on any we missed
+        updateAmpAdsrParameters();
+        updateFilterAdsrParameters();
         ampEG.start();
         filterEG.start();
         pumpEG.start();
+        needsPrep = true;
         
         noteFrequency = frequency;
         noteNumber = noteNum;
+        controlCountdown = 0;
     }
     
     void SynthVoice::restart(unsigned evt, float volume)
@@ -62,6 +70,7 @@ namespace DunneCore
         newNoteVol = volume;
         ampEG.restart();
         pumpEG.restart();
+        needsPrep = true;
     }
     
     void SynthVoice::restart(unsigned evt, unsigned noteNum, float frequency, float volume)
@@ -72,6 +81,7 @@ namespace DunneCore
         noteFrequency = frequency;
         ampEG.restart();
         pumpEG.restart();
+        needsPrep = true;
     }
 
     void SynthVoice::release(unsigned evt)
@@ -86,6 +96,8 @@ namespace DunneCore
     {
         event = evt;
         noteNumber = -1;
+        inaudibleChunkCount = 0;
+        culledSampleCount = 0;
         ampEG.reset();
         filterEG.reset();
         pumpEG.reset();
@@ -95,8 +107,10 @@ namespace DunneCore
                                       float phaseDeltaMultiplier,
                                       float cutoffMultiple,
                                       float cutoffStrength,
-                                      float resLinear)
+                                      float resLinear,
+                                      int controlDivisor)
     {
+        needsPrep = false;
         if (ampEG.isIdle()) return true;
 
         if (ampEG.isPreStarting())
@@ -115,6 +129,7 @@ namespace DunneCore
                     osc2.setFrequency(noteFrequency * pow(2.0f, pParameters->osc2.pitchOffset / 12.0f));
                     osc3.setFrequency(noteFrequency);
                     noteNumber = newNoteNumber;
+                    controlCountdown = 0;
                 }
                 ampEG.start();
                 filterEG.start();
@@ -132,8 +147,13 @@ namespace DunneCore
         // standard ADSR EG
         double cutoffFrequency = noteFrequency * (1.0f + cutoffMultiple + cutoffStrength * filterEG.getSample());
 #endif
-        leftFilter.setParameters(cutoffFrequency, resLinear);
-        rightFilter.setParameters(cutoffFrequency, resLinear);
+        // the envelope must advance every chunk, but coefficients may be recomputed less often
+        if (--controlCountdown <= 0)
+        {
+            controlCountdown = controlDivisor;
+            leftFilter.setParameters(cutoffFrequency, resLinear);
+            rightFilter.setParameters(cutoffFrequency, resLinear);
+        }
 
         osc1.phaseDeltaMultiplier = phaseDeltaMultiplier;
         osc2.phaseDeltaMultiplier = phaseDeltaMultiplier;
@@ -166,4 +186,18 @@ namespace DunneCore
         return false;
     }
 
+    bool SynthVoice::isInaudible(int sampleCount, float audibilityFloor, int chunkLimit)
+    {
+        if (!ampEG.isReleasing() || tempGain >= audibilityFloor)
+        {
+            inaudibleChunkCount = 0;
+            return false;
+        }
+        if (++inaudibleChunkCount < chunkLimit) return false;
+
+        // this chunk and the rest of the release, as the envelope advances once per chunk
+        culledSampleCount = sampleCount + std::max(0, ampEG.getRemainingSampleCount()) * SYNTH_CHUNKSIZE;
+        return true;
+    }
+
 }
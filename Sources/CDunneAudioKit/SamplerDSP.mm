@@ -1,55 +1,250 @@
 // Copyright AudioKit. All Rights Reserved.
 
 #import "SamplerDSP.h"
-#include "wavpack.h"
 #include <math.h>
 
 #import "DSPBase.h"
 #include "DunneCore/Sampler/CoreSampler.h"
+#include "DunneCore/Sampler/SamplePool.h"
+#include "DunneCore/Sampler/SfzParser.h"
 #include "LinearParameterRamp.h"
 #include "AtomicDataPtr.h"
+#include "DunneCore/Common/CommandQueue.h"
+#include <algorithm>
+#include <atomic>
+
+// most parameter changes which may be waiting for process() to apply them
+#define PARAMETER_QUEUE_CAPACITY 256
 
 CoreSamplerRef akCoreSamplerCreate(void) {
     return new CoreSampler();
 }
 
+void akCoreSamplerDestroy(CoreSamplerRef pSampler) {
+    delete pSampler;
+}
+
+void akCoreSamplerInit(CoreSamplerRef pSampler, double sampleRate) {
+    pSampler->init(sampleRate);
+}
+
+bool akCoreSamplerPlayNote(CoreSamplerRef pSampler, unsigned noteNumber, unsigned velocity, int64_t sampleTime) {
+    return pSampler->playNote(noteNumber, velocity, sampleTime);
+}
+
+bool akCoreSamplerStopNote(CoreSamplerRef pSampler, unsigned noteNumber, bool immediate, int64_t sampleTime) {
+    return pSampler->stopNote(noteNumber, immediate, sampleTime);
+}
+
+int64_t akCoreSamplerGetSampleTime(CoreSamplerRef pSampler) {
+    return pSampler->getSampleTime();
+}
+
+uint64_t akCoreSamplerStopAllVoices(CoreSamplerRef pSampler) {
+    return pSampler->stopAllVoices();
+}
+
+bool akCoreSamplerWaitForStop(CoreSamplerRef pSampler, uint64_t epoch, double timeoutSeconds) {
+    return pSampler->waitForStop(epoch, timeoutSeconds);
+}
+
+void akCoreSamplerRestartVoices(CoreSamplerRef pSampler) {
+    pSampler->restartVoices();
+}
+
+void akCoreSamplerRender(CoreSamplerRef pSampler, unsigned sampleCount, float *pLeft, float *pRight) {
+    // in chunks of at most CORESAMPLER_CHUNKSIZE, as SamplerDSP::process() renders
+    for (unsigned done = 0; done < sampleCount; done += CORESAMPLER_CHUNKSIZE) {
+        float *outBuffers[2] = { pLeft + done, pRight + done };
+        pSampler->render(2, std::min(sampleCount - done, unsigned(CORESAMPLER_CHUNKSIZE)), outBuffers);
+    }
+}
+
 void akCoreSamplerLoadData(CoreSamplerRef pSampler, SampleDataDescriptor *pSDD) {
     pSampler->loadSampleData(*pSDD);
 }
 
-void akCoreSamplerLoadCompressedFile(CoreSamplerRef pSampler, SampleFileDescriptor *pSFD) {
-    char errMsg[100];
-    WavpackContext *wpc = WavpackOpenFileInput(pSFD->path, errMsg, OPEN_2CH_MAX, 0);
-    if (wpc == 0)
-    {
-        printf("Wavpack error loading %s: %s\n", pSFD->path, errMsg);
-        return;
-    }
+bool akCoreSamplerLoadSharedData(CoreSamplerRef pSampler, SampleDataDescriptor *pSDD, const char *sourceKey) {
+    return pSampler->loadSampleData(*pSDD, sourceKey);
+}
 
-    SampleDataDescriptor sdd;
-    sdd.sampleDescriptor = pSFD->sampleDescriptor;
-    sdd.sampleRate = (float)WavpackGetSampleRate(wpc);
-    sdd.channelCount = WavpackGetReducedChannels(wpc);
-    sdd.sampleCount = WavpackGetNumSamples(wpc);
-    sdd.isInterleaved = sdd.channelCount > 1;
-    sdd.data = new float[sdd.channelCount * sdd.sampleCount];
-
-    int mode = WavpackGetMode(wpc);
-    WavpackUnpackSamples(wpc, (int32_t*)sdd.data, sdd.sampleCount);
-    if ((mode & MODE_FLOAT) == 0)
-    {
-        // convert samples to floating-point
-        int bps = WavpackGetBitsPerSample(wpc);
-        float scale = 1.0f / (1 << (bps - 1));
-        float *pf = sdd.data;
-        int32_t *pi = (int32_t*)pf;
-        for (int i = 0; i < (sdd.sampleCount * sdd.channelCount); i++)
-            *pf++ = scale * *pi++;
+bool akCoreSamplerAdoptData(CoreSamplerRef pSampler, SampleDataDescriptor *pSDD, const char *sourceKey,
+                            void (*releaseData)(float *data, void *context), void *context) {
+    return pSampler->adoptSampleData(*pSDD, sourceKey, releaseData, context);
+}
+
+int akSamplePoolGetSampleCount(void) {
+    return DunneCore::SamplePool::shared().getEntryCount();
+}
+
+double akSamplePoolGetMegabytes(void) {
+    return DunneCore::SamplePool::shared().getByteCount() / (1024.0 * 1024.0);
+}
+
+SfzFileRef akSfzFileCreate(const char *path) {
+    DunneCore::SfzParser *pParser = new DunneCore::SfzParser();
+    if (!pParser->parseFile(path)) {
+        delete pParser;
+        return nullptr;
     }
-    WavpackCloseFile(wpc);
+    return reinterpret_cast<SfzFileRef>(pParser);
+}
+
+int akSfzFileGetRegionCount(SfzFileRef pFile) {
+    return int(reinterpret_cast<DunneCore::SfzParser*>(pFile)->getRegions().size());
+}
+
+SampleFileDescriptor akSfzFileGetRegion(SfzFileRef pFile, int index) {
+    const DunneCore::SfzParser::Region &region = reinterpret_cast<DunneCore::SfzParser*>(pFile)->getRegions()[index];
+    SampleFileDescriptor sfd;
+    sfd.sampleDescriptor = region.sampleDescriptor;
+    sfd.path = region.samplePath.c_str();
+    return sfd;
+}
+
+int akSfzFileGetUnreadableIncludeCount(SfzFileRef pFile) {
+    return int(reinterpret_cast<DunneCore::SfzParser*>(pFile)->getUnreadableIncludes().size());
+}
+
+const char *akSfzFileGetUnreadableInclude(SfzFileRef pFile, int index) {
+    return reinterpret_cast<DunneCore::SfzParser*>(pFile)->getUnreadableIncludes()[index].c_str();
+}
+
+void akSfzFileDestroy(SfzFileRef pFile) {
+    delete reinterpret_cast<DunneCore::SfzParser*>(pFile);
+}
+
+void akCoreSamplerLoadCompressedFile(CoreSamplerRef pSampler, SampleFileDescriptor *pSFD) {
+    pSampler->loadCompressedSampleFile(*pSFD);
+}
+
+int akCoreSamplerLoadCompressedFiles(CoreSamplerRef pSampler, SampleFileDescriptor *pSFDs, int count, int threadCount) {
+    return pSampler->loadCompressedSampleFiles(pSFDs, count, threadCount);
+}
+
+SampleLoadStatistics akCoreSamplerGetLoadStatistics(CoreSamplerRef pSampler) {
+    return pSampler->getLoadStatistics();
+}
+
+static SampleBufferRef sampleRef(DunneCore::KeyMappedSampleBuffer *pSample) {
+    return reinterpret_cast<SampleBufferRef>(pSample);
+}
+
+static DunneCore::KeyMappedSampleBuffer *sampleBuffer(SampleBufferRef pSample) {
+    return reinterpret_cast<DunneCore::KeyMappedSampleBuffer *>(pSample);
+}
+
+int akCoreSamplerGetSampleCount(CoreSamplerRef pSampler) {
+    return pSampler->getSampleCount();
+}
+
+SampleBufferRef akCoreSamplerGetSample(CoreSamplerRef pSampler, int index) {
+    return sampleRef(pSampler->getSample(index));
+}
+
+SampleBufferRef akCoreSamplerAddSample(CoreSamplerRef pSampler, SampleDataDescriptor *pSDD) {
+    return sampleRef(pSampler->addSample(*pSDD));
+}
+
+SampleBufferRef akCoreSamplerAddCompressedSample(CoreSamplerRef pSampler, SampleFileDescriptor *pSFD) {
+    return sampleRef(pSampler->addCompressedSample(*pSFD));
+}
+
+SampleBufferRef akCoreSamplerReplaceSample(CoreSamplerRef pSampler, SampleBufferRef pOld, SampleDataDescriptor *pSDD) {
+    return sampleRef(pSampler->replaceSample(sampleBuffer(pOld), *pSDD));
+}
+
+SampleBufferRef akCoreSamplerReplaceCompressedSample(CoreSamplerRef pSampler, SampleBufferRef pOld,
+                                                     SampleFileDescriptor *pSFD) {
+    return sampleRef(pSampler->replaceCompressedSample(sampleBuffer(pOld), *pSFD));
+}
+
+bool akCoreSamplerRemoveSample(CoreSamplerRef pSampler, SampleBufferRef pSample) {
+    return pSampler->removeSample(sampleBuffer(pSample));
+}
+
+int akCoreSamplerReclaimRetiredSamples(CoreSamplerRef pSampler) {
+    return pSampler->reclaimRetiredSamples();
+}
+
+void akCoreSamplerSetStreamingPreloadFrames(CoreSamplerRef pSampler, int preloadFrames) {
+    pSampler->setStreamingPreloadFrames(preloadFrames);
+}
+
+unsigned akCoreSamplerGetStreamingUnderrunCount(CoreSamplerRef pSampler) {
+    return pSampler->getStreamingUnderrunCount();
+}
+
+unsigned akCoreSamplerGetStreamingErrorCount(CoreSamplerRef pSampler) {
+    return pSampler->getStreamingErrorCount();
+}
+
+void akCoreSamplerSetLazyLoading(CoreSamplerRef pSampler, bool lazy, int headFrames) {
+    pSampler->setLazyLoading(lazy, headFrames);
+}
 
-    pSampler->loadSampleData(sdd);
-    delete[] sdd.data;
+int akCoreSamplerGetPendingLazySampleCount(CoreSamplerRef pSampler) {
+    return pSampler->getPendingLazySampleCount();
+}
+
+void akCoreSamplerSetMaxVoices(CoreSamplerRef pSampler, int maxVoices) {
+    pSampler->init(pSampler->currentSampleRate, maxVoices);
+}
+
+int akCoreSamplerGetActiveVoiceCount(CoreSamplerRef pSampler) {
+    return pSampler->getActiveVoiceCount();
+}
+
+void akCoreSamplerSetVoiceStealingPolicy(CoreSamplerRef pSampler, int policy) {
+    pSampler->voiceStealingPolicy = (CoreSampler::VoiceStealingPolicy)policy;
+}
+
+void akCoreSamplerSetReleaseDuration(CoreSamplerRef pSampler, float seconds) {
+    pSampler->setADSRReleaseDurationSeconds(seconds);
+}
+
+void akCoreSamplerSetAudibilityFloor(CoreSamplerRef pSampler, float floor, int chunkCount) {
+    pSampler->setAudibilityFloor(floor, chunkCount);
+}
+
+uint64_t akCoreSamplerGetCulledSampleCount(CoreSamplerRef pSampler) {
+    return pSampler->getCulledSampleCount();
+}
+
+void akCoreSamplerSetPreResampling(CoreSamplerRef pSampler, bool resample, double sampleRate) {
+    pSampler->setPreResampling(resample, sampleRate);
+}
+
+int akCoreSamplerGetPendingResampleCount(CoreSamplerRef pSampler) {
+    return pSampler->getPendingResampleCount();
+}
+
+void akCoreSamplerSetMipMapping(CoreSamplerRef pSampler, bool mipMap) {
+    pSampler->setMipMapping(mipMap);
+}
+
+void akCoreSamplerSetRenderThreadCount(CoreSamplerRef pSampler, int threadCount) {
+    pSampler->setRenderThreadCount(threadCount);
+}
+
+void akCoreSamplerSetInterleavedStorage(CoreSamplerRef pSampler, bool interleaved) {
+    pSampler->setInterleavedStorage(interleaved);
+}
+
+void akCoreSamplerSetFixedPointPhase(CoreSamplerRef pSampler, bool fixedPoint) {
+    pSampler->fixedPointPhase = fixedPoint;
+}
+
+void akCoreSamplerSetSampleSharing(CoreSamplerRef pSampler, bool share) {
+    pSampler->setSampleSharing(share);
+}
+
+void akCoreSamplerSetContentDeduplication(CoreSamplerRef pSampler, bool dedup) {
+    pSampler->setContentDeduplication(dedup);
+}
+
+bool akCoreSamplerSetStorageBitDepth(CoreSamplerRef pSampler, int bitDepth) {
+    return pSampler->setStorageBitDepth(bitDepth);
 }
 
 void akCoreSamplerSetNoteFrequency(CoreSamplerRef pSampler, int noteNumber, float noteFrequency) {
@@ -87,6 +282,13 @@ struct SamplerDSP : DSPBase
 
     std::vector<std::unique_ptr<CoreSampler>> cleanupArray;
 
+    // Parameters may be set on any thread, but only the audio thread touches the ramps and the sampler:
+    // setParameter() records each new value, for getParameter(), and queues it for process() to apply.
+    // If the queue ever fills, process() re-applies every recorded value instead.
+    std::atomic<float> parameterValues[SamplerParameterRampDuration + 1];
+    DunneCore::CommandQueue<DunneCore::EngineCommand, PARAMETER_QUEUE_CAPACITY> parameterQueue;
+    std::atomic<bool> parameterQueueOverflowed;
+
     SamplerDSP();
     void init(int channelCount, double sampleRate) override;
     void deinit() override;
@@ -97,44 +299,17 @@ struct SamplerDSP : DSPBase
     void handleMIDIEvent(AUMIDIEvent const& midiEvent) override;
     void process(FrameRange range) override;
 
+    void applyParameter(uint64_t address, float value, bool immediate);
+    void applyQueuedParameters();
+    float initialParameterValue(uint64_t address);
+    static void applySamplerParameter(CoreSampler *pSampler, uint64_t address, float value);
+
     void updateCoreSampler(CoreSampler* newSampler) {
+        // newSampler is not shared yet, so may be set up directly; ramped values follow in process()
         newSampler->init(sampleRate);
-        newSampler->setADSRAttackDurationSeconds(sampler->getADSRAttackDurationSeconds());
-        newSampler->setADSRDecayDurationSeconds(sampler->getADSRDecayDurationSeconds());
-        newSampler->setADSRHoldDurationSeconds(sampler->getADSRHoldDurationSeconds());
-        newSampler->setADSRSustainFraction(sampler->getADSRSustainFraction());
-        newSampler->setADSRReleaseHoldDurationSeconds(sampler->getADSRReleaseHoldDurationSeconds());
-        newSampler->setADSRReleaseDurationSeconds(sampler->getADSRReleaseDurationSeconds());
-        
-        newSampler->setFilterAttackDurationSeconds(sampler->getFilterAttackDurationSeconds());
-        newSampler->setFilterDecayDurationSeconds(sampler->getFilterDecayDurationSeconds());
-        newSampler->setFilterSustainFraction(sampler->getFilterSustainFraction());
-        newSampler->setFilterReleaseDurationSeconds(sampler->getFilterReleaseDurationSeconds());
-        
-        newSampler->setPitchAttackDurationSeconds(sampler->getPitchAttackDurationSeconds());
-        newSampler->setPitchDecayDurationSeconds(sampler->getPitchDecayDurationSeconds());
-        newSampler->setPitchSustainFraction(sampler->getPitchSustainFraction());
-        newSampler->setPitchReleaseDurationSeconds(sampler->getPitchReleaseDurationSeconds());
-        newSampler->pitchADSRSemitones = sampler->pitchADSRSemitones;
-        
-        newSampler->pitchOffset = sampler->pitchOffset;
-        newSampler->cutoffEnvelopeStrength = sampler->cutoffEnvelopeStrength;
-        newSampler->cutoffMultiple = sampler->cutoffMultiple;
-        newSampler->filterEnvelopeVelocityScaling = sampler->filterEnvelopeVelocityScaling;
-        newSampler->glideRate = sampler->glideRate;
-        newSampler->isFilterEnabled = sampler->isFilterEnabled;
-        newSampler->isLegato = sampler->isLegato;
-        newSampler->isMonophonic = sampler->isMonophonic;
-        newSampler->keyTracking = sampler->keyTracking;
-        newSampler->linearResonance = sampler->linearResonance;
-        newSampler->masterVolume = sampler->masterVolume;
-        newSampler->portamentoRate = sampler->portamentoRate;
-        newSampler->vibratoDepth = sampler->vibratoDepth;
-        newSampler->vibratoFrequency = sampler->vibratoFrequency;
-        newSampler->voiceVibratoDepth = sampler->voiceVibratoDepth;
-        newSampler->voiceVibratoFrequency = sampler->voiceVibratoFrequency;
-        newSampler->setLoopThruRelease(sampler->loopThruRelease);
-        
+        for (uint64_t address = 0; address <= SamplerParameterRampDuration; address++)
+            applySamplerParameter(newSampler, address, parameterValues[address].load());
+
         sampler.set(newSampler);
     }
 };
@@ -147,6 +322,26 @@ void akSamplerUpdateCoreSampler(DSPRef pDSP, CoreSamplerRef pSampler) {
     ((SamplerDSP*)pDSP)->updateCoreSampler(pSampler);
 }
 
+unsigned akSamplerGetStreamingUnderrunCount(DSPRef pDSP) {
+    return ((SamplerDSP*)pDSP)->sampler->getStreamingUnderrunCount();
+}
+
+unsigned akSamplerGetStreamingErrorCount(DSPRef pDSP) {
+    return ((SamplerDSP*)pDSP)->sampler->getStreamingErrorCount();
+}
+
+int akSamplerGetQualityLevel(DSPRef pDSP) {
+    return ((SamplerDSP*)pDSP)->sampler->getQualityLevel();
+}
+
+float akSamplerGetCpuLoad(DSPRef pDSP) {
+    return ((SamplerDSP*)pDSP)->sampler->getCpuLoad();
+}
+
+uint64_t akSamplerGetCulledSampleCount(DSPRef pDSP) {
+    return ((SamplerDSP*)pDSP)->sampler->getCulledSampleCount();
+}
+
 SamplerDSP::SamplerDSP()
 {
     sampler.set(new CoreSampler);
@@ -162,6 +357,10 @@ SamplerDSP::SamplerDSP()
     filterResonanceRamp.setTarget(1.0, true);
     pitchADSRSemitonesRamp.setTarget(0.0, true);
     glideRateRamp.setTarget(0.0, true);
+
+    for (uint64_t address = 0; address <= SamplerParameterRampDuration; address++)
+        parameterValues[address].store(initialParameterValue(address));
+    parameterQueueOverflowed.store(false);
 }
 
 void SamplerDSP::init(int channelCount, double sampleRate)
@@ -176,7 +375,36 @@ void SamplerDSP::deinit()
     sampler->deinit();
 }
 
-void SamplerDSP::setParameter(AUParameterAddress address, float value, bool immediate) __attribute__((no_sanitize("thread")))
+void SamplerDSP::setParameter(AUParameterAddress address, float value, bool immediate)
+{
+    if (address > SamplerParameterRampDuration) return;
+    parameterValues[address].store(value);
+    if (!parameterQueue.push(DunneCore::EngineCommand::setParameter(address, value, immediate)))
+        parameterQueueOverflowed.store(true);
+}
+
+float SamplerDSP::getParameter(AUParameterAddress address)
+{
+    if (address > SamplerParameterRampDuration) return 0;
+    return parameterValues[address].load();
+}
+
+// audio thread: apply every parameter change queued since the last call
+void SamplerDSP::applyQueuedParameters()
+{
+    DunneCore::EngineCommand command;
+    while (parameterQueue.pop(command))
+        applyParameter(command.address, command.value, command.immediate);
+
+    if (parameterQueueOverflowed.exchange(false))
+    {
+        applyParameter(SamplerParameterRampDuration, parameterValues[SamplerParameterRampDuration].load(), false);
+        for (uint64_t address = 0; address < SamplerParameterRampDuration; address++)
+            applyParameter(address, parameterValues[address].load(), false);
+    }
+}
+
+void SamplerDSP::applyParameter(AUParameterAddress address, float value, bool immediate)
 {
     switch (address) {
         case SamplerParameterRampDuration:
@@ -223,81 +451,107 @@ void SamplerDSP::setParameter(AUParameterAddress address, float value, bool imme
         case SamplerParameterGlideRate:
             glideRateRamp.setTarget(value, immediate);
             break;
+        case SamplerParameterPitchADSRSemitones:
+            pitchADSRSemitonesRamp.setTarget(value, immediate);
+            break;
 
+        default:
+            applySamplerParameter(sampler.operator->(), address, value);
+            break;
+    }
+}
+
+// set one of the parameters held by the CoreSampler itself, rather than ramped here
+void SamplerDSP::applySamplerParameter(CoreSampler *pSampler, AUParameterAddress address, float value)
+{
+    switch (address) {
         case SamplerParameterAttackDuration:
-            sampler->setADSRAttackDurationSeconds(value);
+            pSampler->setADSRAttackDurationSeconds(value);
             break;
         case SamplerParameterHoldDuration:
-            sampler->setADSRHoldDurationSeconds(value);
+            pSampler->setADSRHoldDurationSeconds(value);
             break;
         case SamplerParameterDecayDuration:
-            sampler->setADSRDecayDurationSeconds(value);
+            pSampler->setADSRDecayDurationSeconds(value);
             break;
         case SamplerParameterSustainLevel:
-            sampler->setADSRSustainFraction(value);
+            pSampler->setADSRSustainFraction(value);
             break;
         case SamplerParameterReleaseHoldDuration:
-            sampler->setADSRReleaseHoldDurationSeconds(value);
+            pSampler->setADSRReleaseHoldDurationSeconds(value);
             break;
         case SamplerParameterReleaseDuration:
-            sampler->setADSRReleaseDurationSeconds(value);
+            pSampler->setADSRReleaseDurationSeconds(value);
             break;
 
         case SamplerParameterFilterAttackDuration:
-            sampler->setFilterAttackDurationSeconds(value);
+            pSampler->setFilterAttackDurationSeconds(value);
             break;
         case SamplerParameterFilterDecayDuration:
-            sampler->setFilterDecayDurationSeconds(value);
+            pSampler->setFilterDecayDurationSeconds(value);
             break;
         case SamplerParameterFilterSustainLevel:
-            sampler->setFilterSustainFraction(value);
+            pSampler->setFilterSustainFraction(value);
             break;
         case SamplerParameterFilterReleaseDuration:
-            sampler->setFilterReleaseDurationSeconds(value);
+            pSampler->setFilterReleaseDurationSeconds(value);
             break;
 
         case SamplerParameterPitchAttackDuration:
-            sampler->setPitchAttackDurationSeconds(value);
+            pSampler->setPitchAttackDurationSeconds(value);
             break;
         case SamplerParameterPitchDecayDuration:
-            sampler->setPitchDecayDurationSeconds(value);
+            pSampler->setPitchDecayDurationSeconds(value);
             break;
         case SamplerParameterPitchSustainLevel:
-            sampler->setPitchSustainFraction(value);
+            pSampler->setPitchSustainFraction(value);
             break;
         case SamplerParameterPitchReleaseDuration:
-            sampler->setPitchReleaseDurationSeconds(value);
-            break;
-        case SamplerParameterPitchADSRSemitones:
-            pitchADSRSemitonesRamp.setTarget(value, immediate);
+            pSampler->setPitchReleaseDurationSeconds(value);
             break;
 
         case SamplerParameterRestartVoiceLFO:
-            sampler->restartVoiceLFO = value > 0.5f;
+            pSampler->restartVoiceLFO = value > 0.5f;
             break;
 
         case SamplerParameterFilterEnable:
-            sampler->isFilterEnabled = value > 0.5f;
+            pSampler->isFilterEnabled = value > 0.5f;
             break;
         case SamplerParameterLoopThruRelease:
-            sampler->loopThruRelease = value > 0.5f;
+            pSampler->loopThruRelease = value > 0.5f;
             break;
         case SamplerParameterMonophonic:
-            sampler->isMonophonic = value > 0.5f;
+            pSampler->isMonophonic = value > 0.5f;
             break;
         case SamplerParameterLegato:
-            sampler->isLegato = value > 0.5f;
+            pSampler->isLegato = value > 0.5f;
             break;
         case SamplerParameterKeyTrackingFraction:
-            sampler->keyTracking = value;
+            pSampler->keyTracking = value;
             break;
         case SamplerParameterFilterEnvelopeVelocityScaling:
-            sampler->filterEnvelopeVelocityScaling = value;
+            pSampler->filterEnvelopeVelocityScaling = value;
+            break;
+        case SamplerParameterVoiceStealingPolicy:
+            pSampler->voiceStealingPolicy = (CoreSampler::VoiceStealingPolicy)(int)(value + 0.5f);
+            break;
+        case SamplerParameterInterpolationMode:
+            pSampler->interpolationMode = value < 0.5f ? 0 : value < 1.5f ? 1 : 2;
+            break;
+        case SamplerParameterCpuBudget:
+            pSampler->setCpuBudget(value);
+            break;
+        case SamplerParameterFixedPointPhase:
+            pSampler->fixedPointPhase = value > 0.5f;
+            break;
+        case SamplerParameterAudibilityFloor:
+            pSampler->setAudibilityFloor(value);
             break;
     }
 }
 
-float SamplerDSP::getParameter(AUParameterAddress address) __attribute__((no_sanitize("thread")))
+// the value of a parameter as the ramps and a newly created sampler have it, before any is set
+float SamplerDSP::initialParameterValue(AUParameterAddress address)
 {
     switch (address) {
         case SamplerParameterRampDuration:
@@ -372,6 +626,16 @@ float SamplerDSP::getParameter(AUParameterAddress address) __attribute__((no_san
             return sampler->keyTracking;
         case SamplerParameterFilterEnvelopeVelocityScaling:
             return sampler->filterEnvelopeVelocityScaling;
+        case SamplerParameterVoiceStealingPolicy:
+            return (float)sampler->voiceStealingPolicy;
+        case SamplerParameterInterpolationMode:
+            return (float)sampler->interpolationMode;
+        case SamplerParameterCpuBudget:
+            return sampler->getCpuBudget();
+        case SamplerParameterFixedPointPhase:
+            return sampler->fixedPointPhase ? 1.0f : 0.0f;
+        case SamplerParameterAudibilityFloor:
+            return sampler->getAudibilityFloor();
     }
     return 0;
 }
@@ -405,8 +669,9 @@ void SamplerDSP::handleMIDIEvent(const AUMIDIEvent &midiEvent)
                     sampler->sustainPedal(true);
                 }
             }
-            if (num == 123) { // all notes off
-                sampler->stopAllVoices();
+            if (num == 123) { // all notes off: we are on the audio thread, so silence everything now
+                sampler->stopAllVoicesNow();
+                sampler->restartVoices();
             }
             break;
         }
@@ -423,6 +688,7 @@ void SamplerDSP::process(FrameRange range)
     memset(pRight, 0, range.count * sizeof(float));
 
     sampler.update();
+    applyQueuedParameters();
 
     // process in chunks of maximum length CORESAMPLER_CHUNKSIZE
     for (int frameIndex = 0; frameIndex < range.count; frameIndex += CORESAMPLER_CHUNKSIZE) {
@@ -498,4 +764,9 @@ AK_REGISTER_PARAMETER(SamplerParameterMonophonic)
 AK_REGISTER_PARAMETER(SamplerParameterLegato)
 AK_REGISTER_PARAMETER(SamplerParameterKeyTrackingFraction)
 AK_REGISTER_PARAMETER(SamplerParameterFilterEnvelopeVelocityScaling)
+AK_REGISTER_PARAMETER(SamplerParameterVoiceStealingPolicy)
+AK_REGISTER_PARAMETER(SamplerParameterInterpolationMode)
+AK_REGISTER_PARAMETER(SamplerParameterCpuBudget)
+AK_REGISTER_PARAMETER(SamplerParameterFixedPointPhase)
+AK_REGISTER_PARAMETER(SamplerParameterAudibilityFloor)
 AK_REGISTER_PARAMETER(SamplerParameterRampDuration)
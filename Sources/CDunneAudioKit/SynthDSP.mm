@@ -6,6 +6,11 @@
 #import "DSPBase.h"
 #include "DunneCore/Synth/CoreSynth.h"
 #include "LinearParameterRamp.h"
+#include "DunneCore/Common/CommandQueue.h"
+#include <atomic>
+
+// most parameter changes which may be waiting for process() to apply them
+#define PARAMETER_QUEUE_CAPACITY 256
 
 struct SynthDSP : DSPBase, CoreSynth
 {
@@ -17,6 +22,13 @@ struct SynthDSP : DSPBase, CoreSynth
     LinearParameterRamp filterStrengthRamp;
     LinearParameterRamp filterResonanceRamp;
 
+    // Parameters may be set on any thread, but only the audio thread touches the ramps and voices:
+    // setParameter() records each new value, for getParameter(), and queues it for process() to apply.
+    // If the queue ever fills, process() re-applies every recorded value instead.
+    std::atomic<float> parameterValues[SynthParameterRampDuration + 1];
+    DunneCore::CommandQueue<DunneCore::EngineCommand, PARAMETER_QUEUE_CAPACITY> parameterQueue;
+    std::atomic<bool> parameterQueueOverflowed;
+
     SynthDSP();
     void init(int channelCount, double sampleRate) override;
     void deinit() override;
@@ -26,12 +38,32 @@ struct SynthDSP : DSPBase, CoreSynth
 
     void handleMIDIEvent(const AUMIDIEvent &midiEvent) override;
     void process(FrameRange) override;
+
+    void applyParameter(uint64_t address, float value, bool immediate);
+    void applyQueuedParameters();
+    float initialParameterValue(uint64_t address);
 };
 
 DSPRef akSynthCreateDSP() {
     return new SynthDSP();
 }
 
+int akSynthGetQualityLevel(DSPRef pDSP) {
+    return ((SynthDSP*)pDSP)->getQualityLevel();
+}
+
+float akSynthGetCpuLoad(DSPRef pDSP) {
+    return ((SynthDSP*)pDSP)->getCpuLoad();
+}
+
+uint64_t akSynthGetCulledSampleCount(DSPRef pDSP) {
+    return ((SynthDSP*)pDSP)->getCulledSampleCount();
+}
+
+void akSynthSetRenderThreadCount(DSPRef pDSP, int threadCount) {
+    ((SynthDSP*)pDSP)->setRenderThreadCount(threadCount);
+}
+
 SynthDSP::SynthDSP() : DSPBase(/*inputBusCount*/0), CoreSynth()
 {
     masterVolumeRamp.setTarget(1.0, true);
@@ -39,6 +71,10 @@ SynthDSP::SynthDSP() : DSPBase(/*inputBusCount*/0), CoreSynth()
     vibratoDepthRamp.setTarget(0.0, true);
     filterCutoffRamp.setTarget(1000.0, true);
     filterResonanceRamp.setTarget(1.0, true);
+
+    for (uint64_t address = 0; address <= SynthParameterRampDuration; address++)
+        parameterValues[address].store(initialParameterValue(address));
+    parameterQueueOverflowed.store(false);
 }
 
 void SynthDSP::init(int channelCount, double sampleRate)
@@ -54,6 +90,35 @@ void SynthDSP::deinit()
 }
 
 void SynthDSP::setParameter(uint64_t address, float value, bool immediate)
+{
+    if (address > SynthParameterRampDuration) return;
+    parameterValues[address].store(value);
+    if (!parameterQueue.push(DunneCore::EngineCommand::setParameter(address, value, immediate)))
+        parameterQueueOverflowed.store(true);
+}
+
+float SynthDSP::getParameter(uint64_t address)
+{
+    if (address > SynthParameterRampDuration) return 0;
+    return parameterValues[address].load();
+}
+
+// audio thread: apply every parameter change queued since the last call
+void SynthDSP::applyQueuedParameters()
+{
+    DunneCore::EngineCommand command;
+    while (parameterQueue.pop(command))
+        applyParameter(command.address, command.value, command.immediate);
+
+    if (parameterQueueOverflowed.exchange(false))
+    {
+        applyParameter(SynthParameterRampDuration, parameterValues[SynthParameterRampDuration].load(), false);
+        for (uint64_t address = 0; address < SynthParameterRampDuration; address++)
+            applyParameter(address, parameterValues[address].load(), false);
+    }
+}
+
+void SynthDSP::applyParameter(uint64_t address, float value, bool immediate)
 {
     switch (address) {
         case SynthParameterRampDuration:
@@ -108,10 +173,17 @@ void SynthDSP::setParameter(uint64_t address, float value, bool immediate)
         case SynthParameterFilterReleaseDuration:
             setFilterReleaseDurationSeconds(value);
             break;
+        case SynthParameterCpuBudget:
+            setCpuBudget(value);
+            break;
+        case SynthParameterAudibilityFloor:
+            setAudibilityFloor(value);
+            break;
     }
 }
 
-float SynthDSP::getParameter(uint64_t address)
+// the value of a parameter as the ramps and voices have it, before any is set
+float SynthDSP::initialParameterValue(uint64_t address)
 {
     switch (address) {
         case SynthParameterRampDuration:
@@ -147,6 +219,11 @@ float SynthDSP::getParameter(uint64_t address)
             return getFilterSustainFraction();
         case SynthParameterFilterReleaseDuration:
             return getFilterReleaseDurationSeconds();
+
+        case SynthParameterCpuBudget:
+            return getCpuBudget();
+        case SynthParameterAudibilityFloor:
+            return getAudibilityFloor();
     }
     return 0;
 }
@@ -182,6 +259,8 @@ void SynthDSP::process(FrameRange range)
 
     memset(pLeft, 0, range.count * sizeof(float));
     memset(pRight, 0, range.count * sizeof(float));
+
+    applyQueuedParameters();
     
     // process in chunks of maximum length CHUNKSIZE
     for (int frameIndex = 0; frameIndex < range.count; frameIndex += SYNTH_CHUNKSIZE) {
@@ -227,4 +306,6 @@ AK_REGISTER_PARAMETER(SynthParameterFilterAttackDuration)
 AK_REGISTER_PARAMETER(SynthParameterFilterDecayDuration)
 AK_REGISTER_PARAMETER(SynthParameterFilterSustainLevel)
 AK_REGISTER_PARAMETER(SynthParameterFilterReleaseDuration)
+AK_REGISTER_PARAMETER(SynthParameterCpuBudget)
+AK_REGISTER_PARAMETER(SynthParameterAudibilityFloor)
 AK_REGISTER_PARAMETER(SynthParameterRampDuration)
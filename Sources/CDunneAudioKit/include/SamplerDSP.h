@@ -42,6 +42,11 @@ typedef NS_ENUM(AUParameterAddress, SamplerParameter)
     SamplerParameterLegato,
     SamplerParameterKeyTrackingFraction,
     SamplerParameterFilterEnvelopeVelocityScaling,
+    SamplerParameterVoiceStealingPolicy,
+    SamplerParameterInterpolationMode,
+    SamplerParameterCpuBudget,
+    SamplerParameterFixedPointPhase,
+    SamplerParameterAudibilityFloor,
     
     // ensure this is always last in the list, to simplify parameter addressing
     SamplerParameterRampDuration,
@@ -52,14 +57,124 @@ typedef NS_ENUM(AUParameterAddress, SamplerParameter)
 CF_EXTERN_C_BEGIN
 typedef struct CoreSampler* CoreSamplerRef;
 
+/// Opaque handle to one sample of a CoreSampler's sample set.
+typedef struct SampleBufferHandle* SampleBufferRef;
+
+/// Opaque handle to a parsed SFZ file.
+typedef struct SfzFileHandle* SfzFileRef;
+
 DSPRef akSamplerCreateDSP(void);
 
 /// Takes ownership of the CoreSampler.
 void akSamplerUpdateCoreSampler(DSPRef pDSP, CoreSamplerRef pSampler);
 
+/// Number of output samples rendered before the disk streamer could deliver their sample data.
+unsigned akSamplerGetStreamingUnderrunCount(DSPRef pDSP);
+
+/// Number of times a sample file could not be reopened for streaming, so a voice played only its resident head.
+unsigned akSamplerGetStreamingErrorCount(DSPRef pDSP);
+
+/// How far quality has been lowered to meet the CPU budget (0 = full quality).
+int akSamplerGetQualityLevel(DSPRef pDSP);
+
+/// Smoothed render time as a fraction of real time, measured while a CPU budget is set.
+float akSamplerGetCpuLoad(DSPRef pDSP);
+
+/// Voice-samples not rendered because voices were stopped below the audibility floor.
+uint64_t akSamplerGetCulledSampleCount(DSPRef pDSP);
+
 CoreSamplerRef akCoreSamplerCreate(void);
+
+/// Drive a CoreSampler directly, rather than through akSamplerUpdateCoreSampler, e.g. in tests. Notes may be
+/// posted from any thread, and are applied by akCoreSamplerRender at sampleTime (see akCoreSamplerGetSampleTime),
+/// or as soon as possible if that has passed; they return false if the command queue is full. Rendering adds
+/// sampleCount frames to pLeft and pRight.
+void akCoreSamplerDestroy(CoreSamplerRef pSampler);
+void akCoreSamplerInit(CoreSamplerRef pSampler, double sampleRate);
+bool akCoreSamplerPlayNote(CoreSamplerRef pSampler, unsigned noteNumber, unsigned velocity, int64_t sampleTime);
+bool akCoreSamplerStopNote(CoreSamplerRef pSampler, unsigned noteNumber, bool immediate, int64_t sampleTime);
+int64_t akCoreSamplerGetSampleTime(CoreSamplerRef pSampler);
+void akCoreSamplerRender(CoreSamplerRef pSampler, unsigned sampleCount, float *pLeft, float *pRight);
+
+/// Stop all voices at the next render, and ignore new notes until akCoreSamplerRestartVoices; returns the
+/// request's epoch (0 if the command queue is full), for akCoreSamplerWaitForStop, which returns false if the
+/// stop has not been carried out within timeoutSeconds.
+uint64_t akCoreSamplerStopAllVoices(CoreSamplerRef pSampler);
+bool akCoreSamplerWaitForStop(CoreSamplerRef pSampler, uint64_t epoch, double timeoutSeconds);
+void akCoreSamplerRestartVoices(CoreSamplerRef pSampler);
+
+/// Parses an SFZ file and the files it includes, returning null if it cannot be read. Each region's sample
+/// path is absolute (or relative to the working directory), and valid until the SfzFileRef is destroyed,
+/// as is the path of each included file which could not be read, and so was skipped.
+SfzFileRef akSfzFileCreate(const char *path);
+int akSfzFileGetRegionCount(SfzFileRef pFile);
+SampleFileDescriptor akSfzFileGetRegion(SfzFileRef pFile, int index);
+int akSfzFileGetUnreadableIncludeCount(SfzFileRef pFile);
+const char *akSfzFileGetUnreadableInclude(SfzFileRef pFile, int index);
+void akSfzFileDestroy(SfzFileRef pFile);
+
 void akCoreSamplerLoadData(CoreSamplerRef pSampler, SampleDataDescriptor *pSDD);
 void akCoreSamplerLoadCompressedFile(CoreSamplerRef pSampler, SampleFileDescriptor *pSFD);
+
+/// Loads sample data shared with every other sample loaded from sourceKey with the same length and storage
+/// settings; if pSDD->data is null, attaches only to data already shared, returning false if there is none.
+bool akCoreSamplerLoadSharedData(CoreSamplerRef pSampler, SampleDataDescriptor *pSDD, const char *sourceKey);
+
+/// As akCoreSamplerLoadSharedData (sourceKey may be null), but taking ownership of pSDD->data, which is freed
+/// by calling releaseData(data, context) once no sample uses it. Returns true if the data is used in place,
+/// false if it was converted to the storage format or layout (or already shared), and freed at once.
+bool akCoreSamplerAdoptData(CoreSamplerRef pSampler, SampleDataDescriptor *pSDD, const char *sourceKey,
+                            void (*releaseData)(float *data, void *context), void *context);
+
+/// Distinct samples currently shared between samplers, and the memory they occupy.
+int akSamplePoolGetSampleCount(void);
+double akSamplePoolGetMegabytes(void);
+
+/// Decodes the files on threadCount threads (0 = one per core), adding them in order; returns the number loaded.
+int akCoreSamplerLoadCompressedFiles(CoreSamplerRef pSampler, SampleFileDescriptor *pSFDs, int count, int threadCount);
+SampleLoadStatistics akCoreSamplerGetLoadStatistics(CoreSamplerRef pSampler);
+
+/// Edit a sample set while it plays; these return null (or false) on failure.
+int akCoreSamplerGetSampleCount(CoreSamplerRef pSampler);
+SampleBufferRef akCoreSamplerGetSample(CoreSamplerRef pSampler, int index);
+SampleBufferRef akCoreSamplerAddSample(CoreSamplerRef pSampler, SampleDataDescriptor *pSDD);
+SampleBufferRef akCoreSamplerAddCompressedSample(CoreSamplerRef pSampler, SampleFileDescriptor *pSFD);
+SampleBufferRef akCoreSamplerReplaceSample(CoreSamplerRef pSampler, SampleBufferRef pOld, SampleDataDescriptor *pSDD);
+SampleBufferRef akCoreSamplerReplaceCompressedSample(CoreSamplerRef pSampler, SampleBufferRef pOld,
+                                                     SampleFileDescriptor *pSFD);
+bool akCoreSamplerRemoveSample(CoreSamplerRef pSampler, SampleBufferRef pSample);
+int akCoreSamplerReclaimRetiredSamples(CoreSamplerRef pSampler);
+
+/// Keep only preloadFrames of each compressed file loaded from now on in memory, streaming the rest from disk.
+void akCoreSamplerSetStreamingPreloadFrames(CoreSamplerRef pSampler, int preloadFrames);
+unsigned akCoreSamplerGetStreamingUnderrunCount(CoreSamplerRef pSampler);
+unsigned akCoreSamplerGetStreamingErrorCount(CoreSamplerRef pSampler);
+
+/// Load compressed files registered with only headFrames decoded, the rest on first use (or on a neighbour's).
+void akCoreSamplerSetLazyLoading(CoreSamplerRef pSampler, bool lazy, int headFrames);
+int akCoreSamplerGetPendingLazySampleCount(CoreSamplerRef pSampler);
+void akCoreSamplerSetMaxVoices(CoreSamplerRef pSampler, int maxVoices);
+int akCoreSamplerGetActiveVoiceCount(CoreSamplerRef pSampler);
+
+/// 0 = released voices first, 1 = oldest, 2 = quietest, as for SamplerParameterVoiceStealingPolicy.
+void akCoreSamplerSetVoiceStealingPolicy(CoreSamplerRef pSampler, int policy);
+void akCoreSamplerSetReleaseDuration(CoreSamplerRef pSampler, float seconds);
+
+/// Stop voices whose release stays below floor for chunkCount chunks, as for SamplerParameterAudibilityFloor.
+void akCoreSamplerSetAudibilityFloor(CoreSamplerRef pSampler, float floor, int chunkCount);
+uint64_t akCoreSamplerGetCulledSampleCount(CoreSamplerRef pSampler);
+
+/// Convert samples loaded from now on to sampleRate, the rate the engine is expected to run at, as they load;
+/// once akCoreSamplerInit (or a Sampler) has given the engine's rate, to that instead. Never re-initialises.
+void akCoreSamplerSetPreResampling(CoreSamplerRef pSampler, bool resample, double sampleRate);
+int akCoreSamplerGetPendingResampleCount(CoreSamplerRef pSampler);
+void akCoreSamplerSetMipMapping(CoreSamplerRef pSampler, bool mipMap);
+void akCoreSamplerSetRenderThreadCount(CoreSamplerRef pSampler, int threadCount);
+void akCoreSamplerSetInterleavedStorage(CoreSamplerRef pSampler, bool interleaved);
+void akCoreSamplerSetFixedPointPhase(CoreSamplerRef pSampler, bool fixedPoint);
+void akCoreSamplerSetSampleSharing(CoreSamplerRef pSampler, bool share);
+void akCoreSamplerSetContentDeduplication(CoreSamplerRef pSampler, bool dedup);
+bool akCoreSamplerSetStorageBitDepth(CoreSamplerRef pSampler, int bitDepth);
 void akCoreSamplerSetNoteFrequency(CoreSamplerRef pSampler, int noteNumber, float noteFrequency);
 void akCoreSamplerBuildSimpleKeyMap(CoreSamplerRef pSampler);
 void akCoreSamplerBuildKeyMap(CoreSamplerRef pSampler);
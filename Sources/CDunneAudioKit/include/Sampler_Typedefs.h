@@ -37,3 +37,15 @@ typedef struct
     const char *path;
     
 } SampleFileDescriptor;
+
+typedef struct
+{
+    int fileCount;
+    double megabytes;           // sample data newly stored in memory, in millions of bytes
+    double seconds;             // elapsed (wall-clock) time spent loading
+    double megabytesPerSecond;  // sample data made ready per second, whether decoded or shared
+    int sharedFileCount;        // files (of fileCount) whose data was already in memory, so shared, not decoded
+    double sharedMegabytes;     // memory those shared files would otherwise have taken
+    int unmappedSampleCount;    // samples beyond the key map's limit of 65535, left out of the last map built
+
+} SampleLoadStatistics;
@@ -26,6 +26,8 @@ typedef NS_ENUM(AUParameterAddress, SynthParameter)
     SynthParameterFilterDecayDuration,
     SynthParameterFilterSustainLevel,
     SynthParameterFilterReleaseDuration,
+    SynthParameterCpuBudget,
+    SynthParameterAudibilityFloor,
 
     // ensure this is always last in the list, to simplify parameter addressing
     SynthParameterRampDuration,
@@ -33,4 +35,16 @@ typedef NS_ENUM(AUParameterAddress, SynthParameter)
 
 CF_EXTERN_C_BEGIN
 DSPRef akSynthCreateDSP(void);
+
+/// How far quality has been lowered to meet the CPU budget (0 = full quality).
+int akSynthGetQualityLevel(DSPRef pDSP);
+
+/// Smoothed render time as a fraction of real time, measured while a CPU budget is set.
+float akSynthGetCpuLoad(DSPRef pDSP);
+
+/// Voice-samples not rendered because voices were stopped below the audibility floor.
+uint64_t akSynthGetCulledSampleCount(DSPRef pDSP);
+
+/// Render voices on this many worker threads as well as the audio thread; call only while not rendering.
+void akSynthSetRenderThreadCount(DSPRef pDSP, int threadCount);
 CF_EXTERN_C_END
\ No newline at end of file
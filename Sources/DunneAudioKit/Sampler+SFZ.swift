@@ -4,7 +4,7 @@ import AudioKit
 import AVFoundation
 import CDunneAudioKit
 
-/// Super-naive code to read a .sfz file
+/// Loading .sfz files, which DunneCore's SfzParser reads
 
 extension SamplerData {
     /// Load an SFZ at the given location
@@ -17,107 +17,46 @@ extension SamplerData {
         loadSFZ(url: URL(fileURLWithPath: path).appendingPathComponent(fileName))
     }
 
-    /// Load an SFZ at the given location
+    /// Load an SFZ at the given location. Regions inherit opcodes from their <global>, <master> and <group>
+    /// headers, and #define and #include directives are supported.
     ///
     /// Parameters:
     ///   - url: File url to the SFZ file
     ///
     public func loadSFZ(url: URL) {
-        var lowNoteNumber: MIDINoteNumber = 0
-        var highNoteNumber: MIDINoteNumber = 127
-        var noteNumber: MIDINoteNumber = 60
-        var lowVelocity: MIDIVelocity = 0
-        var highVelocity: MIDIVelocity = 127
-        var sample = ""
-        var loopMode = "no_loop"
-        var loopStartPoint: Float32 = 0
-        var loopEndPoint: Float32 = 0
+        guard let sfzFile = akSfzFileCreate(url.path) else {
+            Log("Could not load SFZ: cannot read \(url.path)")
+            return
+        }
+        defer { akSfzFileDestroy(sfzFile) }
+        for index in 0 ..< akSfzFileGetUnreadableIncludeCount(sfzFile) {
+            Log("SFZ \(url.path): cannot include \(String(cString: akSfzFileGetUnreadableInclude(sfzFile, index)))")
+        }
 
-        let samplesBaseURL = url.deletingLastPathComponent()
+        // compressed files are collected and decoded in parallel, before any other sample which follows them
+        var compressedFiles: [PathWithSampleDescriptor] = []
 
         do {
-            let data = try String(contentsOf: url, encoding: .ascii)
-            let lines = data.components(separatedBy: .newlines)
-            for line in lines {
-                let trimmed = String(line.trimmingCharacters(in: .whitespacesAndNewlines))
-                if trimmed == "" || trimmed.hasPrefix("//") {
-                    // ignore blank lines and comment lines
-                    continue
-                }
-                if trimmed.hasPrefix("<group>") {
-                    // parse a <group> line
-                    for part in trimmed.dropFirst(7).components(separatedBy: .whitespaces) {
-                        if part.hasPrefix("key") {
-                            noteNumber = MIDINoteNumber(part.components(separatedBy: "=")[1]) ?? 0
-                            lowNoteNumber = noteNumber
-                            highNoteNumber = noteNumber
-                        } else if part.hasPrefix("lokey") {
-                            lowNoteNumber = MIDINoteNumber(part.components(separatedBy: "=")[1]) ?? 0
-                        } else if part.hasPrefix("hikey") {
-                            highNoteNumber = MIDINoteNumber(part.components(separatedBy: "=")[1]) ?? 0
-                        } else if part.hasPrefix("pitch_keycenter") {
-                            noteNumber = MIDINoteNumber(part.components(separatedBy: "=")[1]) ?? 0
-                        }
-                    }
-                }
-                if trimmed.hasPrefix("<region>") {
-                    // parse a <region> line
-                    for part in trimmed.dropFirst(8).components(separatedBy: .whitespaces) {
-                        if part.hasPrefix("lovel") {
-                            lowVelocity = MIDIVelocity(part.components(separatedBy: "=")[1]) ?? 0
-                        } else if part.hasPrefix("hivel") {
-                            highVelocity = MIDIVelocity(part.components(separatedBy: "=")[1]) ?? 0
-                        } else if part.hasPrefix("loop_mode") {
-                            loopMode = part.components(separatedBy: "=")[1]
-                        } else if part.hasPrefix("loop_start") {
-                            loopStartPoint = Float32(part.components(separatedBy: "=")[1]) ?? 0
-                        } else if part.hasPrefix("loop_end") {
-                            loopEndPoint = Float32(part.components(separatedBy: "=")[1]) ?? 0
-                        } else if part.hasPrefix("sample") {
-                            sample = trimmed.components(separatedBy: "sample=")[1]
-                        }
-                    }
-
-                    let noteFrequency = Float(440.0 * pow(2.0, (Double(noteNumber) - 69.0) / 12.0))
+            for index in 0 ..< akSfzFileGetRegionCount(sfzFile) {
+                let region = akSfzFileGetRegion(sfzFile, index)
+                let sampleDescriptor = region.sampleDescriptor
+                let sample = String(cString: region.path)
 
-                    let noteLog = "load \(noteNumber) \(noteFrequency) NN range \(lowNoteNumber)-\(highNoteNumber)"
-                    Log("\(noteLog) vel \(lowVelocity)-\(highVelocity) \(sample)")
+                let noteLog = "load \(sampleDescriptor.noteNumber) \(sampleDescriptor.noteFrequency) " +
+                    "NN range \(sampleDescriptor.minimumNoteNumber)-\(sampleDescriptor.maximumNoteNumber)"
+                Log("\(noteLog) vel \(sampleDescriptor.minimumVelocity)-\(sampleDescriptor.maximumVelocity) \(sample)")
 
-                    let sampleDescriptor = SampleDescriptor(noteNumber: Int32(noteNumber),
-                                                            noteFrequency: noteFrequency,
-                                                            minimumNoteNumber: Int32(lowNoteNumber),
-                                                            maximumNoteNumber: Int32(highNoteNumber),
-                                                            minimumVelocity: Int32(lowVelocity),
-                                                            maximumVelocity: Int32(highVelocity),
-                                                            isLooping: loopMode != "no_loop",
-                                                            loopStartPoint: loopStartPoint,
-                                                            loopEndPoint: loopEndPoint,
-                                                            startPoint: 0.0,
-                                                            endPoint: 0.0)
-                    sample = sample.replacingOccurrences(of: "\\", with: "/")
-                    let sampleFileURL = samplesBaseURL
-                        .appendingPathComponent(sample)
-                    if sample.hasSuffix(".wv") {
-                        sampleFileURL.path.withCString { path in
-                            loadCompressedSampleFile(from: SampleFileDescriptor(sampleDescriptor: sampleDescriptor,
-                                                                                path: path))
-                        }
+                if sample.hasSuffix(".wv") {
+                    compressedFiles.append((sampleDescriptor, sample))
+                } else if sample.hasSuffix(".aif") || sample.hasSuffix(".wav") {
+                    let compressedPath = String(sample.dropLast(4) + ".wv")
+                    if FileManager.default.fileExists(atPath: compressedPath) {
+                        compressedFiles.append((sampleDescriptor, compressedPath))
                     } else {
-                        if sample.hasSuffix(".aif") || sample.hasSuffix(".wav") {
-                            let compressedFileURL = samplesBaseURL
-                                .appendingPathComponent(String(sample.dropLast(4) + ".wv"))
-                            let fileMgr = FileManager.default
-                            if fileMgr.fileExists(atPath: compressedFileURL.path) {
-                                compressedFileURL.path.withCString { path in
-                                    loadCompressedSampleFile(
-                                        from: SampleFileDescriptor(sampleDescriptor: sampleDescriptor,
-                                                                   path: path))
-                                }
-                            } else {
-                                let sampleFile = try AVAudioFile(forReading: sampleFileURL)
-                                loadAudioFile(from: sampleDescriptor, file: sampleFile)
-                            }
-                        }
+                        loadCompressedSampleFiles(compressedFiles)
+                        compressedFiles.removeAll()
+                        let sampleFile = try AVAudioFile(forReading: URL(fileURLWithPath: sample))
+                        loadAudioFile(from: sampleDescriptor, file: sampleFile)
                     }
                 }
             }
@@ -125,6 +64,17 @@ extension SamplerData {
             Log("Could not load SFZ: \(error.localizedDescription)")
         }
 
+        loadCompressedSampleFiles(compressedFiles)
+        let stats = loadStatistics
+        if stats.fileCount > 0 {
+            Log("loaded \(stats.fileCount) compressed samples, " +
+                String(format: "%.1f MB at %.1f MB/s", stats.megabytes, stats.megabytesPerSecond) +
+                ", \(stats.sharedFileCount) shared (" + String(format: "%.1f MB saved)", stats.sharedMegabytes))
+        }
         buildKeyMap()
+        let unmappedCount = loadStatistics.unmappedSampleCount
+        if unmappedCount > 0 {
+            Log("\(unmappedCount) samples not mapped: a key map holds at most 65535")
+        }
     }
 }
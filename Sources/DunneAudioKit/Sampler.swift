@@ -440,6 +440,81 @@ public class Sampler: Node {
     /// filterEnvelopeVelocityScaling (fraction 0.0 to 1.0)
     @Parameter(filterEnvelopeVelocityScalingDef) public var filterEnvelopeVelocityScaling: AUValue
 
+    /// Specification details for voiceStealingPolicy
+    public static let voiceStealingPolicyDef = NodeParameterDef(
+        identifier: "voiceStealingPolicy",
+        name: "Voice Stealing Policy",
+        address: akGetParameterAddress("SamplerParameterVoiceStealingPolicy"),
+        defaultValue: 0,
+        range: 0 ... 2,
+        unit: .indexed,
+        flags: nonRampFlags
+    )
+
+    /// voiceStealingPolicy, used when a note arrives and all voices are busy:
+    /// 0 = stalest released voice first, 1 = oldest voice, 2 = quietest voice
+    @Parameter(voiceStealingPolicyDef) public var voiceStealingPolicy: AUValue
+
+    /// Specification details for interpolationMode
+    public static let interpolationModeDef = NodeParameterDef(
+        identifier: "interpolationMode",
+        name: "Interpolation Mode",
+        address: akGetParameterAddress("SamplerParameterInterpolationMode"),
+        defaultValue: 0,
+        range: 0 ... 2,
+        unit: .indexed,
+        flags: nonRampFlags
+    )
+
+    /// interpolationMode, trading CPU for less aliasing when samples are pitch-shifted:
+    /// 0 = linear, 1 = 4-point Hermite, 2 = 8-point windowed sinc
+    @Parameter(interpolationModeDef) public var interpolationMode: AUValue
+
+    /// Specification details for cpuBudget
+    public static let cpuBudgetDef = NodeParameterDef(
+        identifier: "cpuBudget",
+        name: "CPU Budget",
+        address: akGetParameterAddress("SamplerParameterCpuBudget"),
+        defaultValue: 0,
+        range: 0 ... 1,
+        unit: .generic,
+        flags: nonRampFlags
+    )
+
+    /// cpuBudget, the fraction of real time rendering may take before quality is lowered
+    /// (see qualityLevel); 0 = never lower quality
+    @Parameter(cpuBudgetDef) public var cpuBudget: AUValue
+
+    /// Specification details for fixedPointPhase
+    public static let fixedPointPhaseDef = NodeParameterDef(
+        identifier: "fixedPointPhase",
+        name: "Fixed-Point Phase",
+        address: akGetParameterAddress("SamplerParameterFixedPointPhase"),
+        defaultValue: 0,
+        range: 0 ... 1,
+        unit: .boolean,
+        flags: nonRampFlags
+    )
+
+    /// fixedPointPhase (boolean, 0.0 for false or 1.0 for true): track sample position as 32.32 fixed point,
+    /// which is slightly cheaper and keeps long sustained loops exact
+    @Parameter(fixedPointPhaseDef) public var fixedPointPhase: AUValue
+
+    /// Specification details for audibilityFloor
+    public static let audibilityFloorDef = NodeParameterDef(
+        identifier: "audibilityFloor",
+        name: "Audibility Floor",
+        address: akGetParameterAddress("SamplerParameterAudibilityFloor"),
+        defaultValue: 0,
+        range: 0 ... 0.01,
+        unit: .linearGain,
+        flags: nonRampFlags
+    )
+
+    /// audibilityFloor, the gain (envelope, note and master volume combined) below which releasing voices are
+    /// stopped early, e.g. 0.00003 for -90 dBFS; 0 = let every release run to its end
+    @Parameter(audibilityFloorDef) public var audibilityFloor: AUValue
+
     // MARK: - Initialization
 
     /// Initialize without any descriptors
@@ -472,6 +547,33 @@ public class Sampler: Node {
         akSamplerUpdateCoreSampler(au.dsp, data.coreSamplerRef)
     }
 
+    /// Number of output samples rendered before disk streaming could deliver their sample data
+    public var streamingUnderrunCount: Int {
+        Int(akSamplerGetStreamingUnderrunCount(au.dsp))
+    }
+
+    /// Number of times a sample file could not be reopened for streaming (e.g. it was moved after loading),
+    /// so a voice played only the part of the sample held in memory
+    public var streamingErrorCount: Int {
+        Int(akSamplerGetStreamingErrorCount(au.dsp))
+    }
+
+    /// How far quality has been lowered to stay within cpuBudget: 0 = full quality,
+    /// 1-2 = cheaper interpolation, 3-4 = slower filter updates, 5-8 = fewer voices
+    public var qualityLevel: Int {
+        Int(akSamplerGetQualityLevel(au.dsp))
+    }
+
+    /// Smoothed render time as a fraction of real time, measured while cpuBudget is set
+    public var cpuLoad: Float {
+        akSamplerGetCpuLoad(au.dsp)
+    }
+
+    /// Voice-samples left unrendered by stopping voices below audibilityFloor
+    public var culledSampleCount: Int {
+        Int(akSamplerGetCulledSampleCount(au.dsp))
+    }
+
     #if !os(tvOS)
     /// Play the sampler
     /// - Parameters:
@@ -546,24 +648,46 @@ public struct SamplerData {
     }
 
     public func loadAudioFile(from sampleDescriptor: SampleDescriptor, file: AVAudioFile) {
-        guard let floatChannelData = file.toFloatChannelData() else { return }
-
         let sampleRate = Float(file.fileFormat.sampleRate)
         let sampleCount = Int32(file.length)
         let channelCount = Int32(file.fileFormat.channelCount)
-        var flattened = Array(floatChannelData.joined())
-
-        flattened.withUnsafeMutableBufferPointer { data in
+        var descriptor = SampleDataDescriptor(sampleDescriptor: sampleDescriptor,
+                                              sampleRate: sampleRate,
+                                              isInterleaved: false,
+                                              channelCount: channelCount,
+                                              sampleCount: sampleCount,
+                                              data: nil)
+
+        // share the samples of a file already loaded by any sampler, rather than reading it again
+        let sourceKey = SamplerData.sourceKey(for: file.url)
+        if akCoreSamplerLoadSharedData(coreSamplerRef, &descriptor, sourceKey) { return }
+
+        // read the file straight into one buffer, which the sampler then keeps (or de-interleaves and frees)
+        guard let buffer = SamplerData.interleavedBuffer(reading: file),
+              let data = buffer.floatChannelData?[0] else { return }
+        descriptor.isInterleaved = true
+        descriptor.sampleCount = Int32(buffer.frameLength)
+        descriptor.data = data
+        akCoreSamplerAdoptData(coreSamplerRef, &descriptor, sourceKey, { _, context in
+            Unmanaged<AVAudioPCMBuffer>.fromOpaque(context!).release()
+        }, Unmanaged.passRetained(buffer).toOpaque())
+    }
 
-            var descriptor = SampleDataDescriptor(sampleDescriptor: sampleDescriptor,
-                                                  sampleRate: sampleRate,
-                                                  isInterleaved: false,
-                                                  channelCount: channelCount,
-                                                  sampleCount: sampleCount,
-                                                  data: data.baseAddress)
+    /// The whole of a file's audio as 32-bit float, interleaved if stereo
+    static func interleavedBuffer(reading file: AVAudioFile) -> AVAudioPCMBuffer? {
+        guard let interleavedFile = try? AVAudioFile(forReading: file.url, commonFormat: .pcmFormatFloat32, interleaved: true),
+              let buffer = AVAudioPCMBuffer(pcmFormat: interleavedFile.processingFormat,
+                                            frameCapacity: AVAudioFrameCount(interleavedFile.length)),
+              (try? interleavedFile.read(into: buffer)) != nil else { return nil }
+        return buffer
+    }
 
-            akCoreSamplerLoadData(coreSamplerRef, &descriptor)
-        }
+    /// Identifies an audio file's contents for sample sharing: its path, size and modification date
+    static func sourceKey(for url: URL) -> String {
+        let attributes = try? FileManager.default.attributesOfItem(atPath: url.path)
+        let size = (attributes?[.size] as? NSNumber)?.uint64Value ?? 0
+        let modified = (attributes?[.modificationDate] as? Date)?.timeIntervalSince1970 ?? 0
+        return "\(url.path)|\(size)|\(modified)"
     }
 
     public func loadAudioFile(file: AVAudioFile,
@@ -602,6 +726,111 @@ public struct SamplerData {
         akCoreSamplerLoadData(coreSamplerRef, &copy)
     }
 
+    /// Stream compressed sample files from disk instead of loading them fully. Call before loading.
+    /// - Parameter preloadFrames: Number of frames of each file kept in memory (0 disables streaming)
+    public func enableStreaming(preloadFrames: Int) {
+        akCoreSamplerSetStreamingPreloadFrames(coreSamplerRef, Int32(preloadFrames))
+    }
+
+    /// Load compressed sample files lazily: each is registered at once with only its attack decoded, and the
+    /// rest streamed from disk until a background thread has loaded the whole file, which happens when it is
+    /// first played, or a neighbouring note or velocity layer is. Layers never played are never loaded.
+    /// Call before loading.
+    /// - Parameters:
+    ///   - lazy: true to load lazily, false (the default) to load everything up front
+    ///   - headFrames: Frames of each file decoded at once; with 0, a note plays the nearest velocity layer
+    ///     already loaded until its own arrives
+    public func setLazyLoading(_ lazy: Bool, headFrames: Int = 8192) {
+        akCoreSamplerSetLazyLoading(coreSamplerRef, lazy, Int32(headFrames))
+    }
+
+    /// Number of lazily loaded samples not yet loaded in full
+    public var pendingLazySampleCount: Int {
+        Int(akCoreSamplerGetPendingLazySampleCount(coreSamplerRef))
+    }
+
+    /// Convert samples loaded after this call to the engine's sample rate as they load, with a high-quality
+    /// resampler, rather than have every voice interpolate between rates. Notes played at a sample's own pitch
+    /// then read it straight through. If the engine turns out to run at another rate, the samples are converted
+    /// again in the background, and play as before until their copies are ready.
+    /// - Parameters:
+    ///   - resample: true to convert samples as they load, false (the default) to keep them at their own rate
+    ///   - sampleRate: The rate the engine is expected to run at, used until this data is passed to a Sampler, which
+    ///     converts samples loaded from then on to its own rate
+    public func setPreResampling(_ resample: Bool, sampleRate: Double = Settings.sampleRate) {
+        akCoreSamplerSetPreResampling(coreSamplerRef, resample, sampleRate)
+    }
+
+    /// Number of samples still being converted to the engine's sample rate in the background
+    public var pendingResampleCount: Int {
+        Int(akCoreSamplerGetPendingResampleCount(coreSamplerRef))
+    }
+
+    /// Give samples loaded after this call band-limited copies at half and a quarter of their rate, which notes
+    /// played an octave or more above a sample's pitch read instead, so they do not alias. Costs 75% more memory
+    /// per sample; notes less than an octave up are unaffected.
+    /// - Parameter mipMap: true to build the copies as samples load, false (the default) not to
+    public func setMipMapping(_ mipMap: Bool) {
+        akCoreSamplerSetMipMapping(coreSamplerRef, mipMap)
+    }
+
+    /// Store stereo samples loaded after this call interleaved (LRLR) rather than planar, so each playing
+    /// voice reads one contiguous stream of memory. Output is identical either way.
+    /// - Parameter interleaved: true for interleaved storage, false for planar (the default)
+    public func setInterleavedStorage(_ interleaved: Bool) {
+        akCoreSamplerSetInterleavedStorage(coreSamplerRef, interleaved)
+    }
+
+    /// Share the samples loaded after this call (the default) with every other sampler which loads the same
+    /// files with the same storage settings, so identical instruments take the memory of one.
+    /// - Parameter share: false to give this sample set its own copy of every sample
+    public func setSampleSharing(_ share: Bool) {
+        akCoreSamplerSetSampleSharing(coreSamplerRef, share)
+    }
+
+    /// Identify Wavpack files loaded after this call by their content rather than their path, so identical
+    /// files under different names (round-robins or release samples copied between layers, say) are decoded
+    /// once and shared. Each file is read once more, to hash it, the first time it is loaded.
+    /// - Parameter dedup: true to share identical files wherever they are, false (the default) to go by path
+    public func setContentDeduplication(_ dedup: Bool) {
+        akCoreSamplerSetContentDeduplication(coreSamplerRef, dedup)
+    }
+
+    /// Number of distinct samples in memory shared between all sample sets
+    public static var sharedSampleCount: Int {
+        Int(akSamplePoolGetSampleCount())
+    }
+
+    /// Megabytes of sample memory shared between all sample sets
+    public static var sharedSampleMegabytes: Double {
+        akSamplePoolGetMegabytes()
+    }
+
+    /// Store samples loaded after this call as 16-bit or packed 24-bit integers rather than 32-bit float,
+    /// halving (or cutting by a quarter) their memory. Sources of the same or lower bit depth play back
+    /// identically; deeper sources are rounded to the nearest integer sample.
+    /// - Parameter bitDepth: 16, 24, or 32 for float (the default)
+    /// - Returns: false if bitDepth is not supported
+    @discardableResult
+    public func setStorageBitDepth(_ bitDepth: Int) -> Bool {
+        return akCoreSamplerSetStorageBitDepth(coreSamplerRef, Int32(bitDepth))
+    }
+
+    /// Set polyphony, i.e. the number of voices allocated for this sample set (default 64).
+    /// Call before passing this data to a Sampler.
+    /// - Parameter maxVoices: Maximum number of simultaneously sounding notes
+    public func setMaxVoices(_ maxVoices: Int) {
+        akCoreSamplerSetMaxVoices(coreSamplerRef, Int32(maxVoices))
+    }
+
+    /// Render voices on this many extra worker threads, as well as the audio thread (default 0).
+    /// Output is identical either way; this only helps when many voices sound at once.
+    /// Call before passing this data to a Sampler.
+    /// - Parameter threadCount: Number of worker threads
+    public func setRenderThreadCount(_ threadCount: Int) {
+        akCoreSamplerSetRenderThreadCount(coreSamplerRef, Int32(threadCount))
+    }
+
     /// Load data from compressed file
     /// - Parameter sampleFileDescriptor: Sample descriptor information
     public func loadCompressedSampleFile(from sampleFileDescriptor: SampleFileDescriptor) {
@@ -609,6 +838,97 @@ public struct SamplerData {
         akCoreSamplerLoadCompressedFile(coreSamplerRef, &copy)
     }
 
+    /// A type to hold a compressed sample file's path with its sample descriptor
+    public typealias PathWithSampleDescriptor = (sampleDescriptor: SampleDescriptor, path: String)
+
+    /// Load many compressed files at once, decoding them in parallel straight into sample memory.
+    /// Samples are added in the order given, exactly as by loading each with loadCompressedSampleFile().
+    /// - Parameters:
+    ///   - files: Sample descriptors and file paths
+    ///   - threadCount: Number of decoding threads (0, the default, means one per processor core)
+    /// - Returns: Number of files loaded
+    @discardableResult
+    public func loadCompressedSampleFiles(_ files: [PathWithSampleDescriptor], threadCount: Int = 0) -> Int {
+        let paths = files.map { strdup($0.path) }
+        defer { paths.forEach { free($0) } }
+        var descriptors = zip(files, paths).map {
+            SampleFileDescriptor(sampleDescriptor: $0.0.sampleDescriptor, path: UnsafePointer($0.1))
+        }
+        return Int(akCoreSamplerLoadCompressedFiles(coreSamplerRef, &descriptors,
+                                                    Int32(descriptors.count), Int32(threadCount)))
+    }
+
+    /// Totals for all compressed files loaded so far: file count, megabytes of sample memory,
+    /// seconds spent, throughput in MB/s (of sample data decoded or shared alike), and how many files
+    /// (and megabytes) were shared rather than decoded; also how many samples the last key map built
+    /// had no room for (only the first 65535 can be mapped)
+    public var loadStatistics: SampleLoadStatistics {
+        akCoreSamplerGetLoadStatistics(coreSamplerRef)
+    }
+
+    /// Number of samples loaded
+    public var sampleCount: Int {
+        Int(akCoreSamplerGetSampleCount(coreSamplerRef))
+    }
+
+    /// Handle to a loaded sample, for editing it with replaceSample() or removeSample()
+    /// - Parameter index: Position in load order, which is also the order samples are mapped in
+    public func sample(at index: Int) -> SampleBufferRef? {
+        akCoreSamplerGetSample(coreSamplerRef, Int32(index))
+    }
+
+    // Samples may be added, replaced and removed while the sampler plays, after building the key map:
+    // only the notes each change affects are re-mapped, and nothing else is reloaded. Replaced and
+    // removed samples are freed once no voice can still be playing them.
+
+    /// Add a sample, after all others in mapping order
+    /// - Returns: Handle to the new sample, or nil on failure
+    @discardableResult
+    public func addSample(from sampleDataDescriptor: SampleDataDescriptor) -> SampleBufferRef? {
+        var copy = sampleDataDescriptor
+        return akCoreSamplerAddSample(coreSamplerRef, &copy)
+    }
+
+    /// Add a compressed sample file, after all others in mapping order
+    /// - Returns: Handle to the new sample, or nil on failure
+    @discardableResult
+    public func addCompressedSample(from sampleFileDescriptor: SampleFileDescriptor) -> SampleBufferRef? {
+        var copy = sampleFileDescriptor
+        return akCoreSamplerAddCompressedSample(coreSamplerRef, &copy)
+    }
+
+    /// Replace a sample, keeping its place in mapping order
+    /// - Returns: Handle to the new sample, or nil on failure (leaving the old one in place)
+    @discardableResult
+    public func replaceSample(_ sample: SampleBufferRef,
+                              with sampleDataDescriptor: SampleDataDescriptor) -> SampleBufferRef? {
+        var copy = sampleDataDescriptor
+        return akCoreSamplerReplaceSample(coreSamplerRef, sample, &copy)
+    }
+
+    /// Replace a sample with a compressed sample file, keeping its place in mapping order
+    /// - Returns: Handle to the new sample, or nil on failure (leaving the old one in place)
+    @discardableResult
+    public func replaceSample(_ sample: SampleBufferRef,
+                              with sampleFileDescriptor: SampleFileDescriptor) -> SampleBufferRef? {
+        var copy = sampleFileDescriptor
+        return akCoreSamplerReplaceCompressedSample(coreSamplerRef, sample, &copy)
+    }
+
+    /// Remove a sample
+    /// - Returns: false if the sample is not part of this sample set
+    @discardableResult
+    public func removeSample(_ sample: SampleBufferRef) -> Bool {
+        akCoreSamplerRemoveSample(coreSamplerRef, sample)
+    }
+
+    /// Free replaced and removed samples which the sampler has finished playing. Every edit does this too.
+    /// - Returns: Number of samples still waiting to be freed
+    @discardableResult
+    public func reclaimRetiredSamples() -> Int {
+        Int(akCoreSamplerReclaimRetiredSamples(coreSamplerRef))
+    }
+
     public func buildKeyMap() {
         akCoreSamplerBuildKeyMap(coreSamplerRef)
     }
@@ -188,6 +188,48 @@ public class Synth: Node {
     /// Filter Amplitude release duration (seconds)
     @Parameter(filterReleaseDurationDef) public var filterReleaseDuration: AUValue
 
+    /// Specification details for cpuBudget
+    public static let cpuBudgetDef = NodeParameterDef(
+        identifier: "cpuBudget",
+        name: "CPU Budget",
+        address: akGetParameterAddress("SynthParameterCpuBudget"),
+        defaultValue: 0,
+        range: 0 ... 1,
+        unit: .generic)
+
+    /// Fraction of real time rendering may take before quality is lowered (see qualityLevel);
+    /// 0 = never lower quality
+    @Parameter(cpuBudgetDef) public var cpuBudget: AUValue
+
+    /// Specification details for audibilityFloor
+    public static let audibilityFloorDef = NodeParameterDef(
+        identifier: "audibilityFloor",
+        name: "Audibility Floor",
+        address: akGetParameterAddress("SynthParameterAudibilityFloor"),
+        defaultValue: 0,
+        range: 0 ... 0.01,
+        unit: .linearGain)
+
+    /// Gain (envelope, note and master volume combined) below which releasing voices are stopped early,
+    /// e.g. 0.00003 for -90 dBFS; 0 = let every release run to its end
+    @Parameter(audibilityFloorDef) public var audibilityFloor: AUValue
+
+    /// How far quality has been lowered to stay within cpuBudget: 0 = full quality,
+    /// 1 = fewer filter stages, 2-3 = slower filter updates, 4-7 = fewer voices
+    public var qualityLevel: Int {
+        Int(akSynthGetQualityLevel(au.dsp))
+    }
+
+    /// Smoothed render time as a fraction of real time, measured while cpuBudget is set
+    public var cpuLoad: Float {
+        akSynthGetCpuLoad(au.dsp)
+    }
+
+    /// Voice-samples left unrendered by stopping voices below audibilityFloor
+    public var culledSampleCount: Int {
+        Int(akSynthGetCulledSampleCount(au.dsp))
+    }
+
     // MARK: - Initialization
 
     /// Initialize this synth node
@@ -246,6 +288,14 @@ public class Synth: Node {
         
     }
 
+    /// Render voices on this many extra worker threads, as well as the audio thread (default 0).
+    /// Output is identical either way; this only helps when many voices sound at once.
+    /// Call only while the audio engine is stopped.
+    /// - Parameter threadCount: Number of worker threads
+    public func setRenderThreadCount(_ threadCount: Int) {
+        akSynthSetRenderThreadCount(au.dsp, Int32(threadCount))
+    }
+
     /// Play a note on the synth
     /// - Parameters:
     ///   - noteNumber: MIDI Note Number
@@ -8,6 +8,67 @@ import DunneAudioKit
 import XCTest
 
 class SamplerTests: XCTestCase {
+    let sampleURL = Bundle.module.url(forResource: "TestResources/12345", withExtension: "wav")!
+    lazy var file = try! AVAudioFile(forReading: sampleURL)
+
+    /// Maps the test sample to the given keys, at every velocity
+    func descriptor(noteNumber: Int32 = 64, noteFrequency: Float = 440, keys: ClosedRange<Int32> = 0 ... 127,
+                    isLooping: Bool = false, loopEndPoint: Float = 1000.0, endPoint: Float = 44100.0 * 5.0) -> SampleDescriptor {
+        SampleDescriptor(noteNumber: noteNumber, noteFrequency: noteFrequency, minimumNoteNumber: keys.lowerBound, maximumNoteNumber: keys.upperBound, minimumVelocity: 0, maximumVelocity: 127, isLooping: isLooping, loopStartPoint: 0, loopEndPoint: loopEndPoint, startPoint: 0.0, endPoint: endPoint)
+    }
+
+    /// Renders a Sampler playing data: perform plays notes on it, and calls render(seconds) to render that much audio
+    func renderSampler(_ data: SamplerData, masterVolume: AUValue = 0.1, duration: Double,
+                       _ perform: (Sampler, _ render: (Double) -> Void) -> Void) -> AVAudioPCMBuffer {
+        let engine = AudioEngine()
+        let sampler = Sampler()
+        sampler.update(data: data)
+        sampler.masterVolume = masterVolume
+        engine.output = sampler
+        let audio = engine.startTest(totalDuration: duration)
+        perform(sampler) { audio.append(engine.render(duration: $0)) }
+        return audio
+    }
+
+    /// A CoreSampler playing the test sample, to drive directly rather than through an audio unit: configure sets
+    /// it up before the sample loads, and it then runs at sampleRate (by default, the sample's own)
+    func makeCoreSampler(sampleRate: Double? = nil, _ configure: (CoreSamplerRef) -> Void = { _ in }) -> CoreSamplerRef {
+        let sampler: CoreSamplerRef = akCoreSamplerCreate()
+        configure(sampler)
+        var samples = Array(file.toFloatChannelData()!.joined())
+        samples.withUnsafeMutableBufferPointer { data in
+            var sampleData = SampleDataDescriptor(sampleDescriptor: descriptor(), sampleRate: Float(file.fileFormat.sampleRate), isInterleaved: false, channelCount: Int32(file.fileFormat.channelCount), sampleCount: Int32(file.length), data: data.baseAddress)
+            akCoreSamplerLoadData(sampler, &sampleData)
+        }
+        akCoreSamplerBuildKeyMap(sampler)
+        akCoreSamplerInit(sampler, sampleRate ?? file.fileFormat.sampleRate)
+        return sampler
+    }
+
+    /// Loads compressed files into a CoreSampler, mapping the first to the keys below middle C, rooted at note 48,
+    /// and the second to the rest, rooted at note 72
+    func loadCompressedFiles(_ paths: [String], into sampler: CoreSamplerRef) {
+        for (path, noteNumber) in zip(paths, [48, 72] as [Int32]) {
+            let sampleDescriptor = descriptor(noteNumber: noteNumber, noteFrequency: 440 * powf(2, Float(noteNumber - 69) / 12),
+                                              keys: noteNumber < 60 ? 0 ... 59 : 60 ... 127)
+            path.withCString { path in
+                var fileDescriptor = SampleFileDescriptor(sampleDescriptor: sampleDescriptor, path: path)
+                akCoreSamplerLoadCompressedFile(sampler, &fileDescriptor)
+            }
+        }
+        akCoreSamplerBuildKeyMap(sampler)
+        akCoreSamplerInit(sampler, 44100)
+    }
+
+    /// Renders frameCount frames from a CoreSampler, returning the left channel followed by the right
+    func renderCoreSampler(_ sampler: CoreSamplerRef, frameCount: Int) -> [Float] {
+        var output = [Float](repeating: 0, count: 2 * frameCount)
+        output.withUnsafeMutableBufferPointer { buffer in
+            akCoreSamplerRender(sampler, UInt32(frameCount), buffer.baseAddress!, buffer.baseAddress! + frameCount)
+        }
+        return output
+    }
+
     func testSampler() {
         let engine = AudioEngine()
         let sampleURL = Bundle.module.url(forResource: "TestResources/12345", withExtension: "wav")!
@@ -38,6 +99,1077 @@ class SamplerTests: XCTestCase {
         testMD5(audio)
     }
 
+    /// 16-bit storage must render a 16-bit source exactly as float storage does
+    func testSampler16BitStorage() {
+        func render(bitDepth: Int) -> AVAudioPCMBuffer {
+            let data = SamplerData(filesWithSampleDescriptors: [])
+            XCTAssertTrue(data.setStorageBitDepth(bitDepth))
+            data.loadAudioFile(from: descriptor(), file: file)
+            data.buildKeyMap()
+            return renderSampler(data, duration: 3.0) { sampler, render in
+                render(1.0)
+                sampler.play(noteNumber: 64, velocity: 127)
+                sampler.play(noteNumber: 71, velocity: 100)
+                render(1.0)
+                sampler.stop(noteNumber: 64)
+                sampler.play(noteNumber: 88, velocity: 127)
+                render(1.0)
+            }
+        }
+
+        XCTAssertEqual(render(bitDepth: 16).md5, render(bitDepth: 32).md5)
+    }
+
+    /// Editing a sample set in place must render exactly as building the result from scratch
+    func testSamplerRegionEditing() {
+        func descriptor(_ noteNumber: Int32, _ minimumNoteNumber: Int32, _ maximumNoteNumber: Int32) -> SampleDescriptor {
+            self.descriptor(noteNumber: noteNumber, noteFrequency: 440 * powf(2, Float(noteNumber - 69) / 12), keys: minimumNoteNumber ... maximumNoteNumber)
+        }
+
+        func render(data: SamplerData) -> AVAudioPCMBuffer {
+            renderSampler(data, duration: 2.0) { sampler, render in
+                sampler.play(noteNumber: 48, velocity: 127)
+                sampler.play(noteNumber: 72, velocity: 127)
+                render(1.0)
+                sampler.play(noteNumber: 60, velocity: 100)
+                render(1.0)
+            }
+        }
+
+        let expected = SamplerData(filesWithSampleDescriptors: [(descriptor(48, 0, 59), file), (descriptor(72, 60, 127), file)])
+        expected.buildKeyMap()
+
+        // replace one sample, remove another and add a third, while nothing renders
+        let edited = SamplerData(filesWithSampleDescriptors: [(descriptor(64, 0, 127), file), (descriptor(30, 20, 90), file)])
+        edited.buildKeyMap()
+        var samples = Array(file.toFloatChannelData()!.joined())
+        samples.withUnsafeMutableBufferPointer { data in
+            func dataDescriptor(_ sampleDescriptor: SampleDescriptor) -> SampleDataDescriptor {
+                SampleDataDescriptor(sampleDescriptor: sampleDescriptor, sampleRate: Float(file.fileFormat.sampleRate), isInterleaved: false, channelCount: Int32(file.fileFormat.channelCount), sampleCount: Int32(file.length), data: data.baseAddress)
+            }
+            XCTAssertNotNil(edited.replaceSample(edited.sample(at: 0)!, with: dataDescriptor(descriptor(48, 0, 59))))
+            XCTAssertTrue(edited.removeSample(edited.sample(at: 1)!))
+            XCTAssertNotNil(edited.addSample(from: dataDescriptor(descriptor(72, 60, 127))))
+        }
+        XCTAssertEqual(edited.sampleCount, 2)
+
+        XCTAssertEqual(render(data: edited).md5, render(data: expected).md5)
+    }
+
+    /// Each note and velocity plays the first sample mapped to it, among thousands of velocity-layered samples
+    func testSamplerDenseKeyMap() {
+        // a constant level, unique to each sample, looped
+        func load(_ sampler: CoreSamplerRef, index: Int, keys: ClosedRange<Int32>, velocities: ClosedRange<Int32>) {
+            var level = [Float](repeating: Float(index + 1) / 4096, count: 64)
+            level.withUnsafeMutableBufferPointer { data in
+                let sampleDescriptor = SampleDescriptor(noteNumber: 69, noteFrequency: 440, minimumNoteNumber: keys.lowerBound, maximumNoteNumber: keys.upperBound, minimumVelocity: velocities.lowerBound, maximumVelocity: velocities.upperBound, isLooping: true, loopStartPoint: 0, loopEndPoint: 63, startPoint: 0, endPoint: 63)
+                var sampleData = SampleDataDescriptor(sampleDescriptor: sampleDescriptor, sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+                akCoreSamplerLoadData(sampler, &sampleData)
+            }
+        }
+
+        func render(_ sampler: CoreSamplerRef, noteNumber: UInt32, velocity: UInt32) -> [Float] {
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, noteNumber, velocity, 0))
+            let output = renderCoreSampler(sampler, frameCount: 1024)
+            XCTAssertTrue(akCoreSamplerStopNote(sampler, noteNumber, true, 0))
+            _ = renderCoreSampler(sampler, frameCount: 64)
+            return output
+        }
+
+        // 16 velocity layers on every note, then one sample covering them all, which is never played
+        let layered: CoreSamplerRef = akCoreSamplerCreate()
+        defer { akCoreSamplerDestroy(layered) }
+        for note: Int32 in 0 ... 127 {
+            for layer: Int32 in 0 ..< 16 {
+                load(layered, index: Int(16 * note + layer), keys: note ... note, velocities: 8 * layer ... 8 * layer + 7)
+            }
+        }
+        load(layered, index: 2048, keys: 0 ... 127, velocities: 0 ... 127)
+        akCoreSamplerBuildKeyMap(layered)
+        akCoreSamplerInit(layered, 44100)
+        XCTAssertEqual(akCoreSamplerGetSampleCount(layered), 2049)
+
+        for (noteNumber, velocity) in [(0, 1), (21, 64), (60, 127), (61, 8), (108, 7), (127, 100)] as [(UInt32, UInt32)] {
+            let expected: CoreSamplerRef = akCoreSamplerCreate()
+            defer { akCoreSamplerDestroy(expected) }
+            load(expected, index: Int(16 * noteNumber + velocity / 8), keys: 0 ... 127, velocities: 0 ... 127)
+            akCoreSamplerBuildKeyMap(expected)
+            akCoreSamplerInit(expected, 44100)
+
+            let output = render(layered, noteNumber: noteNumber, velocity: velocity)
+            XCTAssertTrue(output.contains { $0 != 0 })
+            XCTAssertEqual(output, render(expected, noteNumber: noteNumber, velocity: velocity))
+        }
+    }
+
+    /// The key map holds 65535 samples; building it with more reports how many were left out
+    func testSamplerKeyMapOverflow() {
+        let sampler: CoreSamplerRef = akCoreSamplerCreate()
+        defer { akCoreSamplerDestroy(sampler) }
+        var level = [Float](repeating: 0.5, count: 4)
+        level.withUnsafeMutableBufferPointer { data in
+            let sampleDescriptor = SampleDescriptor(noteNumber: 69, noteFrequency: 440, minimumNoteNumber: 0, maximumNoteNumber: 127, minimumVelocity: 0, maximumVelocity: 127, isLooping: false, loopStartPoint: 0, loopEndPoint: 0, startPoint: 0, endPoint: 3)
+            var sampleData = SampleDataDescriptor(sampleDescriptor: sampleDescriptor, sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+            for _ in 0 ..< 65535 { akCoreSamplerLoadData(sampler, &sampleData) }
+            akCoreSamplerBuildKeyMap(sampler)
+            XCTAssertEqual(akCoreSamplerGetLoadStatistics(sampler).unmappedSampleCount, 0)
+
+            for _ in 0 ..< 2 { akCoreSamplerLoadData(sampler, &sampleData) }
+        }
+        akCoreSamplerBuildKeyMap(sampler)
+        XCTAssertEqual(akCoreSamplerGetLoadStatistics(sampler).unmappedSampleCount, 2)
+        akCoreSamplerBuildSimpleKeyMap(sampler)
+        XCTAssertEqual(akCoreSamplerGetLoadStatistics(sampler).unmappedSampleCount, 2)
+    }
+
+    /// However many notes play, no more than the configured number of voices sound, above or below the default 64
+    func testSamplerMaxVoices() {
+        // each voice adds the same constant level, so the output measures how many are sounding
+        func voicesSounding(maxVoices: Int32?, noteCount: Int) -> Float {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            defer { akCoreSamplerDestroy(sampler) }
+            var level = [Float](repeating: 0.01, count: 64)
+            level.withUnsafeMutableBufferPointer { data in
+                var sampleData = SampleDataDescriptor(sampleDescriptor: descriptor(noteNumber: 69, isLooping: true, loopEndPoint: 63, endPoint: 63), sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+                akCoreSamplerLoadData(sampler, &sampleData)
+            }
+            akCoreSamplerBuildKeyMap(sampler)
+            akCoreSamplerInit(sampler, 44100)
+            if let maxVoices = maxVoices {
+                akCoreSamplerSetMaxVoices(sampler, maxVoices)
+            }
+            for note in 0 ..< noteCount {
+                XCTAssertTrue(akCoreSamplerPlayNote(sampler, UInt32(20 + note), 127, 0))
+            }
+            return renderCoreSampler(sampler, frameCount: 4096)[4095] / 0.01
+        }
+
+        XCTAssertEqual(voicesSounding(maxVoices: nil, noteCount: 8), 8, accuracy: 1e-3)
+        XCTAssertEqual(voicesSounding(maxVoices: 4, noteCount: 8), 4, accuracy: 1e-3)
+        XCTAssertEqual(voicesSounding(maxVoices: nil, noteCount: 100), 64, accuracy: 1e-3)
+        XCTAssertEqual(voicesSounding(maxVoices: 100, noteCount: 100), 100, accuracy: 1e-3)
+    }
+
+    /// With all voices busy, each voice-stealing policy gives a new note the voice it should: the released note's
+    /// first, the least recently started or released, or the quietest
+    func testSamplerVoiceStealing() {
+        // notes 60-63 each play a constant level of their own, so the output shows which are sounding
+        let levels: [Float] = [0.08, 0.01, 0.02, 0.04]
+        func level(policy: Int32, releasing: Bool, secondVelocity: UInt32) -> Float {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            defer { akCoreSamplerDestroy(sampler) }
+            for (index, level) in levels.enumerated() {
+                let noteNumber = Int32(60 + index)
+                var data = [Float](repeating: level, count: 64)
+                data.withUnsafeMutableBufferPointer { data in
+                    var sampleData = SampleDataDescriptor(sampleDescriptor: descriptor(noteNumber: noteNumber, keys: noteNumber ... noteNumber, isLooping: true, loopEndPoint: 63, endPoint: 63), sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+                    akCoreSamplerLoadData(sampler, &sampleData)
+                }
+            }
+            akCoreSamplerBuildKeyMap(sampler)
+            akCoreSamplerInit(sampler, 44100)
+            akCoreSamplerSetMaxVoices(sampler, 3)
+            akCoreSamplerSetVoiceStealingPolicy(sampler, policy)
+
+            // a released note keeps sounding, almost at full level, long after the new note arrives
+            akCoreSamplerSetReleaseDuration(sampler, 10)
+            akCoreSamplerSetLoopThruRelease(sampler, true)
+
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 60, 127, 0))
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 61, secondVelocity, 0))
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 62, 127, 0))
+            _ = renderCoreSampler(sampler, frameCount: 64)
+            if releasing {
+                XCTAssertTrue(akCoreSamplerStopNote(sampler, 61, false, 0))
+                _ = renderCoreSampler(sampler, frameCount: 64)
+            }
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 63, 127, 0))
+            let output = renderCoreSampler(sampler, frameCount: 4096)
+            XCTAssertEqual(akCoreSamplerGetActiveVoiceCount(sampler), 3)
+            return output[4095]
+        }
+        let without60 = levels[1] + levels[2] + levels[3]
+        let without61 = levels[0] + levels[2] + levels[3]
+
+        // released first (0): note 61, though 60 started earlier
+        XCTAssertEqual(level(policy: 0, releasing: true, secondVelocity: 127), without61, accuracy: 1e-3)
+
+        // oldest (1): note 60, as releasing note 61 made it the most recent event
+        XCTAssertEqual(level(policy: 1, releasing: true, secondVelocity: 127), without60, accuracy: 1e-3)
+        XCTAssertEqual(level(policy: 1, releasing: false, secondVelocity: 127), without60, accuracy: 1e-3)
+
+        // quietest (2): note 61, played softly, though 60 is oldest
+        XCTAssertEqual(level(policy: 2, releasing: false, secondVelocity: 32), without61, accuracy: 1e-3)
+    }
+
+    /// A voice whose release stays below the audibility floor for chunkCount chunks is stopped, sounding the same
+    /// until then; a floor of 0 stops none early
+    func testSamplerAudibilityFloor() {
+        let frameCount = 11200
+        func render(floor: Float?, chunkCount: Int32 = 4) -> (output: [Float], activeVoices: Int32, culled: UInt64) {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            defer { akCoreSamplerDestroy(sampler) }
+            var data = [Float](repeating: 0.5, count: 64)
+            data.withUnsafeMutableBufferPointer { data in
+                var sampleData = SampleDataDescriptor(sampleDescriptor: descriptor(noteNumber: 69, isLooping: true, loopEndPoint: 63, endPoint: 63), sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+                akCoreSamplerLoadData(sampler, &sampleData)
+            }
+            akCoreSamplerBuildKeyMap(sampler)
+            akCoreSamplerInit(sampler, 44100)
+            akCoreSamplerSetReleaseDuration(sampler, 0.5)
+            akCoreSamplerSetLoopThruRelease(sampler, true)
+            if let floor = floor {
+                akCoreSamplerSetAudibilityFloor(sampler, floor, chunkCount)
+            }
+
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 69, 127, 0))
+            XCTAssertTrue(akCoreSamplerStopNote(sampler, 69, false, 1024))
+            let output = Array(renderCoreSampler(sampler, frameCount: frameCount).prefix(frameCount))
+            return (output, akCoreSamplerGetActiveVoiceCount(sampler), akCoreSamplerGetCulledSampleCount(sampler))
+        }
+
+        // the release outlasts the render, so without a floor the voice is still sounding at its end
+        let unculled = render(floor: nil)
+        XCTAssertEqual(unculled.activeVoices, 1)
+        XCTAssertEqual(unculled.culled, 0)
+        XCTAssertNotEqual(unculled.output.last, 0)
+
+        let zeroFloor = render(floor: 0)
+        XCTAssertEqual(zeroFloor.output, unculled.output)
+        XCTAssertEqual(zeroFloor.activeVoices, 1)
+        XCTAssertEqual(zeroFloor.culled, 0)
+
+        // the envelope steps once per 16-frame chunk; this is the first chunk released below a gain of 0.1
+        let firstQuietChunk = unculled.output.indices.first { $0 >= 1024 && unculled.output[$0] < 0.5 * 0.1 }! / 16
+        for chunkCount: Int32 in [1, 4] {
+            let culled = render(floor: 0.1, chunkCount: chunkCount)
+            let cullFrame = (firstQuietChunk + Int(chunkCount) - 1) * 16
+            XCTAssertLessThan(cullFrame, frameCount)
+            XCTAssertEqual(culled.output[..<cullFrame], unculled.output[..<cullFrame])
+            XCTAssertFalse(culled.output[cullFrame...].contains { $0 != 0 })
+            XCTAssertEqual(culled.activeVoices, 0)
+            XCTAssertGreaterThan(culled.culled, 0)
+        }
+    }
+
+    /// Voices count as active from their note's start until it is stopped, or its sample runs out
+    func testSamplerActiveVoices() {
+        let sampler: CoreSamplerRef = akCoreSamplerCreate()
+        defer { akCoreSamplerDestroy(sampler) }
+        var level = [Float](repeating: 0.01, count: 22050)
+        level.withUnsafeMutableBufferPointer { data in
+            var sampleData = SampleDataDescriptor(sampleDescriptor: descriptor(noteNumber: 69, endPoint: Float(data.count - 1)), sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+            akCoreSamplerLoadData(sampler, &sampleData)
+        }
+        akCoreSamplerBuildKeyMap(sampler)
+        akCoreSamplerInit(sampler, 44100)
+        XCTAssertEqual(akCoreSamplerGetActiveVoiceCount(sampler), 0)
+
+        for note: UInt32 in [57, 69, 81] {
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, note, 127, 0))
+        }
+        _ = renderCoreSampler(sampler, frameCount: 64)
+        XCTAssertEqual(akCoreSamplerGetActiveVoiceCount(sampler), 3)
+
+        XCTAssertTrue(akCoreSamplerStopNote(sampler, 81, true, 0))
+        _ = renderCoreSampler(sampler, frameCount: 64)
+        XCTAssertEqual(akCoreSamplerGetActiveVoiceCount(sampler), 2)
+
+        // with no release time, a stopped note ends at once
+        XCTAssertTrue(akCoreSamplerStopNote(sampler, 57, false, 0))
+        _ = renderCoreSampler(sampler, frameCount: 4410)
+        XCTAssertEqual(akCoreSamplerGetActiveVoiceCount(sampler), 1)
+
+        // note 69 plays the sample at its own rate, so ends with it
+        _ = renderCoreSampler(sampler, frameCount: 22050)
+        XCTAssertEqual(akCoreSamplerGetActiveVoiceCount(sampler), 0)
+    }
+
+    /// Voices render in blocks, across loop wraps and up to the end point, exactly as interpolating one output
+    /// sample at a time would
+    func testSamplerBlockRendering() {
+        let samples = (0 ..< 1000).map { Float(($0 * 7919) % 1000) / 1000 - 0.5 }
+        for isLooping in [true, false] {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            defer { akCoreSamplerDestroy(sampler) }
+            var data = samples
+            data.withUnsafeMutableBufferPointer { data in
+                var sampleDescriptor = descriptor(noteNumber: 69, isLooping: isLooping, loopEndPoint: 700, endPoint: 999)
+                sampleDescriptor.loopStartPoint = 100
+                var sampleData = SampleDataDescriptor(sampleDescriptor: sampleDescriptor, sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+                akCoreSamplerLoadData(sampler, &sampleData)
+            }
+            akCoreSamplerBuildKeyMap(sampler)
+            akCoreSamplerInit(sampler, 44100)
+
+            // at the sample's own speed, an octave down and an octave up
+            for (noteNumber, step) in [(69, 1.0), (57, 0.5), (81, 2.0)] as [(UInt32, Double)] {
+                XCTAssertTrue(akCoreSamplerPlayNote(sampler, noteNumber, 127, 0))
+                let output = renderCoreSampler(sampler, frameCount: 4096)
+                XCTAssertTrue(akCoreSamplerStopNote(sampler, noteNumber, true, 0))
+                _ = renderCoreSampler(sampler, frameCount: 64)
+
+                var expected: [Float] = []
+                var position = 0.0
+                for _ in 0 ..< 4096 where position <= 999 {
+                    let index = Int(position), fraction = position - Double(index)
+                    let next = index + 1 < samples.count ? samples[index + 1] : 0
+                    expected.append(Float((1 - fraction) * Double(samples[index]) + fraction * Double(next)))
+                    position += step
+                    if isLooping && position > 700 {
+                        position = position - 700 + 100
+                    }
+                }
+                expected += [Float](repeating: 0, count: 4096 - expected.count)
+
+                // after the first 16 samples, over which the note's volume ramps up
+                XCTAssertEqual(Array(output[16 ..< 4096]), Array(expected[16...]))
+                XCTAssertEqual(Array(output[4096...]), Array(output[..<4096]))
+            }
+        }
+    }
+
+    /// Stereo samples stored interleaved render exactly as planar ones do, with every interpolation kernel
+    func testSamplerInterleavedStorage() {
+        XCTAssertEqual(file.fileFormat.channelCount, 2)
+        func render(interleaved: Bool, mode: Int) -> AVAudioPCMBuffer {
+            let data = SamplerData(filesWithSampleDescriptors: [])
+            data.setInterleavedStorage(interleaved)
+            data.loadAudioFile(from: descriptor(isLooping: true, loopEndPoint: 44100.0 * 0.5), file: file)
+            data.buildKeyMap()
+            return renderSampler(data, duration: 2.0) { sampler, render in
+                sampler.interpolationMode = AUValue(mode)
+                sampler.play(noteNumber: 64, velocity: 127)
+                sampler.play(noteNumber: 71, velocity: 100)
+                render(1.0)
+                sampler.play(noteNumber: 57, velocity: 127)
+                render(1.0)
+            }
+        }
+
+        for mode in 0 ... 2 {
+            let audio = render(interleaved: true, mode: mode)
+            XCTAssertFalse(audio.isSilent)
+            XCTAssertEqual(audio.md5, render(interleaved: false, mode: mode).md5)
+        }
+    }
+
+    /// With a fixed-point phase, a loop sustained for a long time stays exactly where integer steps put it, and
+    /// sounds all but the same as with a double-precision position
+    func testSamplerFixedPointPhase() {
+        let samples = (0 ..< 1000).map { Float(($0 * 7919) % 1000) / 1000 - 0.5 }
+        let frameCount = 1_000_000
+        func render(fixedPoint: Bool) -> [Float] {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            defer { akCoreSamplerDestroy(sampler) }
+            var data = samples
+            data.withUnsafeMutableBufferPointer { data in
+                var sampleDescriptor = descriptor(noteNumber: 69, isLooping: true, loopEndPoint: 700, endPoint: 999)
+                sampleDescriptor.loopStartPoint = 100
+                var sampleData = SampleDataDescriptor(sampleDescriptor: sampleDescriptor, sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+                akCoreSamplerLoadData(sampler, &sampleData)
+            }
+            akCoreSamplerSetNoteFrequency(sampler, 69, 443)
+            akCoreSamplerBuildKeyMap(sampler)
+            akCoreSamplerInit(sampler, 44100)
+            akCoreSamplerSetFixedPointPhase(sampler, fixedPoint)
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 69, 127, 0))
+            return Array(renderCoreSampler(sampler, frameCount: frameCount)[..<frameCount])
+        }
+
+        // 32.32 phases, stepping by 443/440 (as the voice computes it) and wrapping around the loop
+        let step = UInt64(Double(Float(443) / Float(440)) * 4294967296.0 + 0.5)
+        let loopStart = UInt64(100) << 32, loopEnd = UInt64(700) << 32
+        var expected: [Float] = []
+        var phase: UInt64 = 0
+        for _ in 0 ..< frameCount {
+            let index = Int(phase >> 32)
+            let fraction = Float(UInt32(truncatingIfNeeded: phase) >> 8) / 16777216
+            expected.append((1 - fraction) * samples[index] + fraction * samples[index + 1])
+            phase += step
+            if phase > loopEnd {
+                phase = phase - loopEnd + loopStart
+            }
+        }
+
+        // after the first 16 samples, over which the note's volume ramps up
+        let fixedPoint = render(fixedPoint: true)
+        XCTAssertLessThan(zip(fixedPoint, expected).dropFirst(16).map { abs($0 - $1) }.max()!, 1e-6)
+        let doublePrecision = render(fixedPoint: false)
+        XCTAssertNotEqual(fixedPoint, doublePrecision)
+        XCTAssertLessThan(zip(fixedPoint, doublePrecision).map { abs($0 - $1) }.max()!, 1e-6)
+    }
+
+    /// Compressed files decoded on several threads at once load, map and render exactly as files loaded one by one
+    func testSamplerParallelLoading() {
+        let path = Bundle.module.url(forResource: "TestResources/12345", withExtension: "wv")!.path
+        // four key ranges, then a sample covering them all, which is mapped last and so never played
+        let ranges: [(noteNumber: Int32, keys: ClosedRange<Int32>)] = [(30, 0 ... 35), (48, 36 ... 59), (72, 60 ... 83), (96, 84 ... 127), (60, 0 ... 127)]
+        let files: [SamplerData.PathWithSampleDescriptor] = ranges.map {
+            (descriptor(noteNumber: $0.noteNumber, noteFrequency: 440 * powf(2, Float($0.noteNumber - 69) / 12), keys: $0.keys), path)
+        }
+
+        func render(data: SamplerData) -> AVAudioPCMBuffer {
+            data.buildKeyMap()
+            return renderSampler(data, duration: 1.0) { sampler, render in
+                for noteNumber: MIDINoteNumber in [30, 48, 72, 96] {
+                    sampler.play(noteNumber: noteNumber, velocity: 127)
+                }
+                render(1.0)
+            }
+        }
+
+        // without sample sharing, so every file is decoded
+        let oneByOne = SamplerData(filesWithSampleDescriptors: [])
+        oneByOne.setSampleSharing(false)
+        for file in files {
+            file.path.withCString { path in
+                oneByOne.loadCompressedSampleFile(from: SampleFileDescriptor(sampleDescriptor: file.sampleDescriptor, path: path))
+            }
+        }
+        let expectedStats = oneByOne.loadStatistics
+        XCTAssertEqual(expectedStats.fileCount, 5)
+        let expected = render(data: oneByOne)
+        XCTAssertFalse(expected.isSilent)
+
+        let parallel = SamplerData(filesWithSampleDescriptors: [])
+        parallel.setSampleSharing(false)
+        XCTAssertEqual(parallel.loadCompressedSampleFiles(files, threadCount: 4), 5)
+        let stats = parallel.loadStatistics
+        XCTAssertEqual(stats.fileCount, 5)
+        XCTAssertEqual(stats.sharedFileCount, 0)
+        XCTAssertEqual(stats.megabytes, expectedStats.megabytes, accuracy: 1e-9)
+        XCTAssertGreaterThan(stats.megabytesPerSecond, 0)
+        XCTAssertEqual(render(data: parallel).md5, expected.md5)
+    }
+
+    func testSamplerSampleSharing() {
+        // a copy of the test sample, which no other sample set shares
+        let url = FileManager.default.temporaryDirectory.appendingPathComponent("SamplerSharingTest-\(UUID().uuidString).wav")
+        try! FileManager.default.copyItem(at: sampleURL, to: url)
+        defer { try? FileManager.default.removeItem(at: url) }
+        let file = try! AVAudioFile(forReading: url)
+
+        func render(data: SamplerData) -> AVAudioPCMBuffer {
+            data.buildKeyMap()
+            return renderSampler(data, duration: 1.0) { sampler, render in
+                sampler.play(noteNumber: 60, velocity: 127)
+                render(1.0)
+            }
+        }
+
+        let unshared = SamplerData(filesWithSampleDescriptors: [])
+        unshared.setSampleSharing(false)
+        unshared.loadAudioFile(from: descriptor(), file: file)
+        let megabytes = Double(Int(file.fileFormat.channelCount) * Int(file.length) * MemoryLayout<Float>.size) / (1024 * 1024)
+
+        // the first sample set to load the file adds it to the pool, and a second takes no more sample memory
+        let before = SamplerData.sharedSampleMegabytes
+        let first = SamplerData(sampleDescriptor: descriptor(), file: file)
+        XCTAssertEqual(SamplerData.sharedSampleMegabytes - before, megabytes, accuracy: 1e-9)
+        let second = SamplerData(sampleDescriptor: descriptor(), file: file)
+        XCTAssertEqual(SamplerData.sharedSampleMegabytes - before, megabytes, accuracy: 1e-9)
+
+        let expected = render(data: unshared).md5
+        XCTAssertEqual(render(data: first).md5, expected)
+        XCTAssertEqual(render(data: second).md5, expected)
+    }
+
+    /// With content deduplication, byte-identical files under different names are decoded once and shared;
+    /// without it, each is decoded
+    func testSamplerContentDeduplication() {
+        let compressedURL = Bundle.module.url(forResource: "TestResources/12345", withExtension: "wv")!
+        let directory = FileManager.default.temporaryDirectory.appendingPathComponent("SamplerDeduplicationTest-\(UUID().uuidString)")
+        try! FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        defer { try? FileManager.default.removeItem(at: directory) }
+        let paths = ["first.wv", "second.wv"].map { name -> String in
+            let url = directory.appendingPathComponent(name)
+            try! FileManager.default.copyItem(at: compressedURL, to: url)
+            return url.path
+        }
+
+        // each file at its own root note, so both play the same
+        func render(_ sampler: CoreSamplerRef, noteNumber: UInt32) -> [Float] {
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, noteNumber, 127, 0))
+            let output = renderCoreSampler(sampler, frameCount: 44100)
+            XCTAssertTrue(akCoreSamplerStopNote(sampler, noteNumber, true, 0))
+            _ = renderCoreSampler(sampler, frameCount: 64)
+            return output
+        }
+
+        let deduplicated: CoreSamplerRef = akCoreSamplerCreate()
+        defer { akCoreSamplerDestroy(deduplicated) }
+        akCoreSamplerSetContentDeduplication(deduplicated, true)
+        loadCompressedFiles(paths, into: deduplicated)
+        let stats = akCoreSamplerGetLoadStatistics(deduplicated)
+        XCTAssertEqual(stats.fileCount, 2)
+        XCTAssertEqual(stats.sharedFileCount, 1)
+        XCTAssertGreaterThan(stats.sharedMegabytes, 0)
+        XCTAssertEqual(stats.sharedMegabytes, stats.megabytes, accuracy: 1e-9)
+        let lower = render(deduplicated, noteNumber: 48)
+        XCTAssertGreaterThan(lower.map(abs).max()!, 0.1)
+        XCTAssertEqual(render(deduplicated, noteNumber: 72), lower)
+
+        let byPath: CoreSamplerRef = akCoreSamplerCreate()
+        defer { akCoreSamplerDestroy(byPath) }
+        loadCompressedFiles(paths, into: byPath)
+        let byPathStats = akCoreSamplerGetLoadStatistics(byPath)
+        XCTAssertEqual(byPathStats.fileCount, 2)
+        XCTAssertEqual(byPathStats.sharedFileCount, 0)
+        XCTAssertEqual(byPathStats.megabytes, 2 * stats.megabytes, accuracy: 1e-9)
+        XCTAssertEqual(render(byPath, noteNumber: 48), lower)
+        XCTAssertEqual(render(byPath, noteNumber: 72), lower)
+    }
+
+    /// Pre-resampling leaves samples already at the engine's rate alone, and converts the rest: as they load, or in
+    /// the background when the engine's rate changes, with the same result either way
+    func testSamplerPreResampling() {
+        func render(data: SamplerData) -> AVAudioPCMBuffer {
+            data.buildKeyMap()
+            return renderSampler(data, duration: 2.0) { sampler, render in
+                sampler.play(noteNumber: 64, velocity: 127)
+                render(1.0)
+                sampler.play(noteNumber: 71, velocity: 100)
+                render(1.0)
+            }
+        }
+
+        let plain = SamplerData(filesWithSampleDescriptors: [])
+        plain.loadAudioFile(from: descriptor(), file: file)
+        let resampled = SamplerData(filesWithSampleDescriptors: [])
+        resampled.setPreResampling(true, sampleRate: file.fileFormat.sampleRate)
+        resampled.loadAudioFile(from: descriptor(), file: file)
+        XCTAssertEqual(render(data: resampled).md5, render(data: plain).md5)
+
+        // at another rate: loaded for it, loaded for the sample's own rate and then converted, or not converted
+        let engineRate = 48000.0
+        let convertedOnLoad = makeCoreSampler(sampleRate: engineRate) { akCoreSamplerSetPreResampling($0, true, engineRate) }
+        let convertedLater = makeCoreSampler(sampleRate: engineRate) { akCoreSamplerSetPreResampling($0, true, self.file.fileFormat.sampleRate) }
+        let interpolated = makeCoreSampler(sampleRate: engineRate)
+        defer {
+            [convertedOnLoad, convertedLater, interpolated].forEach { akCoreSamplerDestroy($0) }
+        }
+        XCTAssertEqual(akCoreSamplerGetPendingResampleCount(convertedOnLoad), 0)
+        for _ in 0 ..< 500 where akCoreSamplerGetPendingResampleCount(convertedLater) > 0 {
+            Thread.sleep(forTimeInterval: 0.01)
+        }
+        XCTAssertEqual(akCoreSamplerGetPendingResampleCount(convertedLater), 0)
+
+        func render(_ sampler: CoreSamplerRef) -> [Float] {
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 64, 127, 0))
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 71, 100, 0))
+            return renderCoreSampler(sampler, frameCount: Int(engineRate))
+        }
+
+        // once converted, the sample plays its copy at the engine's rate
+        let expected = render(convertedOnLoad)
+        XCTAssertGreaterThan(expected.map(abs).max()!, 0.1)
+        XCTAssertEqual(render(convertedLater), expected)
+        XCTAssertNotEqual(render(interpolated), expected)
+    }
+
+    func testSamplerMipMapping() {
+        func render(data: SamplerData, noteNumber: MIDINoteNumber) -> AVAudioPCMBuffer {
+            data.buildKeyMap()
+            return renderSampler(data, duration: 1.0) { sampler, render in
+                sampler.play(noteNumber: noteNumber, velocity: 127)
+                render(1.0)
+            }
+        }
+
+        let plain = SamplerData(filesWithSampleDescriptors: [])
+        plain.loadAudioFile(from: descriptor(), file: file)
+        let mipMapped = SamplerData(filesWithSampleDescriptors: [])
+        mipMapped.setMipMapping(true)
+        mipMapped.loadAudioFile(from: descriptor(), file: file)
+
+        // less than an octave up, the mip levels are not used
+        XCTAssertEqual(render(data: mipMapped, noteNumber: 71).md5, render(data: plain, noteNumber: 71).md5)
+
+        // two octaves up, the band-limited level plays instead
+        let audio = render(data: mipMapped, noteNumber: 88)
+        XCTAssertFalse(audio.isSilent)
+        XCTAssertNotEqual(audio.md5, render(data: plain, noteNumber: 88).md5)
+    }
+
+    /// Played an octave or more up, a mip-mapped sample keeps content below the new Nyquist frequency, and drops
+    /// content above it, which would otherwise alias
+    func testSamplerMipMappingBandLimit() {
+        // a 1 kHz tone, and a 15 kHz one which passes the Nyquist frequency once played an octave up
+        let sampleRate = 44100.0
+        var tones = (0 ..< Int(sampleRate)).map { i -> Float in
+            let time = Double(i) / sampleRate
+            return Float(0.25 * sin(2 * .pi * 1000 * time) + 0.25 * sin(2 * .pi * 15000 * time))
+        }
+
+        func render(noteNumber: UInt32, mipMapping: Bool) -> [Float] {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            defer { akCoreSamplerDestroy(sampler) }
+            akCoreSamplerSetMipMapping(sampler, mipMapping)
+            tones.withUnsafeMutableBufferPointer { data in
+                var sampleData = SampleDataDescriptor(sampleDescriptor: descriptor(noteNumber: 69, noteFrequency: 440, endPoint: Float(data.count - 1)), sampleRate: Float(sampleRate), isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+                akCoreSamplerLoadData(sampler, &sampleData)
+            }
+            akCoreSamplerBuildKeyMap(sampler)
+            akCoreSamplerInit(sampler, sampleRate)
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, noteNumber, 127, 0))
+            return Array(renderCoreSampler(sampler, frameCount: 8192)[1024 ..< 8192])
+        }
+
+        // amplitude of a sinusoid at the given frequency, through a Hann window
+        func amplitude(_ samples: [Float], at frequency: Double) -> Double {
+            var real = 0.0, imaginary = 0.0
+            for (i, sample) in samples.enumerated() {
+                let window = 0.5 - 0.5 * cos(2 * .pi * Double(i) / Double(samples.count))
+                let phase = 2 * .pi * frequency * Double(i) / sampleRate
+                real += window * Double(sample) * cos(phase)
+                imaginary += window * Double(sample) * sin(phase)
+            }
+            return 4 * (real * real + imaginary * imaginary).squareRoot() / Double(samples.count)
+        }
+
+        for octaves in 1 ... 2 {
+            let speed = Double(1 << octaves)
+            let aliasFrequency = 15000 * speed - sampleRate
+            let plain = render(noteNumber: UInt32(69 + 12 * octaves), mipMapping: false)
+            let mipMapped = render(noteNumber: UInt32(69 + 12 * octaves), mipMapping: true)
+            XCTAssertGreaterThan(amplitude(plain, at: abs(aliasFrequency)), 0.2)
+            XCTAssertLessThan(amplitude(mipMapped, at: abs(aliasFrequency)), 0.002)
+            XCTAssertEqual(amplitude(mipMapped, at: 1000 * speed), amplitude(plain, at: 1000 * speed), accuracy: 0.0025)
+        }
+    }
+
+    func testSamplerSFZ() {
+        let directory = FileManager.default.temporaryDirectory.appendingPathComponent("SamplerSFZTest")
+        try? FileManager.default.removeItem(at: directory)
+        try! FileManager.default.createDirectory(at: directory.appendingPathComponent("samples"), withIntermediateDirectories: true)
+        try! FileManager.default.copyItem(at: sampleURL, to: directory.appendingPathComponent("samples/12345.wav"))
+        let sfz = """
+        // two key ranges, with opcodes inherited from headers and a variable
+        #define $CENTER 64
+        #include "missing.sfzh"
+        <control> default_path=samples/
+        <global> lovel=0 hivel=127
+        <group> lokey=0 hikey=59 pitch_keycenter=c3
+        <region> sample=12345.wav
+        <group> lokey=60 hikey=127 pitch_keycenter=$CENTER /* upper half */
+        <region> sample=12345.wav
+        """
+        let sfzURL = directory.appendingPathComponent("test.sfz")
+        try! sfz.write(to: sfzURL, atomically: true, encoding: .ascii)
+
+        // the file which cannot be included is skipped, and reported
+        let sfzFile = akSfzFileCreate(sfzURL.path)!
+        XCTAssertEqual(akSfzFileGetRegionCount(sfzFile), 2)
+        XCTAssertEqual(akSfzFileGetUnreadableIncludeCount(sfzFile), 1)
+        XCTAssertEqual(String(cString: akSfzFileGetUnreadableInclude(sfzFile, 0)), directory.path + "/missing.sfzh")
+        akSfzFileDestroy(sfzFile)
+
+        func descriptor(_ noteNumber: Int32, _ minimumNoteNumber: Int32, _ maximumNoteNumber: Int32) -> SampleDescriptor {
+            self.descriptor(noteNumber: noteNumber, noteFrequency: 440 * powf(2, Float(noteNumber - 69) / 12), keys: minimumNoteNumber ... maximumNoteNumber, loopEndPoint: 0, endPoint: 0)
+        }
+
+        func render(data: SamplerData) -> AVAudioPCMBuffer {
+            renderSampler(data, duration: 1.0) { sampler, render in
+                sampler.play(noteNumber: 48, velocity: 127)
+                sampler.play(noteNumber: 72, velocity: 127)
+                render(1.0)
+            }
+        }
+
+        let expected = SamplerData(filesWithSampleDescriptors: [(descriptor(48, 0, 59), file), (descriptor(64, 60, 127), file)])
+        expected.buildKeyMap()
+        let loaded = SamplerData(sfzURL: sfzURL)
+        XCTAssertEqual(render(data: loaded).md5, render(data: expected).md5)
+    }
+
+    func testSamplerMultiThreaded() {
+        func render(threadCount: Int) -> AVAudioPCMBuffer {
+            let data = SamplerData(filesWithSampleDescriptors: [])
+            data.setRenderThreadCount(threadCount)
+            data.loadAudioFile(from: descriptor(isLooping: true, loopEndPoint: 44100.0 * 2.0), file: file)
+            data.buildKeyMap()
+            return renderSampler(data, masterVolume: 0.02, duration: 2.0) { sampler, render in
+                for note in 40 ..< 72 {
+                    sampler.play(noteNumber: MIDINoteNumber(note), velocity: 127)
+                }
+                render(1.0)
+                for note in stride(from: 40, to: 72, by: 3) {
+                    sampler.stop(noteNumber: MIDINoteNumber(note))
+                }
+                render(1.0)
+            }
+        }
+
+        XCTAssertEqual(render(threadCount: 3).md5, render(threadCount: 0).md5)
+    }
+
+    /// Over budget, quality is lowered step by step; back under budget, it is restored one level at a time
+    func testSamplerCpuBudget() {
+        let data = SamplerData(filesWithSampleDescriptors: [])
+        data.loadAudioFile(from: descriptor(isLooping: true, loopEndPoint: 44100.0 * 2.0), file: file)
+        data.buildKeyMap()
+        let audio = renderSampler(data, duration: 12.0) { sampler, render in
+            sampler.cpuBudget = 0.000001
+            sampler.play(noteNumber: 64, velocity: 120)
+            sampler.play(noteNumber: 67, velocity: 120)
+            sampler.play(noteNumber: 71, velocity: 120)
+            render(1.0)
+            let lowestQuality = sampler.qualityLevel
+            XCTAssertGreaterThan(lowestQuality, 1)
+            XCTAssertGreaterThan(sampler.cpuLoad, sampler.cpuBudget)
+
+            // rendering offline takes a small fraction of real time, so every level is restored in turn
+            sampler.cpuBudget = 1
+            var level = lowestQuality
+            for _ in 0 ..< 44 {
+                render(0.25)
+                XCTAssertTrue(sampler.qualityLevel == level || sampler.qualityLevel == level - 1)
+                level = sampler.qualityLevel
+            }
+            XCTAssertEqual(level, 0)
+            XCTAssertLessThan(sampler.cpuLoad, sampler.cpuBudget)
+        }
+        XCTAssertFalse(audio.isSilent)
+    }
+
+    /// Notes posted from many threads at once are all applied, just as if posted from one
+    func testSamplerConcurrentNotePosting() {
+        let notes = 40 ..< 72
+        func render(concurrently: Bool) -> [Float] {
+            let sampler = makeCoreSampler()
+            defer { akCoreSamplerDestroy(sampler) }
+            if concurrently {
+                DispatchQueue.concurrentPerform(iterations: notes.count) { i in
+                    XCTAssertTrue(akCoreSamplerPlayNote(sampler, UInt32(notes.lowerBound + i), 127, 0))
+                }
+            } else {
+                for note in notes {
+                    XCTAssertTrue(akCoreSamplerPlayNote(sampler, UInt32(note), 127, 0))
+                }
+            }
+            return renderCoreSampler(sampler, frameCount: 44100)
+        }
+
+        // voices may be assigned in another order, which changes only the order their output is summed in
+        let expected = render(concurrently: false)
+        let output = render(concurrently: true)
+        XCTAssertGreaterThan(expected.map(abs).max()!, 0.1)
+        XCTAssertLessThan(zip(output, expected).map { abs($0 - $1) }.max()!, 1e-4)
+    }
+
+    /// Notes posted for a time already past, while another thread renders, apply as soon as possible, and
+    /// never disturb the render
+    func testSamplerPastTimeEvents() {
+        let sampler = makeCoreSampler()
+        defer { akCoreSamplerDestroy(sampler) }
+        let frameCount = 44100
+        var output: [Float] = []
+        let rendered = DispatchSemaphore(value: 0)
+        DispatchQueue.global().async {
+            output = self.renderCoreSampler(sampler, frameCount: frameCount)
+            rendered.signal()
+        }
+        while rendered.wait(timeout: .now()) == .timedOut {
+            let now = akCoreSamplerGetSampleTime(sampler)
+            _ = akCoreSamplerPlayNote(sampler, 64, 127, now - 100)
+            _ = akCoreSamplerStopNote(sampler, 64, false, now - 1)
+        }
+        XCTAssertEqual(akCoreSamplerGetSampleTime(sampler), Int64(frameCount))
+        XCTAssertTrue(output.contains { $0 != 0 })
+    }
+
+    /// An event posted for later holds back none due sooner: a note, or stopping all voices, posted after a
+    /// note due in a second's time still takes effect at once
+    func testSamplerFutureEventsDoNotBlock() {
+        let expected: [Float] = {
+            let sampler = makeCoreSampler()
+            defer { akCoreSamplerDestroy(sampler) }
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 64, 127, 0))
+            return renderCoreSampler(sampler, frameCount: 512)
+        }()
+        XCTAssertTrue(expected.contains { $0 != 0 })
+
+        let sampler = makeCoreSampler()
+        defer { akCoreSamplerDestroy(sampler) }
+        XCTAssertTrue(akCoreSamplerPlayNote(sampler, 60, 127, 44100))
+        XCTAssertTrue(akCoreSamplerPlayNote(sampler, 64, 127, 0))
+        XCTAssertEqual(renderCoreSampler(sampler, frameCount: 512), expected)
+        XCTAssertEqual(akCoreSamplerGetActiveVoiceCount(sampler), 1)
+
+        let epoch = akCoreSamplerStopAllVoices(sampler)
+        _ = renderCoreSampler(sampler, frameCount: 16)
+        XCTAssertTrue(akCoreSamplerWaitForStop(sampler, epoch, 0))
+        XCTAssertEqual(akCoreSamplerGetActiveVoiceCount(sampler), 0)
+    }
+
+    /// Envelopes and the vibrato LFO step once per 16-frame chunk however events and render calls split it, so a
+    /// note sounds the same with other events falling inside its chunks, and rendered in blocks of any size
+    func testSamplerEnvelopeStepsPerChunk() {
+        func render(extraEvents: Bool, blockFrames: Int) -> [Float] {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            defer { akCoreSamplerDestroy(sampler) }
+            var data = [Float](repeating: 0.5, count: 64)
+            data.withUnsafeMutableBufferPointer { data in
+                var sampleData = SampleDataDescriptor(sampleDescriptor: descriptor(noteNumber: 69, isLooping: true, loopEndPoint: 63, endPoint: 63), sampleRate: 44100, isInterleaved: false, channelCount: 1, sampleCount: Int32(data.count), data: data.baseAddress)
+                akCoreSamplerLoadData(sampler, &sampleData)
+            }
+            akCoreSamplerBuildKeyMap(sampler)
+            akCoreSamplerInit(sampler, 44100)
+            akCoreSamplerSetReleaseDuration(sampler, 0.1)
+            akCoreSamplerSetLoopThruRelease(sampler, true)
+
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 69, 127, 0))
+            XCTAssertTrue(akCoreSamplerStopNote(sampler, 69, false, 2000))
+            if extraEvents {
+                // releasing a note that isn't playing changes nothing, but splits the chunks around the release
+                for sampleTime in stride(from: 1005, to: 2485, by: 8) {
+                    XCTAssertTrue(akCoreSamplerStopNote(sampler, 100, false, Int64(sampleTime)))
+                }
+            }
+            var output: [Float] = []
+            while output.count < 8192 {
+                output += renderCoreSampler(sampler, frameCount: blockFrames).prefix(blockFrames)
+            }
+            return Array(output.prefix(8192))
+        }
+        let expected = render(extraEvents: false, blockFrames: 16)
+        XCTAssertEqual(expected[1999], 0.5, accuracy: 1e-6)
+        XCTAssertLessThan(expected[2100], 0.5)
+        XCTAssertGreaterThan(expected[2100], 0)
+
+        XCTAssertEqual(render(extraEvents: true, blockFrames: 16), expected)
+        XCTAssertEqual(render(extraEvents: false, blockFrames: 100), expected)
+        XCTAssertEqual(render(extraEvents: true, blockFrames: 100), expected)
+    }
+
+    /// Stopping all voices never blocks: the rendering thread carries the request out, and new notes are
+    /// ignored until voices restart
+    func testSamplerStopAllVoices() {
+        let sampler = makeCoreSampler()
+        defer { akCoreSamplerDestroy(sampler) }
+        XCTAssertTrue(akCoreSamplerPlayNote(sampler, 64, 127, 0))
+        XCTAssertTrue(renderCoreSampler(sampler, frameCount: 4410).contains { $0 != 0 })
+
+        // nothing is rendering, so neither request has been carried out yet
+        let firstEpoch = akCoreSamplerStopAllVoices(sampler)
+        let secondEpoch = akCoreSamplerStopAllVoices(sampler)
+        XCTAssertGreaterThan(firstEpoch, 0)
+        XCTAssertGreaterThan(secondEpoch, firstEpoch)
+        XCTAssertFalse(akCoreSamplerWaitForStop(sampler, firstEpoch, 0.01))
+
+        // rendering on another thread carries out both, while this one waits
+        var output: [Float] = []
+        let rendered = DispatchSemaphore(value: 0)
+        DispatchQueue.global().async {
+            output = self.renderCoreSampler(sampler, frameCount: 4410)
+            rendered.signal()
+        }
+        XCTAssertTrue(akCoreSamplerWaitForStop(sampler, secondEpoch, 5.0))
+        XCTAssertTrue(akCoreSamplerWaitForStop(sampler, firstEpoch, 0))
+        rendered.wait()
+        XCTAssertFalse(output.contains { $0 != 0 })
+
+        XCTAssertTrue(akCoreSamplerPlayNote(sampler, 64, 127, 0))
+        XCTAssertFalse(renderCoreSampler(sampler, frameCount: 4410).contains { $0 != 0 })
+        akCoreSamplerRestartVoices(sampler)
+        XCTAssertTrue(akCoreSamplerPlayNote(sampler, 64, 127, 0))
+        XCTAssertTrue(renderCoreSampler(sampler, frameCount: 4410).contains { $0 != 0 })
+    }
+
+    /// Adopted sample data renders exactly as copied data does, whether used in place or converted, and is released
+    /// just once: when the last sample using it goes, or at once if it was converted
+    func testSamplerAdoptedData() {
+        final class Adoption {
+            var releaseCount = 0
+        }
+        XCTAssertEqual(file.fileFormat.channelCount, 2)
+        let frameCount = Int(file.length)
+        let planar = Array(file.toFloatChannelData()!.joined())
+        let interleaved = (0 ..< 2 * frameCount).map { planar[($0 % 2) * frameCount + $0 / 2] }
+
+        func adopt(_ samples: [Float], isInterleaved: Bool, interleavedStorage: Bool,
+                   adoption: Adoption) -> (sampler: CoreSamplerRef, isInPlace: Bool) {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            akCoreSamplerSetInterleavedStorage(sampler, interleavedStorage)
+            let data = UnsafeMutablePointer<Float>.allocate(capacity: samples.count)
+            data.initialize(from: samples, count: samples.count)
+            var sampleData = SampleDataDescriptor(sampleDescriptor: descriptor(), sampleRate: Float(file.fileFormat.sampleRate), isInterleaved: isInterleaved, channelCount: 2, sampleCount: Int32(frameCount), data: data)
+            let isInPlace = akCoreSamplerAdoptData(sampler, &sampleData, nil, { data, context in
+                data?.deallocate()
+                Unmanaged<Adoption>.fromOpaque(context!).takeUnretainedValue().releaseCount += 1
+            }, Unmanaged.passUnretained(adoption).toOpaque())
+            akCoreSamplerBuildKeyMap(sampler)
+            akCoreSamplerInit(sampler, file.fileFormat.sampleRate)
+            return (sampler, isInPlace)
+        }
+
+        func render(_ sampler: CoreSamplerRef) -> [Float] {
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 64, 127, 0))
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 71, 100, 0))
+            return renderCoreSampler(sampler, frameCount: 44100)
+        }
+
+        let copied = makeCoreSampler()
+        let expected = render(copied)
+        akCoreSamplerDestroy(copied)
+        XCTAssertGreaterThan(expected.map(abs).max()!, 0.1)
+
+        // already in the storage layout, planar or interleaved: used in place, and released with the sampler
+        for (samples, isInterleaved) in [(planar, false), (interleaved, true)] {
+            let adoption = Adoption()
+            let adopted = adopt(samples, isInterleaved: isInterleaved, interleavedStorage: isInterleaved, adoption: adoption)
+            XCTAssertTrue(adopted.isInPlace)
+            XCTAssertEqual(render(adopted.sampler), expected)
+            XCTAssertEqual(adoption.releaseCount, 0)
+            akCoreSamplerDestroy(adopted.sampler)
+            XCTAssertEqual(adoption.releaseCount, 1)
+        }
+
+        // interleaved, for planar storage: copied into new storage, and released at once
+        let adoption = Adoption()
+        let converted = adopt(interleaved, isInterleaved: true, interleavedStorage: false, adoption: adoption)
+        XCTAssertFalse(converted.isInPlace)
+        XCTAssertEqual(adoption.releaseCount, 1)
+        XCTAssertEqual(render(converted.sampler), expected)
+        akCoreSamplerDestroy(converted.sampler)
+        XCTAssertEqual(adoption.releaseCount, 1)
+    }
+
+    /// Streamed samples keep only their head in memory, and (read from disk fast enough) play exactly as if
+    /// loaded up front
+    func testSamplerStreaming() {
+        let path = Bundle.module.url(forResource: "TestResources/12345", withExtension: "wv")!.path
+        func makeSampler(preloadFrames: Int32) -> CoreSamplerRef {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            akCoreSamplerSetSampleSharing(sampler, false)
+            akCoreSamplerSetStreamingPreloadFrames(sampler, preloadFrames)
+            loadCompressedFiles([path, path], into: sampler)
+            return sampler
+        }
+
+        // rendered in blocks, no faster than twice real time, so the streamer keeps up
+        func render(_ sampler: CoreSamplerRef) -> [Float] {
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 48, 127, 0))
+            var output: [Float] = []
+            for _ in 0 ..< 86 {
+                output += renderCoreSampler(sampler, frameCount: 512)
+                Thread.sleep(forTimeInterval: 0.005)
+            }
+            return output
+        }
+
+        let full = makeSampler(preloadFrames: 0)
+        let streamed = makeSampler(preloadFrames: 8192)
+        defer {
+            akCoreSamplerDestroy(full)
+            akCoreSamplerDestroy(streamed)
+        }
+        XCTAssertLessThan(akCoreSamplerGetLoadStatistics(streamed).megabytes, akCoreSamplerGetLoadStatistics(full).megabytes / 10)
+
+        let expected = render(full)
+        XCTAssertGreaterThan(expected.map(abs).max()!, 0.1)
+        XCTAssertEqual(render(streamed), expected)
+        XCTAssertEqual(akCoreSamplerGetStreamingUnderrunCount(streamed), 0)
+        XCTAssertEqual(akCoreSamplerGetStreamingErrorCount(streamed), 0)
+    }
+
+    /// A streamed sample whose file has gone by the time it plays still plays its head, and the failure to
+    /// reopen the file is counted
+    func testSamplerStreamingMissingFile() {
+        let compressedURL = Bundle.module.url(forResource: "TestResources/12345", withExtension: "wv")!
+        let url = FileManager.default.temporaryDirectory.appendingPathComponent("SamplerStreamingTest-\(UUID().uuidString).wv")
+        try! FileManager.default.copyItem(at: compressedURL, to: url)
+        defer { try? FileManager.default.removeItem(at: url) }
+
+        let full: CoreSamplerRef = akCoreSamplerCreate()
+        let streamed: CoreSamplerRef = akCoreSamplerCreate()
+        defer {
+            akCoreSamplerDestroy(full)
+            akCoreSamplerDestroy(streamed)
+        }
+        akCoreSamplerSetStreamingPreloadFrames(streamed, 8192)
+        for sampler in [full, streamed] {
+            akCoreSamplerSetSampleSharing(sampler, false)
+            loadCompressedFiles([url.path, url.path], into: sampler)
+        }
+        try! FileManager.default.removeItem(at: url)
+
+        // the first block comes from the resident head; the rest of the sample can't be streamed
+        XCTAssertTrue(akCoreSamplerPlayNote(full, 48, 127, 0))
+        XCTAssertTrue(akCoreSamplerPlayNote(streamed, 48, 127, 0))
+        let expected = renderCoreSampler(full, frameCount: 512)
+        XCTAssertEqual(renderCoreSampler(streamed, frameCount: 512), expected)
+        for _ in 0 ..< 40 {
+            _ = renderCoreSampler(streamed, frameCount: 512)
+            Thread.sleep(forTimeInterval: 0.005)
+        }
+        XCTAssertEqual(akCoreSamplerGetStreamingErrorCount(streamed), 1)
+    }
+
+    /// Lazily loaded samples play their head at once, and their body, loaded in the background, once it is
+    /// ready, exactly as if loaded up front; samples neither played nor near a played note never load
+    func testSamplerLazyLoading() {
+        let path = Bundle.module.url(forResource: "TestResources/12345", withExtension: "wv")!.path
+        func makeSampler(lazily: Bool) -> CoreSamplerRef {
+            let sampler: CoreSamplerRef = akCoreSamplerCreate()
+            akCoreSamplerSetSampleSharing(sampler, false)
+            akCoreSamplerSetLazyLoading(sampler, lazily, 8192)
+            loadCompressedFiles([path, path], into: sampler)
+            return sampler
+        }
+
+        // a note short enough to play from the head alone, then (once the body is ready) the whole sample
+        func render(_ sampler: CoreSamplerRef, awaitingBody: Bool) -> [Float] {
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 48, 127, 0))
+            var output = renderCoreSampler(sampler, frameCount: 4096)
+            XCTAssertTrue(akCoreSamplerStopNote(sampler, 48, true, 0))
+            output += renderCoreSampler(sampler, frameCount: 64)
+            for _ in 0 ..< 500 where awaitingBody && akCoreSamplerGetPendingLazySampleCount(sampler) > 1 {
+                Thread.sleep(forTimeInterval: 0.01)
+            }
+            XCTAssertTrue(akCoreSamplerPlayNote(sampler, 48, 127, 0))
+            return output + renderCoreSampler(sampler, frameCount: 44100)
+        }
+
+        let full = makeSampler(lazily: false)
+        let lazy = makeSampler(lazily: true)
+        defer {
+            akCoreSamplerDestroy(full)
+            akCoreSamplerDestroy(lazy)
+        }
+        XCTAssertEqual(akCoreSamplerGetPendingLazySampleCount(lazy), 2)
+        XCTAssertLessThan(akCoreSamplerGetLoadStatistics(lazy).megabytes, akCoreSamplerGetLoadStatistics(full).megabytes / 10)
+
+        let expected = render(full, awaitingBody: false)
+        XCTAssertEqual(render(lazy, awaitingBody: true), expected)
+        XCTAssertEqual(akCoreSamplerGetPendingLazySampleCount(lazy), 1)
+        XCTAssertGreaterThan(expected.map(abs).max()!, 0.1)
+    }
+
+    /// Measures the cost of windowed-sinc interpolation, the costliest mode, for trading CPU against
+    /// sample-set density
+    func testSamplerInterpolationBenchmark() {
+        let data = SamplerData(sampleDescriptor: descriptor(isLooping: true, loopEndPoint: 44100.0 * 4.0), file: file)
+        data.buildKeyMap()
+        func render(mode: Int, duration: Double) -> AVAudioPCMBuffer {
+            renderSampler(data, masterVolume: 0.02, duration: duration) { sampler, render in
+                sampler.interpolationMode = AUValue(mode)
+                for note in 40 ..< 72 {
+                    sampler.play(noteNumber: MIDINoteNumber(note), velocity: 127)
+                }
+                render(duration)
+            }
+        }
+
+        // each kernel must actually be used
+        XCTAssertEqual(Set((0 ... 2).map { render(mode: $0, duration: 1.0).md5 }).count, 3)
+
+        measure {
+            _ = render(mode: 2, duration: 1.0)
+        }
+    }
+
     func testSamplerAttackVolumeEnvelope() {
         let engine = AudioEngine()
         let sampleURL = Bundle.module.url(forResource: "TestResources/12345", withExtension: "wav")!
@@ -58,5 +58,39 @@ class SynthTests: XCTestCase {
         testMD5(audio)
     }
 
+    func testAudibilityFloor() {
+        let engine = AudioEngine()
+        let synth = Synth(releaseDuration: 2.0)
+        synth.audibilityFloor = 0.001
+        engine.output = synth
+        let audio = engine.startTest(totalDuration: 3.0)
+        synth.play(noteNumber: 64, velocity: 120)
+        audio.append(engine.render(duration: 0.5))
+        synth.stop(noteNumber: 64)
+        audio.append(engine.render(duration: 2.5))
+        XCTAssertEqual(synth.audibilityFloor, 0.001)
+        XCTAssertGreaterThan(synth.culledSampleCount, 0)
+    }
+
+    /// An unattainable CPU budget lowers quality; removing the budget restores full quality
+    func testCpuBudget() {
+        let engine = AudioEngine()
+        let synth = Synth()
+        synth.cpuBudget = 0.000001
+        engine.output = synth
+        let audio = engine.startTest(totalDuration: 2.0)
+        synth.play(noteNumber: 64, velocity: 120)
+        synth.play(noteNumber: 67, velocity: 120)
+        synth.play(noteNumber: 71, velocity: 120)
+        audio.append(engine.render(duration: 1.0))
+        XCTAssertGreaterThan(synth.qualityLevel, 0)
+        XCTAssertGreaterThan(synth.cpuLoad, synth.cpuBudget)
+        synth.cpuBudget = 0
+        audio.append(engine.render(duration: 1.0))
+        XCTAssertEqual(synth.qualityLevel, 0)
+        XCTAssertEqual(synth.cpuLoad, 0)
+        XCTAssertFalse(audio.isSilent)
+    }
+
 }
 #endif